@@ -0,0 +1,213 @@
+// Firmware for pio run -e esp32dev-decode-bench: runs the playback decode path over the packet
+// corpus embedded from bench/corpus and prints cycle counts, no WiFi, network or DAC involved.
+//
+// The report is one JSON object per line, everything else on the serial port is not JSON:
+//   {"corpus":...,"mode":...,"frames":...,"cycles_avg":...,"cycles_max":...,...}  per corpus file
+//   {"corpus":...,"stage_cycles_per_frame":{...}}                                per corpus file, with OPUS_STAGE_PROFILING
+//   {"mode":...,"frames":...,"cycles_avg":...,"cycles_max":...}                  per codec mode
+//   {"done":true}
+// cycles_max includes the first, cold-cache pass over each file. pcm_hash is the same hash as
+// opus_host_bench computes; it has to match bench/host/baseline.txt.
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <xtensa/hal.h>
+#include <opus.h>
+#include <opus_scratch.h>
+#include <opus_profile.h>
+#include "playback.hpp"
+#include "../opus_corpus.h"
+
+#define DECODE_BENCH_ITERATIONS 5
+#define DECODE_BENCH_SAMPLE_RATE 48000
+#define DECODE_BENCH_MAX_FRAME_SIZE (DECODE_BENCH_SAMPLE_RATE / 1000 * 60)
+
+#define DECODE_BENCH_CORPUS(X) \
+    X(celt_2_5ms_64k_stereo) \
+    X(celt_5ms_96k_stereo) \
+    X(celt_10ms_128k_stereo) \
+    X(celt_20ms_32k_mono) \
+    X(celt_20ms_64k_mono) \
+    X(celt_20ms_128k_stereo) \
+    X(celt_20ms_128k_stereo_loss) \
+    X(celt_20ms_256k_stereo) \
+    X(celt_40ms_128k_stereo) \
+    X(celt_60ms_96k_stereo) \
+    X(celt_60ms_96k_stereo_loss) \
+    X(silk_10ms_32k_mono) \
+    X(silk_20ms_32k_mono_loss) \
+    X(silk_20ms_32k_stereo) \
+    X(silk_40ms_32k_mono) \
+    X(silk_60ms_32k_mono) \
+    X(hybrid_10ms_64k_stereo) \
+    X(hybrid_20ms_48k_stereo) \
+    X(hybrid_20ms_48k_stereo_loss) \
+    X(hybrid_40ms_64k_mono) \
+    X(hybrid_60ms_64k_stereo)
+
+#define DECODE_BENCH_DECLARE_EMBEDDED(name) \
+    extern "C" const uint8_t _binary_bench_corpus_##name##_opc_start[]; \
+    extern "C" const uint8_t _binary_bench_corpus_##name##_opc_end[];
+DECODE_BENCH_CORPUS(DECODE_BENCH_DECLARE_EMBEDDED)
+
+typedef struct {
+    const char* name;
+    const uint8_t* start;
+    const uint8_t* end;
+} decode_bench_corpus_file_t;
+
+#define DECODE_BENCH_FILE_ENTRY(name) { #name, _binary_bench_corpus_##name##_opc_start, _binary_bench_corpus_##name##_opc_end },
+static const decode_bench_corpus_file_t decode_bench_files[] = {
+    DECODE_BENCH_CORPUS(DECODE_BENCH_FILE_ENTRY)
+};
+
+typedef struct {
+    uint32_t frames;
+    uint64_t cycles_total;
+    uint32_t cycles_max;
+} decode_bench_stats_t;
+
+static opus_int16 decode_bench_buffer[DECODE_BENCH_MAX_FRAME_SIZE * 2];
+
+static void decode_bench_add(decode_bench_stats_t* stats, uint32_t cycles) {
+    stats->frames++;
+    stats->cycles_total += cycles;
+    stats->cycles_max = max(stats->cycles_max, cycles);
+}
+
+static uint32_t decode_bench_fnv1a(uint32_t hash, const opus_int16* pcm, int samples) {
+    for (int i = 0; i < samples; i++) {
+        uint16_t s = (uint16_t) pcm[i];
+        hash = (hash ^ (s & 0xFF)) * 16777619u;
+        hash = (hash ^ (s >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+static void decode_bench_run_file(OpusDecoder* decoder, const decode_bench_corpus_file_t* file, decode_bench_stats_t* mode_stats) {
+    opus_corpus_t corpus;
+    if (opus_corpus_open(&corpus, file->start, file->end - file->start) != 0) {
+        Serial.printf("%s: corpus file is malformed\n", file->name);
+        abort();
+    }
+
+    decode_bench_stats_t stats = {};
+    uint32_t pcm_hash = 2166136261u;
+    uint32_t range_mismatches = 0;
+    opus_stage_profile_reset();
+    for (int iteration = 0; iteration < DECODE_BENCH_ITERATIONS; iteration++) {
+        opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+        const uint8_t* cursor = corpus.packets;
+        for (uint32_t i = 0; i < corpus.packet_count; i++) {
+            opus_corpus_packet_t packet;
+            opus_corpus_next(&cursor, &packet);
+            int max_samples = packet.len == 0 ? corpus.frame_size : DECODE_BENCH_MAX_FRAME_SIZE;
+
+            uint32_t started_at = xthal_get_ccount();
+            int samples = playback_decode_frame(decoder, packet.data, packet.len, decode_bench_buffer, max_samples);
+            uint32_t cycles = xthal_get_ccount() - started_at;
+
+            if (samples < 0) {
+                Serial.printf("%s: frame %u failed to decode: %s\n", file->name, i, opus_strerror(samples));
+                abort();
+            }
+            decode_bench_add(&stats, cycles);
+            decode_bench_add(mode_stats, cycles);
+            if (iteration == 0) {
+                pcm_hash = decode_bench_fnv1a(pcm_hash, decode_bench_buffer, samples * 2);
+                if (packet.len > 0) {
+                    opus_uint32 final_range;
+                    opus_decoder_ctl(decoder, OPUS_GET_FINAL_RANGE(&final_range));
+                    range_mismatches += final_range != packet.final_range;
+                }
+            }
+        }
+    }
+
+    // the share of one core the decoder needs to keep up with playback, taking the worst frame
+    uint32_t frame_duration_cycles = (uint32_t) ((uint64_t) corpus.frame_size * getCpuFrequencyMhz() * 1000000 / DECODE_BENCH_SAMPLE_RATE);
+    Serial.printf(
+        "{\"corpus\":\"%s\",\"mode\":\"%s\",\"frame_samples\":%u,\"bitrate\":%u,\"frames\":%u,"
+        "\"cycles_avg\":%llu,\"cycles_max\":%u,\"worst_core_load_percent\":%.1f,"
+        "\"pcm_hash\":\"%08x\",\"range_mismatches\":%u}\n",
+        file->name, opus_corpus_mode_name(corpus.mode), corpus.frame_size, corpus.bitrate, stats.frames,
+        stats.cycles_total / stats.frames, stats.cycles_max, 100.0 * stats.cycles_max / frame_duration_cycles,
+        pcm_hash, range_mismatches
+    );
+
+#ifdef OPUS_STAGE_PROFILING
+    // cycles per decoded frame spent in each libopus stage, see opus_profile.h
+    opus_stage_profile profile;
+    opus_stage_profile_get(&profile);
+    Serial.printf("{\"corpus\":\"%s\",\"stage_cycles_per_frame\":{", file->name);
+    const char* separator = "";
+    for (int stage = 0; stage < OPUS_STAGE_COUNT; stage++) {
+        if (profile.calls[stage] > 0) {
+            Serial.printf("%s\"%s\":%llu", separator, opus_stage_name(stage), profile.ticks[stage] / stats.frames);
+            separator = ",";
+        }
+    }
+    Serial.println("}}");
+#endif
+}
+
+void decode_bench_task(void* pvParameters) {
+    int decoder_size = opus_decoder_get_size(2);
+    OpusDecoder* decoder = (OpusDecoder*) malloc(decoder_size);
+    if (decoder == nullptr || opus_decoder_init(decoder, DECODE_BENCH_SAMPLE_RATE, 2) != OPUS_OK) {
+        Serial.println("failed to set up the opus decoder");
+        abort();
+    }
+
+    Serial.printf("decode bench: %d corpus files, %d iterations each, CPU at %u MHz, decoder state %d bytes\n",
+        sizeof(decode_bench_files) / sizeof(decode_bench_files[0]), DECODE_BENCH_ITERATIONS, getCpuFrequencyMhz(), decoder_size);
+
+    decode_bench_stats_t mode_stats[OPUS_CORPUS_MODE_COUNT] = {};
+    for (size_t i = 0; i < sizeof(decode_bench_files) / sizeof(decode_bench_files[0]); i++) {
+        opus_corpus_t corpus;
+        const decode_bench_corpus_file_t* file = &decode_bench_files[i];
+        if (opus_corpus_open(&corpus, file->start, file->end - file->start) != 0) {
+            Serial.printf("%s: corpus file is malformed\n", file->name);
+            abort();
+        }
+        decode_bench_run_file(decoder, file, &mode_stats[corpus.mode]);
+    }
+
+    for (uint8_t mode = 0; mode < OPUS_CORPUS_MODE_COUNT; mode++) {
+        decode_bench_stats_t* stats = &mode_stats[mode];
+        if (stats->frames == 0) {
+            continue;
+        }
+        Serial.printf("{\"mode\":\"%s\",\"frames\":%u,\"cycles_avg\":%llu,\"cycles_max\":%u}\n",
+            opus_corpus_mode_name(mode), stats->frames, stats->cycles_total / stats->frames, stats->cycles_max);
+    }
+    Serial.printf("{\"scratch_high_water_mark\":%d,\"task_stack_never_used\":%d}\n",
+        opus_scratch_high_water_mark(), uxTaskGetStackHighWaterMark(NULL));
+    Serial.println("{\"done\":true}");
+
+    free(decoder);
+    vTaskDelete(NULL);
+}
+
+void setup() {
+    Serial.begin(1500000);
+    delay(2000);
+
+    // same stack, priority and core as the playback task
+    BaseType_t rtosResult = xTaskCreatePinnedToCore(
+        decode_bench_task,
+        "decode-bench",
+        configMINIMAL_STACK_SIZE * 12,
+        nullptr,
+        7,
+        nullptr,
+        1
+    );
+    if (rtosResult != pdPASS) {
+        Serial.println("Failed to start decode bench task: OOM");
+        abort();
+    }
+}
+
+void loop() {
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,371 @@
+/*
+ * Simulation of discovering a fleet of receivers on one WiFi channel, to measure the time until a
+ * transmitter knows all of them (time to full inventory). The transmitter broadcasts a discovery
+ * request every round; each receiver misses it with --request-loss (broadcasts are not
+ * acknowledged and receivers in power save miss some), otherwise it answers after its task
+ * wakes up. The answers contend for the channel with 802.11 DCF: random backoff in slots,
+ * binary exponential backoff after collisions and a retry limit after which the answer is lost.
+ * A share of --hidden of all pairs of receivers can't hear each other (hidden stations), so
+ * their answers can overlap at the access point even though both sensed the channel idle.
+ *
+ * Three strategies are compared:
+ *   immediate      every receiver answers every round right away (requests without options)
+ *   jitter         answers are spread over --window ms (DiscoveryQuery.response_window_ms)
+ *   jitter+filter  as jitter, and receivers the transmitter has heard of are in the bloom filter
+ *                  of the query (DiscoveryQuery.known_receivers) with a new seed every round
+ * A round lasts the window plus --margin ms. The receivers' filter test and random delay are the
+ * firmware's, from include/discovery_filter.h.
+ *
+ * usage: discovery_sim [--receivers N] [--trials N] [--rounds N] [--window MS] [--margin MS]
+ *                      [--request-loss P] [--hidden P] [--check]
+ * --check fails unless jitter+filter always finds every receiver, sends fewer answers than
+ * immediate and loses none to collisions.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/discovery_filter.h"
+
+#define MAX_RECEIVERS 1024
+/* 802.11g/n OFDM timing; an answer is ~300 bytes at 24 Mbit/s plus preamble, SIFS and ACK */
+#define SLOT_US 9
+#define DIFS_US 34
+#define AIRTIME_US 250
+#define CW_MIN 15
+#define CW_MAX 1023
+#define RETRY_LIMIT 7
+/* from the request arriving to the answer being handed to the WiFi driver */
+#define MAX_WAKEUP_US 2000
+/* the transmitter's filter, as discovery.kt sizes it */
+#define FILTER_BITS_PER_RECEIVER 10
+#define FILTER_MAX_BYTES 128
+#define FILTER_HASH_COUNT 7
+
+enum { IMMEDIATE, JITTER, JITTER_FILTER, N_STRATEGIES };
+static const char* strategy_names[N_STRATEGIES] = { "immediate", "jitter", "jitter+filter" };
+
+typedef struct {
+    uint64_t mac_address;
+    int known;
+    /* the answer of the current round */
+    int pending;
+    int64_t ready_at_us;
+    /* the channel is idle to this receiver from then on, as far as it can hear */
+    int64_t idle_since_us;
+    int backoff;
+    int cw;
+    int retries;
+    int transmitting;
+} receiver_t;
+
+typedef struct {
+    int receiver;
+    int64_t start_us;
+    int64_t end_us;
+} transmission_t;
+
+typedef struct {
+    int complete;
+    double inventory_ms;
+    uint32_t answers;
+    uint32_t collisions;
+    uint32_t lost;
+} trial_t;
+
+static receiver_t receivers[MAX_RECEIVERS];
+/* hidden[a][b]: a can't hear b */
+static uint8_t hidden[MAX_RECEIVERS][MAX_RECEIVERS];
+/* transmissions of the current round */
+static transmission_t transmissions[MAX_RECEIVERS * (RETRY_LIMIT + 1)];
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t) (rng_state >> 32);
+}
+
+static double rng_unit(void) {
+    return rng_next() / 4294967296.0;
+}
+
+/* when the receiver's backoff may count down from: DIFS after it has an answer and hears an idle channel */
+static int64_t countdown_from(const receiver_t* receiver) {
+    return (receiver->ready_at_us > receiver->idle_since_us ? receiver->ready_at_us : receiver->idle_since_us) + DIFS_US;
+}
+
+/*
+ * runs the channel until every answer of the round is delivered or lost; returns the time the
+ * last one was delivered. Time advances in slots while anything is on the air and jumps ahead
+ * while the channel is idle.
+ */
+static int64_t run_channel(int n_receivers, int64_t start_us, trial_t* trial) {
+    int64_t t = start_us;
+    int64_t last_delivery = -1;
+    int n_transmissions = 0;
+    int n_on_air = 0;
+    /* all answers take the same airtime, so they end in the order they started */
+    int first_on_air = 0;
+    while (1) {
+        /* answers that end now were acknowledged unless another one overlapped them at the access point */
+        for (int n = first_on_air; n < n_transmissions; n++) {
+            transmission_t* tx = &transmissions[n];
+            receiver_t* receiver = &receivers[tx->receiver];
+            if (!receiver->transmitting || tx->end_us > t || receiver->transmitting != n + 1) {
+                continue;
+            }
+            receiver->transmitting = 0;
+            n_on_air--;
+            /* starts and ends are both in order, so any overlap includes a neighbour */
+            int overlapped = (n > 0 && transmissions[n - 1].end_us > tx->start_us)
+                || (n + 1 < n_transmissions && transmissions[n + 1].start_us < tx->end_us);
+            if (!overlapped) {
+                receiver->pending = 0;
+                receiver->known = 1;
+                last_delivery = tx->end_us;
+                continue;
+            }
+            trial->collisions++;
+            receiver->retries++;
+            if (receiver->retries > RETRY_LIMIT) {
+                receiver->pending = 0;
+                trial->lost++;
+                continue;
+            }
+            receiver->cw = receiver->cw * 2 + 1 > CW_MAX ? CW_MAX : receiver->cw * 2 + 1;
+            receiver->backoff = -1;
+            receiver->idle_since_us = tx->end_us;
+        }
+        while (first_on_air < n_transmissions && receivers[transmissions[first_on_air].receiver].transmitting != first_on_air + 1) {
+            first_on_air++;
+        }
+
+        int64_t next_ready = INT64_MAX;
+        int n_pending = 0;
+        for (int r = 0; r < n_receivers; r++) {
+            receiver_t* receiver = &receivers[r];
+            if (!receiver->pending) {
+                continue;
+            }
+            n_pending++;
+            if (receiver->ready_at_us > t && receiver->ready_at_us < next_ready) {
+                next_ready = receiver->ready_at_us;
+            }
+            if (receiver->ready_at_us <= t && receiver->backoff < 0) {
+                receiver->backoff = (int) (rng_next() % (uint32_t) (receiver->cw + 1));
+            }
+        }
+        if (n_pending == 0) {
+            return last_delivery;
+        }
+
+        int64_t next_t = t + SLOT_US;
+        if (n_on_air == 0) {
+            /* nothing on the air: every receiver with an answer counts down undisturbed, so jump to the first one done */
+            next_t = next_ready;
+            for (int r = 0; r < n_receivers; r++) {
+                receiver_t* receiver = &receivers[r];
+                if (receiver->pending && receiver->ready_at_us <= t) {
+                    int64_t from = countdown_from(receiver);
+                    int64_t done_at = (from > t ? from : t) + (int64_t) receiver->backoff * SLOT_US;
+                    next_t = done_at < next_t ? done_at : next_t;
+                }
+            }
+            for (int r = 0; r < n_receivers; r++) {
+                receiver_t* receiver = &receivers[r];
+                int64_t from = countdown_from(receiver);
+                if (receiver->pending && receiver->ready_at_us <= t && next_t > from) {
+                    int64_t counted = (next_t - (from > t ? from : t)) / SLOT_US;
+                    receiver->backoff -= (int) (counted < receiver->backoff ? counted : receiver->backoff);
+                }
+            }
+        } else {
+            /* one slot: who hears something on the air freezes, the others count down */
+            for (int r = 0; r < n_receivers; r++) {
+                receiver_t* receiver = &receivers[r];
+                if (!receiver->pending || receiver->transmitting || receiver->ready_at_us > t) {
+                    continue;
+                }
+                for (int n = first_on_air; n < n_transmissions; n++) {
+                    transmission_t* tx = &transmissions[n];
+                    if (receivers[tx->receiver].transmitting == n + 1 && !hidden[r][tx->receiver] && tx->end_us > receiver->idle_since_us) {
+                        receiver->idle_since_us = tx->end_us;
+                    }
+                }
+                if (next_t > countdown_from(receiver) && receiver->backoff > 0) {
+                    receiver->backoff--;
+                }
+            }
+        }
+        t = next_t;
+
+        /* whoever is done counting down and hears an idle channel starts sending */
+        for (int r = 0; r < n_receivers; r++) {
+            receiver_t* receiver = &receivers[r];
+            if (!receiver->pending || receiver->transmitting || receiver->ready_at_us > t
+                    || receiver->backoff != 0 || t < countdown_from(receiver)) {
+                continue;
+            }
+            transmissions[n_transmissions] = (transmission_t) { r, t, t + AIRTIME_US };
+            receiver->transmitting = ++n_transmissions;
+            n_on_air++;
+        }
+    }
+}
+
+static trial_t run_trial(int strategy, int n_receivers, int rounds, int window_ms, int margin_ms, double request_loss, double hidden_share) {
+    trial_t trial = { 0 };
+    for (int r = 0; r < n_receivers; r++) {
+        receivers[r].mac_address = ((uint64_t) rng_next() << 16 ^ rng_next()) & 0xFFFFFFFFFFFFull;
+        receivers[r].known = 0;
+        for (int other = 0; other < r; other++) {
+            hidden[r][other] = hidden[other][r] = rng_unit() < hidden_share;
+        }
+        hidden[r][r] = 0;
+    }
+
+    int64_t round_us = (int64_t) ((strategy == IMMEDIATE ? 0 : window_ms) + margin_ms) * 1000;
+    uint8_t filter[FILTER_MAX_BYTES];
+    for (int round = 0; round < rounds; round++) {
+        int64_t round_start = round * round_us;
+        size_t filter_size = 0;
+        uint32_t seed = rng_next();
+        if (strategy == JITTER_FILTER) {
+            int n_known = 0;
+            for (int r = 0; r < n_receivers; r++) {
+                n_known += receivers[r].known;
+            }
+            filter_size = (size_t) (n_known * FILTER_BITS_PER_RECEIVER + 7) / 8;
+            filter_size = filter_size > FILTER_MAX_BYTES ? FILTER_MAX_BYTES : filter_size;
+            memset(filter, 0, sizeof(filter));
+            for (int r = 0; r < n_receivers; r++) {
+                if (receivers[r].known) {
+                    discovery_filter_add(filter, filter_size, FILTER_HASH_COUNT, seed, receivers[r].mac_address);
+                }
+            }
+        }
+
+        for (int r = 0; r < n_receivers; r++) {
+            receiver_t* receiver = &receivers[r];
+            receiver->pending = 0;
+            if (rng_unit() < request_loss) {
+                continue;
+            }
+            if (discovery_filter_contains(filter, filter_size, FILTER_HASH_COUNT, seed, receiver->mac_address)) {
+                continue;
+            }
+            uint32_t delay_ms = strategy == IMMEDIATE ? 0 : discovery_response_delay_ms((uint32_t) window_ms, rng_next());
+            receiver->pending = 1;
+            receiver->ready_at_us = round_start + (int64_t) delay_ms * 1000 + rng_next() % MAX_WAKEUP_US;
+            receiver->idle_since_us = round_start;
+            receiver->transmitting = 0;
+            receiver->backoff = -1;
+            receiver->cw = CW_MIN;
+            receiver->retries = 0;
+            trial.answers++;
+        }
+
+        int64_t last_delivery = run_channel(n_receivers, round_start, &trial);
+        int n_known = 0;
+        for (int r = 0; r < n_receivers; r++) {
+            n_known += receivers[r].known;
+        }
+        if (n_known == n_receivers) {
+            trial.complete = 1;
+            trial.inventory_ms = last_delivery / 1000.0;
+            break;
+        }
+    }
+    return trial;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv) {
+    int n_receivers = 50, n_trials = 100, rounds = 5, window_ms = 250, margin_ms = 100, check = 0;
+    double request_loss = 0.05, hidden_share = 0.1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--receivers") == 0 && i + 1 < argc) {
+            n_receivers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+            n_trials = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--margin") == 0 && i + 1 < argc) {
+            margin_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--request-loss") == 0 && i + 1 < argc) {
+            request_loss = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hidden") == 0 && i + 1 < argc) {
+            hidden_share = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--receivers N] [--trials N] [--rounds N] [--window MS] [--margin MS] [--request-loss P] [--hidden P] [--check]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (n_receivers < 1 || n_receivers > MAX_RECEIVERS || n_trials < 1 || rounds < 1) {
+        fprintf(stderr, "receivers must be 1 to %d, trials and rounds at least 1\n", MAX_RECEIVERS);
+        return 2;
+    }
+
+    printf("%d receivers, %d trials of up to %d rounds, window %dms, margin %dms, request loss %.0f%%, %.0f%% hidden\n",
+        n_receivers, n_trials, rounds, window_ms, margin_ms, request_loss * 100, hidden_share * 100);
+    printf("%-14s %9s %9s %9s %9s %9s %11s %6s\n", "strategy", "complete", "p50 ms", "p95 ms", "max ms", "answers", "collisions", "lost");
+
+    double* inventory_ms = malloc(sizeof(double) * n_trials);
+    double answers[N_STRATEGIES], lost[N_STRATEGIES];
+    int complete[N_STRATEGIES];
+    for (int strategy = 0; strategy < N_STRATEGIES; strategy++) {
+        rng_state = 0x9E3779B97F4A7C15ull;
+        uint64_t total_answers = 0, total_collisions = 0, total_lost = 0;
+        int n_complete = 0;
+        for (int n = 0; n < n_trials; n++) {
+            trial_t trial = run_trial(strategy, n_receivers, rounds, window_ms, margin_ms, request_loss, hidden_share);
+            total_answers += trial.answers;
+            total_collisions += trial.collisions;
+            total_lost += trial.lost;
+            if (trial.complete) {
+                inventory_ms[n_complete++] = trial.inventory_ms;
+            }
+        }
+        qsort(inventory_ms, n_complete, sizeof(double), compare_doubles);
+        answers[strategy] = (double) total_answers / n_trials;
+        lost[strategy] = (double) total_lost / n_trials;
+        complete[strategy] = n_complete;
+        if (n_complete == 0) {
+            printf("%-14s %8.1f%% %9s %9s %9s %9.1f %11.1f %6.2f\n", strategy_names[strategy], 0.0, "-", "-", "-",
+                answers[strategy], (double) total_collisions / n_trials, lost[strategy]);
+            continue;
+        }
+        printf("%-14s %8.1f%% %9.1f %9.1f %9.1f %9.1f %11.1f %6.2f\n",
+            strategy_names[strategy],
+            100.0 * n_complete / n_trials,
+            inventory_ms[(n_complete - 1) / 2],
+            inventory_ms[(int) ceil(0.95 * n_complete) - 1],
+            inventory_ms[n_complete - 1],
+            answers[strategy],
+            (double) total_collisions / n_trials,
+            lost[strategy]);
+    }
+    free(inventory_ms);
+
+    if (check) {
+        int ok = complete[JITTER_FILTER] == n_trials && answers[JITTER_FILTER] < answers[IMMEDIATE] && lost[JITTER_FILTER] == 0;
+        if (!ok) {
+            fprintf(stderr, "jitter+filter should find every receiver, with fewer answers than immediate and none lost\n");
+        }
+        return !ok;
+    }
+    return 0;
+}
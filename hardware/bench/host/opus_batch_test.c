@@ -0,0 +1,174 @@
+/*
+ * Test of batched audio messages (StreamConfiguration.frames_per_message). Every corpus file is
+ * sent the way a batching transmitter sends it: runs of consecutive packets with the same TOC
+ * are repacketized (repacketizer.c) into multi-frame packets of up to BATCH_FRAMES frames. Each
+ * of those is then split into single-frame packets the way network_queue_received_packet does
+ * (opus_packet_parse, then the TOC with code 0 before every frame) and decoded frame by frame.
+ * The output has to match decoding the original packets, lost ones concealed in both. Prints
+ * per file how many messages and bytes the batching saves with the 12 byte compact header.
+ *
+ * usage: opus_batch_test <corpus.opc>...
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <opus.h>
+#include "../opus_corpus.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define MAX_FRAME_SIZE (SAMPLE_RATE / 1000 * 120)
+#define BATCH_FRAMES 8
+#define MAX_PACKET_SIZE 4096
+#define COMPACT_HEADER_SIZE 12
+
+static opus_int16 pcm[MAX_FRAME_SIZE * CHANNELS];
+static unsigned char batch[MAX_PACKET_SIZE];
+static unsigned char split_frame[MAX_PACKET_SIZE];
+
+typedef struct {
+    OpusDecoder* decoder;
+    uint32_t pcm_hash;
+    int failures;
+} decode_run_t;
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(*len);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+/* data NULL conceals conceal_samples */
+static void decode_into(decode_run_t* run, const unsigned char* data, int len, int conceal_samples) {
+    int samples = data == NULL
+        ? opus_decode(run->decoder, NULL, 0, pcm, conceal_samples, 0)
+        : opus_decode(run->decoder, data, len, pcm, MAX_FRAME_SIZE, 0);
+    if (samples < 0) {
+        run->failures++;
+        return;
+    }
+    for (int n = 0; n < samples * CHANNELS; n++) {
+        run->pcm_hash = (run->pcm_hash ^ (uint16_t) pcm[n]) * 16777619u;
+    }
+}
+
+/* splits a batch like the receiver and decodes its frames one by one; returns the number of frames */
+static int decode_split(decode_run_t* run, const unsigned char* data, int len) {
+    unsigned char toc;
+    const unsigned char* frames[48];
+    opus_int16 frame_sizes[48];
+    int n_frames = opus_packet_parse(data, len, &toc, frames, frame_sizes, NULL);
+    if (n_frames < 0 || n_frames > BATCH_FRAMES) {
+        run->failures++;
+        return 0;
+    }
+    for (int k = 0; k < n_frames; k++) {
+        split_frame[0] = toc & 0xFC;
+        memcpy(&split_frame[1], frames[k], frame_sizes[k]);
+        decode_into(run, split_frame, 1 + frame_sizes[k], 0);
+    }
+    return n_frames;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus.opc>...\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    OpusRepacketizer* repacketizer = opus_repacketizer_create();
+    for (int f = 1; f < argc; f++) {
+        size_t len;
+        uint8_t* data = read_file(argv[f], &len);
+        opus_corpus_t corpus;
+        if (data == NULL || opus_corpus_open(&corpus, data, len) != 0) {
+            fprintf(stderr, "%s: not a readable corpus file\n", argv[f]);
+            return 1;
+        }
+        const char* name = strrchr(argv[f], '/') ? strrchr(argv[f], '/') + 1 : argv[f];
+
+        decode_run_t reference = { opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL), 2166136261u, 0 };
+        decode_run_t batched = { opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL), 2166136261u, 0 };
+        uint32_t messages = 0, batched_messages = 0, bytes = 0, batched_bytes = 0;
+        int frames_in_batch = 0, frames_split = 0, frames_batched = 0;
+        int batch_bytes = 2;
+        opus_repacketizer_init(repacketizer);
+        const uint8_t* cursor = corpus.packets;
+        for (uint32_t i = 0; i <= corpus.packet_count; i++) {
+            opus_corpus_packet_t packet = { NULL, 0, 0 };
+            if (i < corpus.packet_count) {
+                opus_corpus_next(&cursor, &packet);
+                if (packet.len > 0) {
+                    decode_into(&reference, packet.data, packet.len, 0);
+                    messages++;
+                    bytes += COMPACT_HEADER_SIZE + packet.len;
+                }
+            }
+
+            /* a batch ends at a loss, at the end, when it is full or when the next packet does not fit it;
+               every frame may need two bytes of length in the batch */
+            int packet_frames = packet.len > 0 ? opus_packet_get_nb_frames(packet.data, packet.len) : 0;
+            int fits = packet.len > 0 && frames_in_batch + packet_frames <= BATCH_FRAMES
+                && batch_bytes + packet.len + 2 * packet_frames <= MAX_PACKET_SIZE;
+            if (fits && opus_repacketizer_cat(repacketizer, packet.data, packet.len) == OPUS_OK) {
+                frames_in_batch += packet_frames;
+                frames_batched += packet_frames;
+                batch_bytes += packet.len + 2 * packet_frames;
+                continue;
+            }
+            if (frames_in_batch > 0) {
+                opus_int32 batch_len = opus_repacketizer_out(repacketizer, batch, sizeof(batch));
+                if (batch_len < 0) {
+                    batched.failures++;
+                } else {
+                    frames_split += decode_split(&batched, batch, batch_len);
+                    batched_messages++;
+                    batched_bytes += COMPACT_HEADER_SIZE + batch_len;
+                }
+                opus_repacketizer_init(repacketizer);
+                frames_in_batch = 0;
+                batch_bytes = 2;
+            }
+            if (packet.len == 0) {
+                if (i < corpus.packet_count) {
+                    decode_into(&reference, NULL, 0, corpus.frame_size);
+                    decode_into(&batched, NULL, 0, corpus.frame_size);
+                }
+                continue;
+            }
+            /* starts the next batch */
+            if (opus_repacketizer_cat(repacketizer, packet.data, packet.len) != OPUS_OK) {
+                batched.failures++;
+                continue;
+            }
+            frames_in_batch = packet_frames;
+            frames_batched += packet_frames;
+            batch_bytes = 2 + packet.len + 2 * packet_frames;
+        }
+
+        int ok = reference.failures == 0 && batched.failures == 0
+            && frames_split == frames_batched && reference.pcm_hash == batched.pcm_hash;
+        failed |= !ok;
+        printf("%-32s %s %6u messages %8u bytes -> %5u messages %8u bytes\n",
+            name, ok ? "ok" : "MISMATCH", messages, bytes, batched_messages, batched_bytes);
+        opus_decoder_destroy(reference.decoder);
+        opus_decoder_destroy(batched.decoder);
+        free(data);
+    }
+    opus_repacketizer_destroy(repacketizer);
+    return failed;
+}
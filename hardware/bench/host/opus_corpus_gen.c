@@ -0,0 +1,177 @@
+/*
+ * Generates the packet corpus in bench/corpus with the vendored libopus encoder.
+ *
+ *     opus_corpus_gen <output directory>
+ *
+ * The input signal is synthetic and deterministic (a chord with vibrato, plus noise bursts
+ * for transients), so running this again produces the same files as long as the encoder is
+ * unchanged. The corpus is checked in; only regenerate it on purpose, and update the
+ * baseline of opus_host_bench in the same commit.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <opus.h>
+#include "opus_private.h"
+#include "../opus_corpus.h"
+
+#define SAMPLE_RATE 48000
+/* divisible by every frame duration from 2.5 to 60ms */
+#define DURATION_SAMPLES (SAMPLE_RATE * 12 / 10)
+#define MAX_PACKET_SIZE 1500
+
+typedef struct {
+    uint8_t mode;
+    /* frame duration in tenths of a millisecond */
+    int duration_tenth_ms;
+    int kbps;
+    int channels;
+    int lossy;
+} corpus_config_t;
+
+static const corpus_config_t configs[] = {
+    { OPUS_CORPUS_MODE_CELT,     25,  64, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,     50,  96, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    100, 128, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    200,  32, 1, 0 },
+    { OPUS_CORPUS_MODE_CELT,    200,  64, 1, 0 },
+    { OPUS_CORPUS_MODE_CELT,    200, 128, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    200, 128, 2, 1 },
+    { OPUS_CORPUS_MODE_CELT,    200, 256, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    400, 128, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    600,  96, 2, 0 },
+    { OPUS_CORPUS_MODE_CELT,    600,  96, 2, 1 },
+    { OPUS_CORPUS_MODE_SILK,    100,  32, 1, 0 },
+    { OPUS_CORPUS_MODE_SILK,    200,  32, 1, 1 },
+    { OPUS_CORPUS_MODE_SILK,    200,  32, 2, 0 },
+    { OPUS_CORPUS_MODE_SILK,    400,  32, 1, 0 },
+    { OPUS_CORPUS_MODE_SILK,    600,  32, 1, 0 },
+    { OPUS_CORPUS_MODE_HYBRID,  100,  64, 2, 0 },
+    { OPUS_CORPUS_MODE_HYBRID,  200,  48, 2, 0 },
+    { OPUS_CORPUS_MODE_HYBRID,  200,  48, 2, 1 },
+    { OPUS_CORPUS_MODE_HYBRID,  400,  64, 1, 0 },
+    { OPUS_CORPUS_MODE_HYBRID,  600,  64, 2, 0 },
+};
+
+static const int force_mode_by_corpus_mode[] = { MODE_SILK_ONLY, MODE_HYBRID, MODE_CELT_ONLY };
+
+static uint32_t rng_state = 1;
+
+static int32_t rng_next(void) {
+    rng_state = rng_state * 1664525 + 1013904223;
+    return (int32_t) (rng_state >> 16) - 32768;
+}
+
+static void generate_signal(opus_int16* pcm, int channels) {
+    static const double chord[] = { 220.0, 277.18, 329.63, 440.0 };
+    rng_state = 1;
+    for (int i = 0; i < DURATION_SAMPLES; i++) {
+        double t = (double) i / SAMPLE_RATE;
+        double vibrato = 1.0 + 0.004 * sin(2 * M_PI * 5.0 * t);
+        /* a noise burst every 300ms that decays within ~20ms gives the encoder transients */
+        double since_burst = fmod(t, 0.3);
+        double burst = since_burst < 0.05 ? exp(-since_burst * 200.0) : 0.0;
+        for (int ch = 0; ch < channels; ch++) {
+            double sample = 0;
+            for (size_t n = 0; n < sizeof(chord) / sizeof(chord[0]); n++) {
+                sample += sin(2 * M_PI * chord[n] * vibrato * t + ch * 0.7 * (n + 1)) / (n + 1);
+            }
+            sample = sample * 5000.0 + burst * rng_next() * 0.5;
+            pcm[i * channels + ch] = (opus_int16) fmax(-32768.0, fmin(32767.0, sample));
+        }
+    }
+}
+
+/* drops every 11th packet and a burst of three every 40, the same for every lossy config */
+static int is_lost(int packet_index) {
+    return packet_index % 11 == 10 || (packet_index % 40 >= 20 && packet_index % 40 < 23);
+}
+
+static void put_u16(FILE* f, uint32_t v) {
+    fputc(v & 0xFF, f);
+    fputc((v >> 8) & 0xFF, f);
+}
+
+static void put_u32(FILE* f, uint32_t v) {
+    put_u16(f, v & 0xFFFF);
+    put_u16(f, v >> 16);
+}
+
+static int write_corpus(const char* directory, const corpus_config_t* config) {
+    int frame_size = SAMPLE_RATE * config->duration_tenth_ms / 10000;
+    int packet_count = DURATION_SAMPLES / frame_size;
+    char duration[16];
+    char path[512];
+    if (config->duration_tenth_ms % 10 == 0) {
+        snprintf(duration, sizeof(duration), "%d", config->duration_tenth_ms / 10);
+    } else {
+        snprintf(duration, sizeof(duration), "%d.%d", config->duration_tenth_ms / 10, config->duration_tenth_ms % 10);
+    }
+    snprintf(path, sizeof(path), "%s/%s_%sms_%dk_%s%s.opc", directory, opus_corpus_mode_name(config->mode), duration,
+             config->kbps, config->channels == 1 ? "mono" : "stereo", config->lossy ? "_loss" : "");
+
+    int error;
+    OpusEncoder* encoder = opus_encoder_create(SAMPLE_RATE, config->channels, OPUS_APPLICATION_AUDIO, &error);
+    if (error != OPUS_OK) {
+        fprintf(stderr, "opus_encoder_create: %s\n", opus_strerror(error));
+        return -1;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_FORCE_MODE(force_mode_by_corpus_mode[config->mode]));
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(config->kbps * 1000));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(10));
+
+    opus_int16* pcm = malloc(sizeof(opus_int16) * DURATION_SAMPLES * config->channels);
+    generate_signal(pcm, config->channels);
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    fwrite("OPC1", 1, 4, f);
+    fputc(config->mode, f);
+    fputc(config->channels, f);
+    put_u16(f, frame_size);
+    put_u32(f, config->kbps * 1000);
+    put_u32(f, packet_count);
+
+    for (int i = 0; i < packet_count; i++) {
+        unsigned char packet[MAX_PACKET_SIZE];
+        opus_uint32 final_range;
+        int len = opus_encode(encoder, pcm + i * frame_size * config->channels, frame_size, packet, sizeof(packet));
+        if (len < 0) {
+            fprintf(stderr, "%s: opus_encode: %s\n", path, opus_strerror(len));
+            return -1;
+        }
+        opus_encoder_ctl(encoder, OPUS_GET_FINAL_RANGE(&final_range));
+        if (config->lossy && is_lost(i)) {
+            len = 0;
+            final_range = 0;
+        }
+        put_u16(f, len);
+        put_u32(f, final_range);
+        fwrite(packet, 1, len, f);
+    }
+
+    fclose(f);
+    free(pcm);
+    opus_encoder_destroy(encoder);
+    printf("%s\n", path);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output directory>\n", argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        if (write_corpus(argv[1], &configs[i]) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
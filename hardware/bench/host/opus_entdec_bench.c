@@ -0,0 +1,140 @@
+/*
+ * Micro benchmark of the range decoder (celt/entdec.c) on the packets of the corpus. Every
+ * packet is run through a fixed mix of ec_dec_bit_logp, ec_dec_icdf, ec_dec_uint and
+ * ec_dec_bits until it is used up, which exercises both the range coded front and the raw
+ * bits at the back of the buffer. Prints ns per packet and a hash of everything decoded, per
+ * corpus file. Built twice, with the multi-byte refills and with the byte-at-a-time ones
+ * (OPUS_DISABLE_EC_MULTIBYTE_REFILL), so both can be compared for speed and bit-exactness.
+ *
+ * usage: opus_entdec_bench [--checksum-only] [--iterations N] <corpus.opc>...
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "celt/entdec.h"
+#include "../opus_corpus.h"
+
+/* a skewed distribution over 7 symbols, like the ones CELT codes with ec_dec_icdf */
+static const unsigned char bench_icdf[] = { 200, 150, 100, 60, 30, 10, 0 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(*len);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash == NULL ? path : slash + 1;
+}
+
+static uint32_t decode_packet(const opus_corpus_packet_t* packet, uint32_t hash) {
+    ec_dec dec;
+    /* the decoder never writes to the buffer */
+    ec_dec_init(&dec, (unsigned char*) packet->data, packet->len);
+    int budget = packet->len * 8 - 32;
+    for (unsigned i = 0; ec_tell(&dec) < budget; i++) {
+        opus_uint32 value;
+        switch (i % 4) {
+            case 0: value = ec_dec_bit_logp(&dec, 1 + i % 15); break;
+            case 1: value = ec_dec_icdf(&dec, bench_icdf, 8); break;
+            case 2: value = ec_dec_uint(&dec, 2 + (i * 37) % 1000); break;
+            default: value = ec_dec_bits(&dec, 1 + (i * 7) % 16); break;
+        }
+        hash = (hash ^ value) * 16777619u;
+    }
+    hash = (hash ^ dec.rng) * 16777619u;
+    hash = (hash ^ dec.val) * 16777619u;
+    return (hash ^ (uint32_t) ec_tell_frac(&dec)) * 16777619u;
+}
+
+int main(int argc, char** argv) {
+    int checksum_only = 0;
+    int iterations = 200;
+    int first_file = 1;
+    for (; first_file < argc && strncmp(argv[first_file], "--", 2) == 0; first_file++) {
+        if (strcmp(argv[first_file], "--checksum-only") == 0) {
+            checksum_only = 1;
+        } else if (strcmp(argv[first_file], "--iterations") == 0 && first_file + 1 < argc) {
+            iterations = atoi(argv[++first_file]);
+        } else {
+            break;
+        }
+    }
+    if (first_file >= argc) {
+        fprintf(stderr, "usage: %s [--checksum-only] [--iterations N] <corpus.opc>...\n", argv[0]);
+        return 2;
+    }
+
+    for (int f = first_file; f < argc; f++) {
+        size_t len;
+        uint8_t* data = read_file(argv[f], &len);
+        opus_corpus_t corpus;
+        if (data == NULL || opus_corpus_open(&corpus, data, len) != 0) {
+            fprintf(stderr, "%s: not a readable corpus file\n", argv[f]);
+            return 1;
+        }
+
+        uint32_t hash = 2166136261u;
+        uint32_t packets = 0;
+        const uint8_t* cursor = corpus.packets;
+        for (uint32_t i = 0; i < corpus.packet_count; i++) {
+            opus_corpus_packet_t packet;
+            opus_corpus_next(&cursor, &packet);
+            if (packet.len > 0) {
+                hash = decode_packet(&packet, hash);
+                packets++;
+            }
+        }
+        if (checksum_only || packets == 0) {
+            printf("%-32s checksum %08x\n", base_name(argv[f]), hash);
+            free(data);
+            continue;
+        }
+
+        uint64_t best = UINT64_MAX;
+        volatile uint32_t sink = 0;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            uint64_t start = now_ns();
+            for (int n = 0; n < iterations; n++) {
+                cursor = corpus.packets;
+                for (uint32_t i = 0; i < corpus.packet_count; i++) {
+                    opus_corpus_packet_t packet;
+                    opus_corpus_next(&cursor, &packet);
+                    if (packet.len > 0) {
+                        sink = decode_packet(&packet, sink);
+                    }
+                }
+            }
+            uint64_t elapsed = now_ns() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        printf("%-32s checksum %08x %8.0f ns/packet\n", base_name(argv[f]), hash,
+               (double) best / iterations / packets);
+        free(data);
+    }
+    return 0;
+}
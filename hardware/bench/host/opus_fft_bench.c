@@ -0,0 +1,99 @@
+/*
+ * Times opus_fft_impl() for the four FFT sizes of the static 48kHz mode and hashes its output
+ * for random input. Built twice, against the library's static FFTs and against the generic
+ * kiss_fft.c (OPUS_DISABLE_STATIC_FFT), so both can be compared for speed and bit-exactness.
+ *
+ * usage: opus_fft_bench [--checksum-only] [--iterations N]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "celt/modes.h"
+#include "celt/kiss_fft.h"
+
+#define FFT_INPUTS 64
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t rng_state = 1;
+
+static int32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (int32_t) rng_state;
+}
+
+int main(int argc, char** argv) {
+    int checksum_only = 0;
+    int iterations = 2000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--checksum-only") == 0) {
+            checksum_only = 1;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--checksum-only] [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int error;
+    const CELTMode* mode = opus_custom_mode_create(48000, 960, &error);
+    if (mode == NULL) {
+        fprintf(stderr, "opus_custom_mode_create failed: %d\n", error);
+        return 1;
+    }
+
+    static kiss_fft_cpx input[FFT_INPUTS][480];
+    static kiss_fft_cpx work[480];
+    for (int shift = 0; shift <= mode->mdct.maxshift; shift++) {
+        const kiss_fft_state* st = mode->mdct.kfft[shift];
+        uint32_t hash = 2166136261u;
+
+        /* the inverse MDCT feeds the FFT roughly 16 bit signals scaled up; cover the full range too */
+        rng_state = 0x9E3779B9u ^ st->nfft;
+        for (int n = 0; n < FFT_INPUTS; n++) {
+            int bits = 12 + n % 18;
+            for (int k = 0; k < st->nfft; k++) {
+                input[n][k].r = rng_next() >> (32 - bits);
+                input[n][k].i = rng_next() >> (32 - bits);
+            }
+        }
+        for (int n = 0; n < FFT_INPUTS; n++) {
+            memcpy(work, input[n], sizeof(kiss_fft_cpx) * st->nfft);
+            opus_fft_impl(st, work);
+            for (int k = 0; k < st->nfft; k++) {
+                hash = (hash ^ (uint32_t) work[k].r) * 16777619u;
+                hash = (hash ^ (uint32_t) work[k].i) * 16777619u;
+            }
+        }
+        printf("fft%d checksum %08x\n", st->nfft, hash);
+        if (checksum_only) {
+            continue;
+        }
+
+        uint64_t best = UINT64_MAX;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            uint64_t start = now_ns();
+            for (int i = 0; i < iterations; i++) {
+                memcpy(work, input[i % FFT_INPUTS], sizeof(kiss_fft_cpx) * st->nfft);
+                opus_fft_impl(st, work);
+            }
+            uint64_t elapsed = now_ns() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        printf("fft%d %.0f ns\n", st->nfft, (double) best / iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Host-side benchmark of the vendored libopus decoder, built with the same config.h as the
+ * firmware. Decodes every corpus file the way the playback task does (48kHz stereo output,
+ * concealment for lost packets) and reports, per file:
+ *
+ *   - ns per frame: the fastest of all iterations, averaged over the frames of the file
+ *   - the slowest single frame seen in any iteration
+ *   - peak C stack of the decoding thread, peak use of the scratch arena (opus_scratch.c)
+ *     and peak heap (the decoder state)
+ *   - a hash of the decoded PCM, which must not change unless the decoder output is meant to
+ *
+ * usage: opus_host_bench [--iterations N] [--baseline FILE [--max-regression PERCENT]]
+ *                        [--write-baseline FILE] <corpus.opc>...
+ *
+ * With --baseline, a PCM hash that differs from the baseline fails the run. With
+ * --max-regression as well, so does a ns/frame that is more than PERCENT worse. Timings only
+ * compare against a baseline recorded on the same machine.
+ */
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <opus.h>
+#include <opus_scratch.h>
+#include <opus_profile.h>
+#include "../opus_corpus.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define MAX_FRAME_SIZE (SAMPLE_RATE / 1000 * 120)
+#define MEASURE_STACK_SIZE (1024 * 1024)
+#define STACK_PAINT 0xA5
+#define MAX_BASELINE_ENTRIES 256
+
+typedef struct {
+    const char* name;
+    opus_corpus_t corpus;
+    uint32_t pcm_hash;
+    uint32_t range_mismatches;
+    int error;
+    size_t peak_stack;
+    size_t peak_scratch;
+    size_t peak_heap;
+    double ns_per_frame;
+    uint64_t worst_frame_ns;
+} bench_result_t;
+
+typedef struct {
+    char name[128];
+    double ns_per_frame;
+    uint32_t pcm_hash;
+} baseline_entry_t;
+
+/* heap accounting, linked in with -Wl,--wrap=malloc,--wrap=free */
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+
+static int heap_tracking = 0;
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+
+void* __wrap_malloc(size_t size) {
+    void* ptr = __real_malloc(size);
+    if (heap_tracking && ptr != NULL) {
+        heap_current += malloc_usable_size(ptr);
+        if (heap_current > heap_peak) {
+            heap_peak = heap_current;
+        }
+    }
+    return ptr;
+}
+
+void __wrap_free(void* ptr) {
+    if (heap_tracking && ptr != NULL) {
+        heap_current -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t fnv1a_pcm(uint32_t hash, const opus_int16* pcm, int samples) {
+    for (int i = 0; i < samples; i++) {
+        uint16_t s = (uint16_t) pcm[i];
+        hash = (hash ^ (s & 0xFF)) * 16777619u;
+        hash = (hash ^ (s >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+/* decodes one packet like the playback task does; returns the number of samples per channel or an opus error */
+static int decode_packet(OpusDecoder* decoder, const opus_corpus_t* corpus, const opus_corpus_packet_t* packet, opus_int16* pcm) {
+    if (packet->len == 0) {
+        return opus_decode(decoder, NULL, 0, pcm, corpus->frame_size, 0);
+    }
+    return opus_decode(decoder, packet->data, packet->len, pcm, MAX_FRAME_SIZE, 0);
+}
+
+/* runs on a thread with a painted stack: checks the output and measures memory */
+static void* measure_decode(void* arg) {
+    bench_result_t* result = (bench_result_t*) arg;
+    static opus_int16 pcm[MAX_FRAME_SIZE * CHANNELS];
+    int error;
+
+    heap_current = 0;
+    heap_peak = 0;
+    heap_tracking = 1;
+    opus_scratch_reset_high_water_mark();
+
+    OpusDecoder* decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &error);
+    if (error != OPUS_OK) {
+        result->error = error;
+        heap_tracking = 0;
+        return NULL;
+    }
+
+    result->pcm_hash = 2166136261u;
+    const uint8_t* cursor = result->corpus.packets;
+    for (uint32_t i = 0; i < result->corpus.packet_count; i++) {
+        opus_corpus_packet_t packet;
+        opus_corpus_next(&cursor, &packet);
+        int samples = decode_packet(decoder, &result->corpus, &packet, pcm);
+        if (samples < 0) {
+            result->error = samples;
+            break;
+        }
+        if (packet.len > 0) {
+            opus_uint32 final_range;
+            opus_decoder_ctl(decoder, OPUS_GET_FINAL_RANGE(&final_range));
+            if (final_range != packet.final_range) {
+                result->range_mismatches++;
+            }
+        }
+        result->pcm_hash = fnv1a_pcm(result->pcm_hash, pcm, samples * CHANNELS);
+    }
+
+    opus_decoder_destroy(decoder);
+    heap_tracking = 0;
+    result->peak_heap = heap_peak;
+    result->peak_scratch = opus_scratch_high_water_mark();
+    return NULL;
+}
+
+static void* measure_nothing(void* arg) {
+    return arg;
+}
+
+/* how many bytes of the thread stack were touched by running body(arg) on it */
+static int run_on_painted_stack(void* (*body)(void*), void* arg, size_t* stack_used) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    uint8_t* stack = __real_malloc(MEASURE_STACK_SIZE);
+    if (stack == NULL) {
+        return -1;
+    }
+    memset(stack, STACK_PAINT, MEASURE_STACK_SIZE);
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, MEASURE_STACK_SIZE);
+    if (pthread_create(&thread, &attr, body, arg) != 0) {
+        __real_free(stack);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    /* the stack grows down; the lowest byte that lost its paint is the deepest point reached */
+    size_t untouched = 0;
+    while (untouched < MEASURE_STACK_SIZE && stack[untouched] == STACK_PAINT) {
+        untouched++;
+    }
+    *stack_used = MEASURE_STACK_SIZE - untouched;
+    __real_free(stack);
+    return 0;
+}
+
+static int measure(bench_result_t* result) {
+    size_t thread_overhead, stack_used;
+    /* glibc keeps the thread descriptor and TLS at the top of the stack, that is not the decoder's */
+    if (run_on_painted_stack(measure_nothing, NULL, &thread_overhead) != 0
+        || run_on_painted_stack(measure_decode, result, &stack_used) != 0) {
+        return -1;
+    }
+    result->peak_stack = stack_used - thread_overhead;
+    return 0;
+}
+
+static void time_decode(bench_result_t* result, int iterations) {
+    static opus_int16 pcm[MAX_FRAME_SIZE * CHANNELS];
+    int error;
+    OpusDecoder* decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &error);
+    uint64_t best_total_ns = UINT64_MAX;
+
+    result->worst_frame_ns = 0;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        uint64_t total_ns = 0;
+        const uint8_t* cursor = result->corpus.packets;
+        opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+        for (uint32_t i = 0; i < result->corpus.packet_count; i++) {
+            opus_corpus_packet_t packet;
+            opus_corpus_next(&cursor, &packet);
+            uint64_t start = now_ns();
+            decode_packet(decoder, &result->corpus, &packet, pcm);
+            uint64_t elapsed = now_ns() - start;
+            total_ns += elapsed;
+            if (elapsed > result->worst_frame_ns) {
+                result->worst_frame_ns = elapsed;
+            }
+        }
+        if (total_ns < best_total_ns) {
+            best_total_ns = total_ns;
+        }
+    }
+    result->ns_per_frame = (double) best_total_ns / result->corpus.packet_count;
+    opus_decoder_destroy(decoder);
+}
+
+#ifdef OPUS_STAGE_PROFILING
+static void print_stage_profile(uint32_t frames) {
+    opus_stage_profile profile;
+    opus_stage_profile_get(&profile);
+    for (int stage = 0; stage < OPUS_STAGE_COUNT; stage++) {
+        if (profile.calls[stage] > 0) {
+            printf("  %-22s %10.0f ns/frame\n", opus_stage_name(stage), (double) profile.ticks[stage] / frames);
+        }
+    }
+}
+#endif
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(*len);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash == NULL ? path : slash + 1;
+}
+
+static int read_baseline(const char* path, baseline_entry_t* entries, int max_entries) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    int count = 0;
+    while (count < max_entries && fgets(line, sizeof(line), f) != NULL) {
+        baseline_entry_t* entry = &entries[count];
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%127s %lf %x", entry->name, &entry->ns_per_frame, &entry->pcm_hash) == 3) {
+            count++;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static const baseline_entry_t* find_baseline(const baseline_entry_t* entries, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--iterations N] [--baseline FILE [--max-regression PERCENT]] [--write-baseline FILE] <corpus.opc>...\n", program);
+}
+
+int main(int argc, char** argv) {
+    int iterations = 20;
+    const char* baseline_path = NULL;
+    const char* write_baseline_path = NULL;
+    double max_regression_percent = -1;
+    int first_corpus = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+            max_regression_percent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            write_baseline_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else {
+            first_corpus = i;
+            break;
+        }
+    }
+    if (first_corpus == argc || iterations < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    static baseline_entry_t baseline[MAX_BASELINE_ENTRIES];
+    int baseline_count = 0;
+    if (baseline_path != NULL) {
+        baseline_count = read_baseline(baseline_path, baseline, MAX_BASELINE_ENTRIES);
+        if (baseline_count < 0) {
+            return 2;
+        }
+    }
+
+    FILE* baseline_out = NULL;
+    if (write_baseline_path != NULL) {
+        baseline_out = fopen(write_baseline_path, "w");
+        if (baseline_out == NULL) {
+            perror(write_baseline_path);
+            return 2;
+        }
+        fprintf(baseline_out, "# corpus ns_per_frame pcm_hash, written by opus_host_bench\n");
+    }
+
+    int failures = 0;
+    printf("%-32s %-6s %6s %12s %12s %8s %8s %8s %10s\n",
+           "corpus", "mode", "frames", "ns/frame", "worst ns", "stack", "scratch", "heap", "pcm hash");
+    for (int i = first_corpus; i < argc; i++) {
+        bench_result_t result;
+        size_t len;
+        memset(&result, 0, sizeof(result));
+        result.name = base_name(argv[i]);
+
+        uint8_t* data = read_file(argv[i], &len);
+        if (data == NULL || opus_corpus_open(&result.corpus, data, len) != 0) {
+            fprintf(stderr, "%s: not a readable corpus file\n", argv[i]);
+            free(data);
+            failures++;
+            continue;
+        }
+
+        if (measure(&result) != 0 || result.error != 0) {
+            fprintf(stderr, "%s: decoding failed: %s\n", result.name, opus_strerror(result.error));
+            free(data);
+            failures++;
+            continue;
+        }
+        opus_stage_profile_reset();
+        time_decode(&result, iterations);
+
+        printf("%-32s %-6s %6u %12.0f %12llu %8zu %8zu %8zu   %08x\n",
+               result.name, opus_corpus_mode_name(result.corpus.mode), result.corpus.packet_count,
+               result.ns_per_frame, (unsigned long long) result.worst_frame_ns,
+               result.peak_stack, result.peak_scratch, result.peak_heap, result.pcm_hash);
+
+#ifdef OPUS_STAGE_PROFILING
+        print_stage_profile(iterations * result.corpus.packet_count);
+#endif
+        if (result.range_mismatches > 0) {
+            printf("  FAIL: final range differs from the encoder's on %u packets\n", result.range_mismatches);
+            failures++;
+        }
+        if (baseline_path != NULL) {
+            const baseline_entry_t* expected = find_baseline(baseline, baseline_count, result.name);
+            if (expected == NULL) {
+                printf("  no baseline\n");
+            } else {
+                if (expected->pcm_hash != result.pcm_hash) {
+                    printf("  FAIL: decoded PCM differs from the baseline (hash %08x)\n", expected->pcm_hash);
+                    failures++;
+                }
+                double change_percent = (result.ns_per_frame / expected->ns_per_frame - 1.0) * 100.0;
+                if (max_regression_percent >= 0 && change_percent > max_regression_percent) {
+                    printf("  FAIL: %.1f%% slower than the baseline (%.0f ns/frame)\n", change_percent, expected->ns_per_frame);
+                    failures++;
+                }
+            }
+        }
+        if (baseline_out != NULL) {
+            fprintf(baseline_out, "%s %.0f %08x\n", result.name, result.ns_per_frame, result.pcm_hash);
+        }
+        free(data);
+    }
+
+    if (baseline_out != NULL) {
+        fclose(baseline_out);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/*
+ * Test of the decoder output stage (OPUS_SET_GAIN, OPUS_SET_OUTPUT_ROUTING and
+ * OPUS_SET_OUTPUT_DITHER). Every corpus file is decoded by one decoder with the stage
+ * configured, which applies it inside CELT's de-emphasis for CELT frames, and by one without,
+ * whose output gets celt_output_stage_apply() afterwards. Both have to agree sample for sample,
+ * for every routing, with and without gain and dither. Also checks that unity gain without
+ * routing leaves the output untouched and that an attenuation is actually applied.
+ *
+ * usage: opus_output_stage_test <corpus.opc>...
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "opus.h"
+#include "celt/celt.h"
+#include "celt/mathops.h"
+#include "../opus_corpus.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define MAX_FRAME_SIZE (SAMPLE_RATE / 1000 * 120)
+
+typedef struct {
+    opus_int32 gain_q8_db;
+    opus_int32 routing;
+    opus_int32 dither;
+} output_stage_case_t;
+
+static const output_stage_case_t output_stage_cases[] = {
+    { 0, OPUS_OUTPUT_SWAPPED, 0 },
+    { 0, OPUS_OUTPUT_MONO, 0 },
+    { 0, OPUS_OUTPUT_LEFT, 0 },
+    { 0, OPUS_OUTPUT_RIGHT, 0 },
+    { -6 * 256, OPUS_OUTPUT_STEREO, 0 },
+    { -6 * 256, OPUS_OUTPUT_STEREO, 1 },
+    { -40 * 256, OPUS_OUTPUT_MONO, 1 },
+    { 6 * 256, OPUS_OUTPUT_SWAPPED, 1 },
+};
+
+static opus_int16 fused_pcm[MAX_FRAME_SIZE * CHANNELS];
+static opus_int16 reference_pcm[MAX_FRAME_SIZE * CHANNELS];
+static opus_int16 plain_pcm[MAX_FRAME_SIZE * CHANNELS];
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(*len);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static int decode(OpusDecoder* decoder, const opus_corpus_t* corpus, const opus_corpus_packet_t* packet, opus_int16* pcm) {
+    if (packet->len == 0) {
+        return opus_decode(decoder, NULL, 0, pcm, corpus->frame_size, 0);
+    }
+    return opus_decode(decoder, packet->data, packet->len, pcm, MAX_FRAME_SIZE, 0);
+}
+
+/* returns the number of frames that differ from the post-processed reference */
+static int run_case(const char* name, const opus_corpus_t* corpus, const output_stage_case_t* c) {
+    OpusDecoder* fused = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    OpusDecoder* reference = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    opus_decoder_ctl(fused, OPUS_SET_GAIN(c->gain_q8_db));
+    opus_decoder_ctl(fused, OPUS_SET_OUTPUT_ROUTING(c->routing));
+    opus_decoder_ctl(fused, OPUS_SET_OUTPUT_DITHER(c->dither));
+
+    CELTOutputStage stage = { 0 };
+    stage.apply_gain = c->gain_q8_db != 0;
+    stage.gain = celt_exp2(MULT16_16_P15(QCONST16(6.48814081e-4f, 25), c->gain_q8_db));
+    stage.routing = c->routing;
+    stage.dither = c->dither;
+
+    int mismatches = 0;
+    int64_t energy_in = 0, energy_out = 0;
+    const uint8_t* cursor = corpus->packets;
+    for (uint32_t i = 0; i < corpus->packet_count; i++) {
+        opus_corpus_packet_t packet;
+        opus_corpus_next(&cursor, &packet);
+        int samples = decode(fused, corpus, &packet, fused_pcm);
+        int reference_samples = decode(reference, corpus, &packet, reference_pcm);
+        if (samples < 0 || samples != reference_samples) {
+            fprintf(stderr, "%s: frame %u failed to decode: %d %d\n", name, i, samples, reference_samples);
+            mismatches++;
+            break;
+        }
+        for (int n = 0; n < samples * CHANNELS; n++) {
+            energy_in += (int32_t) reference_pcm[n] * reference_pcm[n];
+        }
+        celt_output_stage_apply(&stage, reference_pcm, samples, CHANNELS);
+        if (memcmp(fused_pcm, reference_pcm, sizeof(opus_int16) * samples * CHANNELS) != 0) {
+            mismatches++;
+        }
+        for (int n = 0; n < samples * CHANNELS; n++) {
+            energy_out += (int32_t) fused_pcm[n] * fused_pcm[n];
+        }
+    }
+    if (c->gain_q8_db < 0 && energy_out >= energy_in && energy_in > 0) {
+        fprintf(stderr, "%s: gain %d did not attenuate\n", name, c->gain_q8_db);
+        mismatches++;
+    }
+    opus_decoder_destroy(fused);
+    opus_decoder_destroy(reference);
+    return mismatches;
+}
+
+/* unity gain without routing has to be the stock decoder, even with dither on */
+static int run_identity(const char* name, const opus_corpus_t* corpus) {
+    OpusDecoder* configured = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    OpusDecoder* plain = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    opus_decoder_ctl(configured, OPUS_SET_OUTPUT_DITHER(1));
+
+    int mismatches = 0;
+    const uint8_t* cursor = corpus->packets;
+    for (uint32_t i = 0; i < corpus->packet_count; i++) {
+        opus_corpus_packet_t packet;
+        opus_corpus_next(&cursor, &packet);
+        int samples = decode(configured, corpus, &packet, fused_pcm);
+        decode(plain, corpus, &packet, plain_pcm);
+        if (samples > 0 && memcmp(fused_pcm, plain_pcm, sizeof(opus_int16) * samples * CHANNELS) != 0) {
+            fprintf(stderr, "%s: frame %u differs from the stock decoder at unity gain\n", name, i);
+            mismatches++;
+        }
+    }
+    opus_decoder_destroy(configured);
+    opus_decoder_destroy(plain);
+    return mismatches;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus.opc>...\n", argv[0]);
+        return 2;
+    }
+
+    OpusDecoder* decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    opus_int32 value;
+    if (opus_decoder_ctl(decoder, OPUS_SET_OUTPUT_ROUTING(OPUS_OUTPUT_RIGHT + 1)) != OPUS_BAD_ARG
+        || opus_decoder_ctl(decoder, OPUS_SET_OUTPUT_DITHER(2)) != OPUS_BAD_ARG
+        || opus_decoder_ctl(decoder, OPUS_SET_OUTPUT_ROUTING(OPUS_OUTPUT_MONO)) != OPUS_OK
+        || opus_decoder_ctl(decoder, OPUS_RESET_STATE) != OPUS_OK
+        || opus_decoder_ctl(decoder, OPUS_GET_OUTPUT_ROUTING(&value)) != OPUS_OK || value != OPUS_OUTPUT_MONO) {
+        fprintf(stderr, "output stage CTLs misbehave\n");
+        return 1;
+    }
+    opus_decoder_destroy(decoder);
+
+    int failed = 0;
+    for (int f = 1; f < argc; f++) {
+        size_t len;
+        uint8_t* data = read_file(argv[f], &len);
+        opus_corpus_t corpus;
+        if (data == NULL || opus_corpus_open(&corpus, data, len) != 0) {
+            fprintf(stderr, "%s: not a readable corpus file\n", argv[f]);
+            return 1;
+        }
+        const char* name = strrchr(argv[f], '/') ? strrchr(argv[f], '/') + 1 : argv[f];
+        int mismatches = run_identity(name, &corpus);
+        for (size_t c = 0; c < sizeof(output_stage_cases) / sizeof(output_stage_cases[0]); c++) {
+            mismatches += run_case(name, &corpus, &output_stage_cases[c]);
+        }
+        printf("%-32s %s\n", name, mismatches == 0 ? "ok" : "MISMATCH");
+        failed |= mismatches != 0;
+        free(data);
+    }
+    return failed;
+}
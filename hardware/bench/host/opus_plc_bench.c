@@ -0,0 +1,193 @@
+/*
+ * Cost of the three concealment policies (OPUS_SET_PLC_POLICY). Decodes every corpus file with
+ * a burst of --burst lost frames after every --interval received ones and times the concealed
+ * frames separately from the decoded ones. Prints, per file and policy, ns per concealed frame
+ * (best of five runs), the slowest concealed frame and ns per decoded frame for comparison.
+ *
+ * Also checks every policy: no frame may fail to decode, the concealment must not be louder
+ * than the audio it conceals (its peak at most twice the peak of the last PEAK_WINDOW_SAMPLES
+ * decoded samples, which covers everything the repeat policy copies from),
+ * and OPUS_PLC_FULL must give exactly the output of a decoder that was never configured. With
+ * --check-only nothing is timed; that is what ctest runs.
+ *
+ * usage: opus_plc_bench [--check-only] [--burst N] [--interval N] <corpus.opc>...
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <opus.h>
+#include "../opus_corpus.h"
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define MAX_FRAME_SIZE (SAMPLE_RATE / 1000 * 120)
+#define POLICY_COUNT 3
+#define PEAK_WINDOW_SAMPLES 1200
+#define PEAK_WINDOW_FRAMES 16
+
+static const char* const policy_names[POLICY_COUNT] = { "full", "noise", "repeat" };
+
+typedef struct {
+    uint64_t concealed_ns;
+    uint64_t concealed_worst_ns;
+    uint32_t concealed_frames;
+    uint64_t decoded_ns;
+    uint32_t decoded_frames;
+    uint32_t pcm_hash;
+    int failures;
+} plc_run_t;
+
+static opus_int16 pcm[MAX_FRAME_SIZE * CHANNELS];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint8_t* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = malloc(*len);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static int peak_of(const opus_int16* samples, int count) {
+    int peak = 0;
+    for (int i = 0; i < count; i++) {
+        int s = abs(samples[i]);
+        peak = s > peak ? s : peak;
+    }
+    return peak;
+}
+
+/* policy -1 leaves the decoder as created */
+static void run_file(const opus_corpus_t* corpus, int policy, int burst, int interval, plc_run_t* run) {
+    memset(run, 0, sizeof(*run));
+    run->pcm_hash = 2166136261u;
+    OpusDecoder* decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, NULL);
+    if (policy >= 0 && opus_decoder_ctl(decoder, OPUS_SET_PLC_POLICY(policy)) != OPUS_OK) {
+        run->failures++;
+    }
+
+    const uint8_t* cursor = corpus->packets;
+    int received = 0;
+    int recent_peaks[PEAK_WINDOW_FRAMES] = { 0 };
+    int peak_frames = (PEAK_WINDOW_SAMPLES + corpus->frame_size - 1) / corpus->frame_size;
+    peak_frames = peak_frames > PEAK_WINDOW_FRAMES ? PEAK_WINDOW_FRAMES : peak_frames;
+    for (uint32_t i = 0; i < corpus->packet_count; i++) {
+        opus_corpus_packet_t packet;
+        opus_corpus_next(&cursor, &packet);
+        int lost = packet.len == 0 || (received >= interval && received % interval < burst);
+        int samples;
+        uint64_t started_at = now_ns();
+        if (lost) {
+            samples = opus_decode(decoder, NULL, 0, pcm, corpus->frame_size, 0);
+        } else {
+            samples = opus_decode(decoder, packet.data, packet.len, pcm, MAX_FRAME_SIZE, 0);
+        }
+        uint64_t elapsed = now_ns() - started_at;
+        if (packet.len > 0) {
+            received++;
+        }
+        if (samples < 0) {
+            run->failures++;
+            continue;
+        }
+
+        int peak = peak_of(pcm, samples * CHANNELS);
+        if (lost) {
+            run->concealed_ns += elapsed;
+            run->concealed_frames++;
+            run->concealed_worst_ns = elapsed > run->concealed_worst_ns ? elapsed : run->concealed_worst_ns;
+            /* the concealment may never get louder than what it continues */
+            int recent_peak = 0;
+            for (int n = 0; n < peak_frames; n++) {
+                recent_peak = recent_peaks[n] > recent_peak ? recent_peaks[n] : recent_peak;
+            }
+            if (peak > 2 * recent_peak + 64) {
+                run->failures++;
+            }
+        } else {
+            run->decoded_ns += elapsed;
+            run->decoded_frames++;
+            recent_peaks[run->decoded_frames % peak_frames] = peak;
+        }
+        for (int n = 0; n < samples * CHANNELS; n++) {
+            run->pcm_hash = (run->pcm_hash ^ (uint16_t) pcm[n]) * 16777619u;
+        }
+    }
+    opus_decoder_destroy(decoder);
+}
+
+int main(int argc, char** argv) {
+    int check_only = 0;
+    int burst = 3;
+    int interval = 20;
+    int first_file = 1;
+    for (; first_file < argc && strncmp(argv[first_file], "--", 2) == 0; first_file++) {
+        if (strcmp(argv[first_file], "--check-only") == 0) {
+            check_only = 1;
+        } else if (strcmp(argv[first_file], "--burst") == 0 && first_file + 1 < argc) {
+            burst = atoi(argv[++first_file]);
+        } else if (strcmp(argv[first_file], "--interval") == 0 && first_file + 1 < argc) {
+            interval = atoi(argv[++first_file]);
+        } else {
+            break;
+        }
+    }
+    if (first_file >= argc || burst < 1 || interval <= burst) {
+        fprintf(stderr, "usage: %s [--check-only] [--burst N] [--interval N] <corpus.opc>...\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    for (int f = first_file; f < argc; f++) {
+        size_t len;
+        uint8_t* data = read_file(argv[f], &len);
+        opus_corpus_t corpus;
+        if (data == NULL || opus_corpus_open(&corpus, data, len) != 0) {
+            fprintf(stderr, "%s: not a readable corpus file\n", argv[f]);
+            return 1;
+        }
+        const char* name = strrchr(argv[f], '/') ? strrchr(argv[f], '/') + 1 : argv[f];
+
+        plc_run_t unconfigured;
+        run_file(&corpus, -1, burst, interval, &unconfigured);
+        for (int policy = 0; policy < POLICY_COUNT; policy++) {
+            plc_run_t run, best;
+            run_file(&corpus, policy, burst, interval, &best);
+            for (int repeat = 1; !check_only && repeat < 5; repeat++) {
+                run_file(&corpus, policy, burst, interval, &run);
+                best.concealed_ns = run.concealed_ns < best.concealed_ns ? run.concealed_ns : best.concealed_ns;
+                best.decoded_ns = run.decoded_ns < best.decoded_ns ? run.decoded_ns : best.decoded_ns;
+                best.concealed_worst_ns = run.concealed_worst_ns > best.concealed_worst_ns ? run.concealed_worst_ns : best.concealed_worst_ns;
+            }
+            int ok = best.failures == 0 && (policy != OPUS_PLC_FULL || best.pcm_hash == unconfigured.pcm_hash);
+            failed |= !ok;
+            if (check_only || best.concealed_frames == 0) {
+                printf("%-32s %-6s %s\n", name, policy_names[policy], ok ? "ok" : "FAILED");
+                continue;
+            }
+            printf("%-32s %-6s %s %8.0f ns/concealed frame (worst %6.0f us) %8.0f ns/decoded frame\n",
+                name, policy_names[policy], ok ? "ok" : "FAILED",
+                (double) best.concealed_ns / best.concealed_frames, best.concealed_worst_ns / 1000.0,
+                (double) best.decoded_ns / best.decoded_frames);
+        }
+        free(data);
+    }
+    return failed;
+}
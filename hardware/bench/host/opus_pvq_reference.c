@@ -0,0 +1,21 @@
+/*
+ * The SMALL_FOOTPRINT build of celt/cwrs.c, which computes the PVQ codebook sizes U(N,K) on
+ * the fly instead of reading them from a table, under other names. opus_pvq_test checks the
+ * firmware's table driven decode_pulses() against it.
+ */
+#define SMALL_FOOTPRINT
+#include "config.h"
+#include "celt/entdec.h"
+
+#define log2_frac opus_pvq_reference_log2_frac
+#define get_required_bits opus_pvq_reference_get_required_bits
+#define encode_pulses opus_pvq_reference_encode_pulses
+#define decode_pulses opus_pvq_reference_decode_pulses
+#include "celt/cwrs.c"
+
+/* cwrs.c's decode_pulses() without the entropy decoder and the scratch arena */
+opus_val32 opus_pvq_reference_cwrsi(int n, int k, opus_uint32 index, int* y, opus_uint32* v) {
+    opus_uint32 u[128 + 2];
+    *v = ncwrs_urow(n, k, u);
+    return cwrsi(n, k, index, y, u);
+}
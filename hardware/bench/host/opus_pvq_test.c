@@ -0,0 +1,153 @@
+/*
+ * Bit-exactness test of the firmware's PVQ decoding (decode_pulses() in celt/cwrs.c) against
+ * the SMALL_FOOTPRINT implementation in opus_pvq_reference.c, which computes the codebook
+ * sizes on the fly. Covers every band size N and
+ * pulse count K the static-mode table supports. For each (N,K) it decodes every codeword index
+ * if there are at most --exhaustive-limit of them, otherwise that many indices spread over the
+ * codebook plus both ends. Fails on the first pulse vector or energy that differs.
+ *
+ * usage: opus_pvq_test [--exhaustive-limit N] [--timing]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "celt/cwrs.h"
+#include "celt/entenc.h"
+#include "celt/entdec.h"
+
+#define PVQ_MAX_N 176
+#define PVQ_MAX_K 128
+
+opus_val32 opus_pvq_reference_cwrsi(int n, int k, opus_uint32 index, int* y, opus_uint32* v);
+
+/* the last column of rows 0..14 of CELT_PVQ_U_DATA in cwrs.c, without CUSTOM_MODES */
+static const int pvq_row_end[15] = { 176, 176, 176, 176, 176, 176, 96, 54, 37, 28, 24, 19, 18, 16, 14 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* V(N,K), the number of codewords, or 0 if it doesn't fit in 32 bits */
+static uint32_t pvq_codebook_size(int n, int k) {
+    static uint64_t u[PVQ_MAX_K + 2];
+    /* U(1,k) = 1 for k > 0, then U(n,k) = U(n-1,k) + U(n,k-1) + U(n-1,k-1) row by row */
+    u[0] = 0;
+    for (int j = 1; j <= k + 1; j++) {
+        u[j] = 1;
+    }
+    for (int i = 2; i <= n; i++) {
+        uint64_t diagonal = u[0];
+        for (int j = 1; j <= k + 1; j++) {
+            uint64_t above = u[j];
+            u[j] = above + u[j - 1] + diagonal;
+            diagonal = above;
+            if (u[j] > UINT32_MAX) {
+                u[j] = UINT32_MAX + 1ull;
+            }
+        }
+    }
+    uint64_t v = u[k] + u[k + 1];
+    return v > UINT32_MAX ? 0 : (uint32_t) v;
+}
+
+/* whether cwrs.c's table holds U(min(N,K+1), max(N,K+1)), i.e. CELT can code K pulses in N */
+static int pvq_supported(int n, int k) {
+    int row = n < k + 1 ? n : k + 1;
+    int column = n < k + 1 ? k + 1 : n;
+    return row < 15 && column <= pvq_row_end[row] && pvq_codebook_size(n, k) != 0;
+}
+
+typedef struct {
+    uint64_t decodes;
+    uint64_t fast_ns;
+    uint64_t reference_ns;
+} pvq_stats_t;
+
+static int pvq_check_index(int n, int k, uint32_t index, uint32_t v, pvq_stats_t* stats, int timing) {
+    unsigned char buf[8];
+    ec_enc enc;
+    ec_enc_init(&enc, buf, sizeof(buf));
+    ec_enc_uint(&enc, index, v);
+    ec_enc_done(&enc);
+
+    int fast[PVQ_MAX_N], reference[PVQ_MAX_N];
+    ec_dec dec;
+    ec_dec_init(&dec, buf, sizeof(buf));
+    uint64_t started_at = timing ? now_ns() : 0;
+    opus_val32 fast_yy = decode_pulses(fast, n, k, &dec);
+    uint64_t fast_done_at = timing ? now_ns() : 0;
+    opus_uint32 reference_v;
+    opus_val32 reference_yy = opus_pvq_reference_cwrsi(n, k, index, reference, &reference_v);
+    if (timing) {
+        stats->fast_ns += fast_done_at - started_at;
+        stats->reference_ns += now_ns() - fast_done_at;
+    }
+    stats->decodes++;
+
+    if (reference_v != v) {
+        printf("FAIL: N=%d K=%d has %u codewords, the reference says %u\n", n, k, v, reference_v);
+        return 1;
+    }
+    if (fast_yy != reference_yy || memcmp(fast, reference, n * sizeof(int)) != 0) {
+        printf("FAIL: N=%d K=%d index %u decodes differently\n", n, k, index);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    uint32_t exhaustive_limit = 4096;
+    int timing = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--exhaustive-limit") == 0 && i + 1 < argc) {
+            exhaustive_limit = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            timing = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--exhaustive-limit N] [--timing]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    pvq_stats_t stats = {0};
+    int pairs = 0, exhaustive_pairs = 0;
+    for (int n = 2; n <= PVQ_MAX_N; n++) {
+        for (int k = 1; k <= PVQ_MAX_K && pvq_supported(n, k); k++) {
+            uint32_t v = pvq_codebook_size(n, k);
+            pairs++;
+            if (v <= exhaustive_limit) {
+                exhaustive_pairs++;
+                for (uint32_t index = 0; index < v; index++) {
+                    if (pvq_check_index(n, k, index, v, &stats, timing)) {
+                        return 1;
+                    }
+                }
+            } else {
+                uint64_t step = v / exhaustive_limit;
+                for (uint32_t s = 0; s < exhaustive_limit; s++) {
+                    /* spread over the codebook, off the grid so that all digits vary */
+                    uint32_t index = (uint32_t) (s * step + (s * 2654435761u) % step);
+                    if (pvq_check_index(n, k, index, v, &stats, timing)) {
+                        return 1;
+                    }
+                }
+                if (pvq_check_index(n, k, v - 1, v, &stats, timing)) {
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("%d (N,K) pairs, %d of them exhaustively, %llu decodes: all bit-exact\n",
+           pairs, exhaustive_pairs, (unsigned long long) stats.decodes);
+    if (timing) {
+        printf("decode_pulses %.1f ns (including ec_dec_uint), reference cwrsi %.1f ns per decode\n",
+               (double) stats.fast_ns / stats.decodes, (double) stats.reference_ns / stats.decodes);
+    }
+    return 0;
+}
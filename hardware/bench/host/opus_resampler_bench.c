@@ -0,0 +1,130 @@
+/*
+ * Micro benchmark of the SILK decoder's upsampling to 48kHz (silk/resampler.c): the 8, 12 and
+ * 16kHz internal rates all go through silk_resampler_private_IIR_FIR, which runs
+ * silk_resampler_private_up2_HQ and then interpolates. Every rate is fed noise at several
+ * levels, a full scale square wave (which saturates the output), a sweep and silence, in calls
+ * of 1 to 20ms, and the output is hashed. Prints the hash and ns per 10ms of input per rate.
+ * Built twice, with the unrolled kernels and with the original loops
+ * (OPUS_DISABLE_FAST_RESAMPLER), so both can be compared for speed and bit-exactness.
+ * test/opus_resampler_xtensa.cpp checks the same hashes on the device.
+ *
+ * usage: opus_resampler_bench [--checksum-only] [--iterations N]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "silk/SigProc_FIX.h"
+#include "celt/stack_alloc.h"
+
+#define OUT_RATE 48000
+#define SIGNAL_MS 2000
+#define MAX_CALL_MS 20
+
+static const opus_int32 in_rates[] = { 8000, 12000, 16000 };
+/* call lengths in ms, cycled through; the decoder itself uses 10 and 20 */
+static const int call_ms[] = { 10, 20, 1, 7, 10, 5, 20, 3 };
+
+static opus_int16 signal_in[SIGNAL_MS * 16];
+static opus_int16 signal_out[MAX_CALL_MS * OUT_RATE / 1000];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t rng_state = 1;
+
+static int32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (int32_t) rng_state;
+}
+
+/* a quarter each of noise at rising levels, a full scale square wave, a sweep and silence */
+static void make_signal(int in_khz) {
+    int len = SIGNAL_MS * in_khz;
+    rng_state = 0x9E3779B9u ^ (uint32_t) in_khz;
+    uint32_t phase = 0;
+    for (int k = 0; k < len; k++) {
+        int part = k * 4 / len;
+        if (part == 0) {
+            signal_in[k] = (opus_int16) (rng_next() >> (31 - 4 - k * 44 / len));
+        } else if (part == 1) {
+            signal_in[k] = (k / (in_khz / 2 + 1)) & 1 ? 32767 : -32768;
+        } else if (part == 2) {
+            /* triangle wave sweeping from 50Hz up to the input's Nyquist frequency */
+            phase += 50u * 65536u / (in_khz * 1000u) + (uint32_t) (k - len / 2) * 32768u / (len / 4);
+            int32_t tri = (int32_t) (phase & 0xFFFF) - 32768;
+            tri = (tri < 0 ? -tri : tri) * 2 - 32768;
+            signal_in[k] = (opus_int16) (tri > 32767 ? 32767 : tri);
+        } else {
+            signal_in[k] = 0;
+        }
+    }
+}
+
+/* resamples the whole signal once, hashing the output into *hash unless that is NULL */
+static void run_rate(opus_int32 in_rate, uint32_t* hash) {
+    /* the resampler takes its buffer from the scratch arena, which opus_decode sets up otherwise */
+    ALLOC_STACK;
+    int in_khz = in_rate / 1000;
+    silk_resampler_state_struct state;
+    silk_resampler_init(&state, in_rate, OUT_RATE, 0);
+    int position = 0;
+    for (int call = 0; position < SIGNAL_MS; call++) {
+        int ms = call_ms[call % (sizeof(call_ms) / sizeof(call_ms[0]))];
+        ms = ms > SIGNAL_MS - position ? SIGNAL_MS - position : ms;
+        silk_resampler(&state, signal_out, &signal_in[position * in_khz], ms * in_khz);
+        for (int k = 0; hash != NULL && k < ms * OUT_RATE / 1000; k++) {
+            *hash = (*hash ^ (uint16_t) signal_out[k]) * 16777619u;
+        }
+        position += ms;
+    }
+    RESTORE_STACK;
+}
+
+int main(int argc, char** argv) {
+    int checksum_only = 0;
+    int iterations = 20;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--checksum-only") == 0) {
+            checksum_only = 1;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--checksum-only] [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (size_t r = 0; r < sizeof(in_rates) / sizeof(in_rates[0]); r++) {
+        make_signal(in_rates[r] / 1000);
+        uint32_t hash = 2166136261u;
+        run_rate(in_rates[r], &hash);
+        if (checksum_only) {
+            printf("%2dkHz checksum %08x\n", in_rates[r] / 1000, hash);
+            continue;
+        }
+
+        uint64_t best = UINT64_MAX;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            uint64_t start = now_ns();
+            for (int n = 0; n < iterations; n++) {
+                run_rate(in_rates[r], NULL);
+            }
+            uint64_t elapsed = now_ns() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+        printf("%2dkHz checksum %08x %8.0f ns/10ms\n", in_rates[r] / 1000, hash,
+               (double) best / iterations / (SIGNAL_MS / 10));
+    }
+    return 0;
+}
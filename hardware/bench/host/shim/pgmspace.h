@@ -0,0 +1,5 @@
+/* libopus keeps some tables in flash on the ESP32 via <pgmspace.h>; on the host that is a no-op */
+#ifndef PGMSPACE_H
+#define PGMSPACE_H
+#define PROGMEM
+#endif
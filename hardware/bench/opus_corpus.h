@@ -0,0 +1,105 @@
+/**
+ * Reader for the packet corpus files in bench/corpus (*.opc), shared by the host benchmark
+ * and the on-device benchmark firmware. Header only, plain C, no allocations: a corpus is
+ * walked in place, wherever it lives (a file read into memory, or flash).
+ *
+ * File layout, all integers little endian:
+ *
+ *     char[4]  magic "OPC1"
+ *     uint8    mode the packets were encoded in, OPUS_CORPUS_MODE_*
+ *     uint8    channels the encoder was fed (1 or 2)
+ *     uint16   frame duration in samples at 48kHz (120 = 2.5ms ... 2880 = 60ms)
+ *     uint32   target bitrate in bits per second
+ *     uint32   number of packets
+ *     then for each packet:
+ *         uint16   length in bytes, 0 marks a lost packet (to be concealed)
+ *         uint32   final range of the encoder, a decoder that decoded the packet correctly has the same
+ *         uint8[length]
+ */
+#ifndef OPUS_CORPUS_H
+#define OPUS_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OPUS_CORPUS_MODE_SILK   0
+#define OPUS_CORPUS_MODE_HYBRID 1
+#define OPUS_CORPUS_MODE_CELT   2
+#define OPUS_CORPUS_MODE_COUNT  3
+
+#define OPUS_CORPUS_HEADER_SIZE        16
+#define OPUS_CORPUS_PACKET_HEADER_SIZE 6
+
+typedef struct {
+    uint8_t mode;
+    uint8_t channels;
+    uint16_t frame_size;
+    uint32_t bitrate;
+    uint32_t packet_count;
+    const uint8_t* packets;
+    const uint8_t* end;
+} opus_corpus_t;
+
+typedef struct {
+    const uint8_t* data;
+    uint16_t len;
+    uint32_t final_range;
+} opus_corpus_packet_t;
+
+static inline uint16_t opus_corpus_read_u16(const uint8_t* p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t opus_corpus_read_u32(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline const char* opus_corpus_mode_name(uint8_t mode) {
+    switch (mode) {
+        case OPUS_CORPUS_MODE_SILK: return "silk";
+        case OPUS_CORPUS_MODE_HYBRID: return "hybrid";
+        case OPUS_CORPUS_MODE_CELT: return "celt";
+        default: return "unknown";
+    }
+}
+
+/** returns 0 on success, -1 if the data is not a well-formed corpus */
+static inline int opus_corpus_open(opus_corpus_t* corpus, const uint8_t* data, size_t len) {
+    if (len < OPUS_CORPUS_HEADER_SIZE || memcmp(data, "OPC1", 4) != 0) {
+        return -1;
+    }
+    corpus->mode = data[4];
+    corpus->channels = data[5];
+    corpus->frame_size = opus_corpus_read_u16(data + 6);
+    corpus->bitrate = opus_corpus_read_u32(data + 8);
+    corpus->packet_count = opus_corpus_read_u32(data + 12);
+    corpus->packets = data + OPUS_CORPUS_HEADER_SIZE;
+    corpus->end = data + len;
+    if (corpus->mode >= OPUS_CORPUS_MODE_COUNT || corpus->channels < 1 || corpus->channels > 2) {
+        return -1;
+    }
+
+    const uint8_t* p = corpus->packets;
+    for (uint32_t i = 0; i < corpus->packet_count; i++) {
+        if (p + OPUS_CORPUS_PACKET_HEADER_SIZE > corpus->end) {
+            return -1;
+        }
+        p += OPUS_CORPUS_PACKET_HEADER_SIZE + opus_corpus_read_u16(p);
+    }
+    return p == corpus->end ? 0 : -1;
+}
+
+/**
+ * reads the packet at *cursor (start with corpus->packets) and advances the cursor.
+ * Only valid for packet_count packets; opus_corpus_open has checked the bounds.
+ */
+static inline void opus_corpus_next(const uint8_t** cursor, opus_corpus_packet_t* packet) {
+    const uint8_t* p = *cursor;
+    packet->len = opus_corpus_read_u16(p);
+    packet->final_range = opus_corpus_read_u32(p + 2);
+    packet->data = p + OPUS_CORPUS_PACKET_HEADER_SIZE;
+    *cursor = packet->data + packet->len;
+}
+
+#endif /* OPUS_CORPUS_H */
@@ -0,0 +1,58 @@
+/*
+ * The known-receivers bloom filter of DiscoveryQuery (see protocol/ip.proto) and the random
+ * response delay. Plain C, so that bench/host/discovery_sim.c runs exactly what the firmware does.
+ */
+#ifndef DISCOVERY_FILTER_H
+#define DISCOVERY_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// receivers ignore filters with more hashes than this, which only cost time to test
+#define DISCOVERY_FILTER_MAX_HASH_COUNT 16
+
+/** h1 and h2 of DiscoveryQuery.known_receivers: the halves of FNV-1a 64 over seed and mac_address, little-endian */
+static inline void discovery_filter_hash(uint32_t seed, uint64_t mac_address, uint32_t* h1, uint32_t* h2) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int n = 0; n < 4; n++) {
+        hash = (hash ^ ((seed >> (n * 8)) & 0xFF)) * 1099511628211ull;
+    }
+    for (int n = 0; n < 8; n++) {
+        hash = (hash ^ ((mac_address >> (n * 8)) & 0xFF)) * 1099511628211ull;
+    }
+    *h1 = (uint32_t) hash;
+    *h2 = (uint32_t) (hash >> 32) | 1;
+}
+
+static inline void discovery_filter_add(uint8_t* filter, size_t size, uint32_t hash_count, uint32_t seed, uint64_t mac_address) {
+    uint32_t h1, h2;
+    discovery_filter_hash(seed, mac_address, &h1, &h2);
+    for (uint32_t i = 0; i < hash_count; i++) {
+        uint32_t bit = (uint32_t) ((h1 + (uint64_t) i * h2) % (8 * size));
+        filter[bit / 8] |= (uint8_t) (1 << (bit % 8));
+    }
+}
+
+/** whether the filter (maybe falsely) contains mac_address; an empty filter contains nothing */
+static inline bool discovery_filter_contains(const uint8_t* filter, size_t size, uint32_t hash_count, uint32_t seed, uint64_t mac_address) {
+    if (size == 0 || hash_count == 0 || hash_count > DISCOVERY_FILTER_MAX_HASH_COUNT) {
+        return false;
+    }
+    uint32_t h1, h2;
+    discovery_filter_hash(seed, mac_address, &h1, &h2);
+    for (uint32_t i = 0; i < hash_count; i++) {
+        uint32_t bit = (uint32_t) ((h1 + (uint64_t) i * h2) % (8 * size));
+        if ((filter[bit / 8] & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** a delay evenly distributed over [0, window_ms) from a random 32 bit value */
+static inline uint32_t discovery_response_delay_ms(uint32_t window_ms, uint32_t random) {
+    return (uint32_t) (((uint64_t) random * window_ms) >> 32);
+}
+
+#endif
@@ -1,12 +1,30 @@
 #include <lwip/ip4_addr.h>
 
 #define NETWORK_EVENT_GROUP_BIT_CONNECTED          0b0001
-#define NETWORK_EVENT_GROUP_BIT_RECONNECT_COOLDOWN 0b0010
 #define NETWORK_EVENT_GROUP_BIT_ACTIVE_STREAM      0b0100
+// set when the receiver gets an IP address, cleared by the discovery task once it starts announcing the receiver
+#define NETWORK_EVENT_GROUP_BIT_ANNOUNCE           0b1000
+// set at power-on and when the AP is lost, cleared by the net-rx task once audio arrives again
+#define NETWORK_EVENT_GROUP_BIT_AWAIT_FIRST_PACKET 0b10000
 
 #define NETWORK_MAX_CONNECT_RETRY_ATTEMPTS             10
 #define NETWORK_RECONNECT_COOLDOWN_MILLIS              1000
 
+// the net-link task averages the RSSI of the AP it polls this often, and looks for a better AP below the threshold
+#define NETWORK_RSSI_POLL_MILLIS                       1000
+#define NETWORK_ROAM_RSSI_THRESHOLD_DBM                -70
+// another AP has to be this much stronger to be worth a roam
+#define NETWORK_ROAM_MIN_GAIN_DB                       8
+// at least this long between two roam scans, which cost airtime and some latency
+#define NETWORK_ROAM_SCAN_INTERVAL_MILLIS              30000
+// the jitter buffer target from the roam scan until the roam settled. It only applies when playback restarts
+// after an underflow: a gap during the roam then resumes with a cushion instead of stuttering.
+#define NETWORK_ROAM_JITTER_BUFFER_TARGET_MS           300
+// a roam that hasn't reassociated after this long failed, the link goes back to the last AP
+#define NETWORK_ROAM_MAX_MILLIS                        3000
+// underflows up to this long after a roam are counted as the roam's
+#define NETWORK_ROAM_SETTLE_MILLIS                     2000
+
 #define NETWORK_PORT_DISCOVERY  58765
 #define NETWORK_PORT_AUDIO_RX   58764
 
@@ -21,4 +39,70 @@ typedef enum {
 
 network_state_t network_get_state();
 
+// the WiFi link as the net-link task drives it. All of the WiFi driver's events go through it, so the
+// default event loop never waits for a scan or a connect.
+typedef enum {
+    NETWORK_LINK_STOPPED = 0,
+    // to the AP of the last connection, without a scan
+    NETWORK_LINK_CONNECTING_DIRECTLY,
+    NETWORK_LINK_SCANNING,
+    // to the strongest AP of the scan
+    NETWORK_LINK_CONNECTING,
+    NETWORK_LINK_CONNECTED,
+    NETWORK_LINK_COOLDOWN,
+    // still connected: the signal got weak, a scan for a better AP of the same SSID runs
+    NETWORK_LINK_ROAM_SCANNING,
+    // reassociating with the better AP
+    NETWORK_LINK_ROAMING
+} network_link_state_t;
+
+typedef enum {
+    NETWORK_LINK_EVENT_STARTED = 0,
+    NETWORK_LINK_EVENT_SCAN_DONE,
+    NETWORK_LINK_EVENT_ASSOCIATED,
+    NETWORK_LINK_EVENT_GOT_IP,
+    NETWORK_LINK_EVENT_DISCONNECTED,
+    NETWORK_LINK_EVENT_COOLDOWN_OVER,
+    // the averaged RSSI of the AP fell below NETWORK_ROAM_RSSI_THRESHOLD_DBM
+    NETWORK_LINK_EVENT_SIGNAL_WEAK,
+    // NETWORK_ROAM_MAX_MILLIS passed in NETWORK_LINK_ROAMING
+    NETWORK_LINK_EVENT_ROAM_TIMEOUT
+} network_link_event_t;
+
+typedef enum {
+    NETWORK_LINK_ACTION_NONE = 0,
+    NETWORK_LINK_ACTION_CONNECT_DIRECTLY,
+    NETWORK_LINK_ACTION_SCAN,
+    NETWORK_LINK_ACTION_CONNECT,
+    NETWORK_LINK_ACTION_RETRY,
+    NETWORK_LINK_ACTION_COOLDOWN,
+    // raise the jitter buffer target and scan in the background
+    NETWORK_LINK_ACTION_ROAM_SCAN,
+    // reassociate with the AP the scan found, without leaving the SSID
+    NETWORK_LINK_ACTION_ROAM,
+    NETWORK_LINK_ACTION_ROAM_DONE,
+    // no better AP: stay, and lower the jitter buffer target again
+    NETWORK_LINK_ACTION_ROAM_ABANDON
+} network_link_action_t;
+
+typedef struct {
+    network_link_state_t state;
+    // failed connects to the AP of the last scan; while roaming, disconnects since leaving the old AP
+    uint32_t connect_attempts;
+} network_link_t;
+
+/**
+ * advances the link by one event and returns what the caller has to do for it. has_cached_ap: whether
+ * the AP of the last connection is known for the configured SSID; scan_found_ap: whether the scan that
+ * just finished found the SSID, or for a roam scan, an AP that is enough better than the current one.
+ * No side effects, the net-link task carries out the action.
+ */
+network_link_action_t network_link_handle(network_link_t* link, network_link_event_t event, bool has_cached_ap, bool scan_found_ap);
+
+/**
+ * whether an AP the roam scan found with candidate_rssi is worth leaving the current AP for, whose RSSI
+ * the net-link task averaged to rssi_avg (0 if it has no average yet)
+ */
+bool network_roam_is_worth_it(int32_t rssi_avg, int8_t candidate_rssi);
+
 ip4_addr_t network_get_broadcast_address(ip4_addr_t* sample_ip_in_network, ip4_addr_t* netmask);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <opus.h>
 
 void playback_mute();
 void playback_unmute();
@@ -11,7 +12,91 @@ void playback_initialize();
 /** returns the maximum number of bytes of decoded opus frames. */
 size_t playback_get_maximum_frame_size_bytes();
 
-/** copies the buffer into the queue for playback. waits indefinitely if the queue is full. */
-esp_err_t playback_queue_audio(void* encoded_opus_frame, size_t len);
+/**
+ * whether the decoder build can decode opus frames of this duration. CELT only codes 2.5 to 20ms
+ * frames, so firmware built with OPUS_DECODER_CELT_ONLY can't decode 40 and 60ms ones.
+ */
+bool playback_can_decode_frame_duration(uint32_t frame_duration_us);
 
-void playback_start_new_stream();
\ No newline at end of file
+/** the audio buffered after the decoder, in the I2S DMA buffers; the least latency playback can have */
+uint32_t playback_get_output_latency_ms();
+
+/**
+ * how much audio of frame_duration_us long frames the jitter buffer holds at least: as many frames
+ * as both the frame queue and the frame ring take when every frame has the highest bitrate opus codes.
+ */
+uint32_t playback_get_jitter_buffer_capacity_ms(uint32_t frame_duration_us);
+
+#define PLAYBACK_BITRATE_CLASS_COUNT 4
+
+typedef struct {
+    // the class holds the bitrates above the next lower class' max_bitrate_bps up to this one
+    uint32_t max_bitrate_bps;
+    // share of the frame duration decoding leaves unused, exponentially averaged over decoded frames
+    uint32_t headroom_permille;
+    uint32_t frames_measured;
+} playback_decode_headroom_t;
+
+/**
+ * copies the decode headroom of every bitrate class that frames have been decoded in since startup
+ * to headroom, from the lowest bitrates up. Returns the number of classes copied.
+ */
+size_t playback_get_decode_headroom(playback_decode_headroom_t headroom[PLAYBACK_BITRATE_CLASS_COUNT]);
+
+/**
+ * whether the decoder build can handle this frame. Firmware built with OPUS_DECODER_CELT_ONLY
+ * has no SILK decoder and rejects SILK and hybrid frames; drop them before queueing.
+ */
+bool playback_can_decode(const void* encoded_opus_frame, size_t len);
+
+/**
+ * reserves room for an encoded frame of len bytes in the playback module's frame ring, so that it
+ * can be received right where the decoder will read it. Waits while the ring is full. Every
+ * reserved frame has to be queued or discarded before the next one is reserved.
+ */
+void* playback_reserve_frame(size_t len);
+
+/** queues a frame from playback_reserve_frame for playback. waits indefinitely if the queue is full. */
+void playback_queue_reserved_frame(void* frame);
+
+/** gives a frame from playback_reserve_frame back to the ring without playing it. */
+void playback_discard_reserved_frame(void* frame);
+
+void playback_start_new_stream();
+
+/**
+ * sets how much audio has to be queued before playback starts, or restarts after an underflow.
+ * 0, the default, starts with the first frame. Raised around a WiFi roam, so that playback resumes
+ * with a cushion after the gap instead of stuttering through it. It doesn't grow the queue while
+ * playback runs, and never waits for more than the queue holds.
+ */
+void playback_set_jitter_buffer_target_ms(uint32_t target_ms);
+
+/** how often playback ran out of audio since startup */
+uint32_t playback_get_underflow_count();
+
+/**
+ * queues the loss of one frame, which is concealed as long as the last frame. How the decoder
+ * conceals depends on its load: the full pitch-based PLC while there is headroom, cheaper noise
+ * or repeat-and-fade concealment when decoding takes more than half or three quarters of the
+ * frame duration on average.
+ */
+void playback_queue_lost_frame();
+
+/**
+ * sets the output volume (linear, 0 to 1), channel routing (one of the OPUS_OUTPUT_* values) and
+ * whether attenuated output is dithered. Takes effect with the next decoded frame. The decoder
+ * applies all three in the same loop as its de-emphasis filter, so they cost no extra pass over
+ * the decoded audio. An invalid routing aborts on the playback task.
+ */
+void playback_set_output(float volume, int routing, bool dither);
+
+/** the channel routing last set with playback_set_output, one of the OPUS_OUTPUT_* values */
+int playback_get_output_routing();
+
+/**
+ * decodes one frame into buffer in the format it is handed to I2S (interleaved 16 bit stereo at 48kHz),
+ * exactly as the playback task does. len 0 conceals a lost frame of max_samples_per_channel.
+ * Returns the number of samples per channel or an opus error code. Exposed for the decode benchmark.
+ */
+int playback_decode_frame(OpusDecoder* decoder, const void* encoded_opus_frame, size_t len, opus_int16* buffer, int max_samples_per_channel);
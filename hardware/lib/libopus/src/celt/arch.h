@@ -164,6 +164,8 @@ static OPUS_INLINE opus_int16 SAT16(opus_int32 x) {
 #include "arm/fixed_armv5e.h"
 #elif defined (OPUS_ARM_INLINE_ASM)
 #include "arm/fixed_armv4.h"
+#elif defined (OPUS_XTENSA_INLINE_ASM)
+#include "xtensa/fixed_xtensa.h"
 #elif defined (BFIN_ASM)
 #include "fixed_bfin.h"
 #elif defined (TI_C5X_ASM)
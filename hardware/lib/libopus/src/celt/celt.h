@@ -77,8 +77,22 @@ typedef struct {
 
 #define __celt_check_analysis_ptr(ptr) ((ptr) + ((ptr) - (const AnalysisInfo*)(ptr)))
 
+/* Gain, channel routing and dither of the decoder output (OPUS_SET_GAIN,
+   OPUS_SET_OUTPUT_ROUTING and OPUS_SET_OUTPUT_DITHER). For CELT frames the Opus
+   decoder hands it to CELT with CELT_SET_OUTPUT_STAGE, which applies it in the
+   de-emphasis loop; everything else gets celt_output_stage_apply() afterwards. */
+typedef struct {
+   int apply_gain;
+   opus_val32 gain;    /* Q16 */
+   int routing;        /* OPUS_OUTPUT_* */
+   int dither;
+   opus_uint32 seed;
+} CELTOutputStage;
+
 #define __celt_check_silkinfo_ptr(ptr) ((ptr) + ((ptr) - (const SILKInfo*)(ptr)))
 
+#define __celt_check_output_stage_ptr(ptr) ((ptr) + ((ptr) - (CELTOutputStage*)(ptr)))
+
 /* Encoder/decoder Requests */
 
 
@@ -131,6 +145,10 @@ typedef struct {
 #define CELT_SET_SILK_INFO_REQUEST    10028
 #define CELT_SET_SILK_INFO(x) CELT_SET_SILK_INFO_REQUEST, __celt_check_silkinfo_ptr(x)
 
+/* NULL (the default) writes the de-emphasized output as is */
+#define CELT_SET_OUTPUT_STAGE_REQUEST    10030
+#define CELT_SET_OUTPUT_STAGE(x) CELT_SET_OUTPUT_STAGE_REQUEST, __celt_check_output_stage_ptr(x)
+
 /* Encoder stuff */
 
 int celt_encoder_get_size(int channels);
@@ -155,6 +173,69 @@ int celt_decode_with_ec(OpusCustomDecoder * OPUS_RESTRICT st, const unsigned cha
 #define celt_encoder_ctl opus_custom_encoder_ctl
 #define celt_decoder_ctl opus_custom_decoder_ctl
 
+/* Whether the stage changes the output of a decoder with C channels at all */
+static OPUS_INLINE int celt_output_stage_active(const CELTOutputStage *stage, int C)
+{
+   return stage->apply_gain || (C == 2 && stage->routing != OPUS_OUTPUT_STEREO);
+}
+
+static OPUS_INLINE opus_val16 celt_output_stage_gain(const CELTOutputStage *stage,
+      opus_val16 x, opus_uint32 *seed)
+{
+   opus_val32 y;
+#ifdef FIXED_POINT
+   if (stage->dither && stage->gain < 65536)
+   {
+      opus_int32 d;
+      /* The two halves of one LCG step are two uniform 16-bit values. Their sum
+         in place of the rounding offset is TPDF dither of +/-1 LSB around
+         round-to-nearest. |x*gain + d| < 2^31 for any gain below unity. */
+      *seed = 1664525 * *seed + 1013904223;
+      d = (opus_int32)(*seed & 0xFFFF) + (opus_int32)(*seed >> 16) - 32768;
+      return (opus_val16)SHR32(ADD32((opus_int32)x*stage->gain, d), 16);
+   }
+#else
+   (void)seed;
+#endif
+   y = MULT16_32_P16(x, stage->gain);
+   return SATURATE(y, 32767);
+}
+
+/* Routes, scales and dithers one stereo sample pair into out[0] and out[1] */
+static OPUS_INLINE void celt_output_stage_write(const CELTOutputStage *stage,
+      opus_val16 l, opus_val16 r, opus_val16 *out, opus_uint32 *seed)
+{
+   switch (stage->routing)
+   {
+   case OPUS_OUTPUT_SWAPPED:
+   {
+      opus_val16 tmp = l;
+      l = r;
+      r = tmp;
+   }
+   break;
+   case OPUS_OUTPUT_MONO:
+      l = r = (opus_val16)HALF32(ADD32(l, r));
+      break;
+   case OPUS_OUTPUT_LEFT:
+      r = l;
+      break;
+   case OPUS_OUTPUT_RIGHT:
+      l = r;
+      break;
+   }
+   if (stage->apply_gain)
+   {
+      l = celt_output_stage_gain(stage, l, seed);
+      r = celt_output_stage_gain(stage, r, seed);
+   }
+   out[0] = l;
+   out[1] = r;
+}
+
+/* Applies the stage to N samples of interleaved PCM with C channels */
+void celt_output_stage_apply(CELTOutputStage *stage, opus_val16 *pcm, int N, int C);
+
 
 #ifdef CUSTOM_MODES
 #define OPUS_CUSTOM_NOSTATIC
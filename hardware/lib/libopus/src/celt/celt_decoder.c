@@ -50,6 +50,7 @@
 #include <stdarg.h>
 #include "celt_lpc.h"
 #include "vq.h"
+#include "../opus_profile.h"
 
 /* The maximum pitch lag to allow in the pitch-based PLC. It's possible to save
    CPU time in the PLC pitch search by making this smaller than MAX_PERIOD. The
@@ -59,6 +60,10 @@
    pitch of 480 Hz. */
 #define PLC_PITCH_LAG_MIN (100)
 
+/* Per-frame attenuation of OPUS_PLC_REPEAT after the first lost frame, like
+   the fade of the pitch-based PLC. */
+#define PLC_REPEAT_FADE QCONST16(.8f,15)
+
 #if defined(SMALL_FOOTPRINT) && defined(FIXED_POINT)
 #define NORM_ALIASING_HACK
 #endif
@@ -83,6 +88,8 @@ struct OpusCustomDecoder {
    int signalling;
    int disable_inv;
    int arch;
+   CELTOutputStage *output_stage;
+   int plc_policy;
 
    /* Everything beyond this point gets cleared on a reset */
 #define DECODER_RESET_START rng
@@ -91,6 +98,7 @@ struct OpusCustomDecoder {
    int error;
    int last_pitch_index;
    int loss_count;
+   int burst_plc_policy;
    int skip_plc;
    int postfilter_period;
    int postfilter_period_old;
@@ -252,13 +260,58 @@ static void deemphasis_stereo_simple(celt_sig *in[], opus_val16 *pcm, int N, con
    mem[0] = m0;
    mem[1] = m1;
 }
+
+/* Same as deemphasis_stereo_simple(), but routes, scales and dithers every
+   sample pair on its way out, so the output stage costs no pass of its own. */
+static void deemphasis_stereo_output(celt_sig *in[], opus_val16 *pcm, int N, const opus_val16 coef0,
+      celt_sig *mem, CELTOutputStage *stage)
+{
+   celt_sig * OPUS_RESTRICT x0;
+   celt_sig * OPUS_RESTRICT x1;
+   celt_sig m0, m1;
+   opus_uint32 seed;
+   int j;
+   x0=in[0];
+   x1=in[1];
+   m0 = mem[0];
+   m1 = mem[1];
+   seed = stage->seed;
+   for (j=0;j<N;j++)
+   {
+      celt_sig tmp0, tmp1;
+      tmp0 = x0[j] + VERY_SMALL + m0;
+      tmp1 = x1[j] + VERY_SMALL + m1;
+      m0 = MULT16_32_Q15(coef0, tmp0);
+      m1 = MULT16_32_Q15(coef0, tmp1);
+      celt_output_stage_write(stage, SCALEOUT(SIG2WORD16(tmp0)), SCALEOUT(SIG2WORD16(tmp1)),
+            pcm+2*j, &seed);
+   }
+   mem[0] = m0;
+   mem[1] = m1;
+   stage->seed = seed;
+}
 #endif
 
+void celt_output_stage_apply(CELTOutputStage *stage, opus_val16 *pcm, int N, int C)
+{
+   int i;
+   opus_uint32 seed = stage->seed;
+   if (C == 2)
+   {
+      for (i=0;i<N;i++)
+         celt_output_stage_write(stage, pcm[2*i], pcm[2*i+1], pcm+2*i, &seed);
+   } else if (stage->apply_gain) {
+      for (i=0;i<N*C;i++)
+         pcm[i] = celt_output_stage_gain(stage, pcm[i], &seed);
+   }
+   stage->seed = seed;
+}
+
 #ifndef RESYNTH
 static
 #endif
-void deemphasis(celt_sig *in[], opus_val16 *pcm, int N, int C, int downsample, const opus_val16 *coef,
-      celt_sig *mem, int accum)
+OPUS_IRAM void deemphasis(celt_sig *in[], opus_val16 *pcm, int N, int C, int downsample, const opus_val16 *coef,
+      celt_sig *mem, int accum, CELTOutputStage *stage)
 {
    int c;
    int Nd;
@@ -267,6 +320,13 @@ void deemphasis(celt_sig *in[], opus_val16 *pcm, int N, int C, int downsample, c
    VARDECL(celt_sig, scratch);
    SAVE_STACK;
 #ifndef CUSTOM_MODES
+   /* The Opus decoder only hands over an output stage for this case */
+   if (stage)
+   {
+      celt_assert(downsample == 1 && C == 2 && !accum);
+      deemphasis_stereo_output(in, pcm, N, coef[0], mem, stage);
+      return;
+   }
    /* Short version for common case. */
    if (downsample == 1 && C == 2 && !accum)
    {
@@ -367,9 +427,8 @@ void celt_synthesis(const CELTMode *mode, celt_norm *X, celt_sig * out_syn[],
 {
    int c, i;
    int M;
-   int b;
    int B;
-   int N, NB;
+   int N;
    int shift;
    int nbEBands;
    int overlap;
@@ -385,11 +444,9 @@ void celt_synthesis(const CELTMode *mode, celt_norm *X, celt_sig * out_syn[],
    if (isTransient)
    {
       B = M;
-      NB = mode->shortMdctSize;
       shift = mode->maxLM;
    } else {
       B = 1;
-      NB = mode->shortMdctSize<<LM;
       shift = mode->maxLM-LM;
    }
 
@@ -402,10 +459,8 @@ void celt_synthesis(const CELTMode *mode, celt_norm *X, celt_sig * out_syn[],
       /* Store a temporary copy in the output buffer because the IMDCT destroys its input. */
       freq2 = out_syn[1]+overlap/2;
       OPUS_COPY(freq2, freq, N);
-      for (b=0;b<B;b++)
-         clt_mdct_backward(&mode->mdct, &freq2[b], out_syn[0]+NB*b, mode->window, overlap, shift, B, arch);
-      for (b=0;b<B;b++)
-         clt_mdct_backward(&mode->mdct, &freq[b], out_syn[1]+NB*b, mode->window, overlap, shift, B, arch);
+      clt_mdct_backward_blocks(&mode->mdct, freq2, out_syn[0], mode->window, overlap, shift, B, arch);
+      clt_mdct_backward_blocks(&mode->mdct, freq, out_syn[1], mode->window, overlap, shift, B, arch);
    } else if (CC==1&&C==2)
    {
       /* Downmixing a stereo stream to mono */
@@ -418,15 +473,13 @@ void celt_synthesis(const CELTMode *mode, celt_norm *X, celt_sig * out_syn[],
             downsample, silence);
       for (i=0;i<N;i++)
          freq[i] = ADD32(HALF32(freq[i]), HALF32(freq2[i]));
-      for (b=0;b<B;b++)
-         clt_mdct_backward(&mode->mdct, &freq[b], out_syn[0]+NB*b, mode->window, overlap, shift, B, arch);
+      clt_mdct_backward_blocks(&mode->mdct, freq, out_syn[0], mode->window, overlap, shift, B, arch);
    } else {
       /* Normal case (mono or stereo) */
       c=0; do {
          denormalise_bands(mode, X+c*N, freq, oldBandE+c*nbEBands, start, effEnd, M,
                downsample, silence);
-         for (b=0;b<B;b++)
-            clt_mdct_backward(&mode->mdct, &freq[b], out_syn[c]+NB*b, mode->window, overlap, shift, B, arch);
+         clt_mdct_backward_blocks(&mode->mdct, freq, out_syn[c], mode->window, overlap, shift, B, arch);
       } while (++c<CC);
    }
    /* Saturate IMDCT output so that we can't overflow in the pitch postfilter
@@ -482,7 +535,7 @@ static int celt_plc_pitch_search(celt_sig *decode_mem[2], int C, int arch)
    int pitch_index;
    VARDECL( opus_val16, lp_pitch_buf );
    SAVE_STACK;
-   opus_val16 *lp_pitch_buf = (opus_val16*)malloc((DECODE_BUFFER_SIZE>>1) * sizeof(opus_val16)); //ALLOC( lp_pitch_buf, DECODE_BUFFER_SIZE>>1, opus_val16 );
+   ALLOC( lp_pitch_buf, DECODE_BUFFER_SIZE>>1, opus_val16 );
    pitch_downsample(decode_mem, lp_pitch_buf,
          DECODE_BUFFER_SIZE, C, arch);
    pitch_search(lp_pitch_buf+(PLC_PITCH_LAG_MAX>>1), lp_pitch_buf,
@@ -490,10 +543,78 @@ static int celt_plc_pitch_search(celt_sig *decode_mem[2], int C, int arch)
          PLC_PITCH_LAG_MAX-PLC_PITCH_LAG_MIN, &pitch_index, arch);
    pitch_index = PLC_PITCH_LAG_MAX-pitch_index;
    RESTORE_STACK;
-   free(lp_pitch_buf);
    return pitch_index;
 }
 
+/* Prepares the overlap past the end of a concealed frame in buf so that it
+   blends with the MDCT of the next frame. etmp has room for overlap values. */
+static void celt_plc_fold_overlap(CELTDecoder * OPUS_RESTRICT st, celt_sig *buf, opus_val32 *etmp)
+{
+   const opus_val16 *window = st->mode->window;
+   int overlap = st->overlap;
+   int i;
+
+   /* Apply the pre-filter to the MDCT overlap for the next frame because
+      the post-filter will be re-applied in the decoder after the MDCT
+      overlap. */
+   comb_filter(etmp, buf+DECODE_BUFFER_SIZE,
+        st->postfilter_period, st->postfilter_period, overlap,
+        -st->postfilter_gain, -st->postfilter_gain,
+        st->postfilter_tapset, st->postfilter_tapset, NULL, 0, st->arch);
+
+   /* Simulate TDAC on the concealed audio so that it blends with the
+      MDCT of the next frame. */
+   for (i=0;i<overlap/2;i++)
+   {
+      buf[DECODE_BUFFER_SIZE+i] =
+         MULT16_32_Q15(window[i], etmp[overlap-1-i])
+         + MULT16_32_Q15(window[overlap-i-1], etmp[i]);
+   }
+}
+
+/* Repeat-and-fade concealment (OPUS_PLC_REPEAT): continues each channel with
+   a faded copy of its last MAX_PERIOD samples instead of extrapolating an LPC
+   excitation at the pitch period. Costs one pass over the frame and two over
+   the overlap per channel, with no pitch search or LPC analysis. */
+static void celt_plc_repeat(CELTDecoder * OPUS_RESTRICT st, celt_sig *decode_mem[2], int N, int loss_count)
+{
+   const opus_val16 *window = st->mode->window;
+   int overlap = st->overlap;
+   int c;
+   VARDECL(opus_val32, etmp);
+   SAVE_STACK;
+
+   ALLOC(etmp, overlap, opus_val32);
+   c=0; do {
+      celt_sig *buf = decode_mem[c];
+      opus_val16 attenuation = loss_count == 0 ? Q15ONE : PLC_REPEAT_FADE;
+      int i, j;
+
+      OPUS_MOVE(buf, buf+N, DECODE_BUFFER_SIZE-N);
+      /* The copy only reads below DECODE_BUFFER_SIZE-N, which it never writes */
+      for (i=j=0;i<N+overlap;i++,j++)
+      {
+         if (j >= MAX_PERIOD) {
+            j -= MAX_PERIOD;
+            attenuation = MULT16_16_Q15(attenuation, PLC_REPEAT_FADE);
+         }
+         buf[DECODE_BUFFER_SIZE-N+i] =
+               MULT16_32_Q15(attenuation, buf[DECODE_BUFFER_SIZE-N-MAX_PERIOD+j]);
+      }
+      /* Cross-fade from the time-reversed end of the decoded signal into the
+         copy, so that there is no step where the copy starts. The window is
+         power complementary. */
+      for (i=0;i<overlap;i++)
+      {
+         buf[DECODE_BUFFER_SIZE-N+i] =
+               MULT16_32_Q15(window[i], buf[DECODE_BUFFER_SIZE-N+i])
+               + MULT16_32_Q15(window[overlap-1-i], buf[DECODE_BUFFER_SIZE-N-1-i]);
+      }
+      celt_plc_fold_overlap(st, buf, etmp);
+   } while (++c<st->channels);
+   RESTORE_STACK;
+}
+
 static void celt_decode_lost(CELTDecoder * OPUS_RESTRICT st, int N, int LM)
 {
    int c;
@@ -529,8 +650,16 @@ static void celt_decode_lost(CELTDecoder * OPUS_RESTRICT st, int N, int LM)
 
    loss_count = st->loss_count;
    start = st->start;
-   noise_based = loss_count >= 5 || start != 0 || st->skip_plc;
-   if (noise_based)
+   /* The policy only changes between bursts: the pitch-based PLC needs the
+      pitch and LPC of the first lost frame for the following ones. */
+   if (loss_count == 0)
+      st->burst_plc_policy = st->plc_policy;
+   noise_based = loss_count >= 5 || start != 0 || st->skip_plc
+         || st->burst_plc_policy == OPUS_PLC_NOISE;
+   if (!noise_based && st->burst_plc_policy == OPUS_PLC_REPEAT)
+   {
+      celt_plc_repeat(st, decode_mem, N, loss_count);
+   } else if (noise_based)
    {
       /* Noise-based PLC/CNG */
 #ifdef NORM_ALIASING_HACK
@@ -788,22 +917,7 @@ static void celt_decode_lost(CELTDecoder * OPUS_RESTRICT st, int N, int LM)
             }
          }
 
-         /* Apply the pre-filter to the MDCT overlap for the next frame because
-            the post-filter will be re-applied in the decoder after the MDCT
-            overlap. */
-         comb_filter(etmp, buf+DECODE_BUFFER_SIZE,
-              st->postfilter_period, st->postfilter_period, overlap,
-              -st->postfilter_gain, -st->postfilter_gain,
-              st->postfilter_tapset, st->postfilter_tapset, NULL, 0, st->arch);
-
-         /* Simulate TDAC on the concealed audio so that it blends with the
-            MDCT of the next frame. */
-         for (i=0;i<overlap/2;i++)
-         {
-            buf[DECODE_BUFFER_SIZE+i] =
-               MULT16_32_Q15(window[i], etmp[overlap-1-i])
-               + MULT16_32_Q15(window[overlap-i-1], etmp[i]);
-         }
+         celt_plc_fold_overlap(st, buf, etmp);
       } while (++c<C);
    }
 
@@ -863,6 +977,7 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
    int nbEBands;
    int overlap;
    const opus_int16 *eBands;
+   OPUS_PROFILE_DECL
    ALLOC_STACK;
 
    VALIDATE_CELT_DECODER(st);
@@ -929,8 +1044,12 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
 
    if (data == NULL || len<=1)
    {
+      OPUS_PROFILE_BEGIN();
       celt_decode_lost(st, N, LM);
-      deemphasis(out_syn, pcm, N, CC, st->downsample, mode->preemph, st->preemph_memD, accum);
+      OPUS_PROFILE_END(OPUS_STAGE_CELT_PLC);
+      OPUS_PROFILE_BEGIN();
+      deemphasis(out_syn, pcm, N, CC, st->downsample, mode->preemph, st->preemph_memD, accum, st->output_stage);
+      OPUS_PROFILE_END(OPUS_STAGE_CELT_DEEMPHASIS);
       RESTORE_STACK;
       return frame_size/st->downsample;
    }
@@ -939,6 +1058,7 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
     * turning on the pitch-based PLC */
    st->skip_plc = st->loss_count != 0;
 
+   OPUS_PROFILE_BEGIN();
    if (dec == NULL)
    {
       ec_dec_init(&_dec,(unsigned char*)data,len);
@@ -1065,6 +1185,7 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
          fine_quant, fine_priority, C, LM, dec, 0, 0, 0);
 
    unquant_fine_energy(mode, start, end, oldBandE, fine_quant, dec, C);
+   OPUS_PROFILE_PAUSE(OPUS_STAGE_CELT_ENTROPY_ENERGY);
 
    c=0; do {
       OPUS_MOVE(decode_mem[c], decode_mem[c]+N, DECODE_BUFFER_SIZE-N+overlap/2);
@@ -1081,11 +1202,14 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
    ALLOC(X, C*N, celt_norm);   /**< Interleaved normalised MDCTs */
 #endif
 
+   OPUS_PROFILE_BEGIN();
    quant_all_bands(0, mode, start, end, X, C==2 ? X+N : NULL, collapse_masks,
          NULL, pulses, shortBlocks, spread_decision, dual_stereo, intensity, tf_res,
          len*(8<<BITRES)-anti_collapse_rsv, balance, dec, LM, codedBands, &st->rng, 0,
          st->arch, st->disable_inv);
+   OPUS_PROFILE_END(OPUS_STAGE_CELT_QUANT_ALL_BANDS);
 
+   OPUS_PROFILE_BEGIN();
    if (anti_collapse_rsv > 0)
    {
       anti_collapse_on = ec_dec_bits(dec, 1);
@@ -1093,6 +1217,7 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
 
    unquant_energy_finalise(mode, start, end, oldBandE,
          fine_quant, fine_priority, len*8-ec_tell(dec), dec, C);
+   OPUS_PROFILE_END(OPUS_STAGE_CELT_ENTROPY_ENERGY);
 
    if (anti_collapse_on)
       anti_collapse(mode, X, collapse_masks, LM, C, N,
@@ -1104,9 +1229,12 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
          oldBandE[i] = -QCONST16(28.f,DB_SHIFT);
    }
 
+   OPUS_PROFILE_BEGIN();
    celt_synthesis(mode, X, out_syn, oldBandE, start, effEnd,
                   C, CC, isTransient, LM, st->downsample, silence, st->arch);
+   OPUS_PROFILE_END(OPUS_STAGE_CELT_SYNTHESIS);
 
+   OPUS_PROFILE_BEGIN();
    c=0; do {
       st->postfilter_period=IMAX(st->postfilter_period, COMBFILTER_MINPERIOD);
       st->postfilter_period_old=IMAX(st->postfilter_period_old, COMBFILTER_MINPERIOD);
@@ -1119,6 +1247,7 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
                mode->window, overlap, st->arch);
 
    } while (++c<CC);
+   OPUS_PROFILE_END(OPUS_STAGE_CELT_COMB_FILTER);
    st->postfilter_period_old = st->postfilter_period;
    st->postfilter_gain_old = st->postfilter_gain;
    st->postfilter_tapset_old = st->postfilter_tapset;
@@ -1169,7 +1298,9 @@ int celt_decode_with_ec(CELTDecoder * OPUS_RESTRICT st, const unsigned char *dat
    } while (++c<2);
    st->rng = dec->rng;
 
-   deemphasis(out_syn, pcm, N, CC, st->downsample, mode->preemph, st->preemph_memD, accum);
+   OPUS_PROFILE_BEGIN();
+   deemphasis(out_syn, pcm, N, CC, st->downsample, mode->preemph, st->preemph_memD, accum, st->output_stage);
+   OPUS_PROFILE_END(OPUS_STAGE_CELT_DEEMPHASIS);
    st->loss_count = 0;
    RESTORE_STACK;
    if (ec_tell(dec) > 8*len)
@@ -1317,6 +1448,28 @@ int opus_custom_decoder_ctl(CELTDecoder * OPUS_RESTRICT st, int request, ...)
          *value = st->postfilter_period;
       }
       break;
+      case OPUS_SET_PLC_POLICY_REQUEST:
+      {
+         opus_int32 value = va_arg(ap, opus_int32);
+         if (value<OPUS_PLC_FULL || value>OPUS_PLC_REPEAT)
+            goto bad_arg;
+         st->plc_policy = value;
+      }
+      break;
+      case OPUS_GET_PLC_POLICY_REQUEST:
+      {
+         opus_int32 *value = va_arg(ap, opus_int32*);
+         if (value==NULL)
+            goto bad_arg;
+         *value = st->plc_policy;
+      }
+      break;
+      case CELT_SET_OUTPUT_STAGE_REQUEST:
+      {
+         CELTOutputStage *value = va_arg(ap, CELTOutputStage*);
+         st->output_stage = value;
+      }
+      break;
       case CELT_GET_MODE_REQUEST:
       {
          const CELTMode ** value = va_arg(ap, const CELTMode**);
@@ -209,9 +209,9 @@ int log2_frac(opus_uint32 val, int frac)
    splitting a band from a standard Opus mode: 176, 144, 96, 88, 72, 64, 48,
    44, 36, 32, 24, 22, 18, 16, 8, 4, 2).*/
 #if defined(CUSTOM_MODES)
-static const opus_uint32 CELT_PVQ_U_DATA[1488] PROGMEM ={
+static const opus_uint32 CELT_PVQ_U_DATA[1488] OPUS_DRAM ={
 #else
-static const opus_uint32 CELT_PVQ_U_DATA[1272] PROGMEM ={
+static const opus_uint32 CELT_PVQ_U_DATA[1272] OPUS_DRAM ={
 #endif
   /*N=0, K=0...176:*/
   1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -411,7 +411,7 @@ static const opus_uint32 CELT_PVQ_U_DATA[1272] PROGMEM ={
 };
 
 #if defined(CUSTOM_MODES)
-static const opus_uint32 *const CELT_PVQ_U_ROW[15] PROGMEM={
+static const opus_uint32 *const CELT_PVQ_U_ROW[15] OPUS_DRAM={
   CELT_PVQ_U_DATA+   0,CELT_PVQ_U_DATA+ 208,CELT_PVQ_U_DATA+ 415,
   CELT_PVQ_U_DATA+ 621,CELT_PVQ_U_DATA+ 826,CELT_PVQ_U_DATA+1030,
   CELT_PVQ_U_DATA+1233,CELT_PVQ_U_DATA+1336,CELT_PVQ_U_DATA+1389,
@@ -419,7 +419,7 @@ static const opus_uint32 *const CELT_PVQ_U_ROW[15] PROGMEM={
   CELT_PVQ_U_DATA+1464,CELT_PVQ_U_DATA+1470,CELT_PVQ_U_DATA+1473
 };
 #else
-static const opus_uint32 *const CELT_PVQ_U_ROW[15] PROGMEM={
+static const opus_uint32 *const CELT_PVQ_U_ROW[15] OPUS_DRAM={
   CELT_PVQ_U_DATA+   0,CELT_PVQ_U_DATA+ 176,CELT_PVQ_U_DATA+ 351,
   CELT_PVQ_U_DATA+ 525,CELT_PVQ_U_DATA+ 698,CELT_PVQ_U_DATA+ 870,
   CELT_PVQ_U_DATA+1041,CELT_PVQ_U_DATA+1131,CELT_PVQ_U_DATA+1178,
@@ -461,7 +461,9 @@ void encode_pulses(const int *_y,int _n,int _k,ec_enc *_enc){
   ec_enc_uint(_enc,icwrs(_n,_y),CELT_PVQ_V(_n,_k));
 }
 
-static opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
+static OPUS_IRAM opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
+  const opus_uint32 *rowk;
+  const opus_uint32 *rowk1;
   opus_uint32 p;
   int         s;
   int         k0;
@@ -469,6 +471,15 @@ static opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
   opus_val32  yy=0;
   celt_assert(_k>0);
   celt_assert(_n>1);
+  /*Rows K and K+1 of the table, for the lots of dimensions case. They only
+     change when pulses are placed, so we don't look them up per dimension.
+    Whenever K<N, K+1 is a valid row: either N<=14, or K+1<=14 for V(N,K) to
+     be in the table at all.*/
+  rowk=rowk1=NULL;
+  if(_k<_n){
+    rowk=CELT_PVQ_U_ROW[_k];
+    rowk1=CELT_PVQ_U_ROW[_k+1];
+  }
   while(_n>2){
     opus_uint32 q;
     /*Lots of pulses case:*/
@@ -493,12 +504,17 @@ static opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
       val=(k0-_k+s)^s;
       *_y++=val;
       yy=MAC16_16(yy,val,val);
+      /*Switching to the lots of dimensions case with the next dimension?*/
+      if(_k<_n-1){
+        rowk=CELT_PVQ_U_ROW[_k];
+        rowk1=CELT_PVQ_U_ROW[_k+1];
+      }
     }
     /*Lots of dimensions case:*/
     else{
       /*Are there any pulses in this dimension at all?*/
-      p=CELT_PVQ_U_ROW[_k][_n];
-      q=CELT_PVQ_U_ROW[_k+1][_n];
+      p=rowk[_n];
+      q=rowk1[_n];
       if(p<=_i&&_i<q){
         _i-=p;
         *_y++=0;
@@ -515,9 +531,18 @@ static opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
         val=(k0-_k+s)^s;
         *_y++=val;
         yy=MAC16_16(yy,val,val);
+        rowk=CELT_PVQ_U_ROW[_k];
+        rowk1=CELT_PVQ_U_ROW[_k+1];
       }
     }
     _n--;
+    /*All pulses placed: the only codeword left, _i==0, is all zeros. High
+       bitrate bands often end in a long run of those.*/
+    if(!_k){
+      celt_sig_assert(_i==0);
+      OPUS_CLEAR(_y,_n);
+      return yy;
+    }
   }
   /*_n==2*/
   p=2*_k+1;
@@ -537,7 +562,7 @@ static opus_val32 cwrsi(int _n,int _k,opus_uint32 _i,int *_y){
   return yy;
 }
 
-opus_val32 decode_pulses(int *_y,int _n,int _k,ec_dec *_dec){
+OPUS_IRAM opus_val32 decode_pulses(int *_y,int _n,int _k,ec_dec *_dec){
   return cwrsi(_n,_k,ec_dec_uint(_dec,CELT_PVQ_V(_n,_k)),_y);
 }
 
@@ -88,31 +88,67 @@
    URL="http://www.stanford.edu/class/ee398a/handouts/papers/Moffat98ArithmCoding.pdf"
   }*/
 
-static int ec_read_byte(ec_dec *_this){
+static OPUS_IRAM int ec_read_byte(ec_dec *_this){
   return _this->offs<_this->storage?_this->buf[_this->offs++]:0;
 }
 
-static int ec_read_byte_from_end(ec_dec *_this){
+static OPUS_IRAM int ec_read_byte_from_end(ec_dec *_this){
   return _this->end_offs<_this->storage?
    _this->buf[_this->storage-++(_this->end_offs)]:0;
 }
 
 /*Normalizes the contents of val and rng so that rng lies entirely in the
    high-order symbol.*/
-static void ec_dec_normalize(ec_dec *_this){
+static OPUS_IRAM void ec_dec_normalize(ec_dec *_this){
   /*If the range is too small, rescale it and input some bits.*/
-  while(_this->rng<=EC_CODE_BOT){
-    int sym;
-    _this->nbits_total+=EC_SYM_BITS;
-    _this->rng<<=EC_SYM_BITS;
-    /*Use up the remaining bits from our last symbol.*/
-    sym=_this->rem;
-    /*Read the next value from the input.*/
-    _this->rem=ec_read_byte(_this);
-    /*Take the rest of the bits we need from this new symbol.*/
-    sym=(sym<<EC_SYM_BITS|_this->rem)>>(EC_SYM_BITS-EC_CODE_EXTRA);
-    /*And subtract them from val, capped to be less than EC_CODE_TOP.*/
-    _this->val=((_this->val<<EC_SYM_BITS)+(EC_SYM_MAX&~sym))&(EC_CODE_TOP-1);
+  if(_this->rng<=EC_CODE_BOT){
+#if !defined(OPUS_DISABLE_EC_MULTIBYTE_REFILL)
+    /*Away from the end of the buffer no symbol needs a bounds check (rng is at
+       least 1, so at most 3 are read), and the state can stay in locals: the
+       stores through _this can't be kept across reads of buf otherwise, since
+       those may alias anything.*/
+    if(_this->offs+3<=_this->storage){
+      const unsigned char *p;
+      opus_uint32          rng;
+      opus_uint32          val;
+      int                  rem;
+      int                  n;
+      p=_this->buf+_this->offs;
+      rng=_this->rng;
+      val=_this->val;
+      rem=_this->rem;
+      n=0;
+      do{
+        int sym;
+        rng<<=EC_SYM_BITS;
+        sym=rem;
+        rem=p[n++];
+        sym=(sym<<EC_SYM_BITS|rem)>>(EC_SYM_BITS-EC_CODE_EXTRA);
+        val=((val<<EC_SYM_BITS)+(EC_SYM_MAX&~sym))&(EC_CODE_TOP-1);
+      }
+      while(rng<=EC_CODE_BOT);
+      _this->offs+=n;
+      _this->nbits_total+=n*EC_SYM_BITS;
+      _this->rng=rng;
+      _this->val=val;
+      _this->rem=rem;
+      return;
+    }
+#endif
+    do{
+      int sym;
+      _this->nbits_total+=EC_SYM_BITS;
+      _this->rng<<=EC_SYM_BITS;
+      /*Use up the remaining bits from our last symbol.*/
+      sym=_this->rem;
+      /*Read the next value from the input.*/
+      _this->rem=ec_read_byte(_this);
+      /*Take the rest of the bits we need from this new symbol.*/
+      sym=(sym<<EC_SYM_BITS|_this->rem)>>(EC_SYM_BITS-EC_CODE_EXTRA);
+      /*And subtract them from val, capped to be less than EC_CODE_TOP.*/
+      _this->val=((_this->val<<EC_SYM_BITS)+(EC_SYM_MAX&~sym))&(EC_CODE_TOP-1);
+    }
+    while(_this->rng<=EC_CODE_BOT);
   }
 }
 
@@ -136,21 +172,21 @@ void ec_dec_init(ec_dec *_this,unsigned char *_buf,opus_uint32 _storage){
   ec_dec_normalize(_this);
 }
 
-unsigned ec_decode(ec_dec *_this,unsigned _ft){
+OPUS_IRAM unsigned ec_decode(ec_dec *_this,unsigned _ft){
   unsigned s;
   _this->ext=celt_udiv(_this->rng,_ft);
   s=(unsigned)(_this->val/_this->ext);
   return _ft-EC_MINI(s+1,_ft);
 }
 
-unsigned ec_decode_bin(ec_dec *_this,unsigned _bits){
+OPUS_IRAM unsigned ec_decode_bin(ec_dec *_this,unsigned _bits){
    unsigned s;
    _this->ext=_this->rng>>_bits;
    s=(unsigned)(_this->val/_this->ext);
    return (1U<<_bits)-EC_MINI(s+1U,1U<<_bits);
 }
 
-void ec_dec_update(ec_dec *_this,unsigned _fl,unsigned _fh,unsigned _ft){
+OPUS_IRAM void ec_dec_update(ec_dec *_this,unsigned _fl,unsigned _fh,unsigned _ft){
   opus_uint32 s;
   s=IMUL32(_this->ext,_ft-_fh);
   _this->val-=s;
@@ -159,7 +195,7 @@ void ec_dec_update(ec_dec *_this,unsigned _fl,unsigned _fh,unsigned _ft){
 }
 
 /*The probability of having a "one" is 1/(1<<_logp).*/
-int ec_dec_bit_logp(ec_dec *_this,unsigned _logp){
+OPUS_IRAM int ec_dec_bit_logp(ec_dec *_this,unsigned _logp){
   opus_uint32 r;
   opus_uint32 d;
   opus_uint32 s;
@@ -174,7 +210,7 @@ int ec_dec_bit_logp(ec_dec *_this,unsigned _logp){
   return ret;
 }
 
-int ec_dec_icdf(ec_dec *_this,const unsigned char *_icdf,unsigned _ftb){
+OPUS_IRAM int ec_dec_icdf(ec_dec *_this,const unsigned char *_icdf,unsigned _ftb){
   opus_uint32 r;
   opus_uint32 d;
   opus_uint32 s;
@@ -195,7 +231,7 @@ int ec_dec_icdf(ec_dec *_this,const unsigned char *_icdf,unsigned _ftb){
   return ret;
 }
 
-opus_uint32 ec_dec_uint(ec_dec *_this,opus_uint32 _ft){
+OPUS_IRAM opus_uint32 ec_dec_uint(ec_dec *_this,opus_uint32 _ft){
   unsigned ft;
   unsigned s;
   int      ftb;
@@ -222,13 +258,32 @@ opus_uint32 ec_dec_uint(ec_dec *_this,opus_uint32 _ft){
   }
 }
 
-opus_uint32 ec_dec_bits(ec_dec *_this,unsigned _bits){
+OPUS_IRAM opus_uint32 ec_dec_bits(ec_dec *_this,unsigned _bits){
   ec_window   window;
   int         available;
   opus_uint32 ret;
   window=_this->end_window;
   available=_this->nend_bits;
   if((unsigned)available<_bits){
+#if !defined(OPUS_DISABLE_EC_MULTIBYTE_REFILL)
+    /*Away from the start of the buffer, fill the window with as many whole
+       symbols as fit in one go.*/
+    if(_this->end_offs+4<=_this->storage){
+      const unsigned char *p;
+      ec_window            in;
+      int                  n;
+      n=(EC_WINDOW_SIZE-EC_SYM_BITS-available)/EC_SYM_BITS+1;
+      p=_this->buf+_this->storage-_this->end_offs;
+      in=p[-1];
+      if(n>1)in|=(ec_window)p[-2]<<EC_SYM_BITS;
+      if(n>2)in|=(ec_window)p[-3]<<2*EC_SYM_BITS;
+      if(n>3)in|=(ec_window)p[-4]<<3*EC_SYM_BITS;
+      _this->end_offs+=n;
+      window|=in<<available;
+      available+=n*EC_SYM_BITS;
+    }
+    else
+#endif
     do{
       window|=(ec_window)ec_read_byte_from_end(_this)<<available;
       available+=EC_SYM_BITS;
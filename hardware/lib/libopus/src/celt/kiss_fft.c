@@ -45,7 +45,17 @@
    complex numbers.  It also delares the kf_ internal functions.
 */
 
-static void kf_bfly2(
+/* Without custom modes the only FFTs are the four of the static 48 kHz mode. Those get
+   straight-line implementations below with per-stage twiddle tables; the generic radix-3
+   and radix-5 butterflies are then only a fallback and don't need to sit in IRAM. */
+#if defined(FIXED_POINT) && !defined(CUSTOM_MODES) && !defined(OPUS_DISABLE_STATIC_FFT)
+#define OPUS_STATIC_FFT
+#define KF_GENERIC_IRAM
+#else
+#define KF_GENERIC_IRAM OPUS_IRAM
+#endif
+
+static OPUS_IRAM void kf_bfly2(
                      kiss_fft_cpx * Fout,
                      int m,
                      int N
@@ -101,7 +111,7 @@ static void kf_bfly2(
    }
 }
 
-static void kf_bfly4(
+static OPUS_IRAM void kf_bfly4(
                      kiss_fft_cpx * Fout,
                      const size_t fstride,
                      const kiss_fft_state *st,
@@ -173,7 +183,7 @@ static void kf_bfly4(
 
 #ifndef RADIX_TWO_ONLY
 
-static void kf_bfly3(
+static KF_GENERIC_IRAM void kf_bfly3(
                      kiss_fft_cpx * Fout,
                      const size_t fstride,
                      const kiss_fft_state *st,
@@ -232,7 +242,7 @@ static void kf_bfly3(
 
 
 #ifndef OVERRIDE_kf_bfly5
-static void kf_bfly5(
+static KF_GENERIC_IRAM void kf_bfly5(
                      kiss_fft_cpx * Fout,
                      const size_t fstride,
                      const kiss_fft_state *st,
@@ -311,6 +321,176 @@ static void kf_bfly5(
 
 #endif
 
+#ifdef OPUS_STATIC_FFT
+
+#include "static_fft_packed_fixed.h"
+
+#if defined(__GNUC__)
+#define KF_ALWAYS_INLINE static OPUS_INLINE __attribute__((always_inline))
+#else
+#define KF_ALWAYS_INLINE static OPUS_INLINE
+#endif
+
+/* The butterflies below do exactly the arithmetic of kf_bfly3/4/5, in the same order, so the
+   output is bit-exact. They differ in that m, N and mm are compile-time constants at every
+   call site and that the twiddles of a column j are read from tw[j*(radix-1)] onwards. */
+
+KF_ALWAYS_INLINE void kf_bfly4_static(kiss_fft_cpx * Fout, const kiss_twiddle_cpx *twiddles,
+                                      const int m, const int N, const int mm)
+{
+   int i, j;
+   for (i=0;i<N;i++)
+   {
+      kiss_fft_cpx *F = Fout + i*mm;
+      const kiss_twiddle_cpx *tw = twiddles;
+      for (j=0;j<m;j++)
+      {
+         kiss_fft_cpx scratch[6];
+         C_MUL(scratch[0], F[m], tw[0]);
+         C_MUL(scratch[1], F[2*m], tw[1]);
+         C_MUL(scratch[2], F[3*m], tw[2]);
+
+         C_SUB( scratch[5] , *F, scratch[1] );
+         C_ADDTO(*F, scratch[1]);
+         C_ADD( scratch[3] , scratch[0] , scratch[2] );
+         C_SUB( scratch[4] , scratch[0] , scratch[2] );
+         C_SUB( F[2*m], *F, scratch[3] );
+         C_ADDTO( *F , scratch[3] );
+
+         F[m].r = ADD32_ovflw(scratch[5].r, scratch[4].i);
+         F[m].i = SUB32_ovflw(scratch[5].i, scratch[4].r);
+         F[3*m].r = SUB32_ovflw(scratch[5].r, scratch[4].i);
+         F[3*m].i = ADD32_ovflw(scratch[5].i, scratch[4].r);
+         tw += 3;
+         ++F;
+      }
+   }
+}
+
+KF_ALWAYS_INLINE void kf_bfly3_static(kiss_fft_cpx * Fout, const kiss_twiddle_cpx *twiddles,
+                                      const int m, const int N, const int mm)
+{
+   int i, j;
+   const opus_val16 epi3_i = -28378;
+   for (i=0;i<N;i++)
+   {
+      kiss_fft_cpx *F = Fout + i*mm;
+      const kiss_twiddle_cpx *tw = twiddles;
+      for (j=0;j<m;j++)
+      {
+         kiss_fft_cpx scratch[4];
+         C_MUL(scratch[1], F[m], tw[0]);
+         C_MUL(scratch[2], F[2*m], tw[1]);
+
+         C_ADD(scratch[3],scratch[1],scratch[2]);
+         C_SUB(scratch[0],scratch[1],scratch[2]);
+
+         F[m].r = SUB32_ovflw(F->r, HALF_OF(scratch[3].r));
+         F[m].i = SUB32_ovflw(F->i, HALF_OF(scratch[3].i));
+
+         C_MULBYSCALAR( scratch[0] , epi3_i );
+
+         C_ADDTO(*F,scratch[3]);
+
+         F[2*m].r = ADD32_ovflw(F[m].r, scratch[0].i);
+         F[2*m].i = SUB32_ovflw(F[m].i, scratch[0].r);
+
+         F[m].r = SUB32_ovflw(F[m].r, scratch[0].i);
+         F[m].i = ADD32_ovflw(F[m].i, scratch[0].r);
+         tw += 2;
+         ++F;
+      }
+   }
+}
+
+KF_ALWAYS_INLINE void kf_bfly5_static(kiss_fft_cpx * Fout, const kiss_twiddle_cpx *twiddles,
+                                      const int m)
+{
+   /* radix 5 is always the last stage, N == 1 */
+   kiss_fft_cpx *Fout0=Fout, *Fout1=Fout+m, *Fout2=Fout+2*m, *Fout3=Fout+3*m, *Fout4=Fout+4*m;
+   const kiss_twiddle_cpx *tw = twiddles;
+   const opus_val16 ya_r = 10126, ya_i = -31164, yb_r = -26510, yb_i = -19261;
+   int u;
+   for ( u=0; u<m; ++u ) {
+      kiss_fft_cpx scratch[13];
+      scratch[0] = *Fout0;
+
+      C_MUL(scratch[1] ,*Fout1, tw[0]);
+      C_MUL(scratch[2] ,*Fout2, tw[1]);
+      C_MUL(scratch[3] ,*Fout3, tw[2]);
+      C_MUL(scratch[4] ,*Fout4, tw[3]);
+
+      C_ADD( scratch[7],scratch[1],scratch[4]);
+      C_SUB( scratch[10],scratch[1],scratch[4]);
+      C_ADD( scratch[8],scratch[2],scratch[3]);
+      C_SUB( scratch[9],scratch[2],scratch[3]);
+
+      Fout0->r = ADD32_ovflw(Fout0->r, ADD32_ovflw(scratch[7].r, scratch[8].r));
+      Fout0->i = ADD32_ovflw(Fout0->i, ADD32_ovflw(scratch[7].i, scratch[8].i));
+
+      scratch[5].r = ADD32_ovflw(scratch[0].r, ADD32_ovflw(S_MUL(scratch[7].r,ya_r), S_MUL(scratch[8].r,yb_r)));
+      scratch[5].i = ADD32_ovflw(scratch[0].i, ADD32_ovflw(S_MUL(scratch[7].i,ya_r), S_MUL(scratch[8].i,yb_r)));
+
+      scratch[6].r =  ADD32_ovflw(S_MUL(scratch[10].i,ya_i), S_MUL(scratch[9].i,yb_i));
+      scratch[6].i = NEG32_ovflw(ADD32_ovflw(S_MUL(scratch[10].r,ya_i), S_MUL(scratch[9].r,yb_i)));
+
+      C_SUB(*Fout1,scratch[5],scratch[6]);
+      C_ADD(*Fout4,scratch[5],scratch[6]);
+
+      scratch[11].r = ADD32_ovflw(scratch[0].r, ADD32_ovflw(S_MUL(scratch[7].r,yb_r), S_MUL(scratch[8].r,ya_r)));
+      scratch[11].i = ADD32_ovflw(scratch[0].i, ADD32_ovflw(S_MUL(scratch[7].i,yb_r), S_MUL(scratch[8].i,ya_r)));
+      scratch[12].r = SUB32_ovflw(S_MUL(scratch[9].i,ya_i), S_MUL(scratch[10].i,yb_i));
+      scratch[12].i = SUB32_ovflw(S_MUL(scratch[10].r,yb_i), S_MUL(scratch[9].r,ya_i));
+
+      C_ADD(*Fout2,scratch[11],scratch[12]);
+      C_SUB(*Fout3,scratch[11],scratch[12]);
+
+      tw += 4;
+      ++Fout0;++Fout1;++Fout2;++Fout3;++Fout4;
+   }
+}
+
+/* Stage sequences follow the factors of fft_state48000_960_0..3 in static_modes_fixed.h,
+   applied last factor first as in opus_fft_impl(). skip_first leaves out the leading,
+   twiddle-free radix-4 stage for opus_fft_impl_skip_first(). */
+static OPUS_IRAM void opus_fft_static480(kiss_fft_cpx *fout, int skip_first)
+{
+   if (!skip_first)
+      kf_bfly4(fout, 0, NULL, 1, 120, 0);
+   kf_bfly2(fout, 4, 60);
+   kf_bfly4_static(fout, fft_twiddles480_radix4, 8, 15, 32);
+   kf_bfly3_static(fout, fft_twiddles480_radix3, 32, 5, 96);
+   kf_bfly5_static(fout, fft_twiddles480_radix5, 96);
+}
+
+static OPUS_IRAM void opus_fft_static240(kiss_fft_cpx *fout, int skip_first)
+{
+   if (!skip_first)
+      kf_bfly4(fout, 0, NULL, 1, 60, 0);
+   kf_bfly4_static(fout, fft_twiddles240_radix4, 4, 15, 16);
+   kf_bfly3_static(fout, fft_twiddles240_radix3, 16, 5, 48);
+   kf_bfly5_static(fout, fft_twiddles240_radix5, 48);
+}
+
+static OPUS_IRAM void opus_fft_static120(kiss_fft_cpx *fout, int skip_first)
+{
+   if (!skip_first)
+      kf_bfly4(fout, 0, NULL, 1, 30, 0);
+   kf_bfly2(fout, 4, 15);
+   kf_bfly3_static(fout, fft_twiddles120_radix3, 8, 5, 24);
+   kf_bfly5_static(fout, fft_twiddles120_radix5, 24);
+}
+
+static OPUS_IRAM void opus_fft_static60(kiss_fft_cpx *fout, int skip_first)
+{
+   if (!skip_first)
+      kf_bfly4(fout, 0, NULL, 1, 15, 0);
+   kf_bfly3_static(fout, fft_twiddles60_radix3, 4, 5, 12);
+   kf_bfly5_static(fout, fft_twiddles60_radix5, 12);
+}
+
+#endif /* OPUS_STATIC_FFT */
+
 
 #ifdef CUSTOM_MODES
 
@@ -518,7 +698,7 @@ void opus_fft_free(const kiss_fft_state *cfg, int arch)
 
 #endif /* CUSTOM_MODES */
 
-void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout)
+static OPUS_IRAM void opus_fft_stages(const kiss_fft_state *st,kiss_fft_cpx *fout,int skip_first)
 {
     int m2, m;
     int p;
@@ -527,6 +707,24 @@ void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout)
     int i;
     int shift;
 
+#ifdef OPUS_STATIC_FFT
+    switch (st->nfft)
+    {
+    case 480:
+       opus_fft_static480(fout, skip_first);
+       return;
+    case 240:
+       opus_fft_static240(fout, skip_first);
+       return;
+    case 120:
+       opus_fft_static120(fout, skip_first);
+       return;
+    case 60:
+       opus_fft_static60(fout, skip_first);
+       return;
+    }
+#endif
+
     /* st->shift can be -1 */
     shift = st->shift>0 ? st->shift : 0;
 
@@ -539,6 +737,13 @@ void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout)
        L++;
     } while(m!=1);
     m = st->factors[2*L-1];
+    if (skip_first)
+    {
+       /* The caller did the radix-4, m==1 stage, so the next one starts on blocks of 4. */
+       celt_assert(st->factors[2*L-2]==4);
+       L--;
+       m = 4;
+    }
     for (i=L-1;i>=0;i--)
     {
        if (i!=0)
@@ -566,6 +771,24 @@ void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout)
     }
 }
 
+OPUS_IRAM void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout)
+{
+   opus_fft_stages(st, fout, 0);
+}
+
+int opus_fft_first_stage_is_radix4(const kiss_fft_state *st)
+{
+   int L=0;
+   while (st->factors[2*L+1]!=1)
+      L++;
+   return st->factors[2*L]==4;
+}
+
+OPUS_IRAM void opus_fft_impl_skip_first(const kiss_fft_state *st,kiss_fft_cpx *fout)
+{
+   opus_fft_stages(st, fout, 1);
+}
+
 void opus_fft_c(const kiss_fft_state *st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout)
 {
    int i;
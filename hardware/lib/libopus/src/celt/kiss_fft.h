@@ -143,6 +143,13 @@ void opus_fft_c(const kiss_fft_state *cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *
 void opus_ifft_c(const kiss_fft_state *cfg,const kiss_fft_cpx *fin,kiss_fft_cpx *fout);
 
 void opus_fft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout);
+
+/* The first stage opus_fft_impl() runs is a radix-4 one with all twiddles equal to one
+   whenever nfft is a multiple of 4 (kf_factor() orders it last). Callers that can do that
+   butterfly while producing the input, like the inverse MDCT, check for it with
+   opus_fft_first_stage_is_radix4() and then run only the remaining stages. */
+int opus_fft_first_stage_is_radix4(const kiss_fft_state *st);
+void opus_fft_impl_skip_first(const kiss_fft_state *st,kiss_fft_cpx *fout);
 void opus_ifft_impl(const kiss_fft_state *st,kiss_fft_cpx *fout);
 
 void opus_fft_free(const kiss_fft_state *cfg, int arch);
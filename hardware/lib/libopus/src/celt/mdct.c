@@ -239,32 +239,69 @@ void clt_mdct_forward_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_scal
 #endif /* OVERRIDE_clt_mdct_forward */
 
 #ifndef OVERRIDE_clt_mdct_backward
-void clt_mdct_backward_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_scalar * OPUS_RESTRICT out,
-      const opus_val16 * OPUS_RESTRICT window, int overlap, int shift, int stride, int arch)
+/* One block of the inverse MDCT, in two passes over out instead of four: the pre-rotation
+   is fused with the FFT's first, twiddle-free radix-4 stage, and the post-rotation with the
+   TDAC windowing. Bit-exact with the separate passes, every output is computed by exactly the
+   same operations. */
+static OPUS_INLINE void mdct_backward_block(const kiss_fft_state *st, int fuse_first_stage,
+      const kiss_fft_scalar *in, kiss_fft_scalar * OPUS_RESTRICT out,
+      const opus_val16 * OPUS_RESTRICT window, int overlap, int N2, int N4,
+      const kiss_twiddle_scalar *trig, int stride)
 {
    int i;
-   int N, N2, N4;
-   const kiss_twiddle_scalar *trig;
-   (void) arch;
-
-   N = l->n;
-   trig = l->trig;
-   for (i=0;i<shift;i++)
-   {
-      N >>= 1;
-      trig += N;
-   }
-   N2 = N>>1;
-   N4 = N>>2;
-
-   /* Pre-rotate */
+   if (fuse_first_stage)
    {
+      /* bitrev[] maps the pre-rotated points i, i+N4/4, i+N4/2 and i+3*N4/4 to the four
+         consecutive outputs bitrev[i]..bitrev[i]+3, which are exactly the inputs of one
+         butterfly of the first stage. So compute the four, do the butterfly in registers
+         and store the result once. */
+      const kiss_fft_scalar * OPUS_RESTRICT xp1 = in;
+      const kiss_fft_scalar * OPUS_RESTRICT xp2 = in+stride*(N2-1);
+      kiss_fft_cpx * OPUS_RESTRICT f = (kiss_fft_cpx*)(out+(overlap>>1));
+      const kiss_twiddle_scalar * OPUS_RESTRICT t = &trig[0];
+      const opus_int16 * OPUS_RESTRICT bitrev = st->bitrev;
+      int Q = N4>>2;
+      int step = 2*stride*Q;
+      for(i=0;i<Q;i++)
+      {
+         kiss_fft_cpx y[4];
+         kiss_fft_cpx scratch0, scratch1;
+         kiss_fft_cpx *Fout;
+         int k;
+         for (k=0;k<4;k++)
+         {
+            kiss_fft_scalar x1 = xp1[k*step];
+            kiss_fft_scalar x2 = xp2[-k*step];
+            kiss_twiddle_scalar t0 = t[i+k*Q];
+            kiss_twiddle_scalar t1 = t[N4+i+k*Q];
+            /* We swap real and imag because we use an FFT instead of an IFFT. */
+            y[k].i = ADD32_ovflw(S_MUL(x2, t0), S_MUL(x1, t1));
+            y[k].r = SUB32_ovflw(S_MUL(x1, t0), S_MUL(x2, t1));
+         }
+         /* kf_bfly4() for m==1 */
+         C_SUB( scratch0 , y[0], y[2] );
+         C_ADDTO(y[0], y[2]);
+         C_ADD( scratch1 , y[1] , y[3] );
+         Fout = f + *bitrev++;
+         C_SUB( Fout[2], y[0], scratch1 );
+         C_ADD( Fout[0], y[0], scratch1 );
+         C_SUB( scratch1 , y[1] , y[3] );
+         Fout[1].r = ADD32_ovflw(scratch0.r, scratch1.i);
+         Fout[1].i = SUB32_ovflw(scratch0.i, scratch1.r);
+         Fout[3].r = SUB32_ovflw(scratch0.r, scratch1.i);
+         Fout[3].i = ADD32_ovflw(scratch0.i, scratch1.r);
+         xp1+=2*stride;
+         xp2-=2*stride;
+      }
+      opus_fft_impl_skip_first(st, f);
+   } else {
+      /* Pre-rotate */
       /* Temp pointers to make it really clear to the compiler what we're doing */
       const kiss_fft_scalar * OPUS_RESTRICT xp1 = in;
       const kiss_fft_scalar * OPUS_RESTRICT xp2 = in+stride*(N2-1);
       kiss_fft_scalar * OPUS_RESTRICT yp = out+(overlap>>1);
       const kiss_twiddle_scalar * OPUS_RESTRICT t = &trig[0];
-      const opus_int16 * OPUS_RESTRICT bitrev = l->kfft[shift]->bitrev;
+      const opus_int16 * OPUS_RESTRICT bitrev = st->bitrev;
       for(i=0;i<N4;i++)
       {
          int rev;
@@ -279,21 +316,28 @@ void clt_mdct_backward_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_sca
          xp1+=2*stride;
          xp2-=2*stride;
       }
+      opus_fft_impl(st, (kiss_fft_cpx*)(out+(overlap>>1)));
    }
 
-   opus_fft_impl(l->kfft[shift], (kiss_fft_cpx*)(out+(overlap>>1)));
-
    /* Post-rotate and de-shuffle from both ends of the buffer at once to make
-      it in-place. */
+      it in-place. The first overlap/2 outputs from the front end are mirrored
+      with the previous block's tail for TDAC right away; the back end never
+      reaches them since overlap <= N2. */
    {
       kiss_fft_scalar * yp0 = out+(overlap>>1);
       kiss_fft_scalar * yp1 = out+(overlap>>1)+N2-2;
       const kiss_twiddle_scalar *t = &trig[0];
+      /* TDAC partners of yp0[0] and yp0[1]: out[overlap/2-1-2i] and out[overlap/2-2-2i] */
+      kiss_fft_scalar * OPUS_RESTRICT xp = out+(overlap>>1)-1;
+      const opus_val16 * OPUS_RESTRICT wp1 = window+(overlap>>1)-1;
+      const opus_val16 * OPUS_RESTRICT wp2 = window+(overlap>>1);
+      int tdac = overlap>>2;
+      celt_assert((overlap&3)==0 && tdac <= (N4+1)>>1);
       /* Loop to (N4+1)>>1 to handle odd N4. When N4 is odd, the
          middle pair will be computed twice. */
       for(i=0;i<(N4+1)>>1;i++)
       {
-         kiss_fft_scalar re, im, yr, yi;
+         kiss_fft_scalar re, im, yr, yi, yr0, yi1;
          kiss_twiddle_scalar t0, t1;
          /* We swap real and imag because we're using an FFT instead of an IFFT. */
          re = yp0[1];
@@ -301,43 +345,82 @@ void clt_mdct_backward_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_sca
          t0 = t[i];
          t1 = t[N4+i];
          /* We'd scale up by 2 here, but instead it's done when mixing the windows */
-         yr = ADD32_ovflw(S_MUL(re,t0), S_MUL(im,t1));
+         yr0 = ADD32_ovflw(S_MUL(re,t0), S_MUL(im,t1));
          yi = SUB32_ovflw(S_MUL(re,t1), S_MUL(im,t0));
          /* We swap real and imag because we're using an FFT instead of an IFFT. */
          re = yp1[1];
          im = yp1[0];
-         yp0[0] = yr;
          yp1[1] = yi;
 
          t0 = t[(N4-i-1)];
          t1 = t[(N2-i-1)];
          /* We'd scale up by 2 here, but instead it's done when mixing the windows */
          yr = ADD32_ovflw(S_MUL(re,t0), S_MUL(im,t1));
-         yi = SUB32_ovflw(S_MUL(re,t1), S_MUL(im,t0));
+         yi1 = SUB32_ovflw(S_MUL(re,t1), S_MUL(im,t0));
          yp1[0] = yr;
-         yp0[1] = yi;
+         if (i < tdac)
+         {
+            /* Mirror on both sides for TDAC */
+            kiss_fft_scalar x2;
+            x2 = xp[0];
+            xp[0] = SUB32_ovflw(MULT16_32_Q15(wp2[0], x2), MULT16_32_Q15(wp1[0], yr0));
+            yp0[0] = ADD32_ovflw(MULT16_32_Q15(wp1[0], x2), MULT16_32_Q15(wp2[0], yr0));
+            x2 = xp[-1];
+            xp[-1] = SUB32_ovflw(MULT16_32_Q15(wp2[1], x2), MULT16_32_Q15(wp1[-1], yi1));
+            yp0[1] = ADD32_ovflw(MULT16_32_Q15(wp1[-1], x2), MULT16_32_Q15(wp2[1], yi1));
+            xp -= 2;
+            wp1 -= 2;
+            wp2 += 2;
+         } else {
+            yp0[0] = yr0;
+            yp0[1] = yi1;
+         }
          yp0 += 2;
          yp1 -= 2;
       }
    }
+}
 
-   /* Mirror on both sides for TDAC */
-   {
-      kiss_fft_scalar * OPUS_RESTRICT xp1 = out+overlap-1;
-      kiss_fft_scalar * OPUS_RESTRICT yp1 = out;
-      const opus_val16 * OPUS_RESTRICT wp1 = window;
-      const opus_val16 * OPUS_RESTRICT wp2 = window+overlap-1;
+void clt_mdct_backward_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_scalar * OPUS_RESTRICT out,
+      const opus_val16 * OPUS_RESTRICT window, int overlap, int shift, int stride, int arch)
+{
+   clt_mdct_backward_blocks_c(l, in, out, window, overlap, shift, stride, 1, arch);
+}
 
-      for(i = 0; i < overlap/2; i++)
-      {
-         kiss_fft_scalar x1, x2;
-         x1 = *xp1;
-         x2 = *yp1;
-         *yp1++ = SUB32_ovflw(MULT16_32_Q15(*wp2, x2), MULT16_32_Q15(*wp1, x1));
-         *xp1-- = ADD32_ovflw(MULT16_32_Q15(*wp1, x2), MULT16_32_Q15(*wp2, x1));
-         wp1++;
-         wp2--;
-      }
+OPUS_IRAM void clt_mdct_backward_blocks_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_scalar * OPUS_RESTRICT out,
+      const opus_val16 * OPUS_RESTRICT window, int overlap, int shift, int B, int blocks, int arch)
+{
+   int i, b;
+   int N, N2, N4;
+   const kiss_twiddle_scalar *trig;
+   const kiss_fft_state *st;
+   int fuse_first_stage;
+   (void) arch;
+
+   N = l->n;
+   trig = l->trig;
+   for (i=0;i<shift;i++)
+   {
+      N >>= 1;
+      trig += N;
    }
+   N2 = N>>1;
+   N4 = N>>2;
+   st = l->kfft[shift];
+   fuse_first_stage = opus_fft_first_stage_is_radix4(st);
+
+   /* Block b overlap-adds into the tail block b-1 left in out, so they run in order. */
+   for (b=0;b<blocks;b++)
+      mdct_backward_block(st, fuse_first_stage, in+b, out+b*N2, window, overlap, N2, N4, trig, B);
+}
+#else
+
+void clt_mdct_backward_blocks_c(const mdct_lookup *l, kiss_fft_scalar *in, kiss_fft_scalar * OPUS_RESTRICT out,
+      const opus_val16 * OPUS_RESTRICT window, int overlap, int shift, int B, int blocks, int arch)
+{
+   int b;
+   int N2 = l->n>>(shift+1);
+   for (b=0;b<blocks;b++)
+      clt_mdct_backward(l, in+b, out+b*N2, window, overlap, shift, B, arch);
 }
 #endif /* OVERRIDE_clt_mdct_backward */
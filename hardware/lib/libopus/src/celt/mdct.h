@@ -74,6 +74,16 @@ void clt_mdct_backward_c(const mdct_lookup *l, kiss_fft_scalar *in,
       const opus_val16 * OPUS_RESTRICT window,
       int overlap, int shift, int stride, int arch);
 
+/** Runs the backward MDCT for the first `blocks` of the B interleaved blocks of in
+    (block b reads in[b], in[b+B], ...), overlap-adding block b into out+b*N/2 */
+void clt_mdct_backward_blocks_c(const mdct_lookup *l, kiss_fft_scalar *in,
+      kiss_fft_scalar * OPUS_RESTRICT out,
+      const opus_val16 * OPUS_RESTRICT window,
+      int overlap, int shift, int B, int blocks, int arch);
+
+#define clt_mdct_backward_blocks(_l, _in, _out, _window, _overlap, _shift, _B, _arch) \
+   clt_mdct_backward_blocks_c(_l, _in, _out, _window, _overlap, _shift, _B, _B, _arch)
+
 #if !defined(OVERRIDE_OPUS_MDCT)
 /* Is run-time CPU detection enabled on this platform? */
 #if defined(OPUS_HAVE_RTCD) && defined(HAVE_ARM_NE10)
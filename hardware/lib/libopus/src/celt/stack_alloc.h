@@ -140,8 +140,13 @@ extern char *global_stack_top;
 
 #else
 
+extern char *global_stack_high_water;
+/** Records a new high-water mark of the pseudostack and aborts if it grew past GLOBAL_STACK_SIZE */
+void opus_pseudostack_grow(char *top);
+#define PSEUDOSTACK_MARK(stack) ((stack) > global_stack_high_water ? opus_pseudostack_grow(stack) : (void)0)
+
 #define ALIGN(stack, size) ((stack) += ((size) - (long)(stack)) & ((size) - 1))
-#define PUSH(stack, size, type) (ALIGN((stack),sizeof(type)/sizeof(char)),(stack)+=(size)*(sizeof(type)/sizeof(char)),(type*)((stack)-(size)*(sizeof(type)/sizeof(char))))
+#define PUSH(stack, size, type) (ALIGN((stack),sizeof(type)/sizeof(char)),(stack)+=(size)*(sizeof(type)/sizeof(char)),PSEUDOSTACK_MARK(stack),(type*)((stack)-(size)*(sizeof(type)/sizeof(char))))
 #if 0 /* Set this to 1 to instrument pseudostack usage */
 #define RESTORE_STACK (printf("%ld %s:%d\n", global_stack-scratch_ptr, __FILE__, __LINE__),global_stack = _saved_stack)
 #else
@@ -0,0 +1,117 @@
+/* Copyright (C) the audio-network contributors */
+/**
+   @file fixed_xtensa.h
+   @brief Xtensa LX6 (ESP32) fixed-point operations
+*/
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FIXED_XTENSA_H
+#define FIXED_XTENSA_H
+
+/* All of these are bit-exact with the OPUS_FAST_INT64 == 0 variants in
+   fixed_generic.h. The 16x32 products are computed as a full 64-bit product
+   (MULL for the low word, MULSH for the high word) and brought back into 32
+   bits with a single funnel shift (SSAI + SRC). The generic C macros need two
+   16x16 products, a mask and two shifts for the same result. */
+
+#undef MULT16_32_Q16
+static OPUS_INLINE opus_val32 MULT16_32_Q16_xtensa(opus_val16 a, opus_val32 b)
+{
+  opus_int32 hi;
+  opus_int32 lo;
+  opus_val32 res;
+  __asm__(
+      "mull %1, %3, %4\n\t"
+      "mulsh %0, %3, %4\n\t"
+      "ssai 16\n\t"
+      "src %2, %0, %1\n\t"
+      : "=&r"(hi), "=&r"(lo), "=r"(res)
+      : "r"((opus_int32)a), "r"(b)
+      : "sar"
+  );
+  return res;
+}
+#define MULT16_32_Q16(a, b) (MULT16_32_Q16_xtensa(a, b))
+
+#undef MULT16_32_Q15
+static OPUS_INLINE opus_val32 MULT16_32_Q15_xtensa(opus_val16 a, opus_val32 b)
+{
+  opus_int32 hi;
+  opus_int32 lo;
+  opus_val32 res;
+  __asm__(
+      "mull %1, %3, %4\n\t"
+      "mulsh %0, %3, %4\n\t"
+      "ssai 15\n\t"
+      "src %2, %0, %1\n\t"
+      : "=&r"(hi), "=&r"(lo), "=r"(res)
+      : "r"((opus_int32)a), "r"(b)
+      : "sar"
+  );
+  return res;
+}
+#define MULT16_32_Q15(a, b) (MULT16_32_Q15_xtensa(a, b))
+
+#undef MAC16_32_Q15
+#define MAC16_32_Q15(c, a, b) ADD32(c, MULT16_32_Q15(a, b))
+
+#undef MAC16_32_Q16
+#define MAC16_32_Q16(c, a, b) ADD32(c, MULT16_32_Q16(a, b))
+
+/* The generic MULT32_32_Q31 drops the low*low partial product and truncates
+   the two cross products separately, so a full 64-bit product would not be
+   bit-exact. This keeps the same three partial products but schedules them
+   as MUL16S/MULL without the intermediate 16-bit casts. */
+#undef MULT32_32_Q31
+static OPUS_INLINE opus_val32 MULT32_32_Q31_xtensa(opus_val32 a, opus_val32 b)
+{
+  opus_int32 ah;
+  opus_int32 bh;
+  opus_int32 al;
+  opus_int32 bl;
+  opus_int32 t;
+  opus_val32 res;
+  __asm__(
+      "srai %0, %6, 16\n\t"
+      "srai %1, %7, 16\n\t"
+      "extui %2, %6, 0, 16\n\t"
+      "extui %3, %7, 0, 16\n\t"
+      "mul16s %5, %0, %1\n\t"
+      "slli %5, %5, 1\n\t"
+      "mull %4, %0, %3\n\t"
+      "srai %4, %4, 15\n\t"
+      "add %5, %5, %4\n\t"
+      "mull %4, %1, %2\n\t"
+      "srai %4, %4, 15\n\t"
+      "add %5, %5, %4\n\t"
+      : "=&r"(ah), "=&r"(bh), "=&r"(al), "=&r"(bl), "=&r"(t), "=&r"(res)
+      : "r"(a), "r"(b)
+  );
+  return res;
+}
+#define MULT32_32_Q31(a, b) (MULT32_32_Q31_xtensa(a, b))
+
+#endif
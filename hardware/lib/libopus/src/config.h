@@ -124,6 +124,35 @@
 /* Define if binary requires NEON intrinsics support */
 /* #undef OPUS_ARM_PRESUME_NEON_INTR */
 
+/* Use Xtensa LX6 (ESP32) inline asm optimizations for the fixed-point macros.
+   Define OPUS_XTENSA_DISABLE_INLINE_ASM to build the generic C macros instead. */
+#if defined(__XTENSA__) && !defined(OPUS_XTENSA_DISABLE_INLINE_ASM)
+#define OPUS_XTENSA_INLINE_ASM 1
+#endif
+
+/* Place the decoder's hot loops (FFT butterflies, inverse MDCT, comb filter,
+   de-emphasis, range decoder, PVQ decode, SILK core, SILK to 48kHz upsampler)
+   in IRAM instead of executing them from flash through the instruction cache.
+   Define OPUS_DISABLE_IRAM_PLACEMENT to leave them in flash. Like IRAM_ATTR, but in
+   sections of their own (.iram1.opus.*, which the IDF linker script puts in IRAM
+   with the rest of .iram1.*), so that scripts/iram_report.py finds them in the map file. */
+#if defined(__XTENSA__) && !defined(OPUS_DISABLE_IRAM_PLACEMENT)
+#include <esp_attr.h>
+#define OPUS_IRAM _SECTION_ATTR_IMPL(".iram1.opus", __COUNTER__)
+#else
+#define OPUS_IRAM
+#endif
+
+/* Keep small tables the decoder reads for every band or sample (the PVQ codebook
+   sizes in cwrs.c, the upsampler's interpolation filter) in DRAM rather than in
+   flash, where they compete with code and the other read-only data for the flash
+   cache. Goes with OPUS_DISABLE_IRAM_PLACEMENT. */
+#if defined(__XTENSA__) && !defined(OPUS_DISABLE_IRAM_PLACEMENT)
+#define OPUS_DRAM DRAM_ATTR
+#else
+#define OPUS_DRAM
+#endif
+
 /* This is a build of OPUS */
 #define OPUS_BUILD /**/
 
@@ -182,7 +211,24 @@
 /* #undef USE_ALLOCA */
 
 /* Use C99 variable-size arrays */
-#define VAR_ARRAYS 1
+/* #undef VAR_ARRAYS */
+
+/* Serve all ALLOC()s from one statically allocated arena (see opus_scratch.c)
+   instead of VLAs on the calling task's stack. Only one task may run the
+   codec at a time. The decoder at 48 kHz stereo peaks at 8228 bytes (CELT
+   and hybrid 20-60 ms frames, including mode transitions, PLC and FEC);
+   GLOBAL_STACK_SIZE adds some headroom to that. The encoder needs about
+   35 kB, so the unit tests, which encode their own input, get a bigger arena.
+   Check opus_scratch_high_water_mark() when changing how the codec is used. */
+#define NONTHREADSAFE_PSEUDOSTACK 1
+#ifndef GLOBAL_STACK_SIZE
+#ifdef UNIT_TEST
+#define GLOBAL_STACK_SIZE 40000
+#else
+#define GLOBAL_STACK_SIZE 10240
+#endif
+#endif
+#define OVERRIDE_OPUS_ALLOC_SCRATCH 1
 
 /* Define to empty if `const' does not conform to ANSI C. */
 /* #undef const */
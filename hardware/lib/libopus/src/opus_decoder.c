@@ -60,6 +60,7 @@ struct OpusDecoder {
    opus_int32   Fs;          /** Sampling rate (at the API level) */
    silk_DecControlStruct DecControl;
    int          decode_gain;
+   CELTOutputStage output_stage;
    int          arch;
 
    /* Everything beyond this point gets cleared on a reset */
@@ -106,10 +107,16 @@ int opus_decoder_get_size(int channels)
    int ret;
    if (channels<1 || channels > 2)
       return 0;
+#ifdef OPUS_DECODER_CELT_ONLY
+   /* No SILK state is carried when SILK decoding is compiled out. */
+   (void)ret;
+   silkDecSizeBytes = 0;
+#else
    ret = silk_Get_Decoder_Size( &silkDecSizeBytes );
    if(ret)
       return 0;
    silkDecSizeBytes = align(silkDecSizeBytes);
+#endif
    celtDecSizeBytes = celt_decoder_get_size(channels);
    return align(sizeof(OpusDecoder))+silkDecSizeBytes+celtDecSizeBytes;
 }
@@ -125,12 +132,16 @@ int opus_decoder_init(OpusDecoder *st, opus_int32 Fs, int channels)
       return OPUS_BAD_ARG;
 
    OPUS_CLEAR((char*)st, opus_decoder_get_size(channels));
+#ifdef OPUS_DECODER_CELT_ONLY
+   silkDecSizeBytes = 0;
+#else
    /* Initialize SILK decoder */
    ret = silk_Get_Decoder_Size(&silkDecSizeBytes);
    if (ret)
       return OPUS_INTERNAL_ERROR;
 
    silkDecSizeBytes = align(silkDecSizeBytes);
+#endif
    st->silk_dec_offset = align(sizeof(OpusDecoder));
    st->celt_dec_offset = st->silk_dec_offset+silkDecSizeBytes;
    silk_dec = (char*)st+st->silk_dec_offset;
@@ -141,9 +152,13 @@ int opus_decoder_init(OpusDecoder *st, opus_int32 Fs, int channels)
    st->DecControl.API_sampleRate = st->Fs;
    st->DecControl.nChannelsAPI      = st->channels;
 
+#ifdef OPUS_DECODER_CELT_ONLY
+   (void)silk_dec;
+#else
    /* Reset decoder */
    ret = silk_InitDecoder( silk_dec );
    if(ret)return OPUS_INTERNAL_ERROR;
+#endif
 
    /* Initialize CELT decoder */
    ret = celt_decoder_init(celt_dec, Fs, channels);
@@ -218,8 +233,11 @@ static int opus_packet_get_mode(const unsigned char *data)
    return mode;
 }
 
+/* apply_output_stage is 0 for the transition frames that get mixed into
+   another frame, which then gets the output stage as a whole. */
 static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
-      opus_int32 len, opus_val16 *pcm, int frame_size, int decode_fec)
+      opus_int32 len, opus_val16 *pcm, int frame_size, int decode_fec,
+      int apply_output_stage)
 {
    void *silk_dec;
    CELTDecoder *celt_dec;
@@ -249,6 +267,7 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
    const opus_val16 *window;
    opus_uint32 redundant_rng = 0;
    int celt_accum;
+   int output_stage_fused = 0;
    ALLOC_STACK;
 
    silk_dec = (char*)st+st->silk_dec_offset;
@@ -296,7 +315,7 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
       if (audiosize > F20)
       {
          do {
-            int ret = opus_decode_frame(st, NULL, 0, pcm, IMIN(audiosize, F20), 0);
+            int ret = opus_decode_frame(st, NULL, 0, pcm, IMIN(audiosize, F20), 0, apply_output_stage);
             if (ret<0)
             {
                RESTORE_STACK;
@@ -342,7 +361,7 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
    if (transition && mode == MODE_CELT_ONLY)
    {
       pcm_transition = pcm_transition_celt;
-      opus_decode_frame(st, NULL, 0, pcm_transition, IMIN(F5, audiosize), 0);
+      opus_decode_frame(st, NULL, 0, pcm_transition, IMIN(F5, audiosize), 0, 0);
    }
    if (audiosize > frame_size)
    {
@@ -357,6 +376,14 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
    pcm_silk_size = (mode != MODE_CELT_ONLY && !celt_accum) ? IMAX(F10, frame_size)*st->channels : ALLOC_NONE;
    ALLOC(pcm_silk, pcm_silk_size, opus_int16);
 
+#ifdef OPUS_DECODER_CELT_ONLY
+   /* opus_decode_native() rejects SILK and hybrid packets, so the only mode
+      that can reach this point (including PLC through prev_mode) is CELT. */
+   celt_assert(mode == MODE_CELT_ONLY);
+   (void)silk_dec;
+   (void)silk_frame_size;
+   (void)silk_ret;
+#else
    /* SILK processing */
    if (mode != MODE_CELT_ONLY)
    {
@@ -417,6 +444,7 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
         decoded_samples += silk_frame_size;
       } while( decoded_samples < frame_size );
    }
+#endif /* OPUS_DECODER_CELT_ONLY */
 
    start_band = 0;
    if (!decode_fec && mode != MODE_CELT_ONLY && data != NULL
@@ -462,7 +490,7 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
    if (transition && mode != MODE_CELT_ONLY)
    {
       pcm_transition = pcm_transition_silk;
-      opus_decode_frame(st, NULL, 0, pcm_transition, IMIN(F5, audiosize), 0);
+      opus_decode_frame(st, NULL, 0, pcm_transition, IMIN(F5, audiosize), 0, 0);
    }
 
 
@@ -515,9 +543,20 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
       /* Make sure to discard any previous CELT state */
       if (mode != st->prev_mode && st->prev_mode > 0 && !st->prev_redundancy)
          MUST_SUCCEED(celt_decoder_ctl(celt_dec, OPUS_RESET_STATE));
+#ifndef CUSTOM_MODES
+      /* Let CELT apply the output stage while it de-emphasizes, unless the
+         frame still gets mixed with a transition frame afterwards */
+      output_stage_fused = apply_output_stage && mode == MODE_CELT_ONLY && !transition
+            && st->channels == 2 && st->Fs == 48000
+            && celt_output_stage_active(&st->output_stage, st->channels);
+#endif
+      if (output_stage_fused)
+         MUST_SUCCEED(celt_decoder_ctl(celt_dec, CELT_SET_OUTPUT_STAGE(&st->output_stage)));
       /* Decode CELT */
       celt_ret = celt_decode_with_ec(celt_dec, decode_fec ? NULL : data,
                                      len, pcm, celt_frame_size, &dec, celt_accum);
+      if (output_stage_fused)
+         MUST_SUCCEED(celt_decoder_ctl(celt_dec, CELT_SET_OUTPUT_STAGE((CELTOutputStage*)NULL)));
    } else {
       unsigned char silence[2] = {0xFF, 0xFF};
       if (!celt_accum)
@@ -593,17 +632,9 @@ static int opus_decode_frame(OpusDecoder *st, const unsigned char *data,
       }
    }
 
-   if(st->decode_gain)
-   {
-      opus_val32 gain;
-      gain = celt_exp2(MULT16_16_P15(QCONST16(6.48814081e-4f, 25), st->decode_gain));
-      for (i=0;i<frame_size*st->channels;i++)
-      {
-         opus_val32 x;
-         x = MULT16_32_P16(pcm[i],gain);
-         pcm[i] = SATURATE(x, 32767);
-      }
-   }
+   if (apply_output_stage && !output_stage_fused
+         && celt_output_stage_active(&st->output_stage, st->channels))
+      celt_output_stage_apply(&st->output_stage, pcm, frame_size, st->channels);
 
    if (len <= 1)
       st->rangeFinal = 0;
@@ -645,7 +676,7 @@ int opus_decode_native(OpusDecoder *st, const unsigned char *data,
       int pcm_count=0;
       do {
          int ret;
-         ret = opus_decode_frame(st, NULL, 0, pcm+pcm_count*st->channels, frame_size-pcm_count, 0);
+         ret = opus_decode_frame(st, NULL, 0, pcm+pcm_count*st->channels, frame_size-pcm_count, 0, 1);
          if (ret<0)
             return ret;
          pcm_count += ret;
@@ -659,6 +690,12 @@ int opus_decode_native(OpusDecoder *st, const unsigned char *data,
       return OPUS_BAD_ARG;
 
    packet_mode = opus_packet_get_mode(data);
+#ifdef OPUS_DECODER_CELT_ONLY
+   /* Checked before any state is touched so a stray SILK/hybrid packet
+      leaves the decoder exactly as it was. */
+   if (packet_mode != MODE_CELT_ONLY)
+      return OPUS_INVALID_PACKET;
+#endif
    packet_bandwidth = opus_packet_get_bandwidth(data);
    packet_frame_size = opus_packet_get_samples_per_frame(data, st->Fs);
    packet_stream_channels = opus_packet_get_nb_channels(data);
@@ -695,7 +732,7 @@ int opus_decode_native(OpusDecoder *st, const unsigned char *data,
       st->frame_size = packet_frame_size;
       st->stream_channels = packet_stream_channels;
       ret = opus_decode_frame(st, data, size[0], pcm+st->channels*(frame_size-packet_frame_size),
-            packet_frame_size, 1);
+            packet_frame_size, 1, 1);
       if (ret<0)
          return ret;
       else {
@@ -719,7 +756,7 @@ int opus_decode_native(OpusDecoder *st, const unsigned char *data,
    for (i=0;i<count;i++)
    {
       int ret;
-      ret = opus_decode_frame(st, data, size[i], pcm+nb_samples*st->channels, frame_size-nb_samples, 0);
+      ret = opus_decode_frame(st, data, size[i], pcm+nb_samples*st->channels, frame_size-nb_samples, 0, 1);
       if (ret<0)
          return ret;
       celt_assert(ret==packet_frame_size);
@@ -873,7 +910,11 @@ int opus_decoder_ctl(OpusDecoder *st, int request, ...)
             ((char*)&st->OPUS_DECODER_RESET_START - (char*)st));
 
       celt_decoder_ctl(celt_dec, OPUS_RESET_STATE);
+#ifdef OPUS_DECODER_CELT_ONLY
+      (void)silk_dec;
+#else
       silk_InitDecoder( silk_dec );
+#endif
       st->stream_channels = st->channels;
       st->frame_size = st->Fs/400;
    }
@@ -919,6 +960,48 @@ int opus_decoder_ctl(OpusDecoder *st, int request, ...)
           goto bad_arg;
        }
        st->decode_gain = value;
+       st->output_stage.apply_gain = value != 0;
+       st->output_stage.gain = celt_exp2(MULT16_16_P15(QCONST16(6.48814081e-4f, 25), value));
+   }
+   break;
+   case OPUS_GET_OUTPUT_ROUTING_REQUEST:
+   {
+      opus_int32 *value = va_arg(ap, opus_int32*);
+      if (!value)
+      {
+         goto bad_arg;
+      }
+      *value = st->output_stage.routing;
+   }
+   break;
+   case OPUS_SET_OUTPUT_ROUTING_REQUEST:
+   {
+       opus_int32 value = va_arg(ap, opus_int32);
+       if (value<OPUS_OUTPUT_STEREO || value>OPUS_OUTPUT_RIGHT)
+       {
+          goto bad_arg;
+       }
+       st->output_stage.routing = value;
+   }
+   break;
+   case OPUS_GET_OUTPUT_DITHER_REQUEST:
+   {
+      opus_int32 *value = va_arg(ap, opus_int32*);
+      if (!value)
+      {
+         goto bad_arg;
+      }
+      *value = st->output_stage.dither;
+   }
+   break;
+   case OPUS_SET_OUTPUT_DITHER_REQUEST:
+   {
+       opus_int32 value = va_arg(ap, opus_int32);
+       if (value<0 || value>1)
+       {
+          goto bad_arg;
+       }
+       st->output_stage.dither = value;
    }
    break;
    case OPUS_GET_LAST_PACKET_DURATION_REQUEST:
@@ -951,6 +1034,22 @@ int opus_decoder_ctl(OpusDecoder *st, int request, ...)
        ret = celt_decoder_ctl(celt_dec, OPUS_GET_PHASE_INVERSION_DISABLED(value));
    }
    break;
+   case OPUS_SET_PLC_POLICY_REQUEST:
+   {
+       opus_int32 value = va_arg(ap, opus_int32);
+       ret = celt_decoder_ctl(celt_dec, OPUS_SET_PLC_POLICY(value));
+   }
+   break;
+   case OPUS_GET_PLC_POLICY_REQUEST:
+   {
+       opus_int32 *value = va_arg(ap, opus_int32*);
+       if (!value)
+       {
+          goto bad_arg;
+       }
+       ret = celt_decoder_ctl(celt_dec, OPUS_GET_PLC_POLICY(value));
+   }
+   break;
    default:
       /*fprintf(stderr, "unknown opus_decoder_ctl() request: %d", request);*/
       ret = OPUS_UNIMPLEMENTED;
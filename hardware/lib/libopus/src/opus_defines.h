@@ -169,6 +169,13 @@ extern "C" {
 #define OPUS_SET_PHASE_INVERSION_DISABLED_REQUEST 4046
 #define OPUS_GET_PHASE_INVERSION_DISABLED_REQUEST 4047
 #define OPUS_GET_IN_DTX_REQUEST              4049
+/* Decoder output stage of this fork, not part of upstream libopus */
+#define OPUS_SET_OUTPUT_ROUTING_REQUEST      4100
+#define OPUS_GET_OUTPUT_ROUTING_REQUEST      4101
+#define OPUS_SET_OUTPUT_DITHER_REQUEST       4102
+#define OPUS_GET_OUTPUT_DITHER_REQUEST       4103
+#define OPUS_SET_PLC_POLICY_REQUEST          4104
+#define OPUS_GET_PLC_POLICY_REQUEST          4105
 
 /** Defines for the presence of extended APIs. */
 #define OPUS_HAVE_OPUS_PROJECTION_H
@@ -217,6 +224,16 @@ extern "C" {
 #define OPUS_FRAMESIZE_100_MS                5008 /**< Use 100 ms frames */
 #define OPUS_FRAMESIZE_120_MS                5009 /**< Use 120 ms frames */
 
+#define OPUS_OUTPUT_STEREO                   0 /**< Both channels as decoded (default) */
+#define OPUS_OUTPUT_SWAPPED                  1 /**< Left and right exchanged */
+#define OPUS_OUTPUT_MONO                     2 /**< The average of both channels on both outputs */
+#define OPUS_OUTPUT_LEFT                     3 /**< The left channel on both outputs */
+#define OPUS_OUTPUT_RIGHT                    4 /**< The right channel on both outputs */
+
+#define OPUS_PLC_FULL                        0 /**< Pitch-based concealment with LPC extrapolation (default) */
+#define OPUS_PLC_NOISE                       1 /**< Shaped noise at the last band energies, fading out */
+#define OPUS_PLC_REPEAT                      2 /**< A faded repeat of the last decoded audio */
+
 /**@}*/
 
 
@@ -768,6 +785,52 @@ extern "C" {
   * @hideinitializer */
 #define OPUS_GET_PITCH(x) OPUS_GET_PITCH_REQUEST, __opus_check_int_ptr(x)
 
+/** Configures which decoded channel goes to which output channel of a stereo decoder.
+  * The routing is applied together with the OPUS_SET_GAIN() gain, for CELT frames in
+  * the same loop as the de-emphasis filter, so it costs no extra pass over the output.
+  * This setting survives decoder reset and has no effect on mono decoders.
+  * @param[in] x <tt>opus_int32</tt>: one of OPUS_OUTPUT_STEREO (default),
+  *                                   OPUS_OUTPUT_SWAPPED, OPUS_OUTPUT_MONO,
+  *                                   OPUS_OUTPUT_LEFT or OPUS_OUTPUT_RIGHT.
+  * @hideinitializer */
+#define OPUS_SET_OUTPUT_ROUTING(x) OPUS_SET_OUTPUT_ROUTING_REQUEST, __opus_check_int(x)
+/** Gets the decoder's configured output routing. @see OPUS_SET_OUTPUT_ROUTING
+  *
+  * @param[out] x <tt>opus_int32 *</tt>: one of the OPUS_OUTPUT_* values.
+  * @hideinitializer */
+#define OPUS_GET_OUTPUT_ROUTING(x) OPUS_GET_OUTPUT_ROUTING_REQUEST, __opus_check_int_ptr(x)
+
+/** Configures triangular dither when an OPUS_SET_GAIN() attenuation requantizes the output.
+  * Without it the scaled samples are rounded, which leaves the rounding error correlated
+  * with the signal at low volumes. The dither has no effect without attenuation.
+  * This setting survives decoder reset. Only fixed-point builds dither.
+  * @param[in] x <tt>opus_int32</tt>: 1 to enable, 0 to disable (default).
+  * @hideinitializer */
+#define OPUS_SET_OUTPUT_DITHER(x) OPUS_SET_OUTPUT_DITHER_REQUEST, __opus_check_int(x)
+/** Gets whether the decoder dithers its attenuated output. @see OPUS_SET_OUTPUT_DITHER
+  *
+  * @param[out] x <tt>opus_int32 *</tt>: 1 if enabled, 0 otherwise.
+  * @hideinitializer */
+#define OPUS_GET_OUTPUT_DITHER(x) OPUS_GET_OUTPUT_DITHER_REQUEST, __opus_check_int_ptr(x)
+
+/** Configures how CELT conceals lost frames, trading quality for CPU time.
+  * OPUS_PLC_FULL runs a pitch search and LPC analysis on the first frame of a
+  * loss, which can cost more than decoding a frame. OPUS_PLC_NOISE skips both
+  * and synthesizes noise at the last band energies, which costs about as much
+  * as the inverse MDCT of a frame. OPUS_PLC_REPEAT only copies and fades
+  * earlier output. After five lost frames all three fade into noise. A new
+  * policy takes effect with the next loss burst. SILK and hybrid frames are
+  * always concealed by SILK.
+  * This setting survives decoder reset.
+  * @param[in] x <tt>opus_int32</tt>: OPUS_PLC_FULL (default), OPUS_PLC_NOISE or OPUS_PLC_REPEAT.
+  * @hideinitializer */
+#define OPUS_SET_PLC_POLICY(x) OPUS_SET_PLC_POLICY_REQUEST, __opus_check_int(x)
+/** Gets the decoder's configured concealment policy. @see OPUS_SET_PLC_POLICY
+  *
+  * @param[out] x <tt>opus_int32 *</tt>: one of the OPUS_PLC_* values.
+  * @hideinitializer */
+#define OPUS_GET_PLC_POLICY(x) OPUS_GET_PLC_POLICY_REQUEST, __opus_check_int_ptr(x)
+
 /**@}*/
 
 /** @defgroup opus_libinfo Opus library information functions
@@ -0,0 +1,91 @@
+/* Copyright (C) the audio-network contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//#ifdef HAVE_CONFIG_H
+#include "config.h"
+//#endif
+
+#include <string.h>
+#include "opus_defines.h"
+#include "opus_profile.h"
+
+static const char *const opus_stage_names[OPUS_STAGE_COUNT] = {
+   "celt_entropy_energy",
+   "celt_quant_all_bands",
+   "celt_synthesis",
+   "celt_comb_filter",
+   "celt_deemphasis",
+   "celt_plc",
+   "silk_decode_frame",
+   "silk_resampler"
+};
+
+const char *opus_stage_name(int stage)
+{
+   if (stage < 0 || stage >= OPUS_STAGE_COUNT)
+   {
+      return "unknown";
+   }
+   return opus_stage_names[stage];
+}
+
+#ifdef OPUS_STAGE_PROFILING
+
+#ifndef __XTENSA__
+#include <time.h>
+
+opus_uint32 opus_profile_host_ticks(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (opus_uint32)ts.tv_sec * 1000000000u + (opus_uint32)ts.tv_nsec;
+}
+#endif
+
+opus_stage_profile opus_stage_profile_current;
+
+void opus_stage_profile_get(opus_stage_profile *profile)
+{
+   *profile = opus_stage_profile_current;
+}
+
+void opus_stage_profile_reset(void)
+{
+   memset(&opus_stage_profile_current, 0, sizeof(opus_stage_profile_current));
+}
+
+#else
+
+void opus_stage_profile_get(opus_stage_profile *profile)
+{
+   memset(profile, 0, sizeof(*profile));
+}
+
+void opus_stage_profile_reset(void)
+{
+}
+
+#endif
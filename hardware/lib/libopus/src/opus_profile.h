@@ -0,0 +1,114 @@
+/* Copyright (C) the audio-network contributors */
+/**
+   @file opus_profile.h
+   @brief Optional per-stage timing of the decoder
+*/
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPUS_PROFILE_H
+#define OPUS_PROFILE_H
+
+#include "opus_types.h"
+#include "opus_defines.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Decoder stages that are timed when the library is built with OPUS_STAGE_PROFILING */
+typedef enum {
+   OPUS_STAGE_CELT_ENTROPY_ENERGY,   /**< CELT side information, allocation and coarse/fine energy */
+   OPUS_STAGE_CELT_QUANT_ALL_BANDS,  /**< CELT PVQ band decoding */
+   OPUS_STAGE_CELT_SYNTHESIS,        /**< CELT denormalisation and inverse MDCT */
+   OPUS_STAGE_CELT_COMB_FILTER,      /**< CELT pitch post-filter */
+   OPUS_STAGE_CELT_DEEMPHASIS,       /**< CELT de-emphasis and output conversion */
+   OPUS_STAGE_CELT_PLC,              /**< CELT packet loss concealment */
+   OPUS_STAGE_SILK_DECODE_FRAME,     /**< one SILK frame of one channel */
+   OPUS_STAGE_SILK_RESAMPLER,        /**< SILK output to the API sample rate */
+   OPUS_STAGE_COUNT
+} opus_stage;
+
+/** Time spent per stage since the last reset. Ticks are CPU cycles on Xtensa and nanoseconds elsewhere,
+    64 bits so that they don't wrap between reports (32 bits do after 18s at 240MHz). */
+typedef struct {
+   opus_uint64 ticks[OPUS_STAGE_COUNT];
+   opus_uint32 calls[OPUS_STAGE_COUNT];
+} opus_stage_profile;
+
+/** Copies the accumulated profile; all zero when the library is built without OPUS_STAGE_PROFILING */
+void opus_stage_profile_get(opus_stage_profile *profile);
+
+/** Clears the accumulated profile */
+void opus_stage_profile_reset(void);
+
+/** Short, stable name of a stage for reports, e.g. "celt_synthesis" */
+const char *opus_stage_name(int stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(OPUS_BUILD) && defined(OPUS_STAGE_PROFILING)
+
+/* Single global, like the scratch arena: only one task may run the codec. */
+extern opus_stage_profile opus_stage_profile_current;
+
+#ifndef __XTENSA__
+opus_uint32 opus_profile_host_ticks(void);
+#endif
+
+static OPUS_INLINE opus_uint32 opus_profile_ticks(void)
+{
+#ifdef __XTENSA__
+   opus_uint32 ccount;
+   __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+   return ccount;
+#else
+   return opus_profile_host_ticks();
+#endif
+}
+
+/* Declare OPUS_PROFILE_DECL with the other locals, then bracket each stage with
+   OPUS_PROFILE_BEGIN() and OPUS_PROFILE_END(stage). A stage timed in several parts
+   ends all but its last part with OPUS_PROFILE_PAUSE(stage), which adds the time
+   without counting a call. Without OPUS_STAGE_PROFILING these expand to nothing. */
+#define OPUS_PROFILE_DECL opus_uint32 opus_profile_start;
+#define OPUS_PROFILE_BEGIN() (opus_profile_start = opus_profile_ticks())
+#define OPUS_PROFILE_PAUSE(stage) \
+   (opus_stage_profile_current.ticks[stage] += (opus_uint32)(opus_profile_ticks() - opus_profile_start))
+#define OPUS_PROFILE_END(stage) \
+   (OPUS_PROFILE_PAUSE(stage), opus_stage_profile_current.calls[stage]++)
+
+#else
+
+#define OPUS_PROFILE_DECL
+#define OPUS_PROFILE_BEGIN() ((void)0)
+#define OPUS_PROFILE_PAUSE(stage) ((void)0)
+#define OPUS_PROFILE_END(stage) ((void)0)
+
+#endif
+
+#endif /* OPUS_PROFILE_H */
@@ -0,0 +1,102 @@
+/* Copyright (C) the audio-network contributors */
+/*
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   - Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+   ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+   OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+   PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+   LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//#ifdef HAVE_CONFIG_H
+#include "config.h"
+//#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "opus_scratch.h"
+#include "celt/arch.h"
+#include "celt/stack_alloc.h"
+
+#ifdef NONTHREADSAFE_PSEUDOSTACK
+
+/* The pseudostack lives in .bss, so it is reserved at link time, always in
+   internal RAM and never competes with the heap. */
+static char opus_scratch_arena[GLOBAL_STACK_SIZE] __attribute__((aligned(8)));
+
+char *global_stack_high_water = 0;
+
+#ifdef OVERRIDE_OPUS_ALLOC_SCRATCH
+void *opus_alloc_scratch(size_t size)
+{
+   if (size > sizeof(opus_scratch_arena))
+   {
+      abort();
+   }
+   global_stack_high_water = opus_scratch_arena;
+   return opus_scratch_arena;
+}
+#endif
+
+void opus_pseudostack_grow(char *top)
+{
+   global_stack_high_water = top;
+   if (top > scratch_ptr + GLOBAL_STACK_SIZE)
+   {
+      fprintf(stderr, "opus pseudostack overflow: %d of %d bytes\n", (int)(top - scratch_ptr), GLOBAL_STACK_SIZE);
+      abort();
+   }
+}
+
+size_t opus_scratch_size(void)
+{
+   return GLOBAL_STACK_SIZE;
+}
+
+size_t opus_scratch_high_water_mark(void)
+{
+   if (scratch_ptr == 0)
+   {
+      return 0;
+   }
+   return (size_t)(global_stack_high_water - scratch_ptr);
+}
+
+void opus_scratch_reset_high_water_mark(void)
+{
+   global_stack_high_water = global_stack;
+}
+
+#else
+
+size_t opus_scratch_size(void)
+{
+   return 0;
+}
+
+size_t opus_scratch_high_water_mark(void)
+{
+   return 0;
+}
+
+void opus_scratch_reset_high_water_mark(void)
+{
+}
+
+#endif
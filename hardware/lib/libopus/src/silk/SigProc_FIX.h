@@ -633,6 +633,10 @@ static OPUS_INLINE opus_int64 silk_max_64(opus_int64 a, opus_int64 b)
 #include "mips/sigproc_fix_mipsr1.h"
 #endif
 
+#ifdef OPUS_XTENSA_INLINE_ASM
+#include "xtensa/SigProc_FIX_xtensa.h"
+#endif
+
 
 #ifdef  __cplusplus
 }
@@ -32,6 +32,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "main.h"
 #include "../celt/stack_alloc.h"
 #include "../celt/os_support.h"
+#include "../opus_profile.h"
 
 /************************/
 /* Decoder Super Struct */
@@ -102,6 +103,7 @@ opus_int silk_Decode(                                   /* O    Returns error co
     opus_int has_side;
     opus_int stereo_to_mono;
     int delay_stack_alloc;
+    OPUS_PROFILE_DECL
     SAVE_STACK;
 
     celt_assert( decControl->nChannelsInternal == 1 || decControl->nChannelsInternal == 2 );
@@ -297,7 +299,9 @@ opus_int silk_Decode(                                   /* O    Returns error co
             } else {
                 condCoding = CODE_CONDITIONALLY;
             }
+            OPUS_PROFILE_BEGIN();
             ret += silk_decode_frame( &channel_state[ n ], psRangeDec, &samplesOut1_tmp[ n ][ 2 ], &nSamplesOutDec, lostFlag, condCoding, arch);
+            OPUS_PROFILE_END( OPUS_STAGE_SILK_DECODE_FRAME );
         } else {
             silk_memset( &samplesOut1_tmp[ n ][ 2 ], 0, nSamplesOutDec * sizeof( opus_int16 ) );
         }
@@ -337,7 +341,9 @@ opus_int silk_Decode(                                   /* O    Returns error co
     for( n = 0; n < silk_min( decControl->nChannelsAPI, decControl->nChannelsInternal ); n++ ) {
 
         /* Resample decoded signal to API_sampleRate */
+        OPUS_PROFILE_BEGIN();
         ret += silk_resampler( &channel_state[ n ].resampler_state, resample_out_ptr, &samplesOut1_tmp[ n ][ 1 ], nSamplesOutDec );
+        OPUS_PROFILE_END( OPUS_STAGE_SILK_RESAMPLER );
 
         /* Interleave if stereo output and stereo stream */
         if( decControl->nChannelsAPI == 2 ) {
@@ -352,7 +358,9 @@ opus_int silk_Decode(                                   /* O    Returns error co
         if ( stereo_to_mono ){
             /* Resample right channel for newly collapsed stereo just in case
                we weren't doing collapsing when switching to mono */
+            OPUS_PROFILE_BEGIN();
             ret += silk_resampler( &channel_state[ 1 ].resampler_state, resample_out_ptr, &samplesOut1_tmp[ 0 ][ 1 ], nSamplesOutDec );
+            OPUS_PROFILE_END( OPUS_STAGE_SILK_RESAMPLER );
 
             for( i = 0; i < *nSamplesOut; i++ ) {
                 samplesOut[ 1 + 2 * i ] = resample_out_ptr[ i ];
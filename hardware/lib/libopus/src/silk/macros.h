@@ -147,5 +147,9 @@ static OPUS_INLINE opus_int32 silk_CLZ32(opus_int32 in32)
 #include "arm/macros_arm64.h"
 #endif
 
+#ifdef OPUS_XTENSA_INLINE_ASM
+#include "xtensa/macros_xtensa.h"
+#endif
+
 #endif /* SILK_MACROS_H */
 
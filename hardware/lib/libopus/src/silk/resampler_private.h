@@ -36,6 +36,10 @@ extern "C" {
 #include "resampler_structs.h"
 #include "resampler_rom.h"
 
+#ifdef OPUS_XTENSA_INLINE_ASM
+#include "xtensa/resampler_xtensa.h"
+#endif
+
 /* Number of input samples to process in the inner loop */
 #define RESAMPLER_MAX_BATCH_SIZE_MS             10
 #define RESAMPLER_MAX_FS_KHZ                    48
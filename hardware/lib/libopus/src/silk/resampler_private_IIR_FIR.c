@@ -33,6 +33,30 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "resampler_private.h"
 #include "../celt/stack_alloc.h"
 
+#if !defined(OPUS_DISABLE_FAST_RESAMPLER)
+#ifndef OVERRIDE_silk_resampler_fir8
+/* One output of the 8-tap interpolation filter: the first half of the taps is row_a, the   */
+/* second half is row_b backwards (the table only stores one half of each symmetric pair). */
+static OPUS_INLINE opus_int32 silk_resampler_fir8(
+    const opus_int16            *buf,
+    const opus_int16            *row_a,
+    const opus_int16            *row_b
+)
+{
+    opus_int32 res_Q15;
+    res_Q15 = silk_SMULBB(          buf[ 0 ], row_a[ 0 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 1 ], row_a[ 1 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 2 ], row_a[ 2 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 3 ], row_a[ 3 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 4 ], row_b[ 3 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 5 ], row_b[ 2 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 6 ], row_b[ 1 ] );
+    res_Q15 = silk_SMLABB( res_Q15, buf[ 7 ], row_b[ 0 ] );
+    return res_Q15;
+}
+#endif
+#endif
+
 static OPUS_INLINE opus_int16 *silk_resampler_private_IIR_FIR_INTERPOL(
     opus_int16  *out,
     opus_int16  *buf,
@@ -41,8 +65,32 @@ static OPUS_INLINE opus_int16 *silk_resampler_private_IIR_FIR_INTERPOL(
 )
 {
     opus_int32 index_Q16, res_Q15;
-    opus_int16 *buf_ptr;
     opus_int32 table_index;
+#if !defined(OPUS_DISABLE_FAST_RESAMPLER)
+    opus_int32 res2_Q15, index2_Q16, table_index2;
+
+    /* Two outputs per iteration. The phase has to be stepped exactly like below, the Q16   */
+    /* increment is rounded, so the sequence of table rows can't be precomputed per ratio. */
+    for( index_Q16 = 0; index_Q16 + index_increment_Q16 < max_index_Q16; index_Q16 = index2_Q16 + index_increment_Q16 ) {
+        index2_Q16   = index_Q16 + index_increment_Q16;
+        table_index  = silk_SMULWB( index_Q16 & 0xFFFF, 12 );
+        table_index2 = silk_SMULWB( index2_Q16 & 0xFFFF, 12 );
+        res_Q15  = silk_resampler_fir8( &buf[ index_Q16 >> 16 ],
+            silk_resampler_frac_FIR_12[ table_index ], silk_resampler_frac_FIR_12[ 11 - table_index ] );
+        res2_Q15 = silk_resampler_fir8( &buf[ index2_Q16 >> 16 ],
+            silk_resampler_frac_FIR_12[ table_index2 ], silk_resampler_frac_FIR_12[ 11 - table_index2 ] );
+        out[ 0 ] = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( res_Q15, 15 ) );
+        out[ 1 ] = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( res2_Q15, 15 ) );
+        out += 2;
+    }
+    if( index_Q16 < max_index_Q16 ) {
+        table_index = silk_SMULWB( index_Q16 & 0xFFFF, 12 );
+        res_Q15 = silk_resampler_fir8( &buf[ index_Q16 >> 16 ],
+            silk_resampler_frac_FIR_12[ table_index ], silk_resampler_frac_FIR_12[ 11 - table_index ] );
+        *out++ = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( res_Q15, 15 ) );
+    }
+#else
+    opus_int16 *buf_ptr;
 
     /* Interpolate upsampled signal and store in output array */
     for( index_Q16 = 0; index_Q16 < max_index_Q16; index_Q16 += index_increment_Q16 ) {
@@ -59,10 +107,11 @@ static OPUS_INLINE opus_int16 *silk_resampler_private_IIR_FIR_INTERPOL(
         res_Q15 = silk_SMLABB( res_Q15, buf_ptr[ 7 ], silk_resampler_frac_FIR_12[ 11 - table_index ][ 0 ] );
         *out++ = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( res_Q15, 15 ) );
     }
+#endif
     return out;
 }
 /* Upsample using a combination of allpass-based 2x upsampling and FIR interpolation */
-void silk_resampler_private_IIR_FIR(
+OPUS_IRAM void silk_resampler_private_IIR_FIR(
     void                            *SS,            /* I/O  Resampler state             */
     opus_int16                      out[],          /* O    Output signal               */
     const opus_int16                in[],           /* I    Input signal                */
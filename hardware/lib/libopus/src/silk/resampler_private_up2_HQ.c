@@ -35,7 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 /* Upsample by a factor 2, high quality */
 /* Uses 2nd order allpass filters for the 2x upsampling, followed by a      */
 /* notch filter just above Nyquist.                                         */
-void silk_resampler_private_up2_HQ(
+OPUS_IRAM void silk_resampler_private_up2_HQ(
     opus_int32                      *S,             /* I/O  Resampler state [ 6 ]       */
     opus_int16                      *out,           /* O    Output signal [ 2 * len ]   */
     const opus_int16                *in,            /* I    Input signal [ len ]        */
@@ -44,6 +44,9 @@ void silk_resampler_private_up2_HQ(
 {
     opus_int32 k;
     opus_int32 in32, out32_1, out32_2, Y, X;
+#if !defined(OPUS_DISABLE_FAST_RESAMPLER)
+    opus_int32 S0, S1, S2, S3, S4, S5;
+#endif
 
     silk_assert( silk_resampler_up2_hq_0[ 0 ] > 0 );
     silk_assert( silk_resampler_up2_hq_0[ 1 ] > 0 );
@@ -52,6 +55,53 @@ void silk_resampler_private_up2_HQ(
     silk_assert( silk_resampler_up2_hq_1[ 1 ] > 0 );
     silk_assert( silk_resampler_up2_hq_1[ 2 ] < 0 );
 
+#if !defined(OPUS_DISABLE_FAST_RESAMPLER)
+    /* Same filter as below, with the state kept in locals: out[] may alias S[] as far as the */
+    /* compiler knows, so every store would otherwise force all six states to be reloaded.    */
+    S0 = S[ 0 ]; S1 = S[ 1 ]; S2 = S[ 2 ];
+    S3 = S[ 3 ]; S4 = S[ 4 ]; S5 = S[ 5 ];
+    for( k = 0; k < len; k++ ) {
+        in32 = silk_LSHIFT( (opus_int32)in[ k ], 10 );
+
+        /* Even output sample */
+        Y       = silk_SUB32( in32, S0 );
+        X       = silk_SMULWB( Y, silk_resampler_up2_hq_0[ 0 ] );
+        out32_1 = silk_ADD32( S0, X );
+        S0      = silk_ADD32( in32, X );
+
+        Y       = silk_SUB32( out32_1, S1 );
+        X       = silk_SMULWB( Y, silk_resampler_up2_hq_0[ 1 ] );
+        out32_2 = silk_ADD32( S1, X );
+        S1      = silk_ADD32( out32_1, X );
+
+        Y       = silk_SUB32( out32_2, S2 );
+        X       = silk_SMLAWB( Y, Y, silk_resampler_up2_hq_0[ 2 ] );
+        out32_1 = silk_ADD32( S2, X );
+        S2      = silk_ADD32( out32_2, X );
+
+        out[ 2 * k ] = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( out32_1, 10 ) );
+
+        /* Odd output sample */
+        Y       = silk_SUB32( in32, S3 );
+        X       = silk_SMULWB( Y, silk_resampler_up2_hq_1[ 0 ] );
+        out32_1 = silk_ADD32( S3, X );
+        S3      = silk_ADD32( in32, X );
+
+        Y       = silk_SUB32( out32_1, S4 );
+        X       = silk_SMULWB( Y, silk_resampler_up2_hq_1[ 1 ] );
+        out32_2 = silk_ADD32( S4, X );
+        S4      = silk_ADD32( out32_1, X );
+
+        Y       = silk_SUB32( out32_2, S5 );
+        X       = silk_SMLAWB( Y, Y, silk_resampler_up2_hq_1[ 2 ] );
+        out32_1 = silk_ADD32( S5, X );
+        S5      = silk_ADD32( out32_2, X );
+
+        out[ 2 * k + 1 ] = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( out32_1, 10 ) );
+    }
+    S[ 0 ] = S0; S[ 1 ] = S1; S[ 2 ] = S2;
+    S[ 3 ] = S3; S[ 4 ] = S4; S[ 5 ] = S5;
+#else
     /* Internal variables and state are in Q10 format */
     for( k = 0; k < len; k++ ) {
         /* Convert to Q10 */
@@ -99,6 +149,7 @@ void silk_resampler_private_up2_HQ(
         /* Apply gain in Q15, convert back to int16 and store to output */
         out[ 2 * k + 1 ] = (opus_int16)silk_SAT16( silk_RSHIFT_ROUND( out32_1, 10 ) );
     }
+#endif
 }
 
 void silk_resampler_private_up2_HQ_wrapper(
@@ -0,0 +1,90 @@
+/***********************************************************************
+Copyright (C) the audio-network contributors
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+- Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+- Neither the name of Internet Society, IETF or IETF Trust, nor the
+names of specific contributors, may be used to endorse or promote
+products derived from this software without specific prior written
+permission.
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+#ifndef SILK_MACROS_XTENSA_H
+#define SILK_MACROS_XTENSA_H
+
+/* Bit-exact with the OPUS_FAST_INT64 == 0 variants in macros.h: a full
+   64-bit product from MULL/MULSH, shifted down by 16 with SSAI + SRC. */
+
+/* (a32 * (opus_int32)((opus_int16)(b32))) >> 16 output have to be 32bit int */
+#undef silk_SMULWB
+static OPUS_INLINE opus_int32 silk_SMULWB_xtensa(opus_int32 a, opus_int32 b)
+{
+  opus_int32 hi;
+  opus_int32 lo;
+  opus_int32 res;
+  __asm__(
+      "mull %1, %3, %4\n\t"
+      "mulsh %0, %3, %4\n\t"
+      "ssai 16\n\t"
+      "src %2, %0, %1\n\t"
+      : "=&r"(hi), "=&r"(lo), "=r"(res)
+      : "r"(a), "r"((opus_int32)(opus_int16)b)
+      : "sar"
+  );
+  return res;
+}
+#define silk_SMULWB(a, b) (silk_SMULWB_xtensa(a, b))
+
+/* a32 + (b32 * (opus_int32)((opus_int16)(c32))) >> 16 output have to be 32bit int */
+#undef silk_SMLAWB
+#define silk_SMLAWB(a, b, c) ((a) + silk_SMULWB(b, c))
+
+/* (a32 * b32) >> 16 */
+#undef silk_SMULWW
+static OPUS_INLINE opus_int32 silk_SMULWW_xtensa(opus_int32 a, opus_int32 b)
+{
+  opus_int32 hi;
+  opus_int32 lo;
+  opus_int32 res;
+  __asm__(
+      "mull %1, %3, %4\n\t"
+      "mulsh %0, %3, %4\n\t"
+      "ssai 16\n\t"
+      "src %2, %0, %1\n\t"
+      : "=&r"(hi), "=&r"(lo), "=r"(res)
+      : "r"(a), "r"(b)
+      : "sar"
+  );
+  return res;
+}
+#define silk_SMULWW(a, b) (silk_SMULWW_xtensa(a, b))
+
+/* a32 + ((b32 * c32) >> 16) */
+#undef silk_SMLAWW
+#define silk_SMLAWW(a, b, c) ((a) + silk_SMULWW(b, c))
+
+/* (a32 * (b32 >> 16)) >> 16 */
+#undef silk_SMULWT
+#define silk_SMULWT(a, b) (silk_SMULWW_xtensa(a, (b) >> 16))
+
+/* a32 + (b32 * (c32 >> 16)) >> 16 */
+#undef silk_SMLAWT
+#define silk_SMLAWT(a, b, c) ((a) + silk_SMULWT(b, c))
+
+#endif /* SILK_MACROS_XTENSA_H */
@@ -0,0 +1,82 @@
+/***********************************************************************
+Copyright (C) the audio-network contributors
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+- Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+- Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+- Neither the name of Internet Society, IETF or IETF Trust, nor the
+names of specific contributors, may be used to endorse or promote
+products derived from this software without specific prior written
+permission.
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+***********************************************************************/
+
+#ifndef SILK_RESAMPLER_XTENSA_H
+#define SILK_RESAMPLER_XTENSA_H
+
+#include <xtensa/config/core-isa.h>
+
+#if XCHAL_HAVE_MAC16
+/* The 8-tap interpolation filter of resampler_private_IIR_FIR.c on the MAC16
+   accumulator: one MUL.AA.LL and seven MULA.AA.LL, loads interleaved with the
+   multiplies. The low 32 bits of ACC are exactly the wrapping 32-bit sum of the
+   generic version. ACC is part of the task context, so no interrupt or task
+   switch can disturb it. */
+#define OVERRIDE_silk_resampler_fir8
+static OPUS_INLINE opus_int32 silk_resampler_fir8(
+    const opus_int16            *buf,
+    const opus_int16            *row_a,
+    const opus_int16            *row_b
+)
+{
+  opus_int32 res;
+  opus_int32 x0, c0, x1, c1;
+  __asm__(
+      "l16si %1, %5, 0\n\t"
+      "l16si %2, %6, 0\n\t"
+      "l16si %3, %5, 2\n\t"
+      "l16si %4, %6, 2\n\t"
+      "mul.aa.ll %1, %2\n\t"
+      "l16si %1, %5, 4\n\t"
+      "l16si %2, %6, 4\n\t"
+      "mula.aa.ll %3, %4\n\t"
+      "l16si %3, %5, 6\n\t"
+      "l16si %4, %6, 6\n\t"
+      "mula.aa.ll %1, %2\n\t"
+      "l16si %1, %5, 8\n\t"
+      "l16si %2, %7, 6\n\t"
+      "mula.aa.ll %3, %4\n\t"
+      "l16si %3, %5, 10\n\t"
+      "l16si %4, %7, 4\n\t"
+      "mula.aa.ll %1, %2\n\t"
+      "l16si %1, %5, 12\n\t"
+      "l16si %2, %7, 2\n\t"
+      "mula.aa.ll %3, %4\n\t"
+      "l16si %3, %5, 14\n\t"
+      "l16si %4, %7, 0\n\t"
+      "mula.aa.ll %1, %2\n\t"
+      "mula.aa.ll %3, %4\n\t"
+      "rsr.acclo %0\n\t"
+      : "=r"(res), "=&r"(x0), "=&r"(c0), "=&r"(x1), "=&r"(c1)
+      : "r"(buf), "r"(row_a), "r"(row_b)
+      : "acc", "memory"
+  );
+  return res;
+}
+#endif
+
+#endif /* SILK_RESAMPLER_XTENSA_H */
@@ -0,0 +1,171 @@
+# Checks that src/protogen/ip.pb.h and ip.pb.c match protocol/ip.proto and protobuf_ip.options:
+# the same messages, field tags, labels and types, enum values, array sizes and callbacks the
+# nanopb generator (generate_nanopb.ps1) would emit. Run it after changing the protocol; it
+# parses ip.proto with protoc, so it catches generated files that were edited instead of
+# regenerated, or not regenerated at all.
+#
+# usage: check_nanopb.py [<protoc>]
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HARDWARE_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PROTO_DIR = os.path.join(os.path.dirname(HARDWARE_DIR), "protocol")
+OPTIONS_FILE = os.path.join(HARDWARE_DIR, "protobuf_ip.options")
+HEADER_FILE = os.path.join(HARDWARE_DIR, "src", "protogen", "ip.pb.h")
+SOURCE_FILE = os.path.join(HARDWARE_DIR, "src", "protogen", "ip.pb.c")
+
+SCALAR_TYPES = {
+    "TYPE_BOOL": "BOOL", "TYPE_UINT32": "UINT32", "TYPE_UINT64": "UINT64", "TYPE_INT32": "INT32",
+    "TYPE_INT64": "INT64", "TYPE_SINT32": "SINT32", "TYPE_SINT64": "SINT64", "TYPE_FIXED32": "FIXED32",
+    "TYPE_FIXED64": "FIXED64", "TYPE_SFIXED32": "SFIXED32", "TYPE_SFIXED64": "SFIXED64",
+    "TYPE_FLOAT": "FLOAT", "TYPE_DOUBLE": "DOUBLE", "TYPE_STRING": "STRING", "TYPE_BYTES": "BYTES",
+    "TYPE_MESSAGE": "MESSAGE",
+}
+
+
+def parse_text_format(text):
+    """the protobuf text format protoc --decode prints, as nested lists of (key, value) pairs"""
+    tokens = re.findall(r'"(?:[^"\\]|\\.)*"|[{}:]|[^\s{}:]+', text)
+    position = 0
+
+    def parse_block():
+        nonlocal position
+        entries = []
+        while position < len(tokens) and tokens[position] != "}":
+            key = tokens[position]
+            position += 1
+            if tokens[position] == ":":
+                value = tokens[position + 1].strip('"')
+                position += 2
+            else:
+                position += 1  # {
+                value = parse_block()
+                position += 1  # }
+            entries.append((key, value))
+        return entries
+
+    return parse_block()
+
+
+def values(entries, key):
+    return [value for entry_key, value in entries if entry_key == key]
+
+
+def value(entries, key, default=None):
+    found = values(entries, key)
+    return found[0] if found else default
+
+
+def load_proto(protoc):
+    with tempfile.TemporaryDirectory() as tmp:
+        descriptor_file = os.path.join(tmp, "ip.desc")
+        subprocess.check_call([protoc, "-I" + PROTO_DIR, "--descriptor_set_out=" + descriptor_file, os.path.join(PROTO_DIR, "ip.proto")])
+        with open(descriptor_file, "rb") as descriptor:
+            text = subprocess.check_output(
+                [protoc, "-I/usr/include", "-I/usr/local/include",
+                 "--decode=google.protobuf.FileDescriptorSet", "google/protobuf/descriptor.proto"],
+                stdin=descriptor, text=True)
+    return value(parse_text_format(text), "file")
+
+
+def load_options():
+    options = {}
+    with open(OPTIONS_FILE) as options_file:
+        for line in options_file:
+            columns = line.split()
+            if columns:
+                options[columns[0]] = dict(option.split(":", 1) for option in columns[1:])
+    return options
+
+
+def main():
+    protoc = sys.argv[1] if len(sys.argv) > 1 else "protoc"
+    proto = load_proto(protoc)
+    options = load_options()
+    with open(HEADER_FILE) as header_file:
+        header = header_file.read()
+    with open(SOURCE_FILE) as source_file:
+        source = source_file.read()
+    errors = []
+
+    enums = {}
+    for enum in values(proto, "enum_type"):
+        name = value(enum, "name")
+        enums[name] = [(value(v, "name"), int(value(v, "number"))) for v in values(enum, "value")]
+        for value_name, number in enums[name]:
+            if not re.search(r"\b%s_%s = %d\b" % (name, value_name, number), header):
+                errors.append("enum %s: %s = %d is missing" % (name, value_name, number))
+
+    messages = values(proto, "message_type")
+    proto_names = sorted(value(message, "name") for message in messages)
+    header_names = sorted(re.findall(r"^extern const pb_msgdesc_t (\w+)_msg;", header, re.MULTILINE))
+    bound_names = sorted(re.findall(r"^PB_BIND\((\w+), \1, \w+\)", source, re.MULTILINE))
+    if header_names != proto_names:
+        errors.append("ip.pb.h has the messages %s, ip.proto %s" % (header_names, proto_names))
+    if bound_names != proto_names:
+        errors.append("ip.pb.c binds the messages %s, ip.proto has %s" % (bound_names, proto_names))
+
+    for message in messages:
+        name = value(message, "name")
+        fieldlist = re.search(r"#define %s_FIELDLIST\(X, a\) \\\n((?:X\(.*\n)+)" % name, header)
+        struct = re.search(r"typedef struct _%s \{(.*?)\} %s;" % (name, name), header, re.DOTALL)
+        if fieldlist is None or struct is None:
+            errors.append("%s: no struct or FIELDLIST in ip.pb.h" % name)
+            continue
+        header_fields = {}
+        for line in fieldlist.group(1).splitlines():
+            x = re.match(r"X\(a, (\w+),\s+(\w+),\s+(\w+),\s+(?:\(\w+,(\w+),[\w.]+\)|(\w+)),\s+(\d+)\)", line)
+            header_fields[x.group(4) or x.group(5)] = (x.group(1), x.group(2), x.group(3), int(x.group(6)))
+
+        message_options = options.get(name, {})
+        callback = message_options.get("callback_function", "").strip('"')
+        if callback and not re.search(r"#define %s_CALLBACK %s\b" % (name, callback), header):
+            errors.append("%s: the callback is not %s" % (name, callback))
+
+        for field in values(message, "field"):
+            field_name = value(field, "name")
+            number = int(value(field, "number"))
+            proto_type = value(field, "type")
+            if proto_type == "TYPE_ENUM":
+                enum_name = value(field, "type_name").lstrip(".")
+                nanopb_type = "UENUM" if all(n >= 0 for _, n in enums.get(enum_name, [])) else "ENUM"
+            else:
+                nanopb_type = SCALAR_TYPES[proto_type]
+            label = {"LABEL_REQUIRED": "REQUIRED", "LABEL_REPEATED": "REPEATED"}.get(value(field, "label"), "OPTIONAL")
+            if value(field, "oneof_index") is not None:
+                label = "ONEOF"
+
+            field_options = options.get("%s.%s" % (name, field_name), {})
+            max_size = field_options.get("max_size")
+            max_count = field_options.get("max_count")
+            is_static = (nanopb_type not in ("STRING", "BYTES") or max_size is not None) and (label != "REPEATED" or max_count is not None)
+            expected = ("STATIC" if is_static else "CALLBACK", label, nanopb_type, number)
+
+            if field_name not in header_fields:
+                errors.append("%s.%s: missing in ip.pb.h" % (name, field_name))
+                continue
+            if header_fields.pop(field_name) != expected:
+                errors.append("%s.%s: ip.pb.h doesn't have it as %s" % (name, field_name, " ".join(map(str, expected))))
+            if not re.search(r"#define %s_%s_tag\s+%d\n" % (name, field_name, number), header):
+                errors.append("%s.%s: no tag define %d" % (name, field_name, number))
+            if max_count is not None and not re.search(r"\b%s\[%s\];" % (field_name, max_count), struct.group(1)):
+                errors.append("%s.%s: the array doesn't hold max_count %s" % (name, field_name, max_count))
+            if max_size is not None and nanopb_type == "STRING" and not re.search(r"char %s\[%s\];" % (field_name, max_size), struct.group(1)):
+                errors.append("%s.%s: the string doesn't hold max_size %s" % (name, field_name, max_size))
+            if max_size is not None and nanopb_type == "BYTES" and not re.search(r"PB_BYTES_ARRAY_T\(%s\) %s_%s_t;" % (max_size, name, field_name), header):
+                errors.append("%s.%s: the bytes don't hold max_size %s" % (name, field_name, max_size))
+        for field_name in header_fields:
+            errors.append("%s.%s: in ip.pb.h, but not in ip.proto" % (name, field_name))
+
+    for error in errors:
+        print(error)
+    print("ip.pb.h/ip.pb.c %s ip.proto" % ("match" if not errors else "DON'T MATCH"))
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
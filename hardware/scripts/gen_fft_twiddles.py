@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Generates lib/libopus/src/celt/static_fft_packed_fixed.h: the twiddles of the four static
+# FFTs (480, 240, 120 and 60 points) re-ordered per butterfly stage, so that the specialized
+# FFTs in kiss_fft.c read them sequentially instead of with a stride through the shared table.
+# The values are copied, not recomputed, from static_modes_fixed.h, which keeps the FFTs bit-exact.
+#
+#   python3 scripts/gen_fft_twiddles.py
+import os
+import re
+
+CELT_DIR = os.path.join(os.path.dirname(__file__), "..", "lib", "libopus", "src", "celt")
+MODES_HEADER = os.path.join(CELT_DIR, "static_modes_fixed.h")
+OUTPUT = os.path.join(CELT_DIR, "static_fft_packed_fixed.h")
+
+
+def parse_modes():
+    source = open(MODES_HEADER).read()
+    table = re.search(r"fft_twiddles48000_960\[480\] = \{(.*?)\};", source, re.S).group(1)
+    twiddles = [(int(r), int(i)) for r, i in re.findall(r"\{(-?\d+), (-?\d+)\}", table)]
+    assert len(twiddles) == 480
+
+    states = []
+    for match in re.finditer(r"static const kiss_fft_state fft_state48000_960_\d = \{\s*(\d+),.*?\n(-?\d+),\s*/\* shift \*/\s*\n\{([^}]*)\}", source, re.S):
+        nfft = int(match.group(1))
+        shift = int(match.group(2))
+        factors = [int(f) for f in match.group(3).split(",") if f.strip()]
+        states.append((nfft, shift, factors))
+    assert [s[0] for s in states] == [480, 240, 120, 60]
+    return twiddles, states
+
+
+def stages(shift, factors):
+    """the stages in the order opus_fft_impl runs them: (radix, m, fstride << shift)"""
+    radices, ms = [], []
+    for i in range(0, len(factors), 2):
+        radices.append(factors[i])
+        ms.append(factors[i + 1])
+        if factors[i + 1] == 1:
+            break
+    fstride = [1]
+    for p in radices:
+        fstride.append(fstride[-1] * p)
+    shift = max(shift, 0)
+    return [(radices[i], ms[i], fstride[i] << shift) for i in reversed(range(len(radices)))]
+
+
+def main():
+    twiddles, states = parse_modes()
+    out = [
+        "/* The contents of this file was automatically generated by scripts/gen_fft_twiddles.py",
+        "   from fft_twiddles48000_960 in static_modes_fixed.h. For every radix-3, -4 and -5 stage",
+        "   of the static FFTs it holds, per butterfly column j, the twiddles j*k*fstride for",
+        "   k = 1..radix-1 next to each other. */",
+        "",
+        "#ifndef STATIC_FFT_PACKED_FIXED_H",
+        "#define STATIC_FFT_PACKED_FIXED_H",
+        "",
+    ]
+    for nfft, shift, factors in states:
+        for radix, m, fs in stages(shift, factors):
+            if radix == 2 or m == 1:
+                continue  # no twiddles: constant in kf_bfly2, all ones for m == 1
+            values = [twiddles[j * k * fs] for j in range(m) for k in range(1, radix)]
+            out.append("static const kiss_twiddle_cpx fft_twiddles%d_radix%d[%d] = {" % (nfft, radix, len(values)))
+            for n in range(0, len(values), radix - 1):
+                out.append(", ".join("{%d, %d}" % v for v in values[n:n + radix - 1]) + ",")
+            out.append("};")
+            out.append("")
+    out.append("#endif")
+    open(OUTPUT, "w").write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,52 @@
+# Prints how much of the ESP32's IRAM the firmware uses after each build and
+# how much of that goes to the libopus functions placed there with OPUS_IRAM
+# (see lib/libopus/src/config.h), from their .iram1.opus.* sections in the map file.
+Import("env")
+
+import os
+import re
+import subprocess
+
+IRAM_SIZE_BYTES = 128 * 1024
+OPUS_IRAM_BUDGET_BYTES = 12 * 1024
+
+MAP_FILE = os.path.join(env.subst("$BUILD_DIR"), "iram_report.map")
+env.Append(LINKFLAGS=["-Wl,-Map=" + MAP_FILE])
+
+# an input section in the memory map: its name, then address and size, on the same line
+# or, for long names, on the next one
+OPUS_IRAM_SECTION = re.compile(r"^ (\.iram1\.opus\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s", re.MULTILINE)
+
+
+def toolchain_binary(name):
+    return re.sub(r"gcc$", name, env.subst("$CC"))
+
+
+def iram_report(source, target, env):
+    elf = str(target[0])
+
+    iram_text_size = 0
+    for line in subprocess.check_output([toolchain_binary("size"), "-A", elf], text=True).splitlines():
+        columns = line.split()
+        if len(columns) >= 2 and columns[0] in (".iram0.vectors", ".iram0.text"):
+            iram_text_size += int(columns[1])
+
+    with open(MAP_FILE) as map_file:
+        memory_map = map_file.read()
+    # sections the linker dropped are listed before the memory map, without a size that counts
+    memory_map = memory_map[memory_map.find("Linker script and memory map"):]
+    opus_size = 0
+    opus_count = 0
+    for match in OPUS_IRAM_SECTION.finditer(memory_map):
+        size = int(match.group(3), 16)
+        if size > 0:
+            opus_size += size
+            opus_count += 1
+
+    print("IRAM: %d of %d bytes used (%.1f%%)" % (iram_text_size, IRAM_SIZE_BYTES, 100.0 * iram_text_size / IRAM_SIZE_BYTES))
+    print("IRAM: libopus hot loops take %d bytes in %d functions (budget %d bytes)" % (opus_size, opus_count, OPUS_IRAM_BUDGET_BYTES))
+    if opus_size > OPUS_IRAM_BUDGET_BYTES:
+        print("WARNING: libopus exceeds its IRAM budget by %d bytes" % (opus_size - OPUS_IRAM_BUDGET_BYTES))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", iram_report)
@@ -6,10 +6,13 @@
 #include <math.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_interface.h>
 #include <esp_event.h>
+#include <esp_mac.h>
+#include <nvs.h>
 #include <lwip/err.h>
 #include <lwip/sys.h>
 #include <lwip/dhcp.h>
@@ -19,6 +22,7 @@
 #include <pb_decode.h>
 #include "protogen/ip.pb.h"
 #include "playback.hpp"
+#include "discovery_filter.h"
 #include <opus.h>
 
 #define MAX_ENCODED_FRAME_SIZE 4096
@@ -106,97 +110,650 @@ wifi_config_t network_await_config() {
     return esp_wifi_config;
 }
 
-bool network_scan_and_set_bssi_with_best_signal(wifi_sta_config_t* config) {
-    char ssidForScanConfig[34];
-    memcpy(&ssidForScanConfig, &config->ssid[0], 33 * sizeof(char));
-    ssidForScanConfig[33] = 0;
+// the scan considers this many of the APs it finds
+#define NETWORK_SCAN_MAX_APS 10
+
+// per channel; a background scan leaves the AP's channel for this long each time, which the jitter buffer has to cover
+#define NETWORK_BACKGROUND_SCAN_MILLIS_PER_CHANNEL 40
+
+/**
+ * starts a scan for the configured SSID on all channels; the driver posts WIFI_EVENT_SCAN_DONE when it
+ * is done. A background scan, while connected, dwells shorter on each channel.
+ */
+esp_err_t network_scan_start(const wifi_sta_config_t* config, bool background) {
+    static char ssid_for_scan_config[33];
+    memcpy(&ssid_for_scan_config[0], &config->ssid[0], 32 * sizeof(char));
+    ssid_for_scan_config[32] = 0;
     wifi_scan_config_t scan_config = {
-        .ssid = (uint8_t*) &(ssidForScanConfig[0])
+        .ssid = (uint8_t*) &ssid_for_scan_config[0]
     };
-    ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
-    uint16_t n_aps_found;
+    if (background) {
+        scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+        scan_config.scan_time.active.min = NETWORK_BACKGROUND_SCAN_MILLIS_PER_CHANNEL / 2;
+        scan_config.scan_time.active.max = NETWORK_BACKGROUND_SCAN_MILLIS_PER_CHANNEL;
+    }
+    return esp_wifi_scan_start(&scan_config, false);
+}
+
+/** after WIFI_EVENT_SCAN_DONE: points the config at the AP with the best signal, whose RSSI goes to rssi. False if the scan found none. */
+bool network_scan_choose_best(wifi_sta_config_t* config, int8_t* rssi) {
+    static wifi_ap_record_t records[NETWORK_SCAN_MAX_APS];
+    uint16_t n_aps_found = 0;
     ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&n_aps_found));
-    if (n_aps_found <= 0) {
-        Serial.println("Scan found no APs, cannot choose the one with best rssi :(");
+    // also frees the driver's list of the APs that don't fit
+    uint16_t n_aps_to_consider = NETWORK_SCAN_MAX_APS;
+    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&n_aps_to_consider, records));
+    if (n_aps_to_consider == 0) {
+        Serial.println("[network] Scan found no APs, cannot choose the one with best rssi :(");
         return false;
     }
 
-    uint16_t n_aps_to_consider =  min(n_aps_found, (uint16_t) 10);
-    wifi_ap_record_t* records = (wifi_ap_record_t*) malloc(sizeof(wifi_ap_record_t) * n_aps_to_consider);
-    assert(records != nullptr);
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&n_aps_to_consider, records));
-    Serial.printf("WiFi Scan result (showing %d of %d)\n", n_aps_to_consider, n_aps_found);
-    int8_t max_rssi = -127;
-    uint8_t max_rssi_bssid[6];
+    Serial.printf("[network] WiFi Scan result (showing %d of %d)\n", n_aps_to_consider, n_aps_found);
+    const wifi_ap_record_t* best = &records[0];
     for (size_t i = 0;i < n_aps_to_consider;i++) {
-        wifi_ap_record_t ap_record = records[i];
-        char* bssid_str = format_hex(&ap_record.bssid[0], 6);
-        char ssid_str[34];
-        memcpy(&ssid_str, &ap_record.ssid[0], 33);
-        ssid_str[33] = 0;
-        Serial.printf("SSID=%s (BSSID %s) at %ddbm\n", &ssid_str[0], bssid_str, ap_record.rssi);
-        free(bssid_str);
-
-        if (ap_record.rssi > max_rssi) {
-            max_rssi = ap_record.rssi;
-            memcpy(&max_rssi_bssid[0], &ap_record.bssid[0], 6 * sizeof(uint8_t));
+        Serial.printf("[network] BSSID " MACSTR " on channel %d at %ddbm\n", MAC2STR(records[i].bssid), records[i].primary, records[i].rssi);
+        if (records[i].rssi > best->rssi) {
+            best = &records[i];
         }
     }
-    free(records);
 
-    memcpy(&config->bssid[0], &max_rssi_bssid[0], 6 * sizeof(uint8_t));
+    memcpy(&config->bssid[0], &best->bssid[0], 6 * sizeof(uint8_t));
     config->bssid_set = true;
+    config->channel = best->primary;
+    *rssi = best->rssi;
+    return true;
+}
+
+// the AP and lease of the last connection, in NVS, so that the next connect can skip the scan
+#define NETWORK_WIFI_CACHE_NAMESPACE "network"
+#define NETWORK_WIFI_CACHE_KEY       "last_ap"
+#define NETWORK_WIFI_CACHE_VERSION   1
+
+typedef struct {
+    uint32_t version;
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+    // the last DHCP lease, network byte order. It is not configured statically: nobody would renew it
+    // and the DHCP server could hand it out again during a stream. lwIP built with
+    // CONFIG_LWIP_DHCP_RESTORE_LAST_IP requests the last address right away instead of discovering
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+} network_wifi_cache_t;
+
+/** reads the cache from NVS; false if there is none or it was written by another firmware version */
+bool network_wifi_cache_load(network_wifi_cache_t* cache) {
+    nvs_handle_t handle;
+    if (nvs_open(NETWORK_WIFI_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(*cache);
+    esp_err_t err = nvs_get_blob(handle, NETWORK_WIFI_CACHE_KEY, cache, &size);
+    nvs_close(handle);
+    return err == ESP_OK && size == sizeof(*cache) && cache->version == NETWORK_WIFI_CACHE_VERSION;
+}
+
+/** writes the cache to NVS unless it is there already, which spares the flash on every reconnect to the same AP */
+void network_wifi_cache_store(const network_wifi_cache_t* cache) {
+    network_wifi_cache_t stored;
+    if (network_wifi_cache_load(&stored) && memcmp(&stored, cache, sizeof(stored)) == 0) {
+        return;
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NETWORK_WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, NETWORK_WIFI_CACHE_KEY, cache, sizeof(*cache));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        Serial.printf("[network] could not store the AP for the next connect: %s\n", esp_err_to_name(err));
+    }
+}
 
-    char* bssid_str = format_hex(&max_rssi_bssid[0], 6 * sizeof(uint8_t));
-    Serial.printf("Chose BSSID = %s with RSSI %ddbm\n", bssid_str, max_rssi);
-    free(bssid_str);
+/** whether the config now points straight at the cached AP of the same SSID, so that connecting needs no scan */
+bool network_wifi_cache_apply(wifi_sta_config_t* config) {
+    network_wifi_cache_t cache;
+    if (!network_wifi_cache_load(&cache) || memcmp(cache.ssid, config->ssid, sizeof(cache.ssid)) != 0) {
+        return false;
+    }
+    memcpy(&config->bssid[0], &cache.bssid[0], 6 * sizeof(uint8_t));
+    config->bssid_set = true;
+    // with the channel set, the driver probes only that channel before it associates
+    config->channel = cache.channel;
+    config->scan_method = WIFI_FAST_SCAN;
 
     return true;
 }
 
-static uint network_connect_retry_attempts = 0;
-static void network_esp_event_handler(void* ctx, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        wifi_config_t wifi_config;
-        ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+/** remembers the AP the station is associated with and its lease for the next connect */
+void network_wifi_cache_update(const wifi_sta_config_t* config, const esp_netif_ip_info_t* ip_info) {
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    // memcmp'd by network_wifi_cache_store, padding included
+    network_wifi_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.version = NETWORK_WIFI_CACHE_VERSION;
+    memcpy(&cache.ssid[0], &config->ssid[0], sizeof(cache.ssid));
+    memcpy(&cache.bssid[0], &ap_info.bssid[0], 6 * sizeof(uint8_t));
+    cache.channel = ap_info.primary;
+    cache.ip = ip_info->ip.addr;
+    cache.netmask = ip_info->netmask.addr;
+    cache.gateway = ip_info->gw.addr;
+
+    network_wifi_cache_t previous;
+    if (network_wifi_cache_load(&previous) && previous.ip != 0 && previous.ip != cache.ip) {
+        Serial.println("[network] DHCP handed out another address than last time");
+    }
+    network_wifi_cache_store(&cache);
+}
 
-        network_scan_and_set_bssi_with_best_signal(&wifi_config.sta);
-        ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+// how long it took from power-on or from losing the AP until audio arrived again
+typedef struct {
+    int64_t started_at;
+    bool is_reconnect;
+    bool is_direct;
+    int64_t associated_at;
+    int64_t got_ip_at;
+} network_link_timing_t;
+
+static network_link_timing_t network_link_timing;
+static portMUX_TYPE network_link_timing_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/** called by the event handler; the net-rx task reports once the first audio packet arrives */
+void network_link_timing_start(int64_t started_at, bool is_reconnect) {
+    portENTER_CRITICAL(&network_link_timing_mux);
+    network_link_timing = {};
+    network_link_timing.started_at = started_at;
+    network_link_timing.is_reconnect = is_reconnect;
+    portEXIT_CRITICAL(&network_link_timing_mux);
+    xEventGroupSetBits(network_event_group, NETWORK_EVENT_GROUP_BIT_AWAIT_FIRST_PACKET);
+}
 
-        esp_wifi_connect();
+/** prints how long the first audio packet since power-on or losing the AP took, once */
+void network_link_timing_report_first_packet() {
+    if ((xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_AWAIT_FIRST_PACKET) & NETWORK_EVENT_GROUP_BIT_AWAIT_FIRST_PACKET) == 0) {
         return;
     }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&network_link_timing_mux);
+    network_link_timing_t timing = network_link_timing;
+    portEXIT_CRITICAL(&network_link_timing_mux);
+    Serial.printf(
+        "[network] first audio packet %lldms after %s (associated after %lldms %s, IP after %lldms)\n",
+        (now - timing.started_at) / 1000,
+        timing.is_reconnect ? "losing the AP" : "power-on",
+        (timing.associated_at - timing.started_at) / 1000,
+        timing.is_direct ? "to the last AP" : "after a scan",
+        (timing.got_ip_at - timing.started_at) / 1000
+    );
+}
 
-    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        Serial.printf(
-            "[network] Got Network config; IP=" IPSTR ", Netmask=" IPSTR ", Default Gateway=" IPSTR "\n",
-            IP2STR(&event->ip_info.ip),
-            IP2STR(&event->ip_info.netmask),
-            IP2STR(&event->ip_info.gw)
-        );
-        xEventGroupSetBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED);
+network_link_action_t network_link_handle(network_link_t* link, network_link_event_t event, bool has_cached_ap, bool scan_found_ap) {
+    switch (event) {
+        case NETWORK_LINK_EVENT_STARTED:
+            link->connect_attempts = 0;
+            link->state = has_cached_ap ? NETWORK_LINK_CONNECTING_DIRECTLY : NETWORK_LINK_SCANNING;
+            return has_cached_ap ? NETWORK_LINK_ACTION_CONNECT_DIRECTLY : NETWORK_LINK_ACTION_SCAN;
+
+        case NETWORK_LINK_EVENT_SCAN_DONE:
+            if (link->state == NETWORK_LINK_ROAM_SCANNING) {
+                link->connect_attempts = 0;
+                link->state = scan_found_ap ? NETWORK_LINK_ROAMING : NETWORK_LINK_CONNECTED;
+                return scan_found_ap ? NETWORK_LINK_ACTION_ROAM : NETWORK_LINK_ACTION_ROAM_ABANDON;
+            }
+            if (link->state != NETWORK_LINK_SCANNING) {
+                return NETWORK_LINK_ACTION_NONE;
+            }
+            if (!scan_found_ap) {
+                link->state = NETWORK_LINK_COOLDOWN;
+                return NETWORK_LINK_ACTION_COOLDOWN;
+            }
+            link->connect_attempts = 0;
+            link->state = NETWORK_LINK_CONNECTING;
+            return NETWORK_LINK_ACTION_CONNECT;
+
+        case NETWORK_LINK_EVENT_ASSOCIATED:
+            if (link->state != NETWORK_LINK_ROAMING) {
+                return NETWORK_LINK_ACTION_NONE;
+            }
+            // the IP stays the same, there may be no GOT_IP after a roam
+            link->state = NETWORK_LINK_CONNECTED;
+            return NETWORK_LINK_ACTION_ROAM_DONE;
+
+        case NETWORK_LINK_EVENT_GOT_IP:
+            link->connect_attempts = 0;
+            // a new lease doesn't interrupt looking for a better AP
+            if (link->state != NETWORK_LINK_ROAM_SCANNING) {
+                link->state = NETWORK_LINK_CONNECTED;
+            }
+            return NETWORK_LINK_ACTION_NONE;
+
+        case NETWORK_LINK_EVENT_DISCONNECTED:
+            switch (link->state) {
+                case NETWORK_LINK_ROAMING:
+                    // the first one is the driver leaving the old AP
+                    if (link->connect_attempts == 0) {
+                        link->connect_attempts++;
+                        return NETWORK_LINK_ACTION_NONE;
+                    }
+                    // the new AP didn't take us, the old one is still the cached one
+                    link->connect_attempts = 0;
+                    link->state = has_cached_ap ? NETWORK_LINK_CONNECTING_DIRECTLY : NETWORK_LINK_SCANNING;
+                    return has_cached_ap ? NETWORK_LINK_ACTION_CONNECT_DIRECTLY : NETWORK_LINK_ACTION_SCAN;
+                case NETWORK_LINK_CONNECTED:
+                case NETWORK_LINK_ROAM_SCANNING:
+                    // most likely the AP comes back, or is still there and only this connection broke
+                    link->state = has_cached_ap ? NETWORK_LINK_CONNECTING_DIRECTLY : NETWORK_LINK_SCANNING;
+                    return has_cached_ap ? NETWORK_LINK_ACTION_CONNECT_DIRECTLY : NETWORK_LINK_ACTION_SCAN;
+                case NETWORK_LINK_CONNECTING_DIRECTLY:
+                    // the last AP is gone or moved to another channel
+                    link->state = NETWORK_LINK_SCANNING;
+                    return NETWORK_LINK_ACTION_SCAN;
+                case NETWORK_LINK_CONNECTING:
+                    link->connect_attempts++;
+                    if (link->connect_attempts < NETWORK_MAX_CONNECT_RETRY_ATTEMPTS) {
+                        return NETWORK_LINK_ACTION_RETRY;
+                    }
+                    link->state = NETWORK_LINK_COOLDOWN;
+                    return NETWORK_LINK_ACTION_COOLDOWN;
+                default:
+                    // a scan or the cooldown is running, which ends in its own event
+                    return NETWORK_LINK_ACTION_NONE;
+            }
+
+        case NETWORK_LINK_EVENT_COOLDOWN_OVER:
+            if (link->state != NETWORK_LINK_COOLDOWN) {
+                return NETWORK_LINK_ACTION_NONE;
+            }
+            // the AP of the last scan didn't take us, another one might
+            link->state = NETWORK_LINK_SCANNING;
+            return NETWORK_LINK_ACTION_SCAN;
+
+        case NETWORK_LINK_EVENT_SIGNAL_WEAK:
+            if (link->state != NETWORK_LINK_CONNECTED) {
+                return NETWORK_LINK_ACTION_NONE;
+            }
+            link->state = NETWORK_LINK_ROAM_SCANNING;
+            return NETWORK_LINK_ACTION_ROAM_SCAN;
+
+        case NETWORK_LINK_EVENT_ROAM_TIMEOUT:
+            if (link->state != NETWORK_LINK_ROAMING) {
+                return NETWORK_LINK_ACTION_NONE;
+            }
+            // e.g. the driver left the old AP without a DISCONNECTED and the new one doesn't answer
+            link->connect_attempts = 0;
+            link->state = has_cached_ap ? NETWORK_LINK_CONNECTING_DIRECTLY : NETWORK_LINK_SCANNING;
+            return has_cached_ap ? NETWORK_LINK_ACTION_CONNECT_DIRECTLY : NETWORK_LINK_ACTION_SCAN;
+    }
+    return NETWORK_LINK_ACTION_NONE;
+}
+
+typedef struct {
+    network_link_event_t event;
+    // NETWORK_LINK_EVENT_GOT_IP only
+    esp_netif_ip_info_t ip_info;
+} network_link_message_t;
+
+#define NETWORK_LINK_QUEUE_LENGTH 16
+
+static QueueHandle_t network_link_queue = nullptr;
+// bit 1 << event is set while a DISCONNECTED or SCAN_DONE is queued. The driver may report them in bursts
+// while the net-link task is starved; more of them until it took the queued one tell it nothing new.
+static uint32_t network_link_pending_events = 0;
+static uint32_t network_link_dropped_events = 0;
+
+/** only forwards to the net-link task, the default event loop must not wait for anything */
+static void network_esp_event_handler(void* ctx, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    network_link_message_t message = {};
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        message.event = NETWORK_LINK_EVENT_STARTED;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        message.event = NETWORK_LINK_EVENT_SCAN_DONE;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        message.event = NETWORK_LINK_EVENT_ASSOCIATED;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        message.event = NETWORK_LINK_EVENT_DISCONNECTED;
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        message.event = NETWORK_LINK_EVENT_GOT_IP;
+        message.ip_info = ((ip_event_got_ip_t*) event_data)->ip_info;
+    } else {
         return;
     }
 
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        Serial.println("[network] Disconnected from AP");
-        xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED);
-        if (network_connect_retry_attempts < NETWORK_MAX_CONNECT_RETRY_ATTEMPTS) {
-            esp_err_t connect_error = esp_wifi_connect();
-            network_connect_retry_attempts++;
-            return;
-        } 
-
-        Serial.printf(
-            "[network] Could not reconnect after %d attempts. Trying again in %dms\n",
-            NETWORK_MAX_CONNECT_RETRY_ATTEMPTS,
-            NETWORK_RECONNECT_COOLDOWN_MILLIS
-        );
-        xEventGroupSetBits(network_event_group, NETWORK_EVENT_GROUP_BIT_RECONNECT_COOLDOWN);
-        network_connect_retry_attempts = 0;
+    uint32_t event_bit = 1 << message.event;
+    bool coalesce = message.event == NETWORK_LINK_EVENT_DISCONNECTED || message.event == NETWORK_LINK_EVENT_SCAN_DONE;
+    if (coalesce && (__atomic_fetch_or(&network_link_pending_events, event_bit, __ATOMIC_RELAXED) & event_bit) != 0) {
         return;
     }
+    if (xQueueSend(network_link_queue, &message, 0) != pdTRUE) {
+        if (coalesce) {
+            __atomic_fetch_and(&network_link_pending_events, ~event_bit, __ATOMIC_RELAXED);
+        }
+        // rebooting would cut the audio for sure, the link may still recover: the cooldown and roam deadline tick without events
+        network_link_dropped_events++;
+        Serial.printf("[network] link event queue full, dropped event %d (%u dropped so far)\n", message.event, network_link_dropped_events);
+    }
+}
+
+// what the net-link task tracks for roaming, besides the link state
+typedef struct {
+    // exponentially averaged over the polls since the last (re)connect; 0 before the first poll
+    int32_t rssi_avg;
+    int64_t next_rssi_poll_at;
+    int64_t last_scan_at;
+    // the AP the roam scan found
+    uint8_t target_bssid[6];
+    uint8_t target_channel;
+    int64_t started_at;
+    int64_t duration_us;
+    uint32_t underflows_before;
+    // 0 unless a roam finished less than NETWORK_ROAM_SETTLE_MILLIS ago
+    int64_t settles_at;
+    bool jitter_buffer_boosted;
+} network_roam_t;
+
+typedef struct {
+    uint32_t roams;
+    uint32_t failed_roams;
+    int64_t duration_us_total;
+    int64_t duration_us_max;
+    uint32_t underflows;
+} network_roam_stats_t;
+
+static network_roam_stats_t network_roam_stats = {};
+
+/** carries out what network_link_handle asked for */
+void network_link_execute(network_link_t* link, network_link_action_t action, wifi_config_t* wifi_config, network_roam_t* roam) {
+    int64_t now = esp_timer_get_time();
+    switch (action) {
+        case NETWORK_LINK_ACTION_NONE:
+            return;
+        case NETWORK_LINK_ACTION_CONNECT_DIRECTLY:
+            Serial.printf("[network] connecting to the last AP, BSSID = " MACSTR " on channel %d, without a scan\n", MAC2STR(wifi_config->sta.bssid), wifi_config->sta.channel);
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, wifi_config));
+            break;
+        case NETWORK_LINK_ACTION_SCAN:
+            Serial.println("[network] scanning for APs");
+            if (network_scan_start(&wifi_config->sta, false) != ESP_OK) {
+                Serial.println("[network] could not start a scan");
+                link->state = NETWORK_LINK_COOLDOWN;
+            }
+            return;
+        case NETWORK_LINK_ACTION_CONNECT:
+            Serial.printf("[network] Chose BSSID = " MACSTR " on channel %d\n", MAC2STR(wifi_config->sta.bssid), wifi_config->sta.channel);
+            // network_scan_choose_best pointed the config at the AP
+            wifi_config->sta.scan_method = WIFI_FAST_SCAN;
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, wifi_config));
+            break;
+        case NETWORK_LINK_ACTION_RETRY:
+            break;
+        case NETWORK_LINK_ACTION_COOLDOWN:
+            Serial.printf(
+                "[network] Could not connect (%u failed attempts). Scanning again in %dms\n",
+                link->connect_attempts,
+                NETWORK_RECONNECT_COOLDOWN_MILLIS
+            );
+            return;
+        case NETWORK_LINK_ACTION_ROAM_SCAN:
+            Serial.printf("[network] signal at %ddbm, looking for a better AP\n", roam->rssi_avg);
+            roam->last_scan_at = now;
+            roam->underflows_before = playback_get_underflow_count();
+            if (network_scan_start(&wifi_config->sta, true) != ESP_OK) {
+                Serial.println("[network] could not start a scan");
+                link->state = NETWORK_LINK_CONNECTED;
+            }
+            return;
+        case NETWORK_LINK_ACTION_ROAM:
+            Serial.printf("[network] roaming to BSSID " MACSTR " on channel %d\n", MAC2STR(roam->target_bssid), roam->target_channel);
+            memcpy(&wifi_config->sta.bssid[0], &roam->target_bssid[0], 6 * sizeof(uint8_t));
+            wifi_config->sta.bssid_set = true;
+            wifi_config->sta.channel = roam->target_channel;
+            wifi_config->sta.scan_method = WIFI_FAST_SCAN;
+#ifdef CONFIG_WPA_11R_SUPPORT
+            // a fast BSS transition (802.11r) where the APs support it, which skips the 4-way handshake
+            wifi_config->sta.ft_enabled = 1;
+#endif
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, wifi_config));
+            roam->started_at = now;
+            // connecting while connected makes the driver reassociate with the new AP
+            break;
+        case NETWORK_LINK_ACTION_ROAM_DONE:
+            roam->duration_us = now - roam->started_at;
+            roam->settles_at = now + (int64_t) NETWORK_ROAM_SETTLE_MILLIS * 1000;
+            roam->rssi_avg = 0;
+            {
+                // there may be no GOT_IP to update the cache, the new AP is the one to come back to
+                esp_netif_ip_info_t ip_info;
+                if (esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info) == ESP_OK) {
+                    network_wifi_cache_update(&wifi_config->sta, &ip_info);
+                }
+            }
+            return;
+        case NETWORK_LINK_ACTION_ROAM_ABANDON:
+            Serial.println("[network] no AP is enough better, staying");
+            return;
+    }
+
+    portENTER_CRITICAL(&network_link_timing_mux);
+    network_link_timing.is_direct = link->state == NETWORK_LINK_CONNECTING_DIRECTLY;
+    portEXIT_CRITICAL(&network_link_timing_mux);
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        Serial.printf("[network] could not connect: %s\n", esp_err_to_name(err));
+    }
+}
+
+bool network_roam_is_worth_it(int32_t rssi_avg, int8_t candidate_rssi) {
+    // without an average there is nothing to compare with
+    return rssi_avg != 0 && candidate_rssi >= rssi_avg + NETWORK_ROAM_MIN_GAIN_DB;
+}
+
+/** when the roam scan found an AP with enough more signal than the current one, makes it the roam's target */
+bool network_roam_choose_target(const wifi_sta_config_t* best, int8_t best_rssi, network_roam_t* roam) {
+    wifi_ap_record_t current;
+    if (esp_wifi_sta_get_ap_info(&current) != ESP_OK) {
+        return false;
+    }
+    if (memcmp(&best->bssid[0], &current.bssid[0], 6) == 0 || !network_roam_is_worth_it(roam->rssi_avg, best_rssi)) {
+        return false;
+    }
+    memcpy(&roam->target_bssid[0], &best->bssid[0], 6 * sizeof(uint8_t));
+    roam->target_channel = best->channel;
+    return true;
+}
+
+/** prints how the roam went once the underflows after it are in, and adds it to network_roam_stats */
+void network_roam_report(network_roam_t* roam) {
+    uint32_t underflows = playback_get_underflow_count() - roam->underflows_before;
+    network_roam_stats.roams++;
+    network_roam_stats.duration_us_total += roam->duration_us;
+    network_roam_stats.duration_us_max = max(network_roam_stats.duration_us_max, roam->duration_us);
+    network_roam_stats.underflows += underflows;
+    Serial.printf(
+        "[network] roamed in %lldms with %u underflow(s); %u roams: AVG(duration) = %lldms, MAX(duration) = %lldms, %u underflows, %u failed\n",
+        roam->duration_us / 1000,
+        underflows,
+        network_roam_stats.roams,
+        network_roam_stats.duration_us_total / network_roam_stats.roams / 1000,
+        network_roam_stats.duration_us_max / 1000,
+        network_roam_stats.underflows,
+        network_roam_stats.failed_roams
+    );
+    roam->settles_at = 0;
+}
+
+/** when the net-link task has to look at the link without an event: cooldown, RSSI polls, a roam taking too long */
+int64_t network_link_next_tick(const network_link_t* link, const network_roam_t* roam, int64_t cooldown_ends_at) {
+    switch (link->state) {
+        case NETWORK_LINK_COOLDOWN:
+            return cooldown_ends_at;
+        case NETWORK_LINK_CONNECTED:
+            return roam->settles_at != 0 ? min(roam->settles_at, roam->next_rssi_poll_at) : roam->next_rssi_poll_at;
+        case NETWORK_LINK_ROAMING:
+            return roam->started_at + (int64_t) NETWORK_ROAM_MAX_MILLIS * 1000;
+        default:
+            return INT64_MAX;
+    }
+}
+
+/** at a tick: whether there is an event for the link */
+bool network_link_tick(const network_link_t* link, network_roam_t* roam, int64_t cooldown_ends_at, network_link_event_t* event) {
+    int64_t now = esp_timer_get_time();
+    switch (link->state) {
+        case NETWORK_LINK_COOLDOWN:
+            *event = NETWORK_LINK_EVENT_COOLDOWN_OVER;
+            return now >= cooldown_ends_at;
+
+        case NETWORK_LINK_CONNECTED: {
+            if (roam->settles_at != 0 && now >= roam->settles_at) {
+                network_roam_report(roam);
+            }
+            if (now < roam->next_rssi_poll_at) {
+                return false;
+            }
+            roam->next_rssi_poll_at = now + (int64_t) NETWORK_RSSI_POLL_MILLIS * 1000;
+            wifi_ap_record_t ap_info;
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+                return false;
+            }
+            roam->rssi_avg = roam->rssi_avg == 0 ? ap_info.rssi : (3 * roam->rssi_avg + ap_info.rssi) / 4;
+            *event = NETWORK_LINK_EVENT_SIGNAL_WEAK;
+            return roam->rssi_avg < NETWORK_ROAM_RSSI_THRESHOLD_DBM
+                && roam->settles_at == 0
+                && (roam->last_scan_at == 0 || now - roam->last_scan_at >= (int64_t) NETWORK_ROAM_SCAN_INTERVAL_MILLIS * 1000);
+        }
+
+        case NETWORK_LINK_ROAMING:
+            *event = NETWORK_LINK_EVENT_ROAM_TIMEOUT;
+            return now >= roam->started_at + (int64_t) NETWORK_ROAM_MAX_MILLIS * 1000;
+
+        default:
+            return false;
+    }
+}
+
+/** the jitter buffer target is up from the roam scan until the roam settled */
+void network_roam_update_jitter_buffer_target(const network_link_t* link, network_roam_t* roam) {
+    bool boost = link->state == NETWORK_LINK_ROAM_SCANNING || link->state == NETWORK_LINK_ROAMING || roam->settles_at != 0;
+    if (boost != roam->jitter_buffer_boosted) {
+        playback_set_jitter_buffer_target_ms(boost ? NETWORK_ROAM_JITTER_BUFFER_TARGET_MS : 0);
+        roam->jitter_buffer_boosted = boost;
+    }
+}
+
+void network_task_link(void* pvParameters) {
+    static network_link_t link = {};
+    static network_roam_t roam = {};
+    int64_t cooldown_ends_at = 0;
+    while (true) {
+        TickType_t wait = portMAX_DELAY;
+        int64_t tick_at = network_link_next_tick(&link, &roam, cooldown_ends_at);
+        if (tick_at != INT64_MAX) {
+            int64_t remaining_millis = (tick_at - esp_timer_get_time() + 999) / 1000;
+            wait = remaining_millis > 0 ? pdMS_TO_TICKS(remaining_millis) : 0;
+        }
+        network_link_message_t message;
+        if (xQueueReceive(network_link_queue, &message, wait) == pdTRUE) {
+            __atomic_fetch_and(&network_link_pending_events, ~(1u << message.event), __ATOMIC_RELAXED);
+        } else if (!network_link_tick(&link, &roam, cooldown_ends_at, &message.event)) {
+            network_roam_update_jitter_buffer_target(&link, &roam);
+            continue;
+        }
+
+        wifi_config_t wifi_config;
+        ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+        network_link_state_t previous_state = link.state;
+        bool has_cached_ap = false;
+        bool scan_found_ap = false;
+        switch (message.event) {
+            case NETWORK_LINK_EVENT_STARTED:
+                network_link_timing_start(0, false);
+                has_cached_ap = network_wifi_cache_apply(&wifi_config.sta);
+                break;
+            case NETWORK_LINK_EVENT_SCAN_DONE: {
+                int8_t best_rssi;
+                if (link.state == NETWORK_LINK_ROAM_SCANNING) {
+                    wifi_sta_config_t best = wifi_config.sta;
+                    scan_found_ap = network_scan_choose_best(&best, &best_rssi) && network_roam_choose_target(&best, best_rssi, &roam);
+                } else {
+                    scan_found_ap = network_scan_choose_best(&wifi_config.sta, &best_rssi);
+                }
+                break;
+            }
+            case NETWORK_LINK_EVENT_ASSOCIATED:
+                portENTER_CRITICAL(&network_link_timing_mux);
+                network_link_timing.associated_at = esp_timer_get_time();
+                portEXIT_CRITICAL(&network_link_timing_mux);
+                break;
+            case NETWORK_LINK_EVENT_GOT_IP:
+                Serial.printf(
+                    "[network] Got Network config; IP=" IPSTR ", Netmask=" IPSTR ", Default Gateway=" IPSTR "\n",
+                    IP2STR(&message.ip_info.ip),
+                    IP2STR(&message.ip_info.netmask),
+                    IP2STR(&message.ip_info.gw)
+                );
+                portENTER_CRITICAL(&network_link_timing_mux);
+                network_link_timing.got_ip_at = esp_timer_get_time();
+                portEXIT_CRITICAL(&network_link_timing_mux);
+                network_wifi_cache_update(&wifi_config.sta, &message.ip_info);
+                xEventGroupSetBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED | NETWORK_EVENT_GROUP_BIT_ANNOUNCE);
+                break;
+            case NETWORK_LINK_EVENT_DISCONNECTED: {
+                // leaving the old AP on a roam doesn't take the IP, the stream goes on
+                bool leaving_for_roam = link.state == NETWORK_LINK_ROAMING && link.connect_attempts == 0;
+                if (leaving_for_roam) {
+                    break;
+                }
+                Serial.println("[network] Disconnected from AP");
+                xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED);
+                if (link.state == NETWORK_LINK_CONNECTED || link.state == NETWORK_LINK_ROAM_SCANNING) {
+                    network_link_timing_start(esp_timer_get_time(), true);
+                }
+                if (link.state == NETWORK_LINK_ROAM_SCANNING) {
+                    esp_wifi_scan_stop();
+                }
+                if (link.state == NETWORK_LINK_CONNECTED || link.state == NETWORK_LINK_ROAM_SCANNING || link.state == NETWORK_LINK_ROAMING) {
+                    has_cached_ap = network_wifi_cache_apply(&wifi_config.sta);
+                }
+                break;
+            }
+            case NETWORK_LINK_EVENT_ROAM_TIMEOUT:
+                Serial.printf("[network] no association with the new AP after %dms\n", NETWORK_ROAM_MAX_MILLIS);
+                // the DISCONNECTED that left the old AP kept this set
+                xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED);
+                network_link_timing_start(esp_timer_get_time(), true);
+                has_cached_ap = network_wifi_cache_apply(&wifi_config.sta);
+                break;
+            default:
+                break;
+        }
+
+        network_link_action_t action = network_link_handle(&link, message.event, has_cached_ap, scan_found_ap);
+        network_link_execute(&link, action, &wifi_config, &roam);
+        if (link.state == NETWORK_LINK_COOLDOWN && (action == NETWORK_LINK_ACTION_COOLDOWN || action == NETWORK_LINK_ACTION_SCAN)) {
+            cooldown_ends_at = esp_timer_get_time() + (int64_t) NETWORK_RECONNECT_COOLDOWN_MILLIS * 1000;
+        }
+        if (previous_state == NETWORK_LINK_ROAMING && link.state != NETWORK_LINK_ROAMING && action != NETWORK_LINK_ACTION_ROAM_DONE) {
+            Serial.println("[network] roam failed, reconnecting");
+            network_roam_stats.failed_roams++;
+        }
+        bool link_lost = link.state == NETWORK_LINK_CONNECTING_DIRECTLY || link.state == NETWORK_LINK_SCANNING
+            || link.state == NETWORK_LINK_CONNECTING || link.state == NETWORK_LINK_COOLDOWN;
+        if (link_lost) {
+            // a roam that settles is reported even if the link is lost right after it
+            if (roam.settles_at != 0) {
+                network_roam_report(&roam);
+            }
+            roam.rssi_avg = 0;
+        }
+        network_roam_update_jitter_buffer_target(&link, &roam);
+    }
 }
 
 bool network_pb_encode_device_name(pb_ostream_t* stream, const pb_field_t* field, void* const* arg) {
@@ -209,14 +766,79 @@ bool network_pb_encode_device_name(pb_ostream_t* stream, const pb_field_t* field
     return pb_encode_string(stream, (pb_byte_t*) deviceName, strlen(deviceName));
 }
 
+static const char* PB_ERRMSG_MAX_ENCODED_FRAME_SIZE_EXCEEDED = "Encoded frame exceeds max size";
+
+// how many opus frames a transmitter may batch into one message, as one multi-frame opus packet
+#define NETWORK_MAX_FRAMES_PER_MESSAGE 8
+
+// what the receiving end of a connection knows about the stream
+typedef struct {
+    AudioFraming framing;
+    uint32_t frames_per_message;
+    bool has_sequence;
+    uint32_t next_sequence;
+    uint32_t next_timestamp;
+    // of the last frame queued, which is how long the playback task conceals a lost frame
+    uint32_t last_frame_samples;
+    uint32_t n_frames_lost;
+} network_rx_stream_t;
+
+// the net-rx task handles one connection at a time
+static network_rx_stream_t network_rx_stream;
+
 typedef struct {
     void* data;
     size_t len;
-} pb_bytes_ctxt;
+    // whether data is a batch of frames in network_rx_batch_buffer rather than a frame reserved in the playback ring
+    bool is_batch;
+} network_rx_packet_t;
+
+// the packet of the AudioData being decoded
+static network_rx_packet_t network_rx_audio_packet;
+// a batch is split into one playback ring frame per opus frame, so it is received here first
+static pb_byte_t network_rx_batch_buffer[MAX_ENCODED_FRAME_SIZE];
+
+/**
+ * reads an opus packet of len bytes. Single frames go straight from the socket into a frame
+ * reserved in the playback ring, the only copy they see before the decoder reads them. When the
+ * stream batches frames, multi-frame packets go to network_rx_batch_buffer instead. The packet
+ * has to be queued or discarded afterwards, even if reading it failed.
+ */
+bool network_read_opus_packet(pb_istream_t* istream, size_t len, network_rx_packet_t* packet) {
+    packet->len = len;
+    packet->is_batch = false;
+    if (len == 0) {
+        packet->data = playback_reserve_frame(0);
+        return true;
+    }
 
-static const char* PB_ERRMSG_OOM = "Out of memory";
-static const char* PB_ERRMSG_MAX_ENCODED_FRAME_SIZE_EXCEEDED = "Encoded frame exceeds max size";
+    // the TOC byte tells whether the packet has more than one frame
+    pb_byte_t toc;
+    if (!pb_read(istream, &toc, 1)) {
+        packet->data = nullptr;
+        return false;
+    }
+    packet->is_batch = network_rx_stream.frames_per_message > 1 && (toc & 0x3) != 0;
+    packet->data = packet->is_batch ? network_rx_batch_buffer : playback_reserve_frame(len);
+    ((pb_byte_t*) packet->data)[0] = toc;
+    return pb_read(istream, ((pb_byte_t*) packet->data) + 1, len - 1);
+}
+
+/**
+ * frees a packet that was read but not queued: a frame reserved in the playback ring goes back to
+ * it, network_rx_batch_buffer is just reused by the next packet.
+ */
+void network_discard_opus_packet(network_rx_packet_t* packet) {
+    if (packet->data != nullptr && !packet->is_batch) {
+        playback_discard_reserved_frame(packet->data);
+    }
+    packet->data = nullptr;
+}
 
+/**
+ * reads the opus frame with network_read_opus_packet. Sets the field's arg to a
+ * network_rx_packet_t, which has to be queued or discarded.
+ */
 bool network_pb_callback_audio_data(pb_istream_t *istream, pb_ostream_t *ostream, const pb_field_t *field) {
     assert(istream != nullptr && ostream == nullptr);
     if (field->tag == AudioData_opus_encoded_frame_tag) {
@@ -224,38 +846,23 @@ bool network_pb_callback_audio_data(pb_istream_t *istream, pb_ostream_t *ostream
             istream->errmsg = PB_ERRMSG_MAX_ENCODED_FRAME_SIZE_EXCEEDED;
             return false;
         }
-        
-        pb_bytes_ctxt* field_value = (pb_bytes_ctxt*) malloc(sizeof(pb_bytes_ctxt));
-        if (field_value == nullptr) {
-            istream->errmsg = PB_ERRMSG_OOM;
-            return false;
-        }
-        field_value->len = istream->bytes_left;
-        field_value->data = malloc(istream->bytes_left);
-        if (field_value->data == nullptr) {
-            istream->errmsg = PB_ERRMSG_OOM;
-            return false;
-        }
-        
-        if (!pb_read(istream, (pb_byte_t*) field_value->data, istream->bytes_left)) {
-            return false;
-        }
-        
-        ((AudioData*) field->message)->opus_encoded_frame.arg = field_value;
-        return true;
+
+        ((AudioData*) field->message)->opus_encoded_frame.arg = &network_rx_audio_packet;
+        return network_read_opus_packet(istream, istream->bytes_left, &network_rx_audio_packet);
     }
 
     return pb_default_field_callback(istream, ostream, field);
 }
 
-void network_pb_bytes_ctxt_destroy(pb_bytes_ctxt* ctxt) {
-    free(ctxt->data);
-    free(ctxt);
-}
-
-void network_pb_audio_data_destroy(AudioData* data) {
-    if (data->opus_encoded_frame.arg != nullptr) {
-        network_pb_bytes_ctxt_destroy((pb_bytes_ctxt*) data->opus_encoded_frame.arg);
+/**
+ * unwraps the network_rx_packet_t that network_pb_callback_audio_data left in the callback arg of
+ * an AudioData, if any, and passes it to network_discard_opus_packet.
+ */
+void network_pb_audio_data_discard(AudioData* data) {
+    network_rx_packet_t* packet = (network_rx_packet_t*) data->opus_encoded_frame.arg;
+    if (packet != nullptr) {
+        network_discard_opus_packet(packet);
+        data->opus_encoded_frame.arg = nullptr;
     }
 }
 
@@ -304,53 +911,329 @@ pb_istream_t network_pb_istream_from_socket(int socket) {
     };
 }
 
-bool network_pb_ostream_from_socket_callback(pb_ostream_t* stream, const uint8_t* buf, size_t count) {
-    int nBytesWrittenTotal = 0;
-    while (nBytesWrittenTotal < count) {
-        int nBytesWritten = write((int) stream->state, &buf[nBytesWrittenTotal], count - nBytesWrittenTotal);
-        if (nBytesWritten == -1) {
-            switch(errno) {
-                case EBADF:
-                    stream->errmsg = "Bad File Descriptor";
-                    break;
-                case EDESTADDRREQ:
-                    stream->errmsg = "Destination address required";
-                    break;
-                case EFAULT:
-                    stream->errmsg = "Segmentation fault";
-                    break;
-                case EINTR:
-                    stream->errmsg = "Interrupted";
-                    break;
-                case EINVAL:
-                    stream->errmsg = "input value";
-                    break;
-                case EIO:
-                    stream->errmsg = "io error (EIO)";
-                    break;
-                case EPERM:
-                    stream->errmsg = "Permission denied.";
-                    break;
-                default:
-                    stream->errmsg = "Unknown";
-                    break;
-            }
+const char* network_socket_errmsg(int err) {
+    switch(err) {
+        case EBADF:
+            return "Bad File Descriptor";
+        case EDESTADDRREQ:
+            return "Destination address required";
+        case EFAULT:
+            return "Segmentation fault";
+        case EINTR:
+            return "Interrupted";
+        case EINVAL:
+            return "input value";
+        case EIO:
+            return "io error (EIO)";
+        case EPERM:
+            return "Permission denied.";
+        case ECONNRESET:
+            return "Connection reset";
+        case ENOTCONN:
+            return "Not connected";
+        default:
+            return "Unknown";
+    }
+}
+
+// the largest message plus its length prefix, a varint of at most 5 bytes
+#define NETWORK_TX_BUFFER_SIZE (ToTransmitter_size + 5)
 
+typedef struct {
+    int socket;
+    uint32_t n_messages_sent;
+    uint32_t n_send_calls;
+    pb_byte_t buffer[NETWORK_TX_BUFFER_SIZE];
+} network_tx_t;
+
+static const char* PB_ERRMSG_TX_BUFFER_EXCEEDED = "Message exceeds the transmit buffer";
+static const char* PB_ERRMSG_UNENCODABLE = "Message cannot be encoded";
+
+/**
+ * Encodes the message length-delimited into tx->buffer and hands it to the socket in one send(),
+ * so it goes out as one TCP segment instead of one per field nanopb writes.
+ */
+bool network_send_delimited(network_tx_t* tx, const pb_msgdesc_t* fields, const void* message, const char** errmsg) {
+    size_t message_size;
+    if (!pb_get_encoded_size(&message_size, fields, message)) {
+        *errmsg = PB_ERRMSG_UNENCODABLE;
+        return false;
+    }
+
+    pb_ostream_t buffer_ostream = pb_ostream_from_buffer(tx->buffer, NETWORK_TX_BUFFER_SIZE);
+    if (!pb_encode_varint(&buffer_ostream, message_size)
+        || buffer_ostream.bytes_written + message_size > NETWORK_TX_BUFFER_SIZE) {
+        *errmsg = PB_ERRMSG_TX_BUFFER_EXCEEDED;
+        return false;
+    }
+    if (!pb_encode(&buffer_ostream, fields, message)) {
+        *errmsg = PB_GET_ERROR(&buffer_ostream);
+        return false;
+    }
+
+    size_t n_bytes_sent_total = 0;
+    while (n_bytes_sent_total < buffer_ostream.bytes_written) {
+        int n_bytes_sent = send(tx->socket, &tx->buffer[n_bytes_sent_total], buffer_ostream.bytes_written - n_bytes_sent_total, 0);
+        tx->n_send_calls++;
+        if (n_bytes_sent < 0) {
+            *errmsg = network_socket_errmsg(errno);
             return false;
         }
+        n_bytes_sent_total += n_bytes_sent;
+    }
+    tx->n_messages_sent++;
+
+    return true;
+}
+
+// AUDIO_FRAMING_COMPACT, see protocol/ip.proto
+#define NETWORK_COMPACT_HEADER_SIZE 12
+#define NETWORK_COMPACT_TYPE_OPUS_FRAME 1
+#define NETWORK_COMPACT_TYPE_PROTOBUF 2
+// a larger jump of the timestamp is taken as a restarted stream, not as that much lost audio
+#define NETWORK_MAX_CONCEALED_GAP_SAMPLES (48000 / 1000 * 120)
+
+static const char* PB_ERRMSG_UNKNOWN_MESSAGE = "Unknown message";
+static const char* PB_ERRMSG_UNSUPPORTED_FRAMING = "Unsupported framing";
+static const char* PB_ERRMSG_INVALID_COMPACT_HEADER = "Invalid compact frame header";
+static const char* PB_ERRMSG_TOO_MANY_FRAMES_PER_MESSAGE = "Too many frames per message";
+static const char* PB_ERRMSG_MALFORMED_OPUS_PACKET = "Malformed opus packet";
+static const char* PB_ERRMSG_UNSUPPORTED_CHANNEL_ROLE = "Unsupported channel role";
+
+static uint32_t network_read_uint32_be(const pb_byte_t* bytes) {
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+// a SILK or hybrid stream drops every frame; logging each would block net-rx on the UART every few ms
+#define NETWORK_UNDECODABLE_LOG_INTERVAL_MILLIS 1000
+
+// only touched by the net-rx task
+static uint32_t network_undecodable_frames = 0;
+static int64_t network_undecodable_logged_at = 0;
+
+/** queues a frame reserved in the playback ring, or conceals it if this firmware cannot decode it */
+void network_queue_received_frame(void* frame, size_t len) {
+    if (playback_can_decode(frame, len)) {
+        playback_queue_reserved_frame(frame);
+    } else {
+        // conceal it instead, which keeps the stream's timing
+        network_undecodable_frames++;
+        int64_t now = esp_timer_get_time();
+        if (network_undecodable_logged_at == 0 || now - network_undecodable_logged_at >= (int64_t) NETWORK_UNDECODABLE_LOG_INTERVAL_MILLIS * 1000) {
+            Serial.printf("dropping non-CELT opus frames, this firmware only decodes CELT (%u so far)\n", network_undecodable_frames);
+            network_undecodable_logged_at = now;
+        }
+        playback_discard_reserved_frame(frame);
+        playback_queue_lost_frame();
+    }
+}
+
+/**
+ * conceals the audio missing between the last received frame and this one. The sequence number
+ * tells that frames are missing, the timestamps tell how much audio to conceal; more than
+ * NETWORK_MAX_CONCEALED_GAP_SAMPLES restarts the sequence, however many frames are missing.
+ * Also notes where the transmitter's clock moved other than by the duration of the previous frame.
+ */
+void network_account_sequence(network_rx_stream_t* stream, uint32_t sequence, uint32_t timestamp, int n_frames, int n_samples) {
+    if (stream->has_sequence) {
+        int32_t missing_samples = (int32_t) (timestamp - stream->next_timestamp);
+        if (sequence != stream->next_sequence) {
+            if (missing_samples <= 0 || missing_samples > NETWORK_MAX_CONCEALED_GAP_SAMPLES || stream->last_frame_samples == 0) {
+                Serial.printf("[network] sequence jumped from %u to %u, restarting it\n", stream->next_sequence, sequence);
+            } else {
+                stream->n_frames_lost += sequence - stream->next_sequence;
+                // every lost frame is concealed as long as the frame before it
+                for (int32_t concealed = 0; concealed < missing_samples; concealed += stream->last_frame_samples) {
+                    playback_queue_lost_frame();
+                }
+            }
+        } else if (missing_samples != 0) {
+            Serial.printf("[network] timestamp discontinuity at frame %u: %d samples\n", sequence, missing_samples);
+        }
+    }
+
+    stream->has_sequence = true;
+    stream->next_sequence = sequence + n_frames;
+    stream->next_timestamp = timestamp + (n_samples > 0 ? n_samples : 0);
+    stream->last_frame_samples = n_samples > 0 ? n_samples : 0;
+}
 
-        nBytesWrittenTotal += nBytesWritten;
+/** queues a packet that is already in the playback ring as one ring frame, however many opus frames it has */
+void network_queue_unsplit_packet(network_rx_stream_t* stream, void* data, int len, bool has_timing, uint32_t sequence, uint32_t timestamp) {
+    if (has_timing) {
+        int n_frames = len > 0 ? opus_packet_get_nb_frames((const unsigned char*) data, len) : 1;
+        int n_samples = len > 0 ? opus_packet_get_nb_samples((const unsigned char*) data, len, 48000) : 0;
+        network_account_sequence(stream, sequence, timestamp, n_frames > 0 ? n_frames : 1, n_samples);
+    }
+    network_queue_received_frame(data, len);
+}
+
+/**
+ * queues a packet from network_read_opus_packet for playback, splitting a batch into one ring
+ * frame per opus frame; a packet of more frames than frames_per_message is not a batch and is
+ * queued unsplit. With has_timing, sequence and timestamp are those of the packet's first frame,
+ * and the frames missing before it are concealed.
+ */
+bool network_queue_received_packet(network_rx_stream_t* stream, network_rx_packet_t* packet, bool has_timing, uint32_t sequence, uint32_t timestamp, const char** errmsg) {
+    const unsigned char* data = (const unsigned char*) packet->data;
+    packet->data = nullptr;
+    if (!packet->is_batch) {
+        network_queue_unsplit_packet(stream, (void*) data, packet->len, has_timing, sequence, timestamp);
+        return true;
     }
 
+    unsigned char toc;
+    const unsigned char* frames[48];
+    opus_int16 frame_sizes[48];
+    int n_frames = opus_packet_parse(data, packet->len, &toc, frames, frame_sizes, nullptr);
+    if (n_frames < 0) {
+        *errmsg = PB_ERRMSG_MALFORMED_OPUS_PACKET;
+        return false;
+    }
+    if ((uint32_t) n_frames > stream->frames_per_message) {
+        // not a batch but a longer packet from the encoder, e.g. 60ms of 20ms CELT frames: played as it is, like without batching
+        void* unsplit = playback_reserve_frame(packet->len);
+        memcpy(unsplit, data, packet->len);
+        network_queue_unsplit_packet(stream, unsplit, packet->len, has_timing, sequence, timestamp);
+        return true;
+    }
+
+    int frame_samples = opus_packet_get_samples_per_frame(data, 48000);
+    for (int k = 0; k < n_frames; k++) {
+        // a packet of a single frame (code 0) is just the TOC byte and the frame
+        pb_byte_t* frame = (pb_byte_t*) playback_reserve_frame(1 + frame_sizes[k]);
+        frame[0] = toc & 0xFC;
+        memcpy(&frame[1], frames[k], frame_sizes[k]);
+        if (has_timing) {
+            network_account_sequence(stream, sequence + k, timestamp + k * frame_samples, 1, frame_samples);
+        }
+        network_queue_received_frame(frame, 1 + frame_sizes[k]);
+    }
     return true;
 }
 
-pb_ostream_t network_pb_ostream_from_socket(int socket) {
-    return pb_ostream_s {
-        .callback = network_pb_ostream_from_socket_callback,
-        .state = (void*) socket,
-        .max_size = SIZE_MAX
-    };
+/** handles a ToReceiver message, whichever framing it came in. Returns false if the connection has to be closed. */
+bool network_handle_to_receiver(network_rx_stream_t* stream, ToReceiver* message, const char** errmsg) {
+    switch (message->which_message) {
+        case ToReceiver_audio_data_tag: {
+            network_rx_packet_t* packet = (network_rx_packet_t*) message->message.audio_data.opus_encoded_frame.arg;
+            assert(packet != nullptr);
+            return network_queue_received_packet(stream, packet, false, 0, 0, errmsg);
+        }
+        case ToReceiver_stream_configuration_tag: {
+            StreamConfiguration* configuration = &message->message.stream_configuration;
+            if (configuration->framing != AudioFraming_AUDIO_FRAMING_PROTOBUF && configuration->framing != AudioFraming_AUDIO_FRAMING_COMPACT) {
+                *errmsg = PB_ERRMSG_UNSUPPORTED_FRAMING;
+                return false;
+            }
+            uint32_t frames_per_message = configuration->has_frames_per_message ? configuration->frames_per_message : 1;
+            if (frames_per_message < 1 || frames_per_message > NETWORK_MAX_FRAMES_PER_MESSAGE) {
+                *errmsg = PB_ERRMSG_TOO_MANY_FRAMES_PER_MESSAGE;
+                return false;
+            }
+            stream->framing = configuration->framing;
+            stream->frames_per_message = frames_per_message;
+            stream->has_sequence = false;
+            Serial.printf(
+                "[network] transmitter switched to %s framing, up to %u frame(s) per message\n",
+                stream->framing == AudioFraming_AUDIO_FRAMING_COMPACT ? "compact" : "protobuf",
+                stream->frames_per_message
+            );
+            return true;
+        }
+        case ToReceiver_output_configuration_tag: {
+            OutputConfiguration* configuration = &message->message.output_configuration;
+            uint32_t volume_permille = configuration->has_volume_permille ? min(configuration->volume_permille, (uint32_t) 1000) : 1000;
+            ChannelRole channel_role = configuration->has_channel_role ? configuration->channel_role : ChannelRole_CHANNEL_ROLE_STEREO;
+            int routing;
+            switch (channel_role) {
+                case ChannelRole_CHANNEL_ROLE_STEREO: routing = OPUS_OUTPUT_STEREO; break;
+                case ChannelRole_CHANNEL_ROLE_LEFT:   routing = OPUS_OUTPUT_LEFT; break;
+                case ChannelRole_CHANNEL_ROLE_RIGHT:  routing = OPUS_OUTPUT_RIGHT; break;
+                case ChannelRole_CHANNEL_ROLE_MONO:   routing = OPUS_OUTPUT_MONO; break;
+                default:
+                    *errmsg = PB_ERRMSG_UNSUPPORTED_CHANNEL_ROLE;
+                    return false;
+            }
+            bool dither = configuration->has_dither && configuration->dither;
+            playback_set_output(volume_permille / 1000.0f, routing, dither);
+            Serial.printf(
+                "[network] transmitter set the output to volume %u/1000, channel role %d, dither %s\n",
+                volume_permille,
+                (int) channel_role,
+                dither ? "on" : "off"
+            );
+            return true;
+        }
+        default:
+            *errmsg = PB_ERRMSG_UNKNOWN_MESSAGE;
+            return false;
+    }
+}
+
+/** reads and handles one varint-delimited ToReceiver message */
+bool network_receive_delimited(network_rx_stream_t* stream, pb_istream_t* istream, const char** errmsg) {
+    ToReceiver toReceiver = ToReceiver_init_zero;
+    if (!pb_decode_delimited(istream, ToReceiver_fields, &toReceiver)) {
+        *errmsg = PB_GET_ERROR(istream);
+        if (toReceiver.which_message == ToReceiver_audio_data_tag) {
+            network_pb_audio_data_discard(&toReceiver.message.audio_data);
+        }
+        return false;
+    }
+
+    return network_handle_to_receiver(stream, &toReceiver, errmsg);
+}
+
+/**
+ * reads and handles one AUDIO_FRAMING_COMPACT message: the fixed header, then the opus packet
+ * with network_read_opus_packet or the ToReceiver message in place.
+ */
+bool network_receive_compact(network_rx_stream_t* stream, pb_istream_t* istream, const char** errmsg) {
+    pb_byte_t header[NETWORK_COMPACT_HEADER_SIZE];
+    if (!pb_read(istream, header, NETWORK_COMPACT_HEADER_SIZE)) {
+        *errmsg = PB_GET_ERROR(istream);
+        return false;
+    }
+    uint8_t type = header[0];
+    size_t length = ((size_t) header[2] << 8) | header[3];
+    if (header[1] != 0) {
+        *errmsg = PB_ERRMSG_INVALID_COMPACT_HEADER;
+        return false;
+    }
+
+    if (type == NETWORK_COMPACT_TYPE_OPUS_FRAME) {
+        if (length > MAX_ENCODED_FRAME_SIZE) {
+            *errmsg = PB_ERRMSG_MAX_ENCODED_FRAME_SIZE_EXCEEDED;
+            return false;
+        }
+        network_rx_packet_t packet;
+        if (!network_read_opus_packet(istream, length, &packet)) {
+            network_discard_opus_packet(&packet);
+            *errmsg = PB_GET_ERROR(istream);
+            return false;
+        }
+
+        return network_queue_received_packet(stream, &packet, true, network_read_uint32_be(&header[4]), network_read_uint32_be(&header[8]), errmsg);
+    }
+
+    if (type == NETWORK_COMPACT_TYPE_PROTOBUF) {
+        pb_istream_t message_istream = *istream;
+        message_istream.bytes_left = length;
+        ToReceiver toReceiver = ToReceiver_init_zero;
+        if (!pb_decode(&message_istream, ToReceiver_fields, &toReceiver)) {
+            *errmsg = PB_GET_ERROR(&message_istream);
+            if (toReceiver.which_message == ToReceiver_audio_data_tag) {
+                network_pb_audio_data_discard(&toReceiver.message.audio_data);
+            }
+            return false;
+        }
+
+        return network_handle_to_receiver(stream, &toReceiver, errmsg);
+    }
+
+    *errmsg = PB_ERRMSG_INVALID_COMPACT_HEADER;
+    return false;
 }
 
 BroadcastMessage network_initialize_discovery_response() {
@@ -369,7 +1252,7 @@ BroadcastMessage network_initialize_discovery_response() {
     BroadcastMessage broadcast = BroadcastMessage_init_zero;
     broadcast.magic_word = 0x2C5DA044;
     broadcast.which_message = BroadcastMessage_discovery_response_tag;
-    broadcast.message.discovery_response.currently_streaming = false; // TODO: fill with actual value
+    broadcast.message.discovery_response.currently_streaming = (xEventGroupGetBits(network_event_group) & NETWORK_EVENT_GROUP_BIT_ACTIVE_STREAM) != 0;
     broadcast.message.discovery_response.mac_address = macAsLong;
     broadcast.message.discovery_response.protocol_version = 1;
     memcpy(broadcast.message.discovery_response.opus_version, opus_version_string, opus_version_string_len);
@@ -377,6 +1260,58 @@ BroadcastMessage network_initialize_discovery_response() {
     return broadcast;
 }
 
+// every frame duration opus codes, in microseconds
+static const uint32_t network_opus_frame_durations_us[] = { 2500, 5000, 10000, 20000, 40000, 60000 };
+
+/**
+ * fills in what the receiver can do, so that the transmitter can pick a configuration that
+ * this receiver sustains instead of assuming the worst case.
+ */
+void network_initialize_receiver_capabilities(ReceiverInformation* info) {
+    info->max_encoded_frame_size = MAX_ENCODED_FRAME_SIZE;
+    info->max_decoded_frame_size = playback_get_maximum_frame_size_bytes();
+    info->supported_framings_count = 1;
+    info->supported_framings[0] = AudioFraming_AUDIO_FRAMING_COMPACT;
+    info->has_max_frames_per_message = true;
+    info->max_frames_per_message = NETWORK_MAX_FRAMES_PER_MESSAGE;
+    info->supported_transports_count = 1;
+    info->supported_transports[0] = Transport_TRANSPORT_TCP;
+
+    static_assert(sizeof(network_opus_frame_durations_us) / sizeof(uint32_t) <= sizeof(info->supported_frame_durations) / sizeof(FrameDuration), "too many frame durations");
+    info->supported_frame_durations_count = 0;
+    for (uint32_t duration_us : network_opus_frame_durations_us) {
+        if (!playback_can_decode_frame_duration(duration_us)) {
+            continue;
+        }
+        FrameDuration* frame_duration = &info->supported_frame_durations[info->supported_frame_durations_count++];
+        frame_duration->duration_us = duration_us;
+        frame_duration->jitter_buffer_max_ms = playback_get_jitter_buffer_capacity_ms(duration_us);
+    }
+    info->has_jitter_buffer_min_ms = true;
+    info->jitter_buffer_min_ms = playback_get_output_latency_ms();
+
+    playback_decode_headroom_t headroom[PLAYBACK_BITRATE_CLASS_COUNT];
+    static_assert(PLAYBACK_BITRATE_CLASS_COUNT <= sizeof(info->decode_headroom) / sizeof(DecodeHeadroom), "too many bitrate classes");
+    info->decode_headroom_count = playback_get_decode_headroom(headroom);
+    for (pb_size_t n = 0; n < info->decode_headroom_count; n++) {
+        info->decode_headroom[n].max_bitrate_bps = headroom[n].max_bitrate_bps;
+        info->decode_headroom[n].headroom_permille = headroom[n].headroom_permille;
+        info->decode_headroom[n].frames_measured = headroom[n].frames_measured;
+    }
+
+    info->has_channel_role = true;
+    switch (playback_get_output_routing()) {
+        case OPUS_OUTPUT_LEFT:  info->channel_role = ChannelRole_CHANNEL_ROLE_LEFT; break;
+        case OPUS_OUTPUT_RIGHT: info->channel_role = ChannelRole_CHANNEL_ROLE_RIGHT; break;
+        case OPUS_OUTPUT_MONO:  info->channel_role = ChannelRole_CHANNEL_ROLE_MONO; break;
+        // swapped still plays both channels
+        default:                info->channel_role = ChannelRole_CHANNEL_ROLE_STEREO; break;
+    }
+    // playback runs off its own I2S clock and does not follow the transmitter's
+    info->has_clock_sync = true;
+    info->clock_sync = false;
+}
+
 void network_handle_next_client(int server_socket) {
     struct sockaddr_in clientAddr;
     socklen_t clientAddrLen = (socklen_t) sizeof(clientAddr);
@@ -384,15 +1319,25 @@ void network_handle_next_client(int server_socket) {
     int client_socket = accept(server_socket, (sockaddr*) &clientAddr, &clientAddrLen);
     SOCK_ERROR_CHECK(client_socket);
     Serial.printf("[network] transmitter %d connected\n", clientAddr.sin_addr.s_addr);
-    pb_ostream_t pb_socket_ostream = network_pb_ostream_from_socket(client_socket);
+    int64_t accepted_at = esp_timer_get_time();
+
+    // every send() carries a whole message now, so waiting to coalesce them only adds latency
+    int nodelay = 1;
+    if (setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) != 0) {
+        Serial.printf("[network] could not set TCP_NODELAY: errno %d\n", errno);
+    }
+
+    static network_tx_t tx;
+    tx.socket = client_socket;
+    tx.n_messages_sent = 0;
+    tx.n_send_calls = 0;
     {
         ToTransmitter helloMessage = ToTransmitter_init_zero;
         helloMessage.which_message = ToTransmitter_receiver_information_tag;
         helloMessage.message.receiver_information.discovery_data = network_initialize_discovery_response().message.discovery_response;
-        helloMessage.message.receiver_information.max_encoded_frame_size = 4096;
-        helloMessage.message.receiver_information.max_decoded_frame_size = playback_get_maximum_frame_size_bytes();
-        if (!pb_encode_delimited(&pb_socket_ostream, ToTransmitter_fields, &helloMessage)) {
-            const char* errMsg = pb_socket_ostream.errmsg;
+        network_initialize_receiver_capabilities(&helloMessage.message.receiver_information);
+        const char* errMsg = nullptr;
+        if (!network_send_delimited(&tx, ToTransmitter_fields, &helloMessage, &errMsg)) {
             if (errMsg == nullptr) {
                 errMsg = "Unknown";
             }
@@ -402,53 +1347,300 @@ void network_handle_next_client(int server_socket) {
             return;
         }
     }
+    Serial.printf(
+        "[network] hello sent %lldus after accept in %u send() call(s)\n",
+        esp_timer_get_time() - accepted_at,
+        tx.n_send_calls
+    );
 
     pb_istream_t pb_socket_istream = network_pb_istream_from_socket(client_socket);
     playback_start_new_stream();
-    
+    xEventGroupSetBits(network_event_group, NETWORK_EVENT_GROUP_BIT_ACTIVE_STREAM);
+
+    network_rx_stream_t* stream = &network_rx_stream;
+    *stream = {};
+    stream->framing = AudioFraming_AUDIO_FRAMING_PROTOBUF;
+    stream->frames_per_message = 1;
     while (true) {
-        ToReceiver toReceiver = ToReceiver_init_zero;
-        if (!pb_decode_delimited(&pb_socket_istream, ToReceiver_fields, &toReceiver)) {
-            const char* errMsg = pb_socket_istream.errmsg;
+        const char* errMsg = nullptr;
+        bool received = stream->framing == AudioFraming_AUDIO_FRAMING_COMPACT
+            ? network_receive_compact(stream, &pb_socket_istream, &errMsg)
+            : network_receive_delimited(stream, &pb_socket_istream, &errMsg);
+        if (!received) {
             if (errMsg == nullptr) {
                 errMsg = "Unknown";
             }
-            Serial.printf("Failed to read audio data protobuf (%s), closing connection.\n", errMsg);
+            Serial.printf("Failed to read from transmitter (%s), closing connection.\n", errMsg);
             break;
         }
-
-        if (toReceiver.which_message != ToReceiver_audio_data_tag) {
-            Serial.println("unknown message, closing connection.");
-            break;
-        }
-
-        pb_bytes_ctxt* audio_data = (pb_bytes_ctxt*) toReceiver.message.audio_data.opus_encoded_frame.arg;
-        assert(audio_data != nullptr);
-
-        ESP_ERROR_CHECK(playback_queue_audio(audio_data->data, audio_data->len));
-        network_pb_audio_data_destroy(&toReceiver.message.audio_data);
+        network_link_timing_report_first_packet();
+    }
+    if (stream->n_frames_lost > 0) {
+        Serial.printf("[network] %u frame(s) were missing from the stream and concealed\n", stream->n_frames_lost);
     }
+    xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_ACTIVE_STREAM);
 
     shutdown(client_socket, 0);
     close(client_socket);
     return;
 }
 
-void network_task_reconnect_after_cooldown(void* pvParameters) {
-    while (true) {
-        EventBits_t networkEventBits = xEventGroupWaitBits(network_event_group, NETWORK_EVENT_GROUP_BIT_RECONNECT_COOLDOWN, pdFALSE, pdFALSE, portMAX_DELAY);
-        if ((networkEventBits & NETWORK_EVENT_GROUP_BIT_RECONNECT_COOLDOWN) > 0) {
-            vTaskDelay(NETWORK_RECONNECT_COOLDOWN_MILLIS * portTICK_RATE_MS);
-            xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_RECONNECT_COOLDOWN);
-            ESP_ERROR_CHECK(esp_wifi_connect());
+#define BROADCAST_MAGIC_WORD 0x2C5DA044
+#define NETWORK_DISCOVERY_RX_BUFFER_SIZE 768
+// replies to discovery requests are limited to this many per second on average, in bursts of up to NETWORK_DISCOVERY_REPLY_BURST
+#define NETWORK_DISCOVERY_REPLIES_PER_SECOND 4
+#define NETWORK_DISCOVERY_REPLY_BURST        8
+// longer DiscoveryQuery.response_window_ms are cut to this
+#define NETWORK_DISCOVERY_MAX_RESPONSE_WINDOW_MILLIS 2000
+// replies waiting for their random delay; requests beyond that are not answered
+#define NETWORK_DISCOVERY_MAX_PENDING_REPLIES 8
+// how long recvfrom waits at most before the task looks at the connection again
+#define NETWORK_DISCOVERY_RECEIVE_TIMEOUT_MILLIS 1000
+#define NETWORK_DISCOVERY_ERROR_BACKOFF_MILLIS   100
+// after coming online the receiver announces itself at these times, each plus a random delay
+// of up to NETWORK_DISCOVERY_ANNOUNCE_JITTER_MILLIS so that receivers powered on together don't collide
+static const uint32_t network_discovery_announce_at_millis[] = { 0, 2000, 6000 };
+#define NETWORK_DISCOVERY_ANNOUNCE_JITTER_MILLIS 1000
+
+typedef struct {
+    struct sockaddr_storage to;
+    socklen_t to_len;
+    int64_t due_at;
+    bool pending;
+} network_discovery_reply_t;
+
+typedef struct {
+    // every discovery request starts with the encoded magic_word field followed by the tag of
+    // discovery_request, as both nanopb and protobuf-java write fields in the order of their numbers.
+    // Datagrams that don't are dropped without decoding, discovery responses of other receivers included.
+    pb_byte_t request_prefix[1 + 5 + 1];
+    size_t request_prefix_len;
+    // a discovery request without options, which can be answered without decoding
+    pb_byte_t plain_request[BroadcastMessage_size];
+    size_t plain_request_len;
+    // the encoded response, refreshed when currently_streaming changes
+    pb_byte_t response[BroadcastMessage_size];
+    size_t response_len;
+    bool response_currently_streaming;
+    uint64_t mac_address;
+    uint32_t reply_tokens;
+    int64_t reply_tokens_updated_at;
+    network_discovery_reply_t replies[NETWORK_DISCOVERY_MAX_PENDING_REPLIES];
+    int64_t online_at;
+    // index into network_discovery_announce_at_millis of the next announcement
+    size_t next_announcement;
+    int64_t next_announcement_at;
+} network_discovery_t;
+
+/** encodes message into buffer, which has to be large enough for any message of its type; returns the encoded length */
+size_t network_discovery_encode(const pb_msgdesc_t* fields, const void* message, pb_byte_t* buffer, size_t buffer_size) {
+    pb_ostream_t out_stream = pb_ostream_from_buffer(buffer, buffer_size);
+    if (!pb_encode(&out_stream, fields, message)) {
+        Serial.printf("Failed to encode discovery message: %s\n", PB_GET_ERROR(&out_stream));
+        abort();
+    }
+    return out_stream.bytes_written;
+}
+
+void network_discovery_initialize(network_discovery_t* discovery) {
+    pb_ostream_t prefix_stream = pb_ostream_from_buffer(discovery->request_prefix, sizeof(discovery->request_prefix));
+    bool prefix_encoded = pb_encode_tag(&prefix_stream, PB_WT_VARINT, BroadcastMessage_magic_word_tag)
+        && pb_encode_varint(&prefix_stream, BROADCAST_MAGIC_WORD)
+        && pb_encode_tag(&prefix_stream, PB_WT_VARINT, BroadcastMessage_discovery_request_tag);
+    assert(prefix_encoded);
+    discovery->request_prefix_len = prefix_stream.bytes_written;
+
+    BroadcastMessage request = BroadcastMessage_init_zero;
+    request.magic_word = BROADCAST_MAGIC_WORD;
+    request.which_message = BroadcastMessage_discovery_request_tag;
+    request.message.discovery_request = true;
+    discovery->plain_request_len = network_discovery_encode(BroadcastMessage_fields, &request, discovery->plain_request, sizeof(discovery->plain_request));
+
+    discovery->response_len = 0;
+    discovery->mac_address = network_initialize_discovery_response().message.discovery_response.mac_address;
+    discovery->reply_tokens = NETWORK_DISCOVERY_REPLY_BURST;
+    discovery->reply_tokens_updated_at = esp_timer_get_time();
+    discovery->next_announcement = sizeof(network_discovery_announce_at_millis) / sizeof(uint32_t);
+}
+
+/** encodes the discovery response again if the streaming state changed since it was last encoded */
+void network_discovery_refresh_response(network_discovery_t* discovery) {
+    bool currently_streaming = (xEventGroupGetBits(network_event_group) & NETWORK_EVENT_GROUP_BIT_ACTIVE_STREAM) != 0;
+    if (discovery->response_len > 0 && discovery->response_currently_streaming == currently_streaming) {
+        return;
+    }
+
+    static BroadcastMessage response;
+    response = network_initialize_discovery_response();
+    response.message.discovery_response.currently_streaming = currently_streaming;
+    discovery->response_len = network_discovery_encode(BroadcastMessage_fields, &response, discovery->response, sizeof(discovery->response));
+    discovery->response_currently_streaming = currently_streaming;
+}
+
+/** refills the reply tokens for the time passed; whether one is left */
+bool network_discovery_can_reply(network_discovery_t* discovery) {
+    int64_t now = esp_timer_get_time();
+    int64_t refill = (now - discovery->reply_tokens_updated_at) * NETWORK_DISCOVERY_REPLIES_PER_SECOND / 1000000;
+    if (refill > 0) {
+        discovery->reply_tokens = (uint32_t) min((int64_t) NETWORK_DISCOVERY_REPLY_BURST, discovery->reply_tokens + refill);
+        // keeps the time of the partial token that is still refilling, unless the bucket is full
+        discovery->reply_tokens_updated_at = discovery->reply_tokens == NETWORK_DISCOVERY_REPLY_BURST
+            ? now
+            : discovery->reply_tokens_updated_at + refill * 1000000 / NETWORK_DISCOVERY_REPLIES_PER_SECOND;
+    }
+    return discovery->reply_tokens > 0;
+}
+
+/**
+ * whether the datagram is a discovery request this receiver answers, and after how long. Only
+ * decodes it when it is not a request in the plain form.
+ */
+bool network_discovery_parse_request(network_discovery_t* discovery, const pb_byte_t* datagram, size_t len, uint32_t* delay_millis) {
+    *delay_millis = 0;
+    if (len == discovery->plain_request_len && memcmp(datagram, discovery->plain_request, len) == 0) {
+        return true;
+    }
+
+    static BroadcastMessage received_message;
+    received_message = BroadcastMessage_init_zero;
+    pb_istream_t received_buffer_istream = pb_istream_from_buffer(datagram, len);
+    if (!pb_decode(&received_buffer_istream, BroadcastMessage_fields, &received_message)) {
+        Serial.printf("Failed to decode broadcast message: %s\n", PB_GET_ERROR(&received_buffer_istream));
+        return false;
+    }
+    if (received_message.magic_word != BROADCAST_MAGIC_WORD || received_message.which_message != BroadcastMessage_discovery_request_tag) {
+        return false;
+    }
+    if (!received_message.has_discovery_query) {
+        return true;
+    }
+
+    const DiscoveryQuery* query = &received_message.discovery_query;
+    if (query->has_known_receivers && discovery_filter_contains(
+            query->known_receivers.bytes,
+            query->known_receivers.size,
+            query->known_receivers_hash_count,
+            query->known_receivers_seed,
+            discovery->mac_address)) {
+        return false;
+    }
+    if (query->has_response_window_ms && query->response_window_ms > 0) {
+        *delay_millis = discovery_response_delay_ms(min(query->response_window_ms, (uint32_t) NETWORK_DISCOVERY_MAX_RESPONSE_WINDOW_MILLIS), esp_random());
+    }
+    return true;
+}
+
+/**
+ * queues the response for the sender of a request, to be sent at due_at. A sender that already
+ * waits for a response doesn't get a second one. Returns whether a response was queued.
+ */
+bool network_discovery_schedule_reply(network_discovery_t* discovery, const struct sockaddr_storage* to, socklen_t to_len, int64_t due_at) {
+    network_discovery_reply_t* free_reply = nullptr;
+    for (network_discovery_reply_t& reply : discovery->replies) {
+        if (reply.pending && reply.to_len == to_len && memcmp(&reply.to, to, to_len) == 0) {
+            return false;
+        }
+        if (!reply.pending && free_reply == nullptr) {
+            free_reply = &reply;
         }
     }
+    if (free_reply == nullptr) {
+        return false;
+    }
+    memcpy(&free_reply->to, to, to_len);
+    free_reply->to_len = to_len;
+    free_reply->due_at = due_at;
+    free_reply->pending = true;
+    return true;
 }
 
-#define BROADCAST_MAGIC_WORD 0x2C5DA044
+void network_discovery_start_announcing(network_discovery_t* discovery) {
+    discovery->online_at = esp_timer_get_time();
+    discovery->next_announcement = 0;
+    discovery->next_announcement_at = discovery->online_at
+        + (int64_t) discovery_response_delay_ms(NETWORK_DISCOVERY_ANNOUNCE_JITTER_MILLIS, esp_random()) * 1000;
+}
+
+/** when the next reply or announcement is due; INT64_MAX if none is */
+int64_t network_discovery_next_due(const network_discovery_t* discovery) {
+    int64_t next_due = INT64_MAX;
+    if (discovery->next_announcement < sizeof(network_discovery_announce_at_millis) / sizeof(uint32_t)) {
+        next_due = discovery->next_announcement_at;
+    }
+    for (const network_discovery_reply_t& reply : discovery->replies) {
+        if (reply.pending) {
+            next_due = min(next_due, reply.due_at);
+        }
+    }
+    return next_due;
+}
+
+/** sends the response to every reply and announcement that is due */
+void network_discovery_send_due(network_discovery_t* discovery, int socket) {
+    int64_t now = esp_timer_get_time();
+    for (network_discovery_reply_t& reply : discovery->replies) {
+        if (!reply.pending || reply.due_at > now) {
+            continue;
+        }
+        reply.pending = false;
+        network_discovery_refresh_response(discovery);
+        if (sendto(socket, discovery->response, discovery->response_len, 0, (struct sockaddr*) &reply.to, reply.to_len) < 0) {
+            Serial.printf("[network] failed to send a discovery response: errno %d\n", errno);
+        }
+    }
+
+    size_t n_announcements = sizeof(network_discovery_announce_at_millis) / sizeof(uint32_t);
+    if (discovery->next_announcement >= n_announcements || discovery->next_announcement_at > now) {
+        return;
+    }
+    sockaddr_in broadcast_addr = {};
+    broadcast_addr.sin_family = AF_INET;
+    broadcast_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    broadcast_addr.sin_port = htons(NETWORK_PORT_DISCOVERY);
+    network_discovery_refresh_response(discovery);
+    if (sendto(socket, discovery->response, discovery->response_len, 0, (struct sockaddr*) &broadcast_addr, sizeof(broadcast_addr)) < 0) {
+        Serial.printf("[network] failed to send a discovery announcement: errno %d\n", errno);
+    }
+    discovery->next_announcement++;
+    if (discovery->next_announcement < n_announcements) {
+        discovery->next_announcement_at = discovery->online_at
+            + (int64_t) network_discovery_announce_at_millis[discovery->next_announcement] * 1000
+            + (int64_t) discovery_response_delay_ms(NETWORK_DISCOVERY_ANNOUNCE_JITTER_MILLIS, esp_random()) * 1000;
+    }
+}
+
+/** makes recvfrom return in time for the next reply or announcement; only calls setsockopt when the timeout changes */
+void network_discovery_set_receive_timeout(int socket, int64_t next_due, uint32_t* current_timeout_millis) {
+    int64_t timeout_millis = NETWORK_DISCOVERY_RECEIVE_TIMEOUT_MILLIS;
+    if (next_due != INT64_MAX) {
+        timeout_millis = constrain((next_due - esp_timer_get_time() + 999) / 1000, (int64_t) 1, timeout_millis);
+    }
+    if ((uint32_t) timeout_millis == *current_timeout_millis) {
+        return;
+    }
+    struct timeval receive_timeout = {
+        .tv_sec = (time_t) (timeout_millis / 1000),
+        .tv_usec = (suseconds_t) ((timeout_millis % 1000) * 1000)
+    };
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout)) != 0) {
+        Serial.printf("[network] could not set a receive timeout on the discovery socket: errno %d\n", errno);
+        return;
+    }
+    *current_timeout_millis = (uint32_t) timeout_millis;
+}
+
+/**
+ * answers discovery requests and announces the receiver when it comes online. Every datagram that
+ * does not start like a discovery request is dropped after a memcmp, plain requests are answered
+ * with the response encoded beforehand, and replies are rate limited, so that a broadcast storm
+ * costs next to nothing on core 0. Requests with a response window are answered after a random
+ * delay within it, so that many receivers don't all answer at once.
+ */
 void network_task_discovery(void* pvParameters) {
-    size_t protobuf_buffer_len = 768;
-    pb_byte_t* protobuf_buffer = (pb_byte_t*) malloc(protobuf_buffer_len);
+    static pb_byte_t datagram[NETWORK_DISCOVERY_RX_BUFFER_SIZE];
+    static network_discovery_t discovery;
+    network_discovery_initialize(&discovery);
+
     int broadcast_socket = SOCK_ERROR_CHECK(socket(AF_INET, SOCK_DGRAM, IPPROTO_IP));
     {
         sockaddr_in listen_addr;
@@ -457,39 +1649,52 @@ void network_task_discovery(void* pvParameters) {
         listen_addr.sin_port = htons(NETWORK_PORT_DISCOVERY);
         SOCK_ERROR_CHECK(bind(broadcast_socket, (struct sockaddr*) &listen_addr, sizeof(listen_addr)));
     }
+    int broadcast = 1;
+    if (setsockopt(broadcast_socket, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast)) != 0) {
+        Serial.printf("[network] could not allow broadcasts on the discovery socket: errno %d\n", errno);
+    }
 
-    BroadcastMessage discovery_response = network_initialize_discovery_response();
-    
+    uint32_t receive_timeout_millis = 0;
+    uint32_t n_replies_dropped = 0;
     while(true) {
         EventBits_t networkEventBits = xEventGroupWaitBits(network_event_group, NETWORK_EVENT_GROUP_BIT_CONNECTED, pdFALSE, pdFALSE, portMAX_DELAY);
         if ((networkEventBits & NETWORK_EVENT_GROUP_BIT_CONNECTED) == 0) {
             continue;
         }
+        if ((xEventGroupClearBits(network_event_group, NETWORK_EVENT_GROUP_BIT_ANNOUNCE) & NETWORK_EVENT_GROUP_BIT_ANNOUNCE) != 0) {
+            network_discovery_start_announcing(&discovery);
+        }
+        network_discovery_send_due(&discovery, broadcast_socket);
+        network_discovery_set_receive_timeout(broadcast_socket, network_discovery_next_due(&discovery), &receive_timeout_millis);
 
         struct sockaddr_storage sender_addr;
         socklen_t sender_addr_len = sizeof(sender_addr);
-        size_t n_bytes_received = SOCK_ERROR_CHECK(recvfrom(broadcast_socket, protobuf_buffer, protobuf_buffer_len, 0, (struct sockaddr *) &sender_addr, &sender_addr_len));
+        int n_bytes_received = recvfrom(broadcast_socket, datagram, sizeof(datagram), 0, (struct sockaddr *) &sender_addr, &sender_addr_len);
+        if (n_bytes_received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Serial.printf("[network] failed to receive on the discovery socket: errno %d\n", errno);
+                vTaskDelay(NETWORK_DISCOVERY_ERROR_BACKOFF_MILLIS / portTICK_PERIOD_MS);
+            }
+            continue;
+        }
 
-        BroadcastMessage received_message;
-        pb_istream_t received_buffer_istream = pb_istream_from_buffer(protobuf_buffer, n_bytes_received);
-        if (!pb_decode(&received_buffer_istream, BroadcastMessage_fields, &received_message)) {
-            Serial.printf("Failed to decode broadcast message: %s\n", received_buffer_istream.errmsg);
+        if ((size_t) n_bytes_received < discovery.request_prefix_len || memcmp(datagram, discovery.request_prefix, discovery.request_prefix_len) != 0) {
             continue;
         }
-        if (received_message.magic_word != BROADCAST_MAGIC_WORD) {
+        if (!network_discovery_can_reply(&discovery)) {
+            if (++n_replies_dropped % 100 == 1) {
+                Serial.printf("[network] discovery replies rate limited, %u dropped so far\n", n_replies_dropped);
+            }
             continue;
         }
-        if (received_message.which_message != BroadcastMessage_discovery_request_tag) {
+        uint32_t delay_millis;
+        if (!network_discovery_parse_request(&discovery, datagram, n_bytes_received, &delay_millis)) {
             continue;
         }
-            
-        pb_ostream_t out_stream = pb_ostream_from_buffer(protobuf_buffer, protobuf_buffer_len);
-        if (!pb_encode(&out_stream, BroadcastMessage_fields, &discovery_response)) {
-            Serial.printf("Failed to encode discovery response: %s\n", out_stream.errmsg);
-            abort();
+        if (!network_discovery_schedule_reply(&discovery, &sender_addr, sender_addr_len, esp_timer_get_time() + (int64_t) delay_millis * 1000)) {
+            continue;
         }
-
-        SOCK_ERROR_CHECK(sendto(broadcast_socket, protobuf_buffer, out_stream.bytes_written, 0, (struct sockaddr *) &sender_addr, sizeof(sender_addr)));
+        discovery.reply_tokens--;
     }
 }
 
@@ -518,6 +1723,11 @@ void network_task_accept_audio_stream(void* pvParameters) {
 void network_initialize() {
 
     network_event_group = xEventGroupCreate();
+    network_link_queue = xQueueCreate(NETWORK_LINK_QUEUE_LENGTH, sizeof(network_link_message_t));
+    if (network_link_queue == nullptr) {
+        Serial.println("[network] Failed to create the link event queue: OOM");
+        panic();
+    }
     ESP_ERROR_CHECK(esp_netif_init());
     esp_netif_create_default_wifi_sta();
 
@@ -542,17 +1752,17 @@ void network_initialize() {
     BaseType_t rtosResult;
     
     rtosResult = xTaskCreatePinnedToCore(
-        network_task_reconnect_after_cooldown,
-        "net-reconnect",
-        configMINIMAL_STACK_SIZE * 2,
+        network_task_link,
+        "net-link",
+        configMINIMAL_STACK_SIZE * 4,
         nullptr,
-        tskIDLE_PRIORITY,
+        tskIDLE_PRIORITY + 1,
         &taskHandle,
         0
     );
     if (rtosResult != pdPASS)
     {
-        Serial.println("[network] Failed to start network reconnect task: OOM");
+        Serial.println("[network] Failed to start network link task: OOM");
         panic();
     }
 
@@ -4,14 +4,28 @@
 #include <freertos/FreeRTOS.h>
 #include <Arduino.h>
 #include <opus.h>
+#include <opus_scratch.h>
+#include <opus_profile.h>
 #include "runtime.hpp"
+#include <esp_timer.h>
 
 #define DECODE_AT_SAMPLE_RATE      48000
 #define AUDIO_BUFFER_SIZE          (sizeof(opus_int16) * 48 * 60 * 2) // 60ms at 48khz stereo. This is the maximum according to the opus documentation
+#define AUDIO_BUFFER_SAMPLES_PER_CHANNEL (AUDIO_BUFFER_SIZE / sizeof(opus_int16) / 2)
 #define DMA_BUFFER_COUNT           8
 #define DMA_BUFFER_SIZE            720
 #define DMA_BUFFER_DURATION_MICROS (DMA_BUFFER_SIZE*DMA_BUFFER_COUNT / 48 / 2 / sizeof(opus_int16) * 1000)
 #define DMA_BUFFER_DURATION_TICKS  (DMA_BUFFER_DURATION_MICROS / 1000 / portTICK_PERIOD_MS)
+// share of a frame's duration the decoder may take on average before concealment gets cheaper
+#define PLC_NOISE_ABOVE_LOAD_PERMILLE  500
+#define PLC_REPEAT_ABOVE_LOAD_PERMILLE 750
+#define PLC_POLICY_COUNT               3
+// encoded frames are received straight into this ring; a power of two, so the byte counters may wrap
+#define FRAME_RING_SIZE                (32 * 1024)
+// frames (and markers) queued for the playback task
+#define FRAME_QUEUE_LENGTH             40
+// the highest bitrate opus codes, which bounds how large a frame of a given duration can be
+#define OPUS_MAX_BITRATE_BPS           510000
 
 #define OPUS_ERROR_CHECK(x) opus_error_check(x, __FILE__, __LINE__)
 void opus_error_check(int result, const char* file, int line) {
@@ -24,8 +38,12 @@ void opus_error_check(int result, const char* file, int line) {
 typedef struct {
     void* data;
     size_t len;
+    // bytes of the frame ring this frame occupies, including any skipped tail of the ring. 0 for markers
+    size_t ring_footprint;
 } encoded_opus_frame_t;
 
+static_assert((FRAME_RING_SIZE & (FRAME_RING_SIZE - 1)) == 0, "FRAME_RING_SIZE must be a power of two");
+
 static const i2s_config_t i2s_config = {
     .mode = i2s_mode_t(I2S_MODE_MASTER | I2S_MODE_TX),
     .sample_rate = DECODE_AT_SAMPLE_RATE,
@@ -55,74 +73,389 @@ void playback_unmute()
     digitalWrite(PIN_MUTE, LOW);
 }
 
-void playback_adjust_volume_16bit_dual_channel(double volume, opus_int16* buffer, size_t bufferLenBytes) {
-    int sampleCount = bufferLenBytes / sizeof(opus_int16);
-    for (int pos = 0;pos < sampleCount;pos++) {
-        opus_int16 sample = buffer[pos];
-        buffer[pos] = (opus_int16) ((double) sample * volume);
+// allocated once in playback_initialize and only ever touched by the playback task
+static OpusDecoder* opus_decoder = nullptr;
+
+typedef struct {
+    opus_int32 gain_q8_db;
+    opus_int32 routing;
+    opus_int32 dither;
+    bool changed;
+} playback_output_settings_t;
+
+// written by playback_set_output from any task, handed to the decoder by the playback task
+static portMUX_TYPE playback_output_settings_mux = portMUX_INITIALIZER_UNLOCKED;
+static playback_output_settings_t playback_output_settings = {
+    .gain_q8_db = 0,
+    .routing = OPUS_OUTPUT_STEREO,
+    .dither = 0,
+    .changed = false
+};
+
+void playback_set_output(float volume, int routing, bool dither) {
+    // OPUS_SET_GAIN takes Q8 dB, its lower bound of -128 dB is as good as silence
+    opus_int32 gain_q8_db = -32768;
+    if (volume > 0) {
+        gain_q8_db = (opus_int32) constrain(lroundf(20 * log10f(volume) * 256), -32768, 32767);
     }
+
+    portENTER_CRITICAL(&playback_output_settings_mux);
+    playback_output_settings.gain_q8_db = gain_q8_db;
+    playback_output_settings.routing = routing;
+    playback_output_settings.dither = dither ? 1 : 0;
+    playback_output_settings.changed = true;
+    portEXIT_CRITICAL(&playback_output_settings_mux);
 }
 
-static OpusDecoder* current_opus_decoder = nullptr;
-void playback_start_new_stream() {
-    if (current_opus_decoder != nullptr) {
-        opus_decoder_destroy(current_opus_decoder);
+/** hands new output settings to the decoder. Called by the playback task before decoding. */
+void playback_apply_output_settings() {
+    if (!playback_output_settings.changed) {
+        return;
     }
-    int opus_error = OPUS_OK;
-    current_opus_decoder = opus_decoder_create(DECODE_AT_SAMPLE_RATE, 2, &opus_error);
-    OPUS_ERROR_CHECK(opus_error);
+    portENTER_CRITICAL(&playback_output_settings_mux);
+    playback_output_settings_t settings = playback_output_settings;
+    playback_output_settings.changed = false;
+    portEXIT_CRITICAL(&playback_output_settings_mux);
+
+    OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_SET_GAIN(settings.gain_q8_db)));
+    OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_SET_OUTPUT_ROUTING(settings.routing)));
+    OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_SET_OUTPUT_DITHER(settings.dither)));
+}
+
+int playback_get_output_routing() {
+    portENTER_CRITICAL(&playback_output_settings_mux);
+    int routing = playback_output_settings.routing;
+    portEXIT_CRITICAL(&playback_output_settings_mux);
+    return routing;
 }
 
 QueueHandle_t qEncodedOpusFrames;
 
+// queued in place of a frame to tell the playback task that all following frames belong to a
+// new stream. Resetting the decoder in-band keeps it on the playback task and in order with the frames.
+static encoded_opus_frame_t playback_new_stream_marker = {
+    .data = nullptr,
+    .len = 0,
+    .ring_footprint = 0
+};
+
+void playback_start_new_stream() {
+    encoded_opus_frame_t* marker = &playback_new_stream_marker;
+    while (xQueueSend(qEncodedOpusFrames, &marker, portMAX_DELAY) != pdTRUE);
+}
+
+/** resets the decoder if the given frame is the new stream marker. Returns whether it was. */
+bool playback_handle_new_stream_marker(encoded_opus_frame_t* encoded_frame) {
+    if (encoded_frame != &playback_new_stream_marker) {
+        return false;
+    }
+
+    OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_RESET_STATE));
+    return true;
+}
+
+// queued in place of a frame that was lost or dropped, so that the playback task conceals it
+// and the stream keeps its timing
+static encoded_opus_frame_t playback_lost_frame_marker = {
+    .data = nullptr,
+    .len = 0,
+    .ring_footprint = 0
+};
+
+void playback_queue_lost_frame() {
+    encoded_opus_frame_t* marker = &playback_lost_frame_marker;
+    while (xQueueSend(qEncodedOpusFrames, &marker, portMAX_DELAY) != pdTRUE);
+}
+
+// Frames are played, and so freed, in the order they were reserved: the ring needs no allocator,
+// just the number of bytes ever reserved (head) and ever freed (tail). Frames never wrap around
+// the end of the ring, the reserving task skips the rest of the ring instead.
+static uint8_t* playback_frame_ring = nullptr;
+// only written by the task receiving frames
+static uint32_t playback_frame_ring_head = 0;
+static encoded_opus_frame_t* playback_frame_ring_last_reserved = nullptr;
+// only written by the playback task
+static uint32_t playback_frame_ring_tail = 0;
+// given by the playback task whenever it frees a frame, so a reservation can wait for space
+static SemaphoreHandle_t playback_frame_ring_freed = nullptr;
+
+void* playback_reserve_frame(size_t len) {
+    uint32_t footprint = (sizeof(encoded_opus_frame_t) + len + 3) & ~3;
+    // larger frames could need more than the whole ring after skipping its tail
+    assert(footprint <= FRAME_RING_SIZE / 2);
+    uint32_t offset = playback_frame_ring_head % FRAME_RING_SIZE;
+    if (offset + footprint > FRAME_RING_SIZE) {
+        footprint += FRAME_RING_SIZE - offset;
+        offset = 0;
+    }
+    while (playback_frame_ring_head + footprint - __atomic_load_n(&playback_frame_ring_tail, __ATOMIC_ACQUIRE) > FRAME_RING_SIZE) {
+        xSemaphoreTake(playback_frame_ring_freed, portMAX_DELAY);
+    }
+
+    encoded_opus_frame_t* encoded_frame = (encoded_opus_frame_t*) &playback_frame_ring[offset];
+    encoded_frame->data = encoded_frame + 1;
+    encoded_frame->len = len;
+    encoded_frame->ring_footprint = footprint;
+    playback_frame_ring_head += footprint;
+    playback_frame_ring_last_reserved = encoded_frame;
+    return encoded_frame->data;
+}
+
+void playback_queue_reserved_frame(void* frame) {
+    encoded_opus_frame_t* encoded_frame = ((encoded_opus_frame_t*) frame) - 1;
+    while (xQueueSend(qEncodedOpusFrames, &encoded_frame, portMAX_DELAY) != pdTRUE);
+}
+
+void playback_discard_reserved_frame(void* frame) {
+    encoded_opus_frame_t* encoded_frame = ((encoded_opus_frame_t*) frame) - 1;
+    // only the last reservation can be given back, the ones before it are still in the ring
+    assert(encoded_frame == playback_frame_ring_last_reserved);
+    playback_frame_ring_head -= encoded_frame->ring_footprint;
+    playback_frame_ring_last_reserved = nullptr;
+}
+
+void playback_free_frame(encoded_opus_frame_t* encoded_frame) {
+    if (encoded_frame->ring_footprint == 0) {
+        return;
+    }
+    __atomic_store_n(&playback_frame_ring_tail, playback_frame_ring_tail + encoded_frame->ring_footprint, __ATOMIC_RELEASE);
+    xSemaphoreGive(playback_frame_ring_freed);
+}
+
+static const char* playback_plc_policy_names[PLC_POLICY_COUNT] = { "full", "noise", "repeat" };
+
+typedef struct {
+    // decode time per frame duration, exponentially averaged over decoded (not concealed) frames
+    uint32_t decode_load_permille;
+    opus_int32 policy;
+    uint32_t concealed_frames[PLC_POLICY_COUNT];
+    unsigned long conceal_micros_max[PLC_POLICY_COUNT];
+} playback_plc_state_t;
+
+// only ever touched by the playback task
+static playback_plc_state_t playback_plc = {};
+
+/**
+ * picks the concealment policy from the decoder's load: the full PLC costs more than a decode,
+ * so when there is little headroom left a loss burst would make the playback task fall behind.
+ * Takes effect with the next loss burst.
+ */
+void playback_update_plc_policy(uint32_t load_permille) {
+    playback_plc.decode_load_permille = (playback_plc.decode_load_permille * 7 + load_permille) / 8;
+
+    opus_int32 policy = OPUS_PLC_FULL;
+    if (playback_plc.decode_load_permille > PLC_REPEAT_ABOVE_LOAD_PERMILLE) {
+        policy = OPUS_PLC_REPEAT;
+    } else if (playback_plc.decode_load_permille > PLC_NOISE_ABOVE_LOAD_PERMILLE) {
+        policy = OPUS_PLC_NOISE;
+    }
+    if (policy != playback_plc.policy) {
+        OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_SET_PLC_POLICY(policy)));
+        playback_plc.policy = policy;
+    }
+}
+
+/** time decoding a frame took, relative to the frame's duration. 0 for frames without samples */
+uint32_t playback_decode_load_permille(unsigned long decode_duration_micros, int samples) {
+    uint32_t frame_duration_micros = (uint32_t) samples * 1000 / (DECODE_AT_SAMPLE_RATE / 1000);
+    if (frame_duration_micros == 0) {
+        return 0;
+    }
+    return min((uint32_t) (decode_duration_micros * 1000 / frame_duration_micros), (uint32_t) 2000);
+}
+
+// written by the playback task, read by the network task when it introduces the receiver to a transmitter
+static portMUX_TYPE playback_decode_headroom_mux = portMUX_INITIALIZER_UNLOCKED;
+static playback_decode_headroom_t playback_decode_headroom[PLAYBACK_BITRATE_CLASS_COUNT] = {
+    { .max_bitrate_bps = 48000 },
+    { .max_bitrate_bps = 96000 },
+    { .max_bitrate_bps = 192000 },
+    { .max_bitrate_bps = OPUS_MAX_BITRATE_BPS }
+};
+
+/** accounts the load of decoding a frame of len bytes and samples to the frame's bitrate class */
+void playback_update_decode_headroom(size_t len, int samples, uint32_t load_permille) {
+    if (samples <= 0) {
+        return;
+    }
+    uint32_t bitrate_bps = (uint32_t) ((uint64_t) len * 8 * DECODE_AT_SAMPLE_RATE / samples);
+    int bitrate_class = 0;
+    while (bitrate_class < PLAYBACK_BITRATE_CLASS_COUNT - 1 && bitrate_bps > playback_decode_headroom[bitrate_class].max_bitrate_bps) {
+        bitrate_class++;
+    }
+    uint32_t headroom_permille = load_permille < 1000 ? 1000 - load_permille : 0;
+
+    portENTER_CRITICAL(&playback_decode_headroom_mux);
+    playback_decode_headroom_t* headroom = &playback_decode_headroom[bitrate_class];
+    if (headroom->frames_measured == 0) {
+        headroom->headroom_permille = headroom_permille;
+    } else {
+        headroom->headroom_permille = (headroom->headroom_permille * 7 + headroom_permille) / 8;
+    }
+    headroom->frames_measured++;
+    portEXIT_CRITICAL(&playback_decode_headroom_mux);
+}
+
+size_t playback_get_decode_headroom(playback_decode_headroom_t headroom[PLAYBACK_BITRATE_CLASS_COUNT]) {
+    size_t n_classes = 0;
+    portENTER_CRITICAL(&playback_decode_headroom_mux);
+    for (int bitrate_class = 0; bitrate_class < PLAYBACK_BITRATE_CLASS_COUNT; bitrate_class++) {
+        if (playback_decode_headroom[bitrate_class].frames_measured > 0) {
+            headroom[n_classes++] = playback_decode_headroom[bitrate_class];
+        }
+    }
+    portEXIT_CRITICAL(&playback_decode_headroom_mux);
+    return n_classes;
+}
+
+void playback_print_plc_stats() {
+    Serial.printf("decode load %u permille, concealment policy %s\n", playback_plc.decode_load_permille, playback_plc_policy_names[playback_plc.policy]);
+    for (int policy = 0; policy < PLC_POLICY_COUNT; policy++) {
+        if (playback_plc.concealed_frames[policy] > 0) {
+            Serial.printf("concealed %u frames with the %s policy, MAX(conceal_duration_micros) = %lu\n",
+                playback_plc.concealed_frames[policy], playback_plc_policy_names[policy], playback_plc.conceal_micros_max[policy]);
+        }
+    }
+}
+
 opus_int16* decoded_audio_buffer;
 
+#ifdef OPUS_STAGE_PROFILING
+/** prints the cycles libopus spent per stage since the last call, averaged per call */
+void playback_print_stage_profile() {
+    opus_stage_profile profile;
+    opus_stage_profile_get(&profile);
+    opus_stage_profile_reset();
+    for (int stage = 0; stage < OPUS_STAGE_COUNT; stage++) {
+        if (profile.calls[stage] > 0) {
+            Serial.printf("AVG(%s cycles) = %llu over %u calls\n", opus_stage_name(stage), profile.ticks[stage] / profile.calls[stage], profile.calls[stage]);
+        }
+    }
+}
+#endif
+
+// written by the network module, read by the playback task when playback (re)starts
+static uint32_t playback_jitter_buffer_target_ms = 0;
+// only written by the playback task
+static uint32_t playback_underflow_count = 0;
+
+void playback_set_jitter_buffer_target_ms(uint32_t target_ms) {
+    __atomic_store_n(&playback_jitter_buffer_target_ms, target_ms, __ATOMIC_RELAXED);
+}
+
+uint32_t playback_get_underflow_count() {
+    return __atomic_load_n(&playback_underflow_count, __ATOMIC_RELAXED);
+}
+
+/**
+ * before playback (re)starts with a frame of frame_samples: waits until the queue holds the jitter
+ * buffer target, is full, or twice the target has passed, in case the stream is slower than that
+ */
+void playback_await_jitter_buffer_target(uint32_t frame_samples) {
+    uint32_t target_ms = __atomic_load_n(&playback_jitter_buffer_target_ms, __ATOMIC_RELAXED);
+    if (target_ms == 0 || frame_samples == 0) {
+        return;
+    }
+    int64_t give_up_at = esp_timer_get_time() + (int64_t) target_ms * 2000;
+    while ((uxQueueMessagesWaiting(qEncodedOpusFrames) + 1) * frame_samples / (DECODE_AT_SAMPLE_RATE / 1000) < target_ms
+            && uxQueueSpacesAvailable(qEncodedOpusFrames) > 0
+            && esp_timer_get_time() < give_up_at) {
+        vTaskDelay(1);
+    }
+}
+
+int playback_decode_frame(OpusDecoder* decoder, const void* encoded_opus_frame, size_t len, opus_int16* buffer, int max_samples_per_channel) {
+    return opus_decode(decoder, (const unsigned char*) encoded_opus_frame, len, buffer, max_samples_per_channel, 0);
+}
+
 void playback_task_play_audio_from_buffers(void* pvParameters) {
     ESP_ERROR_CHECK(i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL));
     ESP_ERROR_CHECK(i2s_set_pin(I2S_NUM_0, &pin_config));
     ESP_ERROR_CHECK(i2s_stop(I2S_NUM_0));
 
     boolean within_playback = false;
-    size_t underflow_counter = 0;
     size_t decode_duration_ticks_avg = 0;
+    unsigned long decode_duration_micros_max = 0;
     while (true) {
         encoded_opus_frame_t* encoded_frame;
         BaseType_t got_buffer = xQueueReceive(qEncodedOpusFrames, &encoded_frame, max((unsigned int) 0, DMA_BUFFER_DURATION_TICKS - decode_duration_ticks_avg - 1)); // 10 ticks for decoding
-        bool can_play_buffer = got_buffer == pdTRUE && encoded_frame->len > 0;
+        if (got_buffer == pdTRUE && playback_handle_new_stream_marker(encoded_frame)) {
+            continue;
+        }
+        // a lost frame can only be concealed while there is a stream to continue
+        bool can_play_buffer = got_buffer == pdTRUE && (encoded_frame->len > 0 || within_playback);
         if (!can_play_buffer) {
             if (within_playback) {
                 // TODO: underflow -> not enough network throughput? Notify audio source!
                 within_playback = false;
                 ESP_ERROR_CHECK(i2s_stop(I2S_NUM_0));
-                underflow_counter++;
-                Serial.printf("Underflow at %d\n", underflow_counter);
+                uint32_t underflow_counter = __atomic_add_fetch(&playback_underflow_count, 1, __ATOMIC_RELAXED);
+                Serial.printf("Underflow at %u\n", underflow_counter);
                 if (underflow_counter % 10 == 0) {
                     Serial.printf("AVG(decode_duration_ticks) = %d\n", decode_duration_ticks_avg);
+                    Serial.printf("MAX(decode_duration_micros) = %lu\n", decode_duration_micros_max);
+                    Serial.printf("opus scratch high water mark = %d of %d bytes\n", opus_scratch_high_water_mark(), opus_scratch_size());
+                    Serial.printf("playback task stack: %d bytes never used\n", uxTaskGetStackHighWaterMark(NULL));
+                    playback_print_plc_stats();
+#ifdef OPUS_STAGE_PROFILING
+                    playback_print_stage_profile();
+#endif
                 }
             }
             
             got_buffer = xQueueReceive(qEncodedOpusFrames, &encoded_frame, portMAX_DELAY);
-            if (got_buffer != pdTRUE || encoded_frame->len == 0) {
+            if (got_buffer == pdTRUE && playback_handle_new_stream_marker(encoded_frame)) {
+                continue;
+            }
+            if (got_buffer != pdTRUE) {
+                continue;
+            }
+            if (encoded_frame->len == 0) {
+                // nothing to conceal before the stream has started
+                playback_free_frame(encoded_frame);
                 continue;
             }
         }
 
         if (!within_playback) {
+            if (encoded_frame->len > 0) {
+                int frame_samples = opus_packet_get_nb_samples((unsigned char*) encoded_frame->data, encoded_frame->len, DECODE_AT_SAMPLE_RATE);
+                playback_await_jitter_buffer_target(frame_samples > 0 ? frame_samples : 0);
+            }
             ESP_ERROR_CHECK(i2s_start(I2S_NUM_0));
             within_playback = true;
         }
         
+        playback_apply_output_settings();
         unsigned long decode_started_at = micros();
-        size_t decoded_data_size = sizeof(opus_int16) * 2 * opus_packet_get_samples_per_frame((unsigned char*) encoded_frame->data, DECODE_AT_SAMPLE_RATE);
-        assert(decoded_data_size <= AUDIO_BUFFER_SIZE);
-        int nSamplesDecoded = opus_decode(current_opus_decoder, (unsigned char*) encoded_frame->data, encoded_frame->len, (opus_int16*) decoded_audio_buffer, AUDIO_BUFFER_SIZE, 0);
+        bool conceal = encoded_frame->len == 0;
+        int max_samples_per_channel = AUDIO_BUFFER_SAMPLES_PER_CHANNEL;
+        if (conceal) {
+            // conceal as much audio as the last frame had
+            opus_int32 last_frame_samples;
+            OPUS_ERROR_CHECK(opus_decoder_ctl(opus_decoder, OPUS_GET_LAST_PACKET_DURATION(&last_frame_samples)));
+            max_samples_per_channel = last_frame_samples > 0 ? last_frame_samples : DECODE_AT_SAMPLE_RATE / 50;
+        } else {
+            assert(sizeof(opus_int16) * 2 * opus_packet_get_samples_per_frame((unsigned char*) encoded_frame->data, DECODE_AT_SAMPLE_RATE) <= AUDIO_BUFFER_SIZE);
+        }
+        int nSamplesDecoded = playback_decode_frame(opus_decoder, encoded_frame->data, encoded_frame->len, decoded_audio_buffer, max_samples_per_channel);
         if (nSamplesDecoded < 0) {
             OPUS_ERROR_CHECK(nSamplesDecoded);
         }
-        decoded_data_size = nSamplesDecoded * 2 * sizeof(opus_int16);
-        free(encoded_frame->data);
-        free(encoded_frame);
-        size_t decode_duration_ticks = (((size_t) (micros() - decode_started_at)) + (1000 * portTICK_PERIOD_MS) - 1) / (1000 * portTICK_PERIOD_MS);
+        size_t decoded_data_size = nSamplesDecoded * 2 * sizeof(opus_int16);
+        size_t encoded_frame_len = encoded_frame->len;
+        playback_free_frame(encoded_frame);
+        unsigned long decode_duration_micros = micros() - decode_started_at;
+        if (conceal) {
+            playback_plc.concealed_frames[playback_plc.policy]++;
+            playback_plc.conceal_micros_max[playback_plc.policy] = max(playback_plc.conceal_micros_max[playback_plc.policy], decode_duration_micros);
+        } else if (nSamplesDecoded > 0) {
+            uint32_t load_permille = playback_decode_load_permille(decode_duration_micros, nSamplesDecoded);
+            playback_update_plc_policy(load_permille);
+            playback_update_decode_headroom(encoded_frame_len, nSamplesDecoded, load_permille);
+        }
+        decode_duration_micros_max = max(decode_duration_micros_max, decode_duration_micros);
+        size_t decode_duration_ticks = (((size_t) decode_duration_micros) + (1000 * portTICK_PERIOD_MS) - 1) / (1000 * portTICK_PERIOD_MS);
         if (decode_duration_ticks_avg == 0) {
             decode_duration_ticks_avg = decode_duration_ticks;
         } else {
@@ -149,15 +482,35 @@ void playback_initialize() {
         Serial.printf("OOM trying to allocate %d bytes of audio buffer\n", AUDIO_BUFFER_SIZE);
         abort();
     }
-    qEncodedOpusFrames = xQueueCreate(40, sizeof(encoded_opus_frame_t*));
-    
-    playback_start_new_stream();
+    qEncodedOpusFrames = xQueueCreate(FRAME_QUEUE_LENGTH, sizeof(encoded_opus_frame_t*));
+    playback_frame_ring = (uint8_t*) malloc(FRAME_RING_SIZE);
+    playback_frame_ring_freed = xSemaphoreCreateBinary();
+    if (playback_frame_ring == nullptr || playback_frame_ring_freed == nullptr) {
+        Serial.printf("OOM trying to allocate %d bytes of encoded frame ring\n", FRAME_RING_SIZE);
+        abort();
+    }
+
+    unsigned long decoder_init_start_micros = micros();
+    int opus_decoder_size = opus_decoder_get_size(2);
+    opus_decoder = (OpusDecoder*) malloc(opus_decoder_size);
+    if (opus_decoder == nullptr) {
+        Serial.printf("OOM trying to allocate %d bytes of opus decoder state\n", opus_decoder_size);
+        abort();
+    }
+    OPUS_ERROR_CHECK(opus_decoder_init(opus_decoder, DECODE_AT_SAMPLE_RATE, 2));
+#ifdef OPUS_DECODER_CELT_ONLY
+    Serial.printf("opus decoder (CELT only): %d bytes of state, init took %lu us\n", opus_decoder_size, micros() - decoder_init_start_micros);
+#else
+    Serial.printf("opus decoder: %d bytes of state, init took %lu us\n", opus_decoder_size, micros() - decoder_init_start_micros);
+#endif
 
+    // libopus takes its scratch memory from its own arena (NONTHREADSAFE_PSEUDOSTACK), so this
+    // task is the only one that may decode, and its stack only holds the decoder's call frames.
     TaskHandle_t taskHandle;
     BaseType_t rtosResult = xTaskCreatePinnedToCore(
         playback_task_play_audio_from_buffers,
         "playback",
-        configMINIMAL_STACK_SIZE * 20,
+        configMINIMAL_STACK_SIZE * 12,
         nullptr,
         7,
         &taskHandle,
@@ -171,25 +524,39 @@ void playback_initialize() {
     Serial.println("playback task started");
 }
 
-esp_err_t playback_queue_audio(void* encoded_opus_frame, size_t len) {
-    encoded_opus_frame_t* encoded_frame = (encoded_opus_frame_t*) malloc(sizeof(encoded_opus_frame_t));
-    if (encoded_frame == nullptr) {
-        return ESP_ERR_NO_MEM;
-    }
-
-    encoded_frame->data = malloc(len);
-    encoded_frame->len = len;
-    if (encoded_frame->data == nullptr) {
-        return ESP_ERR_NO_MEM;
-    }
+bool playback_can_decode(const void* encoded_opus_frame, size_t len) {
+#ifdef OPUS_DECODER_CELT_ONLY
+    // an empty frame is a lost packet and always concealable. Otherwise the config in the
+    // TOC byte has its top bit set for CELT-only packets (RFC 6716, section 3.1)
+    return len == 0 || (((const uint8_t*) encoded_opus_frame)[0] & 0x80) != 0;
+#else
+    return true;
+#endif
+}
 
-    memcpy(encoded_frame->data, encoded_opus_frame, len);
+size_t playback_get_maximum_frame_size_bytes() {
+    return AUDIO_BUFFER_SIZE;
+}
 
-    while (xQueueSend(qEncodedOpusFrames, &encoded_frame, portMAX_DELAY) != pdTRUE);
+bool playback_can_decode_frame_duration(uint32_t frame_duration_us) {
+    if (sizeof(opus_int16) * 2 * frame_duration_us * (DECODE_AT_SAMPLE_RATE / 1000) / 1000 > AUDIO_BUFFER_SIZE) {
+        return false;
+    }
+#ifdef OPUS_DECODER_CELT_ONLY
+    return frame_duration_us <= 20000;
+#else
+    return true;
+#endif
+}
 
-    return ESP_OK;
+uint32_t playback_get_output_latency_ms() {
+    return DMA_BUFFER_DURATION_MICROS / 1000;
 }
 
-size_t playback_get_maximum_frame_size_bytes() {
-    return AUDIO_BUFFER_SIZE;
+uint32_t playback_get_jitter_buffer_capacity_ms(uint32_t frame_duration_us) {
+    uint32_t max_frame_size = (uint32_t) ((uint64_t) OPUS_MAX_BITRATE_BPS / 8 * frame_duration_us / 1000000) + 1;
+    uint32_t footprint = (sizeof(encoded_opus_frame_t) + max_frame_size + 3) & ~3;
+    // a frame that doesn't fit the end of the ring skips it, which wastes less than one footprint
+    uint32_t frames = min((uint32_t) FRAME_QUEUE_LENGTH, (uint32_t) (FRAME_RING_SIZE / footprint - 1));
+    return frames * frame_duration_us / 1000;
 }
\ No newline at end of file
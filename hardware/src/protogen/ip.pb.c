@@ -12,6 +12,9 @@ PB_BIND(BroadcastMessage, BroadcastMessage, 2)
 PB_BIND(DiscoveryResponse, DiscoveryResponse, 2)
 
 
+PB_BIND(DiscoveryQuery, DiscoveryQuery, AUTO)
+
+
 PB_BIND(ToReceiver, ToReceiver, AUTO)
 
 
@@ -27,4 +30,16 @@ PB_BIND(ReceiverError, ReceiverError, AUTO)
 PB_BIND(AudioData, AudioData, AUTO)
 
 
+PB_BIND(StreamConfiguration, StreamConfiguration, AUTO)
+
+
+PB_BIND(OutputConfiguration, OutputConfiguration, AUTO)
+
+
+PB_BIND(FrameDuration, FrameDuration, AUTO)
+
+
+PB_BIND(DecodeHeadroom, DecodeHeadroom, AUTO)
+
+
 
@@ -9,11 +9,62 @@
 #error Regenerate this file with the current version of nanopb generator.
 #endif
 
+/* Enum definitions */
+/* *
+ How messages to the receiver are framed on the TCP connection. It starts out as
+ AUDIO_FRAMING_PROTOBUF and changes right after a StreamConfiguration. */
+typedef enum _AudioFraming { 
+    AudioFraming_AUDIO_FRAMING_PROTOBUF = 0,
+    AudioFraming_AUDIO_FRAMING_COMPACT = 1 
+} AudioFraming;
+
+typedef enum _Transport { 
+    Transport_TRANSPORT_TCP = 0 
+} Transport;
+
+typedef enum _ChannelRole { 
+    ChannelRole_CHANNEL_ROLE_STEREO = 0,
+    ChannelRole_CHANNEL_ROLE_LEFT = 1,
+    ChannelRole_CHANNEL_ROLE_RIGHT = 2,
+    ChannelRole_CHANNEL_ROLE_MONO = 3 
+} ChannelRole;
+
 /* Struct definitions */
+typedef PB_BYTES_ARRAY_T(128) DiscoveryQuery_known_receivers_t;
 typedef struct _AudioData { 
     pb_callback_t opus_encoded_frame; 
 } AudioData;
 
+typedef struct _DecodeHeadroom { 
+    /* * the class holds the bitrates above the next lower class' max_bitrate_bps up to this one */
+    uint32_t max_bitrate_bps; 
+    /* * share of the frame duration decoding leaves unused, averaged over the recent frames of this class */
+    uint32_t headroom_permille; 
+    /* * how many frames of this class have been decoded */
+    uint32_t frames_measured; 
+} DecodeHeadroom;
+
+typedef struct _DiscoveryQuery { 
+    /* *
+ receivers answer after a random delay of up to this many ms, so that many of them don't all
+ answer at once. 0 if not set: right away */
+    bool has_response_window_ms;
+    uint32_t response_window_ms; 
+    /* *
+ bloom filter of the mac_address of the receivers the sender already knows; a receiver that
+ finds itself in it does not answer. Bit n is bit n % 8 of byte n / 8. Hash i of
+ known_receivers_hash_count is bit (h1 + i * h2) % (8 * size) in 64 bit, where h1 is the lower and h2 the
+ upper half of the 64 bit FNV-1a hash of known_receivers_seed (4 bytes) and mac_address (8 bytes),
+ both little-endian, and h2 has its lowest bit set. */
+    bool has_known_receivers;
+    DiscoveryQuery_known_receivers_t known_receivers; 
+    bool has_known_receivers_hash_count;
+    uint32_t known_receivers_hash_count; 
+    /* * should change from one query to the next, so that a receiver the filter contains by mistake is not missed again */
+    bool has_known_receivers_seed;
+    uint32_t known_receivers_seed; 
+} DiscoveryQuery;
+
 typedef struct _DiscoveryResponse { 
     uint32_t protocol_version; 
     uint64_t mac_address; 
@@ -23,6 +74,27 @@ typedef struct _DiscoveryResponse {
     char opus_version[128]; 
 } DiscoveryResponse;
 
+typedef struct _FrameDuration { 
+    uint32_t duration_us; 
+    /* * how much audio of frames this long the jitter buffer holds at least, whatever the bitrate */
+    uint32_t jitter_buffer_max_ms; 
+} FrameDuration;
+
+/* *
+ Replaces the whole output configuration: fields that are not set go back to their defaults. The receiver
+ keeps it for the following connections, until it restarts; ReceiverInformation.channel_role reports it. */
+typedef struct _OutputConfiguration { 
+    /* * linear volume; 1000 plays the audio at the level it was encoded at, more is taken as 1000. 1000 if not set */
+    bool has_volume_permille;
+    uint32_t volume_permille; 
+    /* * CHANNEL_ROLE_STEREO if not set */
+    bool has_channel_role;
+    ChannelRole channel_role; 
+    /* * whether audio attenuated by volume_permille is dithered; false if not set */
+    bool has_dither;
+    bool dither; 
+} OutputConfiguration;
+
 typedef struct _ReceiverError { 
     /* * there was no new audio data when playback of the previous frame finished */
     bool audio_underflow; 
@@ -30,12 +102,26 @@ typedef struct _ReceiverError {
     bool audio_decode_error; 
 } ReceiverError;
 
+typedef struct _StreamConfiguration { 
+    AudioFraming framing; 
+    /* *
+ up to this many consecutive opus frames are sent as one multi-frame opus packet (code 1 to 3,
+ as the opus repacketizer builds them), in one AudioData or one compact message. The receiver
+ plays them as separate frames. At most ReceiverInformation.max_frames_per_message; 1 if not set.
+ Packets of more frames than this, as the encoder makes them for 40 and 60ms, are played as they
+ are, like without batching. */
+    bool has_frames_per_message;
+    uint32_t frames_per_message; 
+} StreamConfiguration;
+
 /* *
  TCP port 58764 */
 typedef struct _ToReceiver { 
     pb_size_t which_message;
     union {
         AudioData audio_data;
+        StreamConfiguration stream_configuration;
+        OutputConfiguration output_configuration;
     } message; 
 } ToReceiver;
 
@@ -50,6 +136,9 @@ typedef struct _BroadcastMessage {
         bool discovery_request;
         DiscoveryResponse discovery_response;
     } message; 
+    /* * options of a discovery_request. Receivers that don't know them answer right away */
+    bool has_discovery_query;
+    DiscoveryQuery discovery_query; 
 } BroadcastMessage;
 
 typedef struct _ReceiverInformation { 
@@ -58,6 +147,32 @@ typedef struct _ReceiverInformation {
     uint32_t max_encoded_frame_size; 
     /* * size of the decode buffer. Decoding happens at 48kHz 16bit stereo. */
     uint32_t max_decoded_frame_size; 
+    /* * framings the receiver accepts in a StreamConfiguration; AUDIO_FRAMING_PROTOBUF is always accepted */
+    pb_size_t supported_framings_count;
+    AudioFraming supported_framings[4]; 
+    /* * the most opus frames one message may carry, see StreamConfiguration.frames_per_message. 1 if not set */
+    bool has_max_frames_per_message;
+    uint32_t max_frames_per_message; 
+    /* * transports the receiver accepts audio on; only TRANSPORT_TCP if empty */
+    pb_size_t supported_transports_count;
+    Transport supported_transports[1]; 
+    /* * opus frame durations the receiver can decode; any up to max_decoded_frame_size if empty */
+    pb_size_t supported_frame_durations_count;
+    FrameDuration supported_frame_durations[6]; 
+    /* * audio that is always buffered after the decoder, i.e. the least latency the receiver plays at */
+    bool has_jitter_buffer_min_ms;
+    uint32_t jitter_buffer_min_ms; 
+    /* *
+ how much time decoding leaves to spare, per bitrate class the receiver has decoded since it
+ started. Empty before the first stream. */
+    pb_size_t decode_headroom_count;
+    DecodeHeadroom decode_headroom[4]; 
+    /* * what the receiver plays of a stereo stream; CHANNEL_ROLE_STEREO if not set */
+    bool has_channel_role;
+    ChannelRole channel_role; 
+    /* * whether the receiver can keep its playback clock in sync with the transmitter's; false if not set */
+    bool has_clock_sync;
+    bool clock_sync; 
 } ReceiverInformation;
 
 /* *
@@ -70,43 +185,91 @@ typedef struct _ToTransmitter {
     } message; 
 } ToTransmitter;
 
+/* Helper constants for enums */
+#define _AudioFraming_MIN AudioFraming_AUDIO_FRAMING_PROTOBUF
+#define _AudioFraming_MAX AudioFraming_AUDIO_FRAMING_COMPACT
+#define _AudioFraming_ARRAYSIZE ((AudioFraming)(AudioFraming_AUDIO_FRAMING_COMPACT+1))
+
+#define _Transport_MIN Transport_TRANSPORT_TCP
+#define _Transport_MAX Transport_TRANSPORT_TCP
+#define _Transport_ARRAYSIZE ((Transport)(Transport_TRANSPORT_TCP+1))
+
+#define _ChannelRole_MIN ChannelRole_CHANNEL_ROLE_STEREO
+#define _ChannelRole_MAX ChannelRole_CHANNEL_ROLE_MONO
+#define _ChannelRole_ARRAYSIZE ((ChannelRole)(ChannelRole_CHANNEL_ROLE_MONO+1))
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* Initializer values for message structs */
-#define BroadcastMessage_init_default            {0, 0, {0}}
+#define BroadcastMessage_init_default            {0, 0, {0}, false, DiscoveryQuery_init_default}
 #define DiscoveryResponse_init_default           {0, 0, "", 0, ""}
+#define DiscoveryQuery_init_default              {false, 0, false, {0, {0}}, false, 0, false, 0}
 #define ToReceiver_init_default                  {0, {AudioData_init_default}}
 #define ToTransmitter_init_default               {0, {ReceiverInformation_init_default}}
-#define ReceiverInformation_init_default         {DiscoveryResponse_init_default, 0, 0}
+#define ReceiverInformation_init_default         {DiscoveryResponse_init_default, 0, 0, 0, {_AudioFraming_MIN, _AudioFraming_MIN, _AudioFraming_MIN, _AudioFraming_MIN}, false, 0, 0, {_Transport_MIN}, 0, {FrameDuration_init_default, FrameDuration_init_default, FrameDuration_init_default, FrameDuration_init_default, FrameDuration_init_default, FrameDuration_init_default}, false, 0, 0, {DecodeHeadroom_init_default, DecodeHeadroom_init_default, DecodeHeadroom_init_default, DecodeHeadroom_init_default}, false, _ChannelRole_MIN, false, 0}
 #define ReceiverError_init_default               {0, 0}
 #define AudioData_init_default                   {{{NULL}, NULL}}
-#define BroadcastMessage_init_zero               {0, 0, {0}}
+#define StreamConfiguration_init_default         {_AudioFraming_MIN, false, 0}
+#define OutputConfiguration_init_default         {false, 0, false, _ChannelRole_MIN, false, 0}
+#define FrameDuration_init_default               {0, 0}
+#define DecodeHeadroom_init_default              {0, 0, 0}
+#define BroadcastMessage_init_zero               {0, 0, {0}, false, DiscoveryQuery_init_zero}
 #define DiscoveryResponse_init_zero              {0, 0, "", 0, ""}
+#define DiscoveryQuery_init_zero                 {false, 0, false, {0, {0}}, false, 0, false, 0}
 #define ToReceiver_init_zero                     {0, {AudioData_init_zero}}
 #define ToTransmitter_init_zero                  {0, {ReceiverInformation_init_zero}}
-#define ReceiverInformation_init_zero            {DiscoveryResponse_init_zero, 0, 0}
+#define ReceiverInformation_init_zero            {DiscoveryResponse_init_zero, 0, 0, 0, {_AudioFraming_MIN, _AudioFraming_MIN, _AudioFraming_MIN, _AudioFraming_MIN}, false, 0, 0, {_Transport_MIN}, 0, {FrameDuration_init_zero, FrameDuration_init_zero, FrameDuration_init_zero, FrameDuration_init_zero, FrameDuration_init_zero, FrameDuration_init_zero}, false, 0, 0, {DecodeHeadroom_init_zero, DecodeHeadroom_init_zero, DecodeHeadroom_init_zero, DecodeHeadroom_init_zero}, false, _ChannelRole_MIN, false, 0}
 #define ReceiverError_init_zero                  {0, 0}
 #define AudioData_init_zero                      {{{NULL}, NULL}}
+#define StreamConfiguration_init_zero            {_AudioFraming_MIN, false, 0}
+#define OutputConfiguration_init_zero            {false, 0, false, _ChannelRole_MIN, false, 0}
+#define FrameDuration_init_zero                  {0, 0}
+#define DecodeHeadroom_init_zero                 {0, 0, 0}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define AudioData_opus_encoded_frame_tag         1
+#define DecodeHeadroom_max_bitrate_bps_tag       1
+#define DecodeHeadroom_headroom_permille_tag     2
+#define DecodeHeadroom_frames_measured_tag       3
+#define DiscoveryQuery_response_window_ms_tag   1
+#define DiscoveryQuery_known_receivers_tag       2
+#define DiscoveryQuery_known_receivers_hash_count_tag 3
+#define DiscoveryQuery_known_receivers_seed_tag  4
 #define DiscoveryResponse_protocol_version_tag   1
 #define DiscoveryResponse_mac_address_tag        2
 #define DiscoveryResponse_device_name_tag        3
 #define DiscoveryResponse_currently_streaming_tag 4
 #define DiscoveryResponse_opus_version_tag       5
+#define FrameDuration_duration_us_tag            1
+#define FrameDuration_jitter_buffer_max_ms_tag   2
+#define OutputConfiguration_volume_permille_tag  1
+#define OutputConfiguration_channel_role_tag     2
+#define OutputConfiguration_dither_tag           3
 #define ReceiverError_audio_underflow_tag        1
 #define ReceiverError_audio_decode_error_tag     2
+#define StreamConfiguration_framing_tag          1
+#define StreamConfiguration_frames_per_message_tag 2
 #define ToReceiver_audio_data_tag                1
+#define ToReceiver_stream_configuration_tag      2
+#define ToReceiver_output_configuration_tag      3
 #define BroadcastMessage_magic_word_tag          1
 #define BroadcastMessage_discovery_request_tag   2
 #define BroadcastMessage_discovery_response_tag  3
+#define BroadcastMessage_discovery_query_tag     4
 #define ReceiverInformation_discovery_data_tag   1
 #define ReceiverInformation_max_encoded_frame_size_tag 2
 #define ReceiverInformation_max_decoded_frame_size_tag 3
+#define ReceiverInformation_supported_framings_tag 4
+#define ReceiverInformation_max_frames_per_message_tag 5
+#define ReceiverInformation_supported_transports_tag 6
+#define ReceiverInformation_supported_frame_durations_tag 7
+#define ReceiverInformation_jitter_buffer_min_ms_tag 8
+#define ReceiverInformation_decode_headroom_tag  9
+#define ReceiverInformation_channel_role_tag     10
+#define ReceiverInformation_clock_sync_tag       11
 #define ToTransmitter_receiver_information_tag   1
 #define ToTransmitter_error_tag                  2
 
@@ -114,10 +277,12 @@ extern "C" {
 #define BroadcastMessage_FIELDLIST(X, a) \
 X(a, STATIC,   REQUIRED, UINT32,   magic_word,        1) \
 X(a, STATIC,   ONEOF,    BOOL,     (message,discovery_request,message.discovery_request),   2) \
-X(a, STATIC,   ONEOF,    MESSAGE,  (message,discovery_response,message.discovery_response),   3)
+X(a, STATIC,   ONEOF,    MESSAGE,  (message,discovery_response,message.discovery_response),   3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  discovery_query,   4)
 #define BroadcastMessage_CALLBACK NULL
 #define BroadcastMessage_DEFAULT NULL
 #define BroadcastMessage_message_discovery_response_MSGTYPE DiscoveryResponse
+#define BroadcastMessage_discovery_query_MSGTYPE DiscoveryQuery
 
 #define DiscoveryResponse_FIELDLIST(X, a) \
 X(a, STATIC,   REQUIRED, UINT32,   protocol_version,   1) \
@@ -128,11 +293,23 @@ X(a, STATIC,   REQUIRED, STRING,   opus_version,      5)
 #define DiscoveryResponse_CALLBACK NULL
 #define DiscoveryResponse_DEFAULT NULL
 
+#define DiscoveryQuery_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, UINT32,   response_window_ms,   1) \
+X(a, STATIC,   OPTIONAL, BYTES,    known_receivers,   2) \
+X(a, STATIC,   OPTIONAL, UINT32,   known_receivers_hash_count,   3) \
+X(a, STATIC,   OPTIONAL, UINT32,   known_receivers_seed,   4)
+#define DiscoveryQuery_CALLBACK NULL
+#define DiscoveryQuery_DEFAULT NULL
+
 #define ToReceiver_FIELDLIST(X, a) \
-X(a, STATIC,   ONEOF,    MESSAGE,  (message,audio_data,message.audio_data),   1)
+X(a, STATIC,   ONEOF,    MESSAGE,  (message,audio_data,message.audio_data),   1) \
+X(a, STATIC,   ONEOF,    MESSAGE,  (message,stream_configuration,message.stream_configuration),   2) \
+X(a, STATIC,   ONEOF,    MESSAGE,  (message,output_configuration,message.output_configuration),   3)
 #define ToReceiver_CALLBACK NULL
 #define ToReceiver_DEFAULT NULL
 #define ToReceiver_message_audio_data_MSGTYPE AudioData
+#define ToReceiver_message_stream_configuration_MSGTYPE StreamConfiguration
+#define ToReceiver_message_output_configuration_MSGTYPE OutputConfiguration
 
 #define ToTransmitter_FIELDLIST(X, a) \
 X(a, STATIC,   ONEOF,    MESSAGE,  (message,receiver_information,message.receiver_information),   1) \
@@ -145,10 +322,20 @@ X(a, STATIC,   ONEOF,    MESSAGE,  (message,error,message.error),   2)
 #define ReceiverInformation_FIELDLIST(X, a) \
 X(a, STATIC,   REQUIRED, MESSAGE,  discovery_data,    1) \
 X(a, STATIC,   REQUIRED, UINT32,   max_encoded_frame_size,   2) \
-X(a, STATIC,   REQUIRED, UINT32,   max_decoded_frame_size,   3)
+X(a, STATIC,   REQUIRED, UINT32,   max_decoded_frame_size,   3) \
+X(a, STATIC,   REPEATED, UENUM,    supported_framings,   4) \
+X(a, STATIC,   OPTIONAL, UINT32,   max_frames_per_message,   5) \
+X(a, STATIC,   REPEATED, UENUM,    supported_transports,   6) \
+X(a, STATIC,   REPEATED, MESSAGE,  supported_frame_durations,   7) \
+X(a, STATIC,   OPTIONAL, UINT32,   jitter_buffer_min_ms,   8) \
+X(a, STATIC,   REPEATED, MESSAGE,  decode_headroom,   9) \
+X(a, STATIC,   OPTIONAL, UENUM,    channel_role,     10) \
+X(a, STATIC,   OPTIONAL, BOOL,     clock_sync,       11)
 #define ReceiverInformation_CALLBACK NULL
 #define ReceiverInformation_DEFAULT NULL
 #define ReceiverInformation_discovery_data_MSGTYPE DiscoveryResponse
+#define ReceiverInformation_supported_frame_durations_MSGTYPE FrameDuration
+#define ReceiverInformation_decode_headroom_MSGTYPE DecodeHeadroom
 
 #define ReceiverError_FIELDLIST(X, a) \
 X(a, STATIC,   REQUIRED, BOOL,     audio_underflow,   1) \
@@ -162,31 +349,72 @@ extern bool network_pb_callback_audio_data(pb_istream_t *istream, pb_ostream_t *
 #define AudioData_CALLBACK network_pb_callback_audio_data
 #define AudioData_DEFAULT NULL
 
+#define StreamConfiguration_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UENUM,    framing,           1) \
+X(a, STATIC,   OPTIONAL, UINT32,   frames_per_message,   2)
+#define StreamConfiguration_CALLBACK NULL
+#define StreamConfiguration_DEFAULT NULL
+
+#define OutputConfiguration_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, UINT32,   volume_permille,   1) \
+X(a, STATIC,   OPTIONAL, UENUM,    channel_role,      2) \
+X(a, STATIC,   OPTIONAL, BOOL,     dither,            3)
+#define OutputConfiguration_CALLBACK NULL
+#define OutputConfiguration_DEFAULT NULL
+
+#define FrameDuration_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   duration_us,       1) \
+X(a, STATIC,   REQUIRED, UINT32,   jitter_buffer_max_ms,   2)
+#define FrameDuration_CALLBACK NULL
+#define FrameDuration_DEFAULT NULL
+
+#define DecodeHeadroom_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   max_bitrate_bps,   1) \
+X(a, STATIC,   REQUIRED, UINT32,   headroom_permille,   2) \
+X(a, STATIC,   REQUIRED, UINT32,   frames_measured,   3)
+#define DecodeHeadroom_CALLBACK NULL
+#define DecodeHeadroom_DEFAULT NULL
+
 extern const pb_msgdesc_t BroadcastMessage_msg;
 extern const pb_msgdesc_t DiscoveryResponse_msg;
+extern const pb_msgdesc_t DiscoveryQuery_msg;
 extern const pb_msgdesc_t ToReceiver_msg;
 extern const pb_msgdesc_t ToTransmitter_msg;
 extern const pb_msgdesc_t ReceiverInformation_msg;
 extern const pb_msgdesc_t ReceiverError_msg;
 extern const pb_msgdesc_t AudioData_msg;
+extern const pb_msgdesc_t StreamConfiguration_msg;
+extern const pb_msgdesc_t OutputConfiguration_msg;
+extern const pb_msgdesc_t FrameDuration_msg;
+extern const pb_msgdesc_t DecodeHeadroom_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define BroadcastMessage_fields &BroadcastMessage_msg
 #define DiscoveryResponse_fields &DiscoveryResponse_msg
+#define DiscoveryQuery_fields &DiscoveryQuery_msg
 #define ToReceiver_fields &ToReceiver_msg
 #define ToTransmitter_fields &ToTransmitter_msg
 #define ReceiverInformation_fields &ReceiverInformation_msg
 #define ReceiverError_fields &ReceiverError_msg
 #define AudioData_fields &AudioData_msg
+#define StreamConfiguration_fields &StreamConfiguration_msg
+#define OutputConfiguration_fields &OutputConfiguration_msg
+#define FrameDuration_fields &FrameDuration_msg
+#define DecodeHeadroom_fields &DecodeHeadroom_msg
 
 /* Maximum encoded size of messages (where known) */
 /* ToReceiver_size depends on runtime parameters */
 /* AudioData_size depends on runtime parameters */
-#define BroadcastMessage_size                    288
+#define BroadcastMessage_size                    440
+#define DecodeHeadroom_size                      18
+#define DiscoveryQuery_size                      149
 #define DiscoveryResponse_size                   279
+#define FrameDuration_size                       12
+#define OutputConfiguration_size                 10
 #define ReceiverError_size                       4
-#define ReceiverInformation_size                 294
-#define ToTransmitter_size                       297
+#define ReceiverInformation_size                 483
+#define StreamConfiguration_size                 8
+#define ToTransmitter_size                       486
 
 #ifdef __cplusplus
 } /* extern "C" */
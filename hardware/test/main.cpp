@@ -0,0 +1,45 @@
+#include <unity.h>
+#include <Arduino.h>
+
+void test_broadcast_ip_should_work_for_netmask_24();
+void test_broadcast_ip_should_work_for_netmask_16();
+void test_broadcast_ip_should_work_for_netmask_8();
+void test_broadcast_ip_should_work_for_netmask_19();
+void test_network_link_should_connect_directly_and_scan_when_that_fails();
+void test_network_link_should_cool_down_after_the_retries_and_scan_again();
+void test_network_link_should_go_back_to_the_last_ap_when_it_is_lost();
+void test_network_link_should_roam_without_losing_the_connection();
+void test_network_roam_should_only_go_to_a_much_stronger_ap();
+void test_network_link_should_go_back_to_the_last_ap_when_a_roam_fails();
+void test_network_link_should_give_up_a_roam_that_takes_too_long();
+void test_opus_fixed_macros_should_be_bit_exact_on_edge_values();
+void test_opus_fixed_macros_should_be_bit_exact_on_random_values();
+void test_opus_decode_cycles_per_frame();
+void test_opus_resampler_should_match_host_and_report_cycles();
+
+#ifndef UNIT_TEST
+void setup() {
+    delay(4000);
+    UNITY_BEGIN();
+    RUN_TEST(test_broadcast_ip_should_work_for_netmask_24);
+    RUN_TEST(test_broadcast_ip_should_work_for_netmask_16);
+    RUN_TEST(test_broadcast_ip_should_work_for_netmask_8);
+    RUN_TEST(test_broadcast_ip_should_work_for_netmask_19);
+    RUN_TEST(test_network_link_should_connect_directly_and_scan_when_that_fails);
+    RUN_TEST(test_network_link_should_cool_down_after_the_retries_and_scan_again);
+    RUN_TEST(test_network_link_should_go_back_to_the_last_ap_when_it_is_lost);
+    RUN_TEST(test_network_link_should_roam_without_losing_the_connection);
+    RUN_TEST(test_network_roam_should_only_go_to_a_much_stronger_ap);
+    RUN_TEST(test_network_link_should_go_back_to_the_last_ap_when_a_roam_fails);
+    RUN_TEST(test_network_link_should_give_up_a_roam_that_takes_too_long);
+    RUN_TEST(test_opus_fixed_macros_should_be_bit_exact_on_edge_values);
+    RUN_TEST(test_opus_fixed_macros_should_be_bit_exact_on_random_values);
+    RUN_TEST(test_opus_decode_cycles_per_frame);
+    RUN_TEST(test_opus_resampler_should_match_host_and_report_cycles);
+    UNITY_END();
+}
+
+void loop() {
+
+}
+#endif
@@ -42,18 +42,90 @@ void test_broadcast_ip_should_work_for_netmask_19() {
     TEST_ASSERT_EQUAL_STRING("143.93.159.255", ip4addr_ntoa(&broadcast));
 }
 
-#ifndef UNIT_TEST
-void setup() {
-    delay(4000);
-    UNITY_BEGIN();
-    RUN_TEST(test_broadcast_ip_should_work_for_netmask_24);
-    RUN_TEST(test_broadcast_ip_should_work_for_netmask_16);
-    RUN_TEST(test_broadcast_ip_should_work_for_netmask_8);
-    RUN_TEST(test_broadcast_ip_should_work_for_netmask_19);
-    UNITY_END();
+void test_network_link_should_connect_directly_and_scan_when_that_fails() {
+    network_link_t link = {};
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT_DIRECTLY, network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, true, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_ASSOCIATED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_SCAN, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_SCANNING, link.state);
+    // whatever the driver still reports while it scans
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT, network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_GOT_IP, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_CONNECTED, link.state);
 }
 
-void loop() {
+void test_network_link_should_cool_down_after_the_retries_and_scan_again() {
+    network_link_t link = {};
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_SCAN, network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT, network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true));
+    for (int i = 1; i < NETWORK_MAX_CONNECT_RETRY_ATTEMPTS; i++) {
+        TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_RETRY, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, false, false));
+    }
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_COOLDOWN, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_SCAN, network_link_handle(&link, NETWORK_LINK_EVENT_COOLDOWN_OVER, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_COOLDOWN, network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, false));
+}
+
+void test_network_link_should_go_back_to_the_last_ap_when_it_is_lost() {
+    network_link_t link = {};
+    network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    network_link_handle(&link, NETWORK_LINK_EVENT_GOT_IP, false, false);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT_DIRECTLY, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, true, false));
+    TEST_ASSERT_EQUAL(0, link.connect_attempts);
+}
+
+void test_network_link_should_roam_without_losing_the_connection() {
+    network_link_t link = {};
+    network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    network_link_handle(&link, NETWORK_LINK_EVENT_GOT_IP, false, false);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_ROAM_SCAN, network_link_handle(&link, NETWORK_LINK_EVENT_SIGNAL_WEAK, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_ROAM_ABANDON, network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_CONNECTED, link.state);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_ROAM_SCAN, network_link_handle(&link, NETWORK_LINK_EVENT_SIGNAL_WEAK, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_ROAM, network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true));
+    // leaving the old AP
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, true, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_ROAM_DONE, network_link_handle(&link, NETWORK_LINK_EVENT_ASSOCIATED, false, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_CONNECTED, link.state);
+}
+
+void test_network_roam_should_only_go_to_a_much_stronger_ap() {
+    TEST_ASSERT_TRUE(network_roam_is_worth_it(-75, -75 + NETWORK_ROAM_MIN_GAIN_DB));
+    TEST_ASSERT_TRUE(network_roam_is_worth_it(-80, -50));
+    TEST_ASSERT_FALSE(network_roam_is_worth_it(-75, -75 + NETWORK_ROAM_MIN_GAIN_DB - 1));
+    TEST_ASSERT_FALSE(network_roam_is_worth_it(-75, -80));
+    // no average yet
+    TEST_ASSERT_FALSE(network_roam_is_worth_it(0, -40));
+}
+
+void test_network_link_should_go_back_to_the_last_ap_when_a_roam_fails() {
+    network_link_t link = {};
+    network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    network_link_handle(&link, NETWORK_LINK_EVENT_GOT_IP, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SIGNAL_WEAK, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, true, false);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT_DIRECTLY, network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, true, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_CONNECTING_DIRECTLY, link.state);
+    // a stale one doesn't start a roam
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_SIGNAL_WEAK, false, false));
+}
 
+void test_network_link_should_give_up_a_roam_that_takes_too_long() {
+    network_link_t link = {};
+    network_link_handle(&link, NETWORK_LINK_EVENT_STARTED, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    network_link_handle(&link, NETWORK_LINK_EVENT_GOT_IP, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SIGNAL_WEAK, false, false);
+    network_link_handle(&link, NETWORK_LINK_EVENT_SCAN_DONE, false, true);
+    // the only DISCONNECTED is taken for leaving the old AP
+    network_link_handle(&link, NETWORK_LINK_EVENT_DISCONNECTED, true, false);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ROAMING, link.state);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_CONNECT_DIRECTLY, network_link_handle(&link, NETWORK_LINK_EVENT_ROAM_TIMEOUT, true, false));
+    TEST_ASSERT_EQUAL(NETWORK_LINK_CONNECTING_DIRECTLY, link.state);
+    TEST_ASSERT_EQUAL(NETWORK_LINK_ACTION_NONE, network_link_handle(&link, NETWORK_LINK_EVENT_ROAM_TIMEOUT, true, false));
 }
-#endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <xtensa/hal.h>
+#include <opus.h>
+#include "silk/SigProc_FIX.h"
+
+// reference implementations, copied from the OPUS_FAST_INT64 == 0 branches of
+// celt/fixed_generic.h and silk/macros.h. The Xtensa inline asm must match these bit by bit.
+static opus_int32 ref_MULT16_32_Q16(opus_int16 a, opus_int32 b) {
+    return ((opus_int32) a * (b >> 16)) + (((opus_int32) a * (opus_int32) (opus_uint16) (b & 0xffff)) >> 16);
+}
+
+static opus_int32 ref_MULT16_32_Q15(opus_int16 a, opus_int32 b) {
+    return (opus_int32) ((opus_uint32) ((opus_int32) a * (b >> 16)) << 1) + (((opus_int32) a * (opus_int32) (opus_uint16) (b & 0xffff)) >> 15);
+}
+
+static opus_int32 ref_MULT32_32_Q31(opus_int32 a, opus_int32 b) {
+    opus_int32 hh = (opus_int32) ((opus_uint32) ((opus_int32) (opus_int16) (a >> 16) * (opus_int32) (opus_int16) (b >> 16)) << 1);
+    opus_int32 hl = ((opus_int32) (opus_int16) (a >> 16) * (opus_int32) (opus_uint16) (b & 0xffff)) >> 15;
+    opus_int32 lh = ((opus_int32) (opus_int16) (b >> 16) * (opus_int32) (opus_uint16) (a & 0xffff)) >> 15;
+    return hh + hl + lh;
+}
+
+static opus_int32 ref_silk_SMULWB(opus_int32 a, opus_int32 b) {
+    return ((a >> 16) * (opus_int32) ((opus_int16) b)) + (((a & 0x0000FFFF) * (opus_int32) ((opus_int16) b)) >> 16);
+}
+
+static opus_int32 ref_silk_SMULWT(opus_int32 a, opus_int32 b) {
+    return (a >> 16) * (b >> 16) + (((a & 0x0000FFFF) * (b >> 16)) >> 16);
+}
+
+static opus_int32 ref_silk_SMULWW(opus_int32 a, opus_int32 b) {
+    return (opus_int32) ((opus_uint32) ref_silk_SMULWB(a, b) + (opus_uint32) a * (opus_uint32) silk_RSHIFT_ROUND(b, 16));
+}
+
+static opus_int32 ref_silk_SMMUL(opus_int32 a, opus_int32 b) {
+    return (opus_int32) (((opus_int64) a * b) >> 32);
+}
+
+static const opus_int32 opus_fixed_edge_values[] = {
+    0, 1, -1, 2, -2, 0x7FFF, -0x8000, 0x8000, -0x8001, 0xFFFF, 0x10000, -0x10000,
+    0x7FFFFFFF, (opus_int32) 0x80000000, 0x7FFF0000, 0x0000FFFF, 0x12345678, (opus_int32) 0xEDCBA988
+};
+#define OPUS_FIXED_N_EDGE_VALUES (sizeof(opus_fixed_edge_values) / sizeof(opus_int32))
+#define OPUS_FIXED_N_RANDOM_PAIRS 200000
+
+static uint32_t opus_fixed_rng_state = 0x2C5DA044;
+static opus_int32 opus_fixed_next_random() {
+    // xorshift32, deterministic so failures can be reproduced
+    opus_fixed_rng_state ^= opus_fixed_rng_state << 13;
+    opus_fixed_rng_state ^= opus_fixed_rng_state >> 17;
+    opus_fixed_rng_state ^= opus_fixed_rng_state << 5;
+    return (opus_int32) opus_fixed_rng_state;
+}
+
+static void opus_fixed_assert_all_macros(opus_int32 a, opus_int32 b) {
+    TEST_ASSERT_EQUAL_INT32(ref_MULT16_32_Q16((opus_int16) a, b), MULT16_32_Q16((opus_int16) a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_MULT16_32_Q15((opus_int16) a, b), MULT16_32_Q15((opus_int16) a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_MULT32_32_Q31(a, b), MULT32_32_Q31(a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_silk_SMULWB(a, b), silk_SMULWB(a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_silk_SMULWT(a, b), silk_SMULWT(a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_silk_SMULWW(a, b), silk_SMULWW(a, b));
+    TEST_ASSERT_EQUAL_INT32(ref_silk_SMMUL(a, b), silk_SMMUL(a, b));
+}
+
+void test_opus_fixed_macros_should_be_bit_exact_on_edge_values() {
+    for (size_t i = 0; i < OPUS_FIXED_N_EDGE_VALUES; i++) {
+        for (size_t j = 0; j < OPUS_FIXED_N_EDGE_VALUES; j++) {
+            opus_fixed_assert_all_macros(opus_fixed_edge_values[i], opus_fixed_edge_values[j]);
+        }
+    }
+}
+
+void test_opus_fixed_macros_should_be_bit_exact_on_random_values() {
+    for (size_t i = 0; i < OPUS_FIXED_N_RANDOM_PAIRS; i++) {
+        opus_int32 a = opus_fixed_next_random();
+        opus_int32 b = opus_fixed_next_random();
+        opus_fixed_assert_all_macros(a, b);
+    }
+}
+
+#define OPUS_BENCH_SAMPLE_RATE 48000
+#define OPUS_BENCH_FRAME_SIZE  960 // 20ms
+#define OPUS_BENCH_N_FRAMES    100
+#define OPUS_BENCH_MAX_PACKET  1500
+
+typedef struct {
+    SemaphoreHandle_t done;
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint64_t cycles_total;
+    int error;
+} opus_bench_result_t;
+
+// runs on its own task: encoding and decoding need about as much stack as the playback task has
+static void opus_bench_task_decode_cycles(void* pvParameters) {
+    opus_bench_result_t* result = (opus_bench_result_t*) pvParameters;
+    int err = OPUS_OK;
+    OpusEncoder* encoder = opus_encoder_create(OPUS_BENCH_SAMPLE_RATE, 2, OPUS_APPLICATION_AUDIO, &err);
+    OpusDecoder* decoder = err == OPUS_OK ? opus_decoder_create(OPUS_BENCH_SAMPLE_RATE, 2, &err) : nullptr;
+    opus_int16* pcm = (opus_int16*) malloc(sizeof(opus_int16) * 2 * OPUS_BENCH_FRAME_SIZE);
+    unsigned char* packet = (unsigned char*) malloc(OPUS_BENCH_MAX_PACKET);
+    if (err != OPUS_OK || pcm == nullptr || packet == nullptr) {
+        result->error = err != OPUS_OK ? err : OPUS_ALLOC_FAIL;
+        xSemaphoreGive(result->done);
+        vTaskDelete(NULL);
+        return;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(128000));
+
+    result->cycles_min = UINT32_MAX;
+    result->cycles_max = 0;
+    result->cycles_total = 0;
+    for (int frame = 0; frame < OPUS_BENCH_N_FRAMES; frame++) {
+        // two detuned tones plus some noise, so CELT has to spend bits across all bands
+        for (int i = 0; i < OPUS_BENCH_FRAME_SIZE; i++) {
+            float t = (float) (frame * OPUS_BENCH_FRAME_SIZE + i) / OPUS_BENCH_SAMPLE_RATE;
+            opus_int16 noise = (opus_int16) (opus_fixed_next_random() >> 22);
+            pcm[i * 2] = (opus_int16) (8000.0f * sinf(2.0f * PI * 440.0f * t)) + noise;
+            pcm[i * 2 + 1] = (opus_int16) (8000.0f * sinf(2.0f * PI * 659.0f * t)) - noise;
+        }
+        int packet_len = opus_encode(encoder, pcm, OPUS_BENCH_FRAME_SIZE, packet, OPUS_BENCH_MAX_PACKET);
+        if (packet_len < 0) {
+            result->error = packet_len;
+            break;
+        }
+
+        uint32_t started_at = xthal_get_ccount();
+        int n_samples = opus_decode(decoder, packet, packet_len, pcm, OPUS_BENCH_FRAME_SIZE, 0);
+        uint32_t cycles = xthal_get_ccount() - started_at;
+        if (n_samples < 0) {
+            result->error = n_samples;
+            break;
+        }
+
+        result->cycles_min = min(result->cycles_min, cycles);
+        result->cycles_max = max(result->cycles_max, cycles);
+        result->cycles_total += cycles;
+    }
+
+    free(packet);
+    free(pcm);
+    opus_decoder_destroy(decoder);
+    opus_encoder_destroy(encoder);
+    xSemaphoreGive(result->done);
+    vTaskDelete(NULL);
+}
+
+void test_opus_decode_cycles_per_frame() {
+    opus_bench_result_t result = {};
+    result.done = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(result.done);
+    BaseType_t rtosResult = xTaskCreatePinnedToCore(
+        opus_bench_task_decode_cycles,
+        "opus-bench",
+        configMINIMAL_STACK_SIZE * 40,
+        &result,
+        tskIDLE_PRIORITY + 1,
+        nullptr,
+        1
+    );
+    TEST_ASSERT_EQUAL(pdPASS, rtosResult);
+    xSemaphoreTake(result.done, portMAX_DELAY);
+    vSemaphoreDelete(result.done);
+    TEST_ASSERT_EQUAL_INT(OPUS_OK, result.error);
+
+    #ifdef OPUS_XTENSA_INLINE_ASM
+    const char* variant = "xtensa";
+    #else
+    const char* variant = "generic";
+    #endif
+    Serial.printf(
+        "opus decode 20ms/128kbit/stereo (%s macros): min=%u avg=%u max=%u cycles per frame\n",
+        variant,
+        result.cycles_min,
+        (uint32_t) (result.cycles_total / OPUS_BENCH_N_FRAMES),
+        result.cycles_max
+    );
+}
@@ -0,0 +1,96 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <xtensa/hal.h>
+#include "silk/SigProc_FIX.h"
+#include "celt/stack_alloc.h"
+
+// Same signal and calls as bench/host/opus_resampler_bench.c; the expected hashes are what the
+// host prints for both its unrolled and its original loops, so the MAC16 kernel has to match them.
+#define RESAMPLER_BENCH_OUT_RATE  48000
+#define RESAMPLER_BENCH_SIGNAL_MS 2000
+#define RESAMPLER_BENCH_N_RATES   3
+
+static const opus_int32 resampler_bench_in_rates[RESAMPLER_BENCH_N_RATES] = { 8000, 12000, 16000 };
+static const uint32_t resampler_bench_hashes[RESAMPLER_BENCH_N_RATES] = { 0x937d23a9, 0x492b0527, 0x727670ba };
+static const int resampler_bench_call_ms[] = { 10, 20, 1, 7, 10, 5, 20, 3 };
+
+static uint32_t resampler_bench_rng_state;
+static int32_t resampler_bench_next_random() {
+    resampler_bench_rng_state ^= resampler_bench_rng_state << 13;
+    resampler_bench_rng_state ^= resampler_bench_rng_state >> 17;
+    resampler_bench_rng_state ^= resampler_bench_rng_state << 5;
+    return (int32_t) resampler_bench_rng_state;
+}
+
+static void resampler_bench_make_signal(opus_int16* signal, int in_khz) {
+    int len = RESAMPLER_BENCH_SIGNAL_MS * in_khz;
+    resampler_bench_rng_state = 0x9E3779B9u ^ (uint32_t) in_khz;
+    uint32_t phase = 0;
+    for (int k = 0; k < len; k++) {
+        int part = k * 4 / len;
+        if (part == 0) {
+            signal[k] = (opus_int16) (resampler_bench_next_random() >> (31 - 4 - k * 44 / len));
+        } else if (part == 1) {
+            signal[k] = (k / (in_khz / 2 + 1)) & 1 ? 32767 : -32768;
+        } else if (part == 2) {
+            phase += 50u * 65536u / (in_khz * 1000u) + (uint32_t) (k - len / 2) * 32768u / (len / 4);
+            int32_t tri = (int32_t) (phase & 0xFFFF) - 32768;
+            tri = (tri < 0 ? -tri : tri) * 2 - 32768;
+            signal[k] = (opus_int16) (tri > 32767 ? 32767 : tri);
+        } else {
+            signal[k] = 0;
+        }
+    }
+}
+
+void test_opus_resampler_should_match_host_and_report_cycles() {
+    opus_int16* signal = (opus_int16*) malloc(sizeof(opus_int16) * RESAMPLER_BENCH_SIGNAL_MS * 16);
+    opus_int16* out = (opus_int16*) malloc(sizeof(opus_int16) * 20 * RESAMPLER_BENCH_OUT_RATE / 1000);
+    TEST_ASSERT_NOT_NULL(signal);
+    TEST_ASSERT_NOT_NULL(out);
+
+    #ifdef OPUS_XTENSA_INLINE_ASM
+    const char* variant = "xtensa";
+    #else
+    const char* variant = "generic";
+    #endif
+    for (int r = 0; r < RESAMPLER_BENCH_N_RATES; r++) {
+        int in_khz = resampler_bench_in_rates[r] / 1000;
+        resampler_bench_make_signal(signal, in_khz);
+
+        // the resampler takes its buffer from the scratch arena, which opus_decode sets up otherwise
+        ALLOC_STACK;
+        silk_resampler_state_struct state;
+        silk_resampler_init(&state, resampler_bench_in_rates[r], RESAMPLER_BENCH_OUT_RATE, 0);
+        uint32_t hash = 2166136261u;
+        uint32_t cycles_10ms = 0;
+        uint32_t calls_10ms = 0;
+        int position = 0;
+        for (int call = 0; position < RESAMPLER_BENCH_SIGNAL_MS; call++) {
+            int ms = resampler_bench_call_ms[call % (sizeof(resampler_bench_call_ms) / sizeof(int))];
+            ms = min(ms, RESAMPLER_BENCH_SIGNAL_MS - position);
+            uint32_t started_at = xthal_get_ccount();
+            silk_resampler(&state, out, &signal[position * in_khz], ms * in_khz);
+            uint32_t cycles = xthal_get_ccount() - started_at;
+            if (ms == 10) {
+                cycles_10ms += cycles;
+                calls_10ms++;
+            }
+            for (int k = 0; k < ms * RESAMPLER_BENCH_OUT_RATE / 1000; k++) {
+                hash = (hash ^ (uint16_t) out[k]) * 16777619u;
+            }
+            position += ms;
+        }
+        RESTORE_STACK;
+
+        Serial.printf(
+            "silk resampler %dkHz->48kHz (%s): %u cycles per 10ms\n",
+            in_khz,
+            variant,
+            cycles_10ms / calls_10ms
+        );
+        TEST_ASSERT_EQUAL_HEX32(resampler_bench_hashes[r], hash);
+    }
+    free(out);
+    free(signal);
+}
@@ -20,7 +20,12 @@ class MulticastAudioOutput(
     opusApplication: OpusEncoder.Application = OpusEncoder.Application.AUDIO,
     opusComplexity: Int = 10,
     opusSignal: OpusEncoder.Signal = OpusEncoder.Signal.MUSIC,
-    opusFrameSize: Duration = Duration.ofMillis(60)
+    opusFrameSize: Duration = Duration.ofMillis(60),
+    /**
+     * Frames shorter than this are batched, up to this much audio per message (as far as the receivers
+     * allow it). Adds up to this much latency.
+     */
+    private val maxBatchDuration: Duration = Duration.ofMillis(20),
 ) : AutoCloseable {
     @Volatile
     private var closed = false
@@ -83,13 +88,13 @@ class MulticastAudioOutput(
      *
      * Models the buffer usage in the receivers in milliseconds of audio data.
      */
-    private val sendRateLimiter = LeakyBucket(1200, 1000)
+    private val sendRateLimiter = LeakyBucket(DEFAULT_RECEIVER_BUFFER_MS, 1000)
 
     private suspend fun sendEncodedFrames(encodedFrames: Collection<ByteBuffer>) {
         encodedFrames.forEach { encodedFrame ->
             sendRateLimiter.waitForCapacity(opusEncoder.frameSize.toMillis())
             actualReceivers.forEach { receiver ->
-                receiver.queueEncodedOpusFrame(encodedFrame)
+                receiver.queueEncodedOpusFrame(encodedFrame, opusEncoder.frameSize)
                 encodedFrame.flip()
             }
         }
@@ -120,14 +125,25 @@ class MulticastAudioOutput(
         actualReceivers.forEach { it.close() }
     }
 
-    private fun onReceiversChanged() {
+    private suspend fun onReceiversChanged() {
         val maxRawFrameSizeBytes = actualReceivers.minOf { it.receiverInformation.maxDecodedFrameSize }
         opusEncoder.frameSize = OpusEncoder.SUPPORTED_FRAME_SIZES
+            .filter { frameSize -> actualReceivers.all { it.supportedFrameDurations?.contains(frameSize) ?: true } }
             .map { frameSize -> frameSize to OpusEncoder.frameSizeToBytes(opusEncoder.inputFormat, frameSize) }
             .filter { (_, frameSizeInBytes) -> frameSizeInBytes <= maxRawFrameSizeBytes }
             .maxOfOrNull { (frameSize, _) -> frameSize }
-            ?: throw IllegalStateException("Cannot accommodate all receivers: receive buffer too small")
+            ?: throw IllegalStateException("Cannot accommodate all receivers: no frame size all of them decode")
         opusEncoder.maxEncodedFrameSizeBytes = actualReceivers.minOf { it.receiverInformation.maxEncodedFrameSize }
+
+        // don't send ahead more than the smallest receiver buffer holds; receivers that don't tell get the old guess
+        sendRateLimiter.capacity = actualReceivers
+            .minOf { it.bufferCapacity(opusEncoder.frameSize)?.toMillis() ?: DEFAULT_RECEIVER_BUFFER_MS }
+            .coerceAtLeast(opusEncoder.frameSize.toMillis())
+
+        val framesPerBatch = (maxBatchDuration.toNanos() / opusEncoder.frameSize.toNanos()).toInt()
+        actualReceivers.forEach { receiver ->
+            receiver.configureBatching(framesPerBatch.coerceIn(1, receiver.maxFramesPerMessage))
+        }
     }
 
     private val asOutputStream = object : OutputStream(), AutoCloseable {
@@ -150,11 +166,15 @@ class MulticastAudioOutput(
         override fun flush() {
             runBlocking {
                 sendEncodedFrames(opusEncoder.final())
+                actualReceivers.forEach { it.flush() }
             }
         }
     }
 
     companion object {
         val FALLBACK_AUDIO_FORMAT = AudioFormat(48000.0f, 16, 2, true, false)
+
+        /** what the receiver buffer is assumed to hold, in ms of audio, when the receiver doesn't report it */
+        private const val DEFAULT_RECEIVER_BUFFER_MS = 1200L
     }
 }
\ No newline at end of file
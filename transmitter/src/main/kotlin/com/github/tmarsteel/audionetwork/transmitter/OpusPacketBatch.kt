@@ -0,0 +1,109 @@
+package com.github.tmarsteel.audionetwork.transmitter
+
+import java.nio.ByteBuffer
+import java.time.Duration
+
+/**
+ * Joins consecutive single-frame opus packets into one multi-frame packet (code 3 with VBR frame
+ * lengths, see RFC 6716 section 3.2.5), the same format libopus' repacketizer builds. All frames
+ * of a packet have to share the TOC byte and together last at most 120ms.
+ */
+class OpusPacketBatch(
+    val maxFrames: Int,
+    /** the size the packet built from this batch may have at most */
+    val maxPacketSize: Int,
+) {
+    init {
+        require(maxFrames in 1..MAX_FRAMES_PER_PACKET)
+    }
+
+    private val frames = ArrayList<ByteBuffer>(maxFrames)
+    private var toc = 0
+    private var packetSize = 0
+
+    val frameCount: Int get() = frames.size
+    var duration: Duration = Duration.ZERO
+        private set
+
+    /**
+     * Adds the frame of a single-frame [packet] and consumes it, unless the batch is full or the frame does
+     * not fit it. [packet] is left untouched then.
+     * @return whether the frame was added
+     */
+    fun tryAdd(packet: ByteBuffer, packetDuration: Duration): Boolean {
+        require(packet.hasRemaining())
+        val packetToc = packet.get(packet.position()).toInt() and 0xFF
+        require(packetToc and 0x03 == 0) { "Only single-frame packets (code 0) can be batched" }
+
+        val frameSize = packet.remaining() - 1
+        val sizeWithFrame = if (frames.isEmpty()) 1 + frameSize else packetSize + frameSize + lengthFieldSize(frames.last().remaining()) + if (frames.size == 1) 1 else 0
+        if (frames.isNotEmpty() && (packetToc != toc || frames.size >= maxFrames)) {
+            return false
+        }
+        if (sizeWithFrame > maxPacketSize || duration + packetDuration > MAX_PACKET_DURATION) {
+            return false
+        }
+
+        packet.get()
+        val frame = ByteBuffer.allocate(frameSize)
+        frame.put(packet)
+        frame.flip()
+        frames.add(frame)
+        toc = packetToc
+        packetSize = sizeWithFrame
+        duration += packetDuration
+        return true
+    }
+
+    /**
+     * @return the packet of all frames added since the last call, ready to be read
+     */
+    fun build(): ByteBuffer {
+        check(frames.isNotEmpty())
+        val packet = ByteBuffer.allocate(packetSize)
+        if (frames.size == 1) {
+            packet.put(toc.toByte())
+        } else {
+            packet.put((toc or 0x03).toByte())
+            packet.put((0x80 or frames.size).toByte())
+            frames.subList(0, frames.size - 1).forEach { putLength(packet, it.remaining()) }
+        }
+        frames.forEach { packet.put(it) }
+        check(!packet.hasRemaining())
+        packet.flip()
+
+        frames.clear()
+        packetSize = 0
+        duration = Duration.ZERO
+        return packet
+    }
+
+    companion object {
+        const val MAX_FRAMES_PER_PACKET = 48
+        val MAX_PACKET_DURATION: Duration = Duration.ofMillis(120)
+
+        private fun lengthFieldSize(frameSize: Int): Int = if (frameSize < 252) 1 else 2
+
+        private fun putLength(packet: ByteBuffer, frameSize: Int) {
+            if (frameSize < 252) {
+                packet.put(frameSize.toByte())
+                return
+            }
+            val firstByte = 252 + (frameSize and 0x03)
+            packet.put(firstByte.toByte())
+            packet.put(((frameSize - firstByte) shr 2).toByte())
+        }
+
+        /** the number of frames in [packet], from its TOC byte and, for code 3, its frame count byte */
+        fun framesInPacket(packet: ByteBuffer): Int {
+            if (!packet.hasRemaining()) {
+                return 1
+            }
+            return when (packet.get(packet.position()).toInt() and 0x03) {
+                0 -> 1
+                1, 2 -> 2
+                else -> packet.get(packet.position() + 1).toInt() and 0x3F
+            }
+        }
+    }
+}
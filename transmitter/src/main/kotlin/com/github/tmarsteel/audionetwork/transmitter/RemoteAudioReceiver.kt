@@ -2,14 +2,20 @@ package com.github.tmarsteel.audionetwork.transmitter
 
 import club.minnced.opus.util.OpusLibrary
 import com.github.tmarsteel.audionetwork.protocol.AudioData
+import com.github.tmarsteel.audionetwork.protocol.AudioFraming
+import com.github.tmarsteel.audionetwork.protocol.ChannelRole
+import com.github.tmarsteel.audionetwork.protocol.OutputConfiguration
 import com.github.tmarsteel.audionetwork.protocol.ReceiverInformation
+import com.github.tmarsteel.audionetwork.protocol.StreamConfiguration
 import com.github.tmarsteel.audionetwork.protocol.ToReceiver
 import com.github.tmarsteel.audionetwork.protocol.ToTransmitter
+import com.github.tmarsteel.audionetwork.protocol.Transport
 import com.google.protobuf.ByteString
 import java.net.SocketAddress
 import java.nio.ByteBuffer
 import java.nio.channels.AsynchronousSocketChannel
 import java.nio.channels.CompletionHandler
+import java.time.Duration
 import kotlin.coroutines.resume
 import kotlin.coroutines.resumeWithException
 import kotlin.coroutines.suspendCoroutine
@@ -17,6 +23,7 @@ import kotlin.coroutines.suspendCoroutine
 class RemoteAudioReceiver private constructor(
     private val channel: AsynchronousSocketChannel,
     val receiverInformation: ReceiverInformation,
+    val framing: AudioFraming,
 ) : AutoCloseable {
     init {
         OpusLibrary.loadFromJar()
@@ -26,8 +33,138 @@ class RemoteAudioReceiver private constructor(
     @Volatile
     private var closed = false
 
-    suspend fun queueEncodedOpusFrame(data: ByteBuffer) {
+    private var nextSequence = 0
+    /** in [CompactFraming.TIMESTAMP_RATE] samples */
+    private var nextTimestamp = 0
+
+    /** the most frames that the receiver accepts in one message */
+    val maxFramesPerMessage: Int = if (receiverInformation.hasMaxFramesPerMessage()) {
+        receiverInformation.maxFramesPerMessage.coerceIn(1, OpusPacketBatch.MAX_FRAMES_PER_PACKET)
+    } else 1
+
+    var framesPerMessage: Int = 1
+        private set
+
+    /** the opus frame durations the receiver decodes; `null` if it decodes any that fit [ReceiverInformation.getMaxDecodedFrameSize] */
+    val supportedFrameDurations: Set<Duration>? = receiverInformation.supportedFrameDurationsList
+        .takeIf { it.isNotEmpty() }
+        ?.map { Duration.ofNanos(it.durationUs * 1000L) }
+        ?.toSet()
+
+    /**
+     * How much audio of [frameDuration] long frames the receiver can hold, in its jitter buffer and after the
+     * decoder, whatever the bitrate. `null` if the receiver doesn't tell.
+     */
+    fun bufferCapacity(frameDuration: Duration): Duration? {
+        val frameDurationUs = frameDuration.toNanos() / 1000
+        val jitterBufferMaxMs = receiverInformation.supportedFrameDurationsList
+            .firstOrNull { it.durationUs.toLong() == frameDurationUs }
+            ?.jitterBufferMaxMs
+            ?: return null
+        return Duration.ofMillis(jitterBufferMaxMs.toLong() + receiverInformation.jitterBufferMinMs)
+    }
+
+    /** frames waiting to be sent in one message while [framesPerMessage] > 1 */
+    private var batch: OpusPacketBatch? = null
+
+    /**
+     * Have up to [framesPerMessage] consecutive frames sent in one message from now on, as one multi-frame
+     * opus packet. Batching short frames saves per-message overhead on the wire and on the receiver, but
+     * delays every batch until its last frame is encoded.
+     */
+    suspend fun configureBatching(framesPerMessage: Int) {
+        require(framesPerMessage in 1..maxFramesPerMessage)
+        if (framesPerMessage == this.framesPerMessage) {
+            return
+        }
+
+        flush()
+        sendControlMessage(
+            ToReceiver.newBuilder()
+                .setStreamConfiguration(
+                    StreamConfiguration.newBuilder()
+                        .setFraming(framing)
+                        .setFramesPerMessage(framesPerMessage)
+                        .build()
+                )
+                .build()
+        )
+        this.framesPerMessage = framesPerMessage
+        batch = if (framesPerMessage > 1) OpusPacketBatch(framesPerMessage, receiverInformation.maxEncodedFrameSize) else null
+    }
+
+    /**
+     * Changes how the receiver plays the audio, from the frames sent after this on. The receiver keeps the
+     * configuration for later connections, until it restarts.
+     * @param volume linear, 0 to 1
+     * @param channelRole what the receiver plays of the stereo stream
+     * @param dither whether audio attenuated by [volume] is dithered
+     */
+    suspend fun configureOutput(volume: Double, channelRole: ChannelRole, dither: Boolean) {
+        require(volume in 0.0..1.0)
+        flush()
+        sendControlMessage(
+            ToReceiver.newBuilder()
+                .setOutputConfiguration(
+                    OutputConfiguration.newBuilder()
+                        .setVolumePermille(Math.round(volume * 1000).toInt())
+                        .setChannelRole(channelRole)
+                        .setDither(dither)
+                        .build()
+                )
+                .build()
+        )
+    }
+
+    private suspend fun sendControlMessage(message: ToReceiver) {
+        if (framing == AudioFraming.AUDIO_FRAMING_COMPACT) {
+            channel.writeCompactFrame(CompactFraming.TYPE_PROTOBUF, ByteBuffer.wrap(message.toByteArray()))
+        } else {
+            channel.writeSingleDelimited(message)
+        }
+    }
+
+    /**
+     * @param frameDuration the duration of the audio in [data]
+     */
+    suspend fun queueEncodedOpusFrame(data: ByteBuffer, frameDuration: Duration) {
         require(data.remaining() <= receiverInformation.maxEncodedFrameSize)
+        val batch = this.batch
+        // packets of several frames already, as the encoder makes them for 40 and 60ms, are sent as they are
+        if (batch == null || OpusPacketBatch.framesInPacket(data) != 1) {
+            flush()
+            sendPacket(data, frameDuration)
+            return
+        }
+
+        if (!batch.tryAdd(data, frameDuration)) {
+            flush()
+            check(batch.tryAdd(data, frameDuration))
+        }
+        if (batch.frameCount >= framesPerMessage) {
+            flush()
+        }
+    }
+
+    /** sends the frames held back for batching */
+    suspend fun flush() {
+        val batch = this.batch ?: return
+        if (batch.frameCount == 0) {
+            return
+        }
+        val duration = batch.duration
+        sendPacket(batch.build(), duration)
+    }
+
+    private suspend fun sendPacket(data: ByteBuffer, duration: Duration) {
+        if (framing == AudioFraming.AUDIO_FRAMING_COMPACT) {
+            val nFrames = OpusPacketBatch.framesInPacket(data)
+            channel.writeCompactFrame(CompactFraming.TYPE_OPUS_FRAME, data, nextSequence, nextTimestamp)
+            nextSequence += nFrames
+            nextTimestamp += CompactFraming.durationToTimestampSamples(duration)
+            return
+        }
+
         channel.writeSingleDelimited(
             ToReceiver.newBuilder()
                 .setAudioData(
@@ -65,8 +202,33 @@ class RemoteAudioReceiver private constructor(
                 channel.close()
                 throw IllegalStateException("Did not understand hello from receiver")
             }
+            val transports = receiverHello.receiverInformation.supportedTransportsList
+            if (transports.isNotEmpty() && Transport.TRANSPORT_TCP !in transports) {
+                channel.shutdownInput()
+                channel.shutdownOutput()
+                channel.close()
+                throw IllegalStateException("Receiver does not accept audio over TCP, only over $transports")
+            }
+
+            // the header of the compact framing is cheaper to write and to parse than an AudioData message
+            val framing = if (AudioFraming.AUDIO_FRAMING_COMPACT in receiverHello.receiverInformation.supportedFramingsList) {
+                AudioFraming.AUDIO_FRAMING_COMPACT
+            } else {
+                AudioFraming.AUDIO_FRAMING_PROTOBUF
+            }
+            if (framing != AudioFraming.AUDIO_FRAMING_PROTOBUF) {
+                channel.writeSingleDelimited(
+                    ToReceiver.newBuilder()
+                        .setStreamConfiguration(
+                            StreamConfiguration.newBuilder()
+                                .setFraming(framing)
+                                .build()
+                        )
+                        .build()
+                )
+            }
 
-            return RemoteAudioReceiver(channel, receiverHello.receiverInformation)
+            return RemoteAudioReceiver(channel, receiverHello.receiverInformation, framing)
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+package com.github.tmarsteel.audionetwork.transmitter
+
+import java.nio.ByteBuffer
+import java.nio.channels.AsynchronousByteChannel
+import java.time.Duration
+
+/**
+ * The fixed header of [com.github.tmarsteel.audionetwork.protocol.AudioFraming.AUDIO_FRAMING_COMPACT],
+ * see protocol/ip.proto for the layout.
+ */
+object CompactFraming {
+    const val HEADER_SIZE = 12
+    const val TYPE_OPUS_FRAME: Byte = 1
+    const val TYPE_PROTOBUF: Byte = 2
+    /** timestamps count samples at this rate, whatever the rate of the encoder input */
+    const val TIMESTAMP_RATE = 48000
+
+    fun durationToTimestampSamples(duration: Duration): Int = Math.toIntExact(duration.toNanos() * TIMESTAMP_RATE / 1_000_000_000)
+}
+
+/**
+ * Writes header and payload with a single write, so they leave in one segment.
+ * Consumes the remaining bytes of [payload].
+ */
+suspend fun AsynchronousByteChannel.writeCompactFrame(type: Byte, payload: ByteBuffer, sequence: Int = 0, timestamp: Int = 0) {
+    require(payload.remaining() <= 0xFFFF)
+    val buffer = ByteBuffer.allocate(CompactFraming.HEADER_SIZE + payload.remaining())
+    buffer.put(type)
+    buffer.put(0)
+    buffer.putShort(payload.remaining().toShort())
+    buffer.putInt(sequence)
+    buffer.putInt(timestamp)
+    buffer.put(payload)
+    buffer.flip()
+    while (buffer.hasRemaining()) {
+        writeAsync(buffer)
+    }
+}
@@ -1,7 +1,9 @@
 package com.github.tmarsteel.audionetwork.transmitter
 
 import com.github.tmarsteel.audionetwork.protocol.BroadcastMessage
+import com.github.tmarsteel.audionetwork.protocol.DiscoveryQuery
 import com.github.tmarsteel.audionetwork.protocol.DiscoveryResponse
+import com.google.protobuf.ByteString
 import com.google.protobuf.InvalidProtocolBufferException
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
@@ -10,21 +12,37 @@ import java.net.DatagramSocket
 import java.net.InetAddress
 import java.net.InetSocketAddress
 import java.net.NetworkInterface
-import java.net.SocketException
+import java.net.SocketTimeoutException
 import java.nio.ByteBuffer
-import kotlin.concurrent.thread
+import kotlin.random.Random
 import kotlin.streams.asSequence
 import kotlin.time.Duration
+import kotlin.time.Duration.Companion.milliseconds
 import kotlin.time.Duration.Companion.nanoseconds
 import kotlin.time.Duration.Companion.seconds
 
 private const val MAGIC_WORD = 0x2C5DA044
 
+/** receivers keep answering for a bit after the response window: their task has to wake up, the channel may be busy */
+private val RESPONSE_MARGIN = 100.milliseconds
+
+/**
+ * Broadcasts discovery requests in rounds until a round brings no new receiver (after at least two, as
+ * requests get lost), [rounds] are done or [timeout] has passed. Receivers spread their answers over
+ * [responseWindow]; the ones already heard of, and those in [knownReceivers], are put in the bloom filter
+ * of the query and stay quiet (see DiscoveryQuery in ip.proto). Receivers announcing themselves while
+ * this runs are picked up, too.
+ * @return the receivers that answered, one per mac address
+ */
 suspend fun discoverReceivers(
     port: UShort = 58765.toUShort(),
     timeout: Duration = 2.seconds,
+    responseWindow: Duration = 250.milliseconds,
+    rounds: Int = 5,
+    knownReceivers: Collection<DiscoveredReceiver> = emptyList(),
 ): List<DiscoveredReceiver> {
     require(timeout.isFinite())
+    require(rounds >= 1)
 
     val discoveryStartedAt = System.nanoTime()
     fun timeSince(time: Long) = (System.nanoTime() - time).nanoseconds
@@ -39,63 +57,113 @@ suspend fun discoverReceivers(
             .map { InetSocketAddress(it, port.toInt()) }
             .toList()
 
-        val discoveryRequest = BroadcastMessage.newBuilder()
-            .setMagicWord(MAGIC_WORD)
-            .setDiscoveryRequest(true)
-            .build()
-            .toByteArray()
-
-        val receivedPackets = mutableListOf<DiscoveredReceiver>()
+        val knownMacAddresses = knownReceivers.mapTo(HashSet()) { it.response.macAddress }
+        val discovered = LinkedHashMap<Long, DiscoveredReceiver>()
 
         DatagramSocket(port.toInt()).use { socket ->
-            thread(start = true, name = "audio-network-discovery-timeout-interrupt") {
-                do {
-                    val timeRemaining = timeout - timeSince(discoveryStartedAt)
-                    if (timeRemaining.isPositive()) {
-                        Thread.sleep(timeRemaining.inWholeMilliseconds)
-                    }
-                } while (timeRemaining.isPositive())
-                socket.close()
-            }
             socket.broadcast = true
             if (socket.receiveBufferSize < 1024) {
                 socket.receiveBufferSize = 1024
             }
 
-            broadcastAddresses.forEach { broadcastAddress ->
-                socket.send(DatagramPacket(discoveryRequest, discoveryRequest.size, broadcastAddress))
-            }
-
             val receivePacket = DatagramPacket(ByteArray(1024), 1024)
-            while (true) {
-                try {
-                    socket.receive(receivePacket)
+            var round = 0
+            while (round < rounds && timeSince(discoveryStartedAt) < timeout) {
+                val discoveryRequest = BroadcastMessage.newBuilder()
+                    .setMagicWord(MAGIC_WORD)
+                    .setDiscoveryRequest(true)
+                    .setDiscoveryQuery(buildDiscoveryQuery(responseWindow, knownMacAddresses + discovered.keys))
+                    .build()
+                    .toByteArray()
+                broadcastAddresses.forEach { broadcastAddress ->
+                    socket.send(DatagramPacket(discoveryRequest, discoveryRequest.size, broadcastAddress))
                 }
-                catch (ex: SocketException) {
-                    if (ex.message?.contains("closed") == true) {
+
+                val roundStartedAt = System.nanoTime()
+                val roundDuration = minOf(responseWindow + RESPONSE_MARGIN, timeout - timeSince(discoveryStartedAt))
+                val discoveredBefore = discovered.size
+                while (true) {
+                    val roundRemaining = roundDuration - timeSince(roundStartedAt)
+                    if (roundRemaining.inWholeMilliseconds <= 0) {
+                        break
+                    }
+                    socket.soTimeout = roundRemaining.inWholeMilliseconds.toInt()
+                    try {
+                        socket.receive(receivePacket)
+                    }
+                    catch (ex: SocketTimeoutException) {
                         break
                     }
-                    throw ex
-                }
 
-                val broadcastMessage = try {
-                    BroadcastMessage.parseFrom(receivePacket.asByteBuffer())
-                } catch (ex: InvalidProtocolBufferException) {
-                    continue
-                }
+                    val broadcastMessage = try {
+                        BroadcastMessage.parseFrom(receivePacket.asByteBuffer())
+                    } catch (ex: InvalidProtocolBufferException) {
+                        continue
+                    }
+
+                    if (broadcastMessage.magicWord != MAGIC_WORD || broadcastMessage.messageCase != BroadcastMessage.MessageCase.DISCOVERY_RESPONSE) {
+                        continue
+                    }
 
-                if (broadcastMessage.magicWord != MAGIC_WORD || broadcastMessage.messageCase != BroadcastMessage.MessageCase.DISCOVERY_RESPONSE) {
-                    continue
+                    val response = broadcastMessage.discoveryResponse
+                    discovered.putIfAbsent(response.macAddress, DiscoveredReceiver(receivePacket.address, response))
                 }
 
-                receivedPackets.add(DiscoveredReceiver(receivePacket.address, broadcastMessage.discoveryResponse))
+                round++
+                if (round >= 2 && discovered.size == discoveredBefore) {
+                    break
+                }
             }
         }
 
-        receivedPackets
+        discovered.values.toList()
     }
 }
 
 data class DiscoveredReceiver(val inetAddress: InetAddress, val response: DiscoveryResponse)
 
-private fun DatagramPacket.asByteBuffer() = ByteBuffer.wrap(data, offset, length)
\ No newline at end of file
+private fun DatagramPacket.asByteBuffer() = ByteBuffer.wrap(data, offset, length)
+
+private const val KNOWN_RECEIVERS_BITS_PER_RECEIVER = 10
+private const val KNOWN_RECEIVERS_MAX_SIZE = 128
+private const val KNOWN_RECEIVERS_HASH_COUNT = 7
+
+/** with a new seed every time, so that a receiver the filter contains by mistake gets another chance */
+private fun buildDiscoveryQuery(responseWindow: Duration, knownMacAddresses: Set<Long>): DiscoveryQuery {
+    val query = DiscoveryQuery.newBuilder()
+        .setResponseWindowMs(responseWindow.inWholeMilliseconds.toInt())
+    if (knownMacAddresses.isEmpty()) {
+        return query.build()
+    }
+
+    val seed = Random.nextInt()
+    val size = ((knownMacAddresses.size * KNOWN_RECEIVERS_BITS_PER_RECEIVER + 7) / 8).coerceAtMost(KNOWN_RECEIVERS_MAX_SIZE)
+    val filter = ByteArray(size)
+    for (macAddress in knownMacAddresses) {
+        val hash = knownReceiversHash(seed, macAddress)
+        val h1 = hash and 0xFFFFFFFFuL
+        val h2 = (hash shr 32) or 1uL
+        for (i in 0 until KNOWN_RECEIVERS_HASH_COUNT) {
+            val bit = ((h1 + i.toULong() * h2) % (8 * size).toULong()).toInt()
+            filter[bit / 8] = (filter[bit / 8].toInt() or (1 shl (bit % 8))).toByte()
+        }
+    }
+
+    return query
+        .setKnownReceivers(ByteString.copyFrom(filter))
+        .setKnownReceiversHashCount(KNOWN_RECEIVERS_HASH_COUNT)
+        .setKnownReceiversSeed(seed)
+        .build()
+}
+
+/** 64 bit FNV-1a over [seed] (4 bytes) and [macAddress] (8 bytes), both little-endian */
+private fun knownReceiversHash(seed: Int, macAddress: Long): ULong {
+    var hash = 14695981039346656037uL
+    for (n in 0 until 4) {
+        hash = (hash xor ((seed ushr (n * 8)) and 0xFF).toULong()) * 1099511628211uL
+    }
+    for (n in 0 until 8) {
+        hash = (hash xor ((macAddress ushr (n * 8)) and 0xFF).toULong()) * 1099511628211uL
+    }
+    return hash
+}
\ No newline at end of file